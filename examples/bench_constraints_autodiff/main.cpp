@@ -0,0 +1,150 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+
+
+// Benchmark: evaluation of constraints and all their derivatives by
+// automatic differentiation (autodiffConstraint()) vs. hand-coded
+// expressions, for the constant distance and mobile slider constraints.
+// Usage: bench_constraints_autodiff [MIN_TIME_PER_TEST_SECONDS]
+// -------------------------------------------------------------------------
+#include <mbse/mbse-autodiff.h>
+#include <mrpt/system/CTicTac.h>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace mbse;
+
+static double MIN_TIME = 0.5;  // [s] per test
+static const size_t NUM_CONSTRAINTS = 1000;
+
+template <std::size_t K>
+struct TStates
+{
+	vector<array<double, K>> q, dq, ddq;
+	vector<TConstraintDerivatives<K>> out;
+
+	TStates()
+	{
+		std::mt19937 rng(123);
+		std::uniform_real_distribution<double> unif(-1.0, 1.0);
+		for (auto* v : {&q, &dq, &ddq})
+		{
+			v->resize(NUM_CONSTRAINTS);
+			for (auto& s : *v)
+				for (auto& x : s) x = unif(rng);
+		}
+		out.resize(NUM_CONSTRAINTS);
+	}
+};
+
+// Returns the average time [ns] per constraint of `f(i)`, called for all of
+// them.
+template <class FUNCTOR>
+static double bench(const FUNCTOR& f)
+{
+	mrpt::system::CTicTac tictac;
+	size_t nCalls = 0;
+	double t = 0;
+	tictac.Tic();
+	do
+	{
+		for (size_t i = 0; i < NUM_CONSTRAINTS; i++) f(i);
+		nCalls += NUM_CONSTRAINTS;
+		t = tictac.Tac();
+	} while (t < MIN_TIME);
+	return 1e9 * t / nCalls;
+}
+
+static void report(const char* name, double tHand, double tAD)
+{
+	printf(
+		"%-16s hand-coded: %8.2f ns  autodiff: %8.2f ns (x%.02f)\n", name,
+		tHand, tAD, tAD / tHand);
+}
+
+static void bench_constant_distance()
+{
+	TStates<4> s;
+	const double L2 = 2.0;
+
+	const double tHand = bench([&](size_t i) {
+		const auto &q = s.q[i], &dq = s.dq[i], &ddq = s.ddq[i];
+		auto& o = s.out[i];
+		const double Ax = q[2] - q[0], Ay = q[3] - q[1];
+		const double Adotx = dq[2] - dq[0], Adoty = dq[3] - dq[1];
+		const double Addotx = ddq[2] - ddq[0], Addoty = ddq[3] - ddq[1];
+		o.Phi = Ax * Ax + Ay * Ay - L2;
+		o.dotPhi = 2 * Ax * Adotx + 2 * Ay * Adoty;
+		o.Phi_q = {-2 * Ax, -2 * Ay, 2 * Ax, 2 * Ay};
+		o.dotPhi_q = {-2 * Adotx, -2 * Adoty, 2 * Adotx, 2 * Adoty};
+		o.Phiqq_times_ddq = {-2 * Addotx, -2 * Addoty, 2 * Addotx, 2 * Addoty};
+		o.dotPhiqq_times_dq = {0, 0, 0, 0};
+	});
+
+	const auto phi = [L2](const auto& x) {
+		return (x[2] - x[0]) * (x[2] - x[0]) + (x[3] - x[1]) * (x[3] - x[1]) -
+			   L2;
+	};
+	const double tAD = bench([&](size_t i) {
+		autodiffConstraint(phi, s.q[i], s.dq[i], s.ddq[i], s.out[i]);
+	});
+
+	report("ConstantDistance", tHand, tAD);
+}
+
+static void bench_mobile_slider()
+{
+	TStates<6> s;
+
+	const double tHand = bench([&](size_t i) {
+		const auto &q = s.q[i], &dq = s.dq[i], &ddq = s.ddq[i];
+		auto& o = s.out[i];
+		const double x = q[0], y = q[1], x0 = q[2], y0 = q[3], x1 = q[4],
+					 y1 = q[5];
+		const double dx = dq[0], dy = dq[1], dx0 = dq[2], dy0 = dq[3],
+					 dx1 = dq[4], dy1 = dq[5];
+		const double ddx = ddq[0], ddy = ddq[1], ddx0 = ddq[2],
+					 ddy0 = ddq[3], ddx1 = ddq[4], ddy1 = ddq[5];
+		o.Phi = (x1 - x0) * (y - y0) - (y1 - y0) * (x - x0);
+		o.dotPhi = (dx1 - dx0) * (y - y0) + (x1 - x0) * (dy - dy0) -
+				   (dy1 - dy0) * (x - x0) - (y1 - y0) * (dx - dx0);
+		o.Phi_q = {y0 - y1, x1 - x0, -y + y1, x - x1, y - y0, -x + x0};
+		o.dotPhi_q = {dy0 - dy1, dx1 - dx0, -dy + dy1,
+					  dx - dx1,  dy - dy0,  -dx + dx0};
+		o.Phiqq_times_ddq = {ddy0 - ddy1, ddx1 - ddx0, -ddy + ddy1,
+							 ddx - ddx1,  ddy - ddy0,  -ddx + ddx0};
+		o.dotPhiqq_times_dq = {0, 0, 0, 0, 0, 0};
+	});
+
+	const auto phi = [](const auto& q) {
+		const auto &x = q[0], &y = q[1];
+		const auto &x0 = q[2], &y0 = q[3], &x1 = q[4], &y1 = q[5];
+		return (x1 - x0) * (y - y0) - (y1 - y0) * (x - x0);
+	};
+	const double tAD = bench([&](size_t i) {
+		autodiffConstraint(phi, s.q[i], s.dq[i], s.ddq[i], s.out[i]);
+	});
+
+	report("MobileSlider", tHand, tAD);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1) MIN_TIME = atof(argv[1]);
+
+	bench_constant_distance();
+	bench_mobile_slider();
+
+	return 0;  // program ended OK.
+}
@@ -0,0 +1,106 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+
+// Benchmark: scaling of update_numeric_Phi_and_Jacobians() with the model
+// size, serial vs. parallel, for several grain sizes.
+// Usage: bench_constraints_update [MIN_TIME_PER_TEST_SECONDS]
+// -------------------------------------------------------------------------
+#include <mbse/mbse.h>
+#include <mbse/model-examples.h>
+#include <mrpt/system/CTicTac.h>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+using namespace mbse;
+
+static double MIN_TIME = 0.5;  // [s] per test
+
+// Returns the average time [us] of one call.
+static double bench(CAssembledRigidModel& arm)
+{
+	mrpt::system::CTicTac tictac;
+	size_t nCalls = 0;
+	double t = 0;
+	arm.update_numeric_Phi_and_Jacobians();  // warm up
+	tictac.Tic();
+	do
+	{
+		for (int i = 0; i < 10; i++) arm.update_numeric_Phi_and_Jacobians();
+		nCalls += 10;
+		t = tictac.Tac();
+	} while (t < MIN_TIME);
+	return 1e6 * t / nCalls;
+}
+
+static void bench_model(const std::string& name, const CModelDefinition& model)
+{
+	auto arm = model.assembleRigidMBS();
+	arm->dotq_.setConstant(0.1);
+	arm->ddotq_.setConstant(0.1);
+
+	auto& pp = arm->parallel_update_params;
+	pp.serial_threshold = 0;
+
+	for (const bool compiled : {true, false})
+	{
+		arm->setCompiledConstraintsEnabled(compiled);
+
+		pp.enabled = false;
+		const double tSerial = bench(*arm);
+		printf(
+			"%-22s m=%6zu %-8s serial          : %10.2f us\n", name.c_str(),
+			arm->constraints_.size(), compiled ? "compiled" : "virtual",
+			tSerial);
+
+		pp.enabled = true;
+		for (const size_t grain : {64, 256, 1024, 4096})
+		{
+			pp.grain_size = grain;
+			const double t = bench(*arm);
+			printf(
+				"%-22s m=%6zu %-8s grain=%5zu     : %10.2f us (x%.02f)\n",
+				name.c_str(), arm->constraints_.size(),
+				compiled ? "compiled" : "virtual", grain, t, tSerial / t);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		if (argc > 1) MIN_TIME = atof(argv[1]);
+
+		timelog().enable(false);
+
+		cout << "Threads in pool: " << threadPool().numThreads() << "\n";
+
+		for (const size_t N : {10, 100, 1000, 5000, 20000})
+			bench_model(
+				"LongString(" + std::to_string(N) + ")",
+				buildLongStringMBS(N));
+
+		for (const size_t n : {5, 20, 50, 100})
+			bench_model(
+				"Parameterized(" + std::to_string(n) + "x" +
+					std::to_string(n) + ")",
+				buildParameterizedMBS(n, n));
+
+		return 0;  // program ended OK.
+	}
+	catch (exception& e)
+	{
+		cerr << e.what() << endl;
+		return 1;
+	}
+}
@@ -382,11 +382,11 @@ int main(int argc, char** argv)
 			// Estimated values:
 			for (size_t i = 0; i < pf.m_particles.size(); i++)
 			{
-				auto part = pf.m_particles[i].d;
+				const auto& q = pf.m_particles[i].d->q;
+				const auto& p2dofs = pf.model().getPoints2DOFs();
 
-				const double val_phi = atan2(
-					part->num_model.q_[part->num_model.points2DOFs_[1].dof_y],
-					part->num_model.q_[part->num_model.points2DOFs_[1].dof_x]);
+				const double val_phi =
+					atan2(q[p2dofs[1].dof_y], q[p2dofs[1].dof_x]);
 
 				orientation_averager.m_particles[i].d.phi = val_phi;
 
@@ -525,10 +525,10 @@ int main(int argc, char** argv)
 void pf_initialize_uniform_distribution(
 	CMultiBodyParticleFilter& pf, CModelDefinition& model)
 {
+	auto& arm = pf.model();
 	for (size_t i = 0; i < pf.m_particles.size(); i++)
 	{
-		auto part = pf.m_particles[i].d;
-		const auto& p2dofs = part->num_model.getPoints2DOFs();
+		const auto& p2dofs = arm.getPoints2DOFs();
 
 		// We draw a random value for the free DOF(s) of the mechanism:
 		// and uniform values for the rest:
@@ -537,16 +537,18 @@ void pf_initialize_uniform_distribution(
 		{
 			const double R = model.getBodies()[0].length();
 			const double ang = rnd.drawUniform(-M_PI, M_PI);
-			const size_t nTotalDOFs = part->num_model.q_.size();
+			const size_t nTotalDOFs = arm.q_.size();
 			for (size_t k = 0; k < nTotalDOFs; k++)
-				part->num_model.q_[k] = rnd.drawUniform(-20, 20);
+				arm.q_[k] = rnd.drawUniform(-20, 20);
 
 			const size_t PT_IDX = 1;  // This point is the one we force to be at
 									  // a predefined position:
-			part->num_model.q_[p2dofs[PT_IDX].dof_x] = R * cos(ang);
-			part->num_model.q_[p2dofs[PT_IDX].dof_y] = R * sin(ang);
+			arm.q_[p2dofs[PT_IDX].dof_x] = R * cos(ang);
+			arm.q_[p2dofs[PT_IDX].dof_y] = R * sin(ang);
 
-			final_err = part->num_model.refinePosition(1e-13, 30);
+			final_err = arm.refinePosition(1e-13, 30);
 		} while (final_err > 1e-6);
+
+		pf.storeParticle(i, arm);
 	}
 }
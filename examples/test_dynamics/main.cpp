@@ -122,6 +122,10 @@ void test_dynamics()
 	// incrementally-built problem:
 	lmp.maxIterations = 5;
 
+	// All factors share the same per-thread copies of the simulator and model:
+	const auto solvers = makePerThreadCopies(&dynSimul);
+	const auto arms = makePerThreadCopies(aMBS);
+
 	for (unsigned int nn = 0; nn < N; nn++, t += dt)
 	{
 		// Create Trapezoidal Integrator factors:
@@ -132,12 +136,13 @@ void test_dynamics()
 
 		// Create Dynamics factors:
 		graph.emplace_shared<FactorDynamics>(
-			&dynSimul, noise_dyn, Q(nn), V(nn), A(nn));
+			&dynSimul, noise_dyn, Q(nn), V(nn), A(nn), solvers);
 
 		// Add dependent-coordinates constraint factor:
-		graph.emplace_shared<FactorConstraints>(aMBS, noise_constr_q, Q(nn));
+		graph.emplace_shared<FactorConstraints>(
+			aMBS, noise_constr_q, Q(nn), arms);
 		graph.emplace_shared<FactorConstraintsVel>(
-			aMBS, noise_constr_dq, Q(nn), V(nn));
+			aMBS, noise_constr_dq, Q(nn), V(nn), arms);
 
 		// Create initial estimates:
 		if (values.find(Q(nn)) == values.end()) values.insert(Q(nn), last_q);
@@ -148,7 +153,8 @@ void test_dynamics()
 		{
 			// Create Dynamics factors:
 			graph.emplace_shared<FactorDynamics>(
-				&dynSimul, noise_dyn, Q(nn + 1), V(nn + 1), A(nn + 1));
+				&dynSimul, noise_dyn, Q(nn + 1), V(nn + 1), A(nn + 1),
+				solvers);
 		}
 
 		// Create initial estimates (so we can run LevMarq)
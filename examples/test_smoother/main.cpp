@@ -132,6 +132,10 @@ void test_smoother()
 	// Save states to files:
 	mrpt::math::CMatrixDouble Qs(N + 1, n), dotQs(N + 1, n), ddotQs(N + 1, n);
 
+	// All factors share the same per-thread copies of the simulator and model:
+	const auto solvers = makePerThreadCopies(&dynSimul);
+	const auto arms = makePerThreadCopies(aMBS);
+
 	for (unsigned int nn = 0; nn < N; nn++, t += dt)
 	{
 		// Create Trapezoidal Integrator factors:
@@ -142,13 +146,13 @@ void test_smoother()
 
 		// Create Dynamics factors:
 		new_factors.emplace_shared<FactorDynamics>(
-			&dynSimul, noise_dyn, Q(nn), V(nn), A(nn));
+			&dynSimul, noise_dyn, Q(nn), V(nn), A(nn), solvers);
 
 		// Add dependent-coordinates constraint factor:
 		new_factors.emplace_shared<FactorConstraints>(
-			aMBS, noise_constr_q, Q(nn));
+			aMBS, noise_constr_q, Q(nn), arms);
 		new_factors.emplace_shared<FactorConstraintsVel>(
-			aMBS, noise_constr_dq, Q(nn), V(nn));
+			aMBS, noise_constr_dq, Q(nn), V(nn), arms);
 
 		// Create initial estimates:
 		new_values.insert(A(nn + 1), last_ddq);
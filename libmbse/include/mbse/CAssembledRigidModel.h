@@ -11,6 +11,12 @@
 #pragma once
 
 #include "CModelDefinition.h"
+#include <mbse/CCoordinatePartition.h>
+#include <mbse/CMassMatrixCache.h>
+#include <mbse/mbse-parallel.h>
+#include <mbse/constraints/CCompiledConstraints.h>
+#include <functional>
+#include <map>
 
 namespace mbse
 {
@@ -26,12 +32,18 @@ struct TSymbolicAssembledModel
 	/** Additional relative coordinates */
 	std::vector<RelativeDOF> rDOFs;
 
+	/** Mass matrix and its factorizations, shared by all models assembled
+	 * from this object (and its copies). */
+	CMassMatrixCache::Ptr massMatrixCache =
+		std::make_shared<CMassMatrixCache>();
+
 	TSymbolicAssembledModel(const CModelDefinition& model_) : model(model_) {}
 
 	void clear()
 	{
 		DOFs.clear();
 		rDOFs.clear();
+		massMatrixCache = std::make_shared<CMassMatrixCache>();
 	}
 };
 
@@ -63,9 +75,43 @@ class CAssembledRigidModel
 	 * this method replicates the state of "o" into "this". */
 	void copyStateFrom(const CAssembledRigidModel& o);
 
+	/** Creates a new model from the same symbolic model, sharing all the
+	 * read-only data (parent model, mass matrix cache) and with the same
+	 * gravity, external forces and evaluation options. The state (q, dq, ddq)
+	 * is not copied. The returned model can be used from another thread than
+	 * this one, see CPerThreadCopies. */
+	Ptr cloneTopology() const;
+
 	/** Copies the opengl object from another instance */
 	void copyOpenGLRepresentationFrom(const CAssembledRigidModel& o);
 
+	/** Linear solvers for the Newton iterations of refinePosition(),
+	 * finiteDisplacement() and computeDependentPosVelAcc() */
+	enum class PositionSolver
+	{
+		/** Dense LU decomposition of the Jacobian: O(n^3) per iteration */
+		DenseLU,
+		/** Sparse QR of the Jacobian columns of the dependent coordinates
+		 * only, see CSparseColumnsSolver (default) */
+		SparseQR
+	};
+	PositionSolver position_solver = PositionSolver::SparseQR;
+
+	/** Reuse of the factorizations of the dependent Jacobian, see
+	 * CCoordinatePartition */
+	CCoordinatePartition::TParams partition_params;
+
+	/** The partition of q with independent coordinates `z_indices`, with
+	 * its cached factorization. Created on first use, and kept while the
+	 * model is alive (copies of the model start with no partitions). */
+	CCoordinatePartition& coordinatePartition(
+		const std::vector<size_t>& z_indices);
+
+	/** Drops the numeric factorizations of all coordinatePartition()s, e.g.
+	 * before working on an unrelated state, so results do not depend on the
+	 * states this model went through before. */
+	void invalidateCoordinatePartitions();
+
 	/** Solves the "initial position" problem: iterates refining the position
 	 * until the constraints are minimized \return The norm of the final \Phi
 	 * vector after optimization
@@ -277,6 +323,11 @@ class CAssembledRigidModel
 	/** @name Solvers auxiliary methods
 	 *  @{ */
 
+	/** The mass matrix of this model (and of all the models assembled from
+	 * the same TSymbolicAssembledModel) and its factorizations. Simulators
+	 * take M from here instead of building it. */
+	CMassMatrixCache& massMatrixCache() const { return *massMatrixCache_; }
+
 	/** Assemble the MBS mass matrix "M" */
 	void buildMassMatrix_dense(Eigen::MatrixXd& M) const;
 	void buildMassMatrix_sparse(
@@ -294,9 +345,90 @@ class CAssembledRigidModel
 	 * corresponding parts in the sparse Jacobians */
 	void update_numeric_Phi_and_Jacobians();
 
+	/** Like update_numeric_Phi_and_Jacobians(), for the rows of one
+	 * constraint in constraints_ only, see getConstraintRows(). Only the
+	 * coordinates of its own points are read from q_, dotq_ and ddotq_. */
+	void update_numeric_Phi_and_Jacobians(size_t constraint_index);
+
+	/** Returns the range [first,last) of the rows in Phi_ and its Jacobians
+	 * of the constraint `constraints_[constraint_index]` */
+	std::pair<size_t, size_t> getConstraintRows(size_t constraint_index) const
+	{
+		return {constraintFirstRow_.at(constraint_index),
+				constraintFirstRow_.at(constraint_index + 1)};
+	}
+
+	/** Evaluates the n x n matrix \f$ (\Phi_q^\top \lambda)_q \f$: the
+	 * derivative with respect to q of the constraint forces for the given
+	 * Lagrange multipliers (m x 1), at the current state.
+	 *
+	 * It is obtained from Phiqq_times_ddq_, evaluated with a few probe
+	 * vectors in place of ddotq_: columns of Phi_q_ which do not share any
+	 * row are probed at once. On return, ddotq_ and all the matrices are
+	 * those of the current state again. */
+	void eval_Phiqq_transpose_times(
+		const Eigen::VectorXd& lambda, Eigen::MatrixXd& out);
+
+	/** Enables (default) or disables the evaluation of constraints grouped
+	 * by type in update_numeric_Phi_and_Jacobians(), see
+	 * CCompiledConstraints. If disabled, update() is called for each
+	 * constraint object. Both give the same results. */
+	void setCompiledConstraintsEnabled(bool enable)
+	{
+		compiledConstraintsEnabled_ = enable;
+	}
+	bool getCompiledConstraintsEnabled() const
+	{
+		return compiledConstraintsEnabled_;
+	}
+
+	/** Options for running update_numeric_Phi_and_Jacobians() in parallel.
+	 * Each constraint only writes its own rows and Jacobian entries, so
+	 * they are split into chunks evaluated in threadPool(). */
+	struct TParallelUpdateParams
+	{
+		bool enabled = false;  //!< Opt-in: serial by default
+		/** Number of constraints (or Jacobian entries, while copying them
+		 * into the sparse matrices) per chunk */
+		size_t grain_size = 512;
+		/** Models with fewer constraints are always updated serially */
+		size_t serial_threshold = 2000;
+	};
+	TParallelUpdateParams parallel_update_params;
+
+	/** Runs `f(i0, i1)` over chunks of [0, n), in parallel or not depending
+	 * on parallel_update_params. */
+	void parallel_update_for(
+		size_t n, const std::function<void(size_t, size_t)>& f) const;
+
 	/** @} */
 
    private:
+	CMassMatrixCache::Ptr massMatrixCache_;
+
+	CCompiledConstraints compiledConstraints_;
+
+	/** First row of each constraint in constraints_, plus the total number
+	 * of rows at the end. */
+	std::vector<size_t> constraintFirstRow_;
+	bool compiledConstraintsEnabled_ = true;
+
+	/** See coordinatePartition(). Not shared between copies. */
+	struct TPartitionCache
+	{
+		std::map<std::vector<size_t>, std::unique_ptr<CCoordinatePartition>>
+			partitions;
+
+		TPartitionCache() = default;
+		TPartitionCache(const TPartitionCache&) {}
+		TPartitionCache& operator=(const TPartitionCache&)
+		{
+			partitions.clear();
+			return *this;
+		}
+	};
+	TPartitionCache partitionCache_;
+
 	mrpt::opengl::CSetOfObjects::Ptr internal_render_ground_point(
 		const Point2& pt, const CBody::TRenderParams& rp) const;
 
@@ -307,4 +439,9 @@ class CAssembledRigidModel
 
 };  // end class CAssembledRigidModel
 
+/** Per-thread copies of `arm`, made with CAssembledRigidModel::cloneTopology()
+ * \sa CPerThreadCopies */
+std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>> makePerThreadCopies(
+	const CAssembledRigidModel::Ptr& arm);
+
 }  // namespace mbse
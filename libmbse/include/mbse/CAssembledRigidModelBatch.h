@@ -0,0 +1,166 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#pragma once
+
+#include <mbse/CAssembledRigidModel.h>
+#include <array>
+#include <map>
+
+namespace mbse
+{
+/** Many states (q, dq) of one and the same assembled model, evaluated all at
+ * once.
+ *
+ * The topology (constraints, sparsity patterns, bodies) is that of the
+ * CAssembledRigidModel passed to the constructor, which is shared, not
+ * copied. All numeric data is stored as structure of arrays: matrices with
+ * one column per state, stored in row-major order so the values of one
+ * coordinate, constraint or Jacobian entry for all states are contiguous in
+ * memory. This way, update_numeric_Phi_and_Jacobians() makes one pass over
+ * the list of constraints, each of them evaluated for all states in tight,
+ * vectorizable loops (see CConstraintBase::updateBatch()).
+ *
+ * Only the position and velocity level terms are evaluated: Phi, dotPhi,
+ * Phi_q and dotPhi_q. Accelerations may be stored too, for those virtual
+ * sensors which read them (see CVirtualSensor::needs_accelerations()).
+ *
+ * \sa CDynamicSimulatorBatch_Lagrange_KLU
+ */
+class CAssembledRigidModelBatch
+{
+   public:
+	using Ptr = std::shared_ptr<CAssembledRigidModelBatch>;
+
+	/** One row per coordinate/constraint/entry, one column per state */
+	using matrix_t = Eigen::Matrix<
+		double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+	/** Creates `numStates` states, all of them initialized with the current
+	 * state of `arm`, whose topology is shared from now on. */
+	CAssembledRigidModelBatch(
+		const CAssembledRigidModel::Ptr& arm, size_t numStates);
+
+	/** Number of states */
+	size_t size() const { return numStates_; }
+
+	/** Changes the number of states. Existing ones are kept, new ones are
+	 * initialized with the state of the underlying model. */
+	void resize(size_t numStates);
+
+	/** Number of generalized coordinates (rows of q() and dotq()) */
+	size_t getDOFCount() const { return nDOFs_; }
+
+	/** Number of constraints (rows of Phi_ and dotPhi_) */
+	size_t getConstraintCount() const { return Phi_.rows(); }
+
+	/** The model providing the topology (and the sparsity pattern of the
+	 * Jacobians, in its Phi_q_) */
+	const CAssembledRigidModel& model() const { return *arm_; }
+	const CAssembledRigidModel::Ptr& modelPtr() const { return arm_; }
+
+	/** Coordinates and velocities of all states (one column per state) */
+	auto q() { return q_.topRows(nDOFs_); }
+	auto q() const { return q_.topRows(nDOFs_); }
+	auto dotq() { return dotq_.topRows(nDOFs_); }
+	auto dotq() const { return dotq_.topRows(nDOFs_); }
+	auto ddotq() { return ddotq_.topRows(nDOFs_); }
+	auto ddotq() const { return ddotq_.topRows(nDOFs_); }
+
+	void setState(
+		size_t k, const Eigen::VectorXd& q, const Eigen::VectorXd& dotq);
+	void getState(size_t k, Eigen::VectorXd& q, Eigen::VectorXd& dotq) const;
+
+	/** Accelerations of state `k` */
+	void setAccelerations(size_t k, const Eigen::VectorXd& ddotq);
+	void getAccelerations(size_t k, Eigen::VectorXd& ddotq) const;
+
+	/** Copies the (q, dq, ddq) state of a model assembled from the same
+	 * symbolic model into state `k` */
+	void setStateFrom(size_t k, const CAssembledRigidModel& arm)
+	{
+		setState(k, arm.q_, arm.dotq_);
+		setAccelerations(k, arm.ddotq_);
+	}
+
+	/** Evaluates Phi_, dotPhi_, Phi_q_ and dotPhi_q_ for all states */
+	void update_numeric_Phi_and_Jacobians();
+
+	/** Jacobian of state `k` as a sparse matrix */
+	void getPhi_q(size_t k, CompressedRowSparseMatrix& Phi_q) const;
+
+	/** @name Helpers for CConstraintBase::updateBatch()
+		@{ */
+
+	/** Rows in q_, dotq_ and ddotq_ of the x and y coordinates of a point */
+	const std::array<size_t, 2>& pointRows(size_t pt_idx) const
+	{
+		return pointRows_[pt_idx];
+	}
+
+	/** Row of a Jacobian entry, given its slot in the CSR pattern. Writes to
+	 * INVALID_SLOT (entries of fixed points) go to a scratch row. */
+	double* jacobRow(matrix_t& m, size_t slot)
+	{
+		return slot == INVALID_SLOT ? scratch_.data() : &m(slot, 0);
+	}
+
+	/** Values kept by a constraint across calls to updateBatch(), like
+	 * those it caches across calls to update() (one column per state):
+	 * `count` rows for the constraint whose first row in Phi_ is
+	 * `constraintRow`, all zeros on first use. */
+	matrix_t& constraintCache(size_t constraintRow, size_t count);
+
+	/** @} */
+
+	/** @name Numeric data, one column per state
+		@{ */
+
+	/** Coordinates. The first getDOFCount() rows are the actual generalized
+	 * coordinates, the rest hold the constant coordinates of fixed points,
+	 * so all points can be read in the same way. \sa pointRows() */
+	matrix_t q_;
+
+	/** Velocities. Same layout than q_, with zeros for fixed points. */
+	matrix_t dotq_;
+
+	/** Accelerations. Same layout than q_, with zeros for fixed points. Not
+	 * used to evaluate the constraints. */
+	matrix_t ddotq_;
+
+	matrix_t Phi_;  //!< Constraint functions (m rows)
+	matrix_t dotPhi_;  //!< Their time derivative (m rows)
+
+	/** Values of the Jacobian Phi_q, one row per non-zero entry in the CSR
+	 * pattern of model().Phi_q_ */
+	matrix_t Phi_q_;
+
+	/** Values of \dot{Phi_q}, with the same pattern than Phi_q_ */
+	matrix_t dotPhi_q_;
+
+	/** @} */
+
+   private:
+	CAssembledRigidModel::Ptr arm_;
+	size_t numStates_ = 0, nDOFs_ = 0;
+
+	/** Indexed by point index, see pointRows() */
+	std::vector<std::array<size_t, 2>> pointRows_;
+
+	/** Values of the rows of q_ beyond nDOFs_ */
+	Eigen::VectorXd fixedCoords_;
+
+	Eigen::VectorXd scratch_;  //!< See jacobRow()
+
+	/** Indexed by constraint row, see constraintCache() */
+	std::map<size_t, matrix_t> constraintCache_;
+};
+
+}  // namespace mbse
@@ -0,0 +1,108 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+
+#pragma once
+
+#include <mbse/CSparseColumnsSolver.h>
+#include <mbse/mbse-common.h>
+#include <vector>
+
+namespace mbse
+{
+class CAssembledRigidModel;
+
+/** A partition of the coordinates q of a model into independent (z) and
+ * dependent (d) ones, with a factorization of Phi_d, the columns of the
+ * Jacobian Phi_q of the dependent coordinates.
+ *
+ * The model keeps one of them per set of independent coordinates (see
+ * CAssembledRigidModel::coordinatePartition()), so the index maps, the
+ * symbolic analysis of Phi_d and its numeric factorization are reused by
+ * consecutive calls to finiteDisplacement() and computeDependentPosVelAcc(),
+ * e.g. across the stages of an integrator step, and across steps.
+ *
+ * The factorization is only recomputed when Phi_q has drifted away from the
+ * values it was computed with by more than TParams::max_drift (relative to
+ * the largest entry). In between, solve() corrects the error of the older
+ * factorization with iterative refinement against the current Phi_q, so
+ * results are accurate to TParams::refine_tolerance anyway. With redundant
+ * constraints (more rows than columns in Phi_d), solve() is a least-squares
+ * problem which cannot be refined that way, so exact solves refactorize
+ * Phi_d whenever Phi_q has changed.
+ */
+class CCoordinatePartition
+{
+   public:
+	struct TParams
+	{
+		/** Maximum relative change of Phi_q since the last factorization */
+		double max_drift = 0.01;
+		/** Relative residual of solve() with an older factorization */
+		double refine_tolerance = 1e-12;
+		/** Iterative refinement steps before refactorizing anyway */
+		size_t max_refine_iters = 10;
+	};
+
+	CCoordinatePartition(
+		const CAssembledRigidModel& arm, const std::vector<size_t>& z_indices);
+
+	/** Independent coordinates (the key of this partition) */
+	const std::vector<size_t>& indep() const { return z_indices_; }
+	/** Dependent coordinates, in ascending order */
+	const std::vector<size_t>& dep() const { return d_indices_; }
+
+	/** Refactorizes Phi_d if there is no factorization yet, if Phi_q has
+	 * drifted too much since the last one, or if `force` is true. */
+	void update(const CAssembledRigidModel& arm, bool force = false);
+
+	/** Drops the numeric factorization (the symbolic analysis is kept), so
+	 * the next update() computes a new one */
+	void invalidate() { factorized_ = false; }
+
+	/** Solves Phi_d x = b, with the current Phi_q of the model. If `exact`
+	 * is false, the last factorization is used as is (e.g. for the steps of
+	 * a modified Newton method), otherwise its result is refined (see
+	 * TParams). update() must have been called once before. */
+	void solve(
+		const CAssembledRigidModel& arm, const Eigen::VectorXd& b,
+		Eigen::VectorXd& x, bool exact = true);
+
+	/** -Phi_z * v_z, with v_z the independent components of `v` */
+	Eigen::VectorXd minusPhi_z_times(
+		const CAssembledRigidModel& arm, const Eigen::VectorXd& v) const;
+
+	/** Number of numeric factorizations so far */
+	size_t factorizationCount() const { return numFactorizations_; }
+
+   private:
+	std::vector<size_t> z_indices_, d_indices_;
+	const bool sparse_;
+	const bool redundant_;  //!< Whether Phi_d has more rows than columns
+
+	CSparseColumnsSolver sparseSolver_;
+	Eigen::FullPivLU<Eigen::MatrixXd> lu_;
+
+	bool factorized_ = false;
+	/** Values of Phi_q at the last factorization */
+	std::vector<double> factorizedValues_;
+	size_t numFactorizations_ = 0;
+
+	void factorize(const CAssembledRigidModel& arm);
+	/** Whether the last factorization is that of the current Phi_q */
+	bool isCurrent(const CAssembledRigidModel& arm) const;
+	Eigen::VectorXd solveFactorized(const Eigen::VectorXd& b) const;
+	/** b - Phi_d * x */
+	Eigen::VectorXd residual(
+		const CAssembledRigidModel& arm, const Eigen::VectorXd& b,
+		const Eigen::VectorXd& x) const;
+};
+
+}  // namespace mbse
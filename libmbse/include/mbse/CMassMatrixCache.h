@@ -0,0 +1,97 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+
+#pragma once
+
+#include <mbse/mbse-common.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace mbse
+{
+class CAssembledRigidModel;
+
+/** The constant mass matrix M of an assembled model, in the forms used by the
+ * dynamic simulators, plus its factorizations.
+ *
+ * One cache is created with each TSymbolicAssembledModel, and shared by all
+ * the CAssembledRigidModel instances built from it (see
+ * CAssembledRigidModel::massMatrixCache()), so all the simulators of e.g. a
+ * particle filter build and factorize M only once.
+ *
+ * Each form is built on first request, from the model passed as argument
+ * (any of those sharing the cache gives the same result), and never
+ * modified afterwards, so the returned references remain valid and may be
+ * used read-only from several threads. All methods are thread-safe.
+ */
+class CMassMatrixCache
+{
+   public:
+	using Ptr = std::shared_ptr<CMassMatrixCache>;
+
+	CMassMatrixCache() = default;
+	~CMassMatrixCache();
+
+	CMassMatrixCache(const CMassMatrixCache&) = delete;
+	CMassMatrixCache& operator=(const CMassMatrixCache&) = delete;
+
+	/** Dense M */
+	const Eigen::MatrixXd& dense(const CAssembledRigidModel& arm);
+
+	/** LDL^t decomposition of the dense M */
+	const Eigen::LDLT<Eigen::MatrixXd>& denseLDLT(
+		const CAssembledRigidModel& arm);
+
+	/** Sparse M, as triplets with both triangles */
+	const std::vector<Eigen::Triplet<double>>& triplets(
+		const CAssembledRigidModel& arm);
+
+	/** Sparse M, in CCS form */
+	const Eigen::SparseMatrix<double>& sparse(const CAssembledRigidModel& arm);
+
+	/** Sparse LDL^t decomposition of M (symbolic and numeric) */
+	const Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>>& sparseLDLT(
+		const CAssembledRigidModel& arm);
+
+	/** CHOLMOD LL^t factor of M, with a given fill-reducing ordering
+	 * (CHOLMOD_AMD, CHOLMOD_METIS,...). It must not be modified: only pass it
+	 * to cholmod_solve() and the like. */
+	cholmod_factor* cholmodFactor(
+		const CAssembledRigidModel& arm, int cholmodOrdering);
+
+	/** Number of numeric factorizations of M done so far (for statistics) */
+	size_t factorizationCount() const;
+
+   private:
+	const std::vector<Eigen::Triplet<double>>& internal_triplets(
+		const CAssembledRigidModel& arm);
+	const Eigen::SparseMatrix<double>& internal_sparse(
+		const CAssembledRigidModel& arm);
+
+	mutable std::mutex mtx_;
+
+	std::unique_ptr<Eigen::MatrixXd> dense_;
+	std::unique_ptr<Eigen::LDLT<Eigen::MatrixXd>> denseLDLT_;
+	std::unique_ptr<std::vector<Eigen::Triplet<double>>> triplets_;
+	std::unique_ptr<Eigen::SparseMatrix<double>> sparse_;
+	std::unique_ptr<Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>>>
+		sparseLDLT_;
+
+	bool cholmod_started_ = false;
+	cholmod_common cholmod_common_;
+	cholmod_sparse* cholmod_M_ = nullptr;
+	std::map<int, cholmod_factor*> cholmod_factors_;
+
+	size_t factorizationCount_ = 0;
+};
+
+}  // namespace mbse
@@ -15,6 +15,7 @@
 #include <mbse/CBody.h>
 #include <mbse/CModelDefinition.h>
 #include <mbse/CAssembledRigidModel.h>
+#include <mbse/CAssembledRigidModelBatch.h>
 #include <mbse/dynamics/dynamic-simulators.h>
 #include <mbse/virtual-sensors.h>
 #include <mrpt/bayes/CParticleFilter.h>
@@ -24,63 +25,41 @@
 
 namespace mbse
 {
-/** A "particle" holding a MultiBody assembly + its state */
-template <class DYN_SIMUL>
+/** A "particle": the state of the MultiBody system. Its model is shared by
+ * all particles, see CMultiBodyParticleFilter::model() */
 struct TMBState_Particle
 {
-	TMBState_Particle(const TSymbolicAssembledModel& sym_model)
-		: sym_assembly_model(sym_model),
-		  num_model_ptr(new CAssembledRigidModel(sym_assembly_model)),
-		  num_model(*num_model_ptr.get()),
-		  dyn_simul(new DYN_SIMUL(num_model_ptr))
-	{
-		dyn_simul->prepare();
-	}
-
-	TSymbolicAssembledModel
-		sym_assembly_model;  //!< Symbolic assembly instructions
-	std::shared_ptr<CAssembledRigidModel> num_model_ptr;
-	CAssembledRigidModel& num_model;
-	CDynamicSimulatorIndepBase::Ptr dyn_simul;
-
-	/** copy ctor */
-	TMBState_Particle(const TMBState_Particle& o)
-		: sym_assembly_model(o.sym_assembly_model),
-		  num_model_ptr(new CAssembledRigidModel(sym_assembly_model)),
-		  num_model(*num_model_ptr.get()),
-		  dyn_simul(new DYN_SIMUL(num_model_ptr))
-	{
-		num_model.copyStateFrom(o.num_model);
-		dyn_simul->prepare();
-	}
-
-	/** copy operator: doesn't copy the entire objects, just the state! */
-	TMBState_Particle& operator=(const TMBState_Particle& o)
-	{
-		num_model.copyStateFrom(o.num_model);
-		return *this;
-	}
+	Eigen::VectorXd q;  //!< Coordinates
+	Eigen::VectorXd dotq;  //!< Velocities
+	/** Accelerations at the end of the last step. Only computed if any
+	 * sensor needs them, see CVirtualSensor::needs_accelerations() */
+	Eigen::VectorXd ddotq;
 };
 
-// select the kind of solver:
-typedef CDynamicSimulator_Indep_dense MBPF_SIMULATOR_TYPE;
-
 /** A particle-based representation of a probability density function (PDF) over
  * the state of a mechanical system.
  */
 class CMultiBodyParticleFilter
-	: public mrpt::bayes::CParticleFilterData<
-		  TMBState_Particle<MBPF_SIMULATOR_TYPE>>,
+	: public mrpt::bayes::CParticleFilterData<TMBState_Particle>,
 	  public mrpt::bayes::CParticleFilterDataImpl<
 		  CMultiBodyParticleFilter,
-		  mrpt::bayes::CParticleFilterData<
-			  TMBState_Particle<MBPF_SIMULATOR_TYPE>>::CParticleList>
+		  mrpt::bayes::CParticleFilterData<TMBState_Particle>::CParticleList>
 {
    public:
-	typedef TMBState_Particle<MBPF_SIMULATOR_TYPE> particle_t;
-
-	/** Initializes a set of M particles for the given multibody system */
-	CMultiBodyParticleFilter(const size_t M, const CModelDefinition& mbs);
+	typedef TMBState_Particle particle_t;
+
+	/** Initializes a set of M particles for the given multibody system, all
+	 * of them with the initial state of the assembled model.
+	 *
+	 * Particles are simulated with dynamic simulators of class
+	 * `simulator_class`, one of those for independent coordinates accepted by
+	 * CDynamicSimulatorBase::Create(): "CDynamicSimulator_Indep_dense" or
+	 * "CDynamicSimulator_Indep_sparse" (better for large models). There is
+	 * one simulator per thread, each with its own copy of model(), into which
+	 * particles are loaded in turn. */
+	CMultiBodyParticleFilter(
+		const size_t M, const CModelDefinition& mbs,
+		const std::string& simulator_class = "CDynamicSimulator_Indep_dense");
 
 	/** Dtor */
 	~CMultiBodyParticleFilter();
@@ -102,6 +81,21 @@ class CMultiBodyParticleFilter
 		const std::vector<CVirtualSensor::Ptr>& sensor_descriptions,
 		const std::vector<double>& sensor_readings, TOutputInfo& out_info);
 
+	/** The assembled model shared by all particles. Its gravity, external
+	 * forces and options apply to all of them, and must be set before the
+	 * first call to run_PF_step(). Its state (q, dq) is that of none of them:
+	 * use it to work on particles with loadParticle() and storeParticle().
+	 */
+	CAssembledRigidModel& model() { return *arm_; }
+	const CAssembledRigidModel& model() const { return *arm_; }
+
+	/** Copies the state of particle `i` into `arm` (model(), or any other
+	 * model assembled from the same symbolic model) */
+	void loadParticle(size_t i, CAssembledRigidModel& arm) const;
+
+	/** Sets the state of particle `i` from that of `arm` */
+	void storeParticle(size_t i, const CAssembledRigidModel& arm);
+
 	void getAs3DRepresentation(
 		mrpt::opengl::CSetOfObjects::Ptr& outObj,
 		const CBody::TRenderParams& rp) const;
@@ -112,15 +106,108 @@ class CMultiBodyParticleFilter
 		double acc_xy_noise_std;  //!< 1 sigma of the additive Gaussian noise
 								  //!< for accelerations in X,Y.
 
+		/** Integrator of the particle dynamics: ODE_RK4 or, for small time
+		 * steps, the cheaper ODE_Euler */
+		ODE_integrator_t ode_solver = ODE_RK4;
+
 		TTransitionModelOptions();
 	};
 
 	TTransitionModelOptions model_options;
-	mrpt::bayes::CParticleFilter::TParticleFilterOptions
-		PF_options;  //!< Parameters for the PF algorithm.
 
+	/** Resampling algorithms. All of them take O(M) time for M particles. */
+	enum class ResamplingMethod
+	{
+		/** One uniform draw, M equally spaced pointers (low variance) */
+		Systematic,
+		/** One uniform draw per stratum [j/M, (j+1)/M) */
+		Stratified,
+		/** floor(M w_i) copies of each particle, the rest drawn with
+		 * Systematic resampling on the residual weights */
+		Residual
+	};
+
+	struct TResamplingParams
+	{
+		ResamplingMethod method = ResamplingMethod::Systematic;
+
+		/** Resample when the ESS (in [0,1]) drops below this value */
+		double ess_threshold = 0.5;
+
+		/** If >0, resample every that many calls to run_PF_step() instead,
+		 * whatever the ESS */
+		size_t every_k_steps = 0;
+	};
+
+	TResamplingParams resampling_params;
+
+	/** Number of copies of each particle after resampling M particles with
+	 * normalized weights `w`, drawing uniform numbers from `rng` */
+	static void resamplingCounts(
+		ResamplingMethod method, const std::vector<double>& w,
+		mrpt::random::CRandomGenerator& rng, std::vector<size_t>& counts);
+
+	/** Resamples the particles with resampling_params.method, drawing from
+	 * random_generator. States are overwritten in place: each particle with
+	 * at least one copy keeps its slot, and its extra copies go to the slots
+	 * of particles with none, so at most M states are copied and nothing is
+	 * allocated. All weights are reset. */
+	void resample();
+
+	/** Parallel evaluation of the transition model and the sensor
+	 * likelihoods, in chunks of particles run in threadPool() */
+	struct TParallelParams
+	{
+		bool enabled = true;
+		size_t grain_size = 16;  //!< Particles per chunk
+	};
+
+	TParallelParams parallel_params;
+
+	/** Seeds the random noise of the transition model. On each call to
+	 * run_PF_step(), one number is drawn from it to seed an independent
+	 * stream per particle, so results for a given seed do not depend on the
+	 * number of threads nor on parallel_params. */
 	mrpt::random::CRandomGenerator random_generator;
 
+   private:
+	/** Copy of the model definition, referenced by the assembled models */
+	const CModelDefinition mbs_;
+
+	/** The shared model, and the simulator prototype working on it */
+	CAssembledRigidModel::Ptr arm_;
+	CDynamicSimulatorIndepBase::Ptr simul_;
+
+	/** Per-thread copies of simul_ (each one with its own model), created
+	 * along with the filter for the workers of threadPool() */
+	std::shared_ptr<CPerThreadCopies<CDynamicSimulatorIndepBase>> simulators_;
+
+	/** States of one chunk of parallel_params.grain_size particles, for the
+	 * batch evaluation of sensors, and their log-likelihoods for one sensor
+	 */
+	struct TLikelihoodChunk
+	{
+		CAssembledRigidModelBatch::Ptr states;
+		Eigen::VectorXd log_lik;
+	};
+	std::vector<TLikelihoodChunk> lik_chunks_;
+
+	/** Calls to run_PF_step() since the last resampling */
+	size_t steps_since_resampling_ = 0;
+
+	/** Workspace of resample() */
+	std::vector<double> resampling_w_;
+	std::vector<size_t> resampling_counts_, resampling_free_;
+
+	/** One model per particle, only to hold its 3D objects, see
+	 * getAs3DRepresentation() */
+	mutable std::vector<CAssembledRigidModel::Ptr> render_models_;
+
+	/** Calls `f(i0, i1)` for ranges of particle indices covering all
+	 * particles, in parallel if enabled in parallel_params */
+	void for_each_particle_range(
+		const std::function<void(size_t, size_t)>& f) const;
+
 };  // end class CMultiBodyParticleFilter
 
 }  // namespace mbse
@@ -0,0 +1,70 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+
+#pragma once
+
+#include <mbse/mbse-common.h>
+#include <vector>
+
+namespace mbse
+{
+/** Sparse solver for the linear systems A_c x = b of Newton methods on the
+ * constraints, with A_c a subset of the columns of a sparse matrix A, e.g.
+ * those of the dependent coordinates in the Jacobian Phi_q.
+ *
+ * setup() extracts the pattern of the submatrix, with a map from its entries
+ * to the slots of A, and does the symbolic analysis (fill-reducing column
+ * ordering) only once. Afterwards, each factorize() copies the current values
+ * of A and computes a numeric sparse QR, instead of the O(n^3) dense LU
+ * decomposition of the whole Jacobian.
+ *
+ * Systems with at least as many rows as columns (e.g. with redundant
+ * constraints) are solved in the least-squares sense. Underdetermined ones
+ * (e.g. for all the coordinates, as in refinePosition()) get the minimum norm
+ * solution, from the QR decomposition of the transpose.
+ */
+class CSparseColumnsSolver
+{
+   public:
+	/** Selects the columns `cols` of `A` and analyzes the pattern. Must be
+	 * called again if the pattern of `A` changes. */
+	void setup(
+		const CompressedRowSparseMatrix& A, const std::vector<size_t>& cols);
+
+	/** Like setup(), selecting all the columns except `excludedCols` */
+	void setupExcluding(
+		const CompressedRowSparseMatrix& A,
+		const std::vector<size_t>& excludedCols);
+
+	/** Numeric factorization, with the current values in the matrix `A`
+	 * passed to setup() (or another one with the same pattern). */
+	void factorize(const CompressedRowSparseMatrix& A);
+
+	/** Solves A_c x = b, with the last factorization */
+	void solve(const Eigen::VectorXd& b, Eigen::VectorXd& x) const;
+
+	/** Selected columns, in ascending order */
+	const std::vector<size_t>& columns() const { return cols_; }
+
+	/** Rank of A_c, as of the last factorization */
+	Eigen::Index rank() const { return qr_.rank(); }
+
+   private:
+	using sparse_t = Eigen::SparseMatrix<double>;
+
+	std::vector<size_t> cols_;
+	bool transposed_ = false;  //!< Whether M_ is the transpose of A_c
+	sparse_t M_;
+	std::vector<size_t> slots_;  //!< Slot in A of each value in M_
+	Eigen::SparseQR<sparse_t, Eigen::COLAMDOrdering<int>> qr_;
+};
+
+}  // namespace mbse
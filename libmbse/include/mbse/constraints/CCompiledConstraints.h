@@ -0,0 +1,124 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#pragma once
+
+#include <mbse/mbse-common.h>
+#include <array>
+#include <vector>
+
+namespace mbse
+{
+class CAssembledRigidModel;
+
+/** The constraints of a CAssembledRigidModel grouped by their concrete type,
+ * to be evaluated without one virtual call per constraint.
+ *
+ * When built, each constraint is offered to be compiled (see
+ * CConstraintBase::compile()). Those which accept store their data in the
+ * group of their type, in structure of arrays layout, with the references to
+ * point coordinates resolved into gather indices: coordinates, velocities
+ * and accelerations are read from extended copies of q, dq and ddq with the
+ * constant coordinates of fixed points (and their zero velocities) appended,
+ * so fixed and variable points are read in the same way. Each group is then
+ * evaluated in a tight, branch-free loop, and the results scattered to their
+ * rows and slots in the model.
+ *
+ * Constraints which do not support compilation are evaluated as usual.
+ */
+class CCompiledConstraints
+{
+   public:
+	/** Groups all the constraints of `arm`, which must have already built
+	 * their sparse structures. */
+	void build(const CAssembledRigidModel& arm);
+
+	/** Evaluates all constraints: same results than calling
+	 * CConstraintBase::update() for each one. */
+	void update(CAssembledRigidModel& arm);
+
+	/** Number of constraints evaluated through CConstraintBase::update() */
+	size_t genericCount() const { return generic_.size(); }
+
+	/** @name Called from CConstraintBase::compile()
+	 * Points are indices in the model, and slots are those of the Jacobian
+	 * entries of their x and y coordinates (INVALID_SLOT for fixed points).
+	 * @{ */
+	void addConstantDistance(
+		size_t row, const std::array<size_t, 2>& points,
+		const std::array<size_t, 4>& slots, double length);
+
+	void addFixedSlider(
+		size_t row, size_t point, const std::array<size_t, 2>& slots,
+		const mrpt::math::TPoint2D& line_pt0,
+		const mrpt::math::TPoint2D& delta);
+
+	void addMobileSlider(
+		size_t row, const std::array<size_t, 3>& points,
+		const std::array<size_t, 6>& slots);
+	/** @} */
+
+   private:
+	/** One group of constraints of the same type, each one with NUM_ENTRIES
+	 * Jacobian entries (one per point coordinate) and NUM_PARAMS constant
+	 * parameters. */
+	template <std::size_t NUM_ENTRIES, std::size_t NUM_PARAMS>
+	struct TGroup
+	{
+		std::vector<size_t> rows;  //!< Row of each constraint in Phi
+		/** Gather indices (in the extended q) of each entry */
+		std::array<std::vector<size_t>, NUM_ENTRIES> idx;
+		std::array<std::vector<double>, NUM_PARAMS> params;
+
+		std::vector<double> Phi, dotPhi;
+
+		/** Values of Phi_q, dotPhi_q, Phiqq_times_ddq and dotPhiqq_times_dq:
+		 * entry `e` of the i-th constraint goes at `e * size() + i`. */
+		std::array<std::vector<double>, 4> jac;
+
+		/** (slot, index in jac[]) of all the entries of non-fixed points */
+		std::vector<std::pair<size_t, size_t>> scatter_list;
+
+		/** Temporary, until finalize() */
+		std::vector<std::array<size_t, NUM_ENTRIES>> slots;
+
+		size_t size() const { return rows.size(); }
+
+		/** Allocates results and builds scatter_list */
+		void finalize();
+
+		/** Copies the results into the model */
+		void scatter(CAssembledRigidModel& arm) const;
+	};
+
+	template <std::size_t NUM_POINTS, std::size_t NUM_PARAMS>
+	void add(
+		TGroup<2 * NUM_POINTS, NUM_PARAMS>& g, size_t row,
+		const std::array<size_t, NUM_POINTS>& points,
+		const std::array<size_t, 2 * NUM_POINTS>& slots,
+		const std::array<double, NUM_PARAMS>& params);
+
+	/** Params: length^2 */
+	TGroup<4, 1> constantDistance_;
+	/** Params: x0, y0, Delta x, Delta y */
+	TGroup<2, 4> fixedSlider_;
+	TGroup<6, 0> mobileSlider_;
+
+	/** Indices in the model list of constraints not compiled */
+	std::vector<size_t> generic_;
+
+	/** Indexed by point index: gather indices of its x and y coordinates */
+	std::vector<std::array<size_t, 2>> pointIdxs_;
+
+	/** Extended coordinates, velocities and accelerations */
+	Eigen::VectorXd q_, dotq_, ddotq_;
+};
+
+}  // namespace mbse
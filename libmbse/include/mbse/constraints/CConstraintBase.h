@@ -16,6 +16,8 @@
 namespace mbse
 {
 class CAssembledRigidModel;
+class CAssembledRigidModelBatch;
+class CCompiledConstraints;
 
 /** The virtual base class of all constraint types. */
 class CConstraintBase
@@ -37,6 +39,19 @@ class CConstraintBase
 	 * MBS. This is called a very large number of times during simulations. */
 	virtual void update(CAssembledRigidModel& arm) const = 0;
 
+	/** Like update(), for all the states of a batch at once, with the states
+	 * in the innermost loop. Only Phi, dotPhi, Phi_q and dotPhi_q are
+	 * evaluated. */
+	virtual void updateBatch(CAssembledRigidModelBatch& b) const = 0;
+
+	/** Adds this constraint to its type group in `cc`, if supported, after
+	 * buildSparseStructures(). \return false if not supported, so update()
+	 * will be called for it instead. */
+	virtual bool compile([[maybe_unused]] CCompiledConstraints& cc) const
+	{
+		return false;
+	}
+
 	/** Virtual destructor (required in any virtual base) */
 	virtual ~CConstraintBase();
 
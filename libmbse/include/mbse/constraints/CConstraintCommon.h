@@ -11,6 +11,8 @@
 #pragma once
 
 #include <mbse/CAssembledRigidModel.h>
+#include <mbse/CAssembledRigidModelBatch.h>
+#include <mbse/mbse-autodiff.h>
 #include <mrpt/core/exceptions.h>
 #include <cstdlib>
 #include <array>
@@ -138,6 +140,28 @@ class CConstraintCommon
 		return {arm.q_[idx], arm.dotq_[idx], arm.ddotq_[idx]};
 	}
 
+	/** Pointers to the rows with the coordinates and velocities of a point
+	 * for all states of a batch (rows of fixed coordinates are constant) */
+	struct PointRows
+	{
+		const double *x, *y, *dotx, *doty;
+	};
+
+	PointRows batch_coords(const CAssembledRigidModelBatch& b, size_t idx) const
+	{
+		const auto& r = b.pointRows(point_index[idx]);
+		return {&b.q_(r[0], 0), &b.q_(r[1], 0), &b.dotq_(r[0], 0),
+				&b.dotq_(r[1], 0)};
+	}
+
+	/** Like batch_coords(), for a relative coordinate */
+	std::array<const double*, 2> batch_rel_coords(
+		const CAssembledRigidModelBatch& b, size_t idxRelativeCoord) const
+	{
+		const auto idx = relativeCoordIndexInQ_.at(idxRelativeCoord);
+		return {&b.q_(idx, 0), &b.dotq_(idx, 0)};
+	}
+
    protected:
 	CConstraintCommon(
 		std::initializer_list<size_t> naturalCoordPointIdxs,
@@ -160,8 +184,8 @@ class CConstraintCommon
 		}
 	}
 
-	using array_dptr_t = std::array<double*, NUM_POINTS>;
-	using array_relative_dptr_t = std::array<double*, NUM_RELATIVE_COORDS>;
+	using array_slot_t = std::array<size_t, NUM_POINTS>;
+	using array_relative_slot_t = std::array<size_t, NUM_RELATIVE_COORDS>;
 
 	/** Assigned constraint indices, i.e. row indices in the Jacobian dQ_dq
 	 */
@@ -193,41 +217,21 @@ class CConstraintCommon
 
 	std::array<size_t, NUM_RELATIVE_COORDS> relativeCoordIndexInQ_;
 
+	/** Slots (indices in valuePtr()) of the entries of one Jacobian row. The
+	 * four sparse matrices Phi_q_, dotPhi_q_, Phiqq_times_ddq_ and
+	 * dotPhiqq_times_dq_ share the same sparsity pattern, hence the same slots
+	 * are valid for all of them. Entries of fixed points are INVALID_SLOT.
+	 */
 	struct JacobRowEntries
 	{
-		/** Pointers to entries in the sparse Jacobian dPhi_dq */
-		array_dptr_t dPhi_dx, dPhi_dy;
-		array_relative_dptr_t dPhi_drel;  //!< Jacobians wrt rel coords
-
-		/** Pointers to entries in the sparse Jacobian \dot{dPhi_dq} */
-		array_dptr_t dot_dPhi_dx, dot_dPhi_dy;
-		array_relative_dptr_t dot_dPhi_drel;  //!< Jacobians wrt rel coords
-
-		/** Pointers to entries in the sparse Jacobian Phiqq_times_ddq */
-		array_dptr_t Phiqq_times_ddq_dx, Phiqq_times_ddq_dy;
-		array_relative_dptr_t Phiqq_times_ddq_drel;
-
-		/** Pointers to entries in the sparse Jacobian dotPhiqq_times_dq */
-		array_dptr_t dotPhiqq_times_dq_dx, dotPhiqq_times_dq_dy;
-		array_relative_dptr_t dotPhiqq_times_dq_drel;
+		array_slot_t dx, dy;
+		array_relative_slot_t drel;  //!< Entries for relative coords
 
 		JacobRowEntries()
 		{
-			dPhi_dx.fill(nullptr);
-			dPhi_dy.fill(nullptr);
-			dPhi_drel.fill(nullptr);
-
-			dot_dPhi_dx.fill(nullptr);
-			dot_dPhi_dy.fill(nullptr);
-			dot_dPhi_drel.fill(nullptr);
-
-			Phiqq_times_ddq_dx.fill(nullptr);
-			Phiqq_times_ddq_dy.fill(nullptr);
-			Phiqq_times_ddq_drel.fill(nullptr);
-
-			dotPhiqq_times_dq_dx.fill(nullptr);
-			dotPhiqq_times_dq_dy.fill(nullptr);
-			dotPhiqq_times_dq_drel.fill(nullptr);
+			dx.fill(INVALID_SLOT);
+			dy.fill(INVALID_SLOT);
+			drel.fill(INVALID_SLOT);
 		}
 	};
 
@@ -235,11 +239,25 @@ class CConstraintCommon
 
 	mutable std::array<JacobRowEntries, NUM_JACOB_ROWS> jacob;
 
-	/** Sets a value, if the pointer is !=nullptr */
-	static void set(double* ptr, double val)
+	/** Sets a value in a sparse matrix, if the slot is not INVALID_SLOT */
+	static void set(CompressedRowSparseMatrix& m, size_t slot, double val)
 	{
-		if (ptr) *ptr = val;
+		if (slot != INVALID_SLOT) m.valuePtr()[slot] = val;
 	}
+
+	/** Number of local coordinates: x and y of each point, then the
+	 * relative coordinates */
+	static constexpr std::size_t NUM_LOCAL_COORDS =
+		2 * NUM_POINTS + NUM_RELATIVE_COORDS;
+
+	/** Evaluates the Jacobian row `row` from the constraint function alone,
+	 * by automatic differentiation: `phi(x)` must return Phi for an array
+	 * `x` of the NUM_LOCAL_COORDS local coordinates, generic in their scalar
+	 * type (see autodiffConstraint()). Updates Phi_, dotPhi_ and the row in
+	 * all four Jacobian matrices. */
+	template <class FUNCTOR>
+	void autodiff_update(
+		CAssembledRigidModel& arm, const FUNCTOR& phi, size_t row = 0) const;
 };
 
 //  ================= Template implementations =============================
@@ -264,53 +282,85 @@ void CConstraintCommon<NUM_POINTS, NUM_RELATIVE_COORDS, NUM_JACOB_ROWS>::
 		idx_constr_[ic] = jRow;
 		auto& j = jacob[ic];
 
-		auto& Phi_q = a.Phi_q_.matrix;
-		auto& dotPhi_q = a.dotPhi_q_.matrix;
-		auto& Phiqq_times_ddq = a.Phiqq_times_ddq_.matrix;
-		auto& dotPhiqq_times_dq = a.dotPhiqq_times_dq_.matrix;
+		// Add columns to the new sparse row (same pattern in all matrices):
+		auto lambdaInsert = [&a, jRow](size_t col) {
+			a.Phi_q_.insert(jRow, col);
+			a.dotPhi_q_.insert(jRow, col);
+			a.Phiqq_times_ddq_.insert(jRow, col);
+			a.dotPhiqq_times_dq_.insert(jRow, col);
+		};
 
 		for (size_t ip = 0; ip < NUM_POINTS; ip++)
 		{
 			// Only for variables, not fixed points
 			if (points_[ip]->fixed) continue;
-
-			const auto idxX = pointDOFs_[ip].dof_x;
-			const auto idxY = pointDOFs_[ip].dof_y;
-
-			// Add columns to sparse row in Phi_q:
-			j.dPhi_dx[ip] = &Phi_q[jRow][idxX];
-			j.dPhi_dy[ip] = &Phi_q[jRow][idxY];
-
-			// Add columns to sparse row in \dot{Phi_q}:
-			j.dot_dPhi_dx[ip] = &dotPhi_q[jRow][idxX];
-			j.dot_dPhi_dy[ip] = &dotPhi_q[jRow][idxY];
-
-			// Add columns to sparse row in Phiqq_times_ddq:
-			j.Phiqq_times_ddq_dx[ip] = &Phiqq_times_ddq[jRow][idxX];
-			j.Phiqq_times_ddq_dy[ip] = &Phiqq_times_ddq[jRow][idxY];
-
-			// Add columns to sparse row in dotPhiqq_times_dq:
-			j.dotPhiqq_times_dq_dx[ip] = &dotPhiqq_times_dq[jRow][idxX];
-			j.dotPhiqq_times_dq_dy[ip] = &dotPhiqq_times_dq[jRow][idxY];
+			lambdaInsert(pointDOFs_[ip].dof_x);
+			lambdaInsert(pointDOFs_[ip].dof_y);
 		}
-
 		for (size_t irc = 0; irc < NUM_RELATIVE_COORDS; irc++)
+			lambdaInsert(relativeCoordIndexInQ_[irc]);
+
+		// Once the row is complete, its slots will not change anymore:
+		for (size_t ip = 0; ip < NUM_POINTS; ip++)
 		{
-			const auto idxRel = relativeCoordIndexInQ_[irc];
+			if (points_[ip]->fixed) continue;
+			j.dx[ip] = a.Phi_q_.slot(jRow, pointDOFs_[ip].dof_x);
+			j.dy[ip] = a.Phi_q_.slot(jRow, pointDOFs_[ip].dof_y);
+		}
+		for (size_t irc = 0; irc < NUM_RELATIVE_COORDS; irc++)
+			j.drel[irc] = a.Phi_q_.slot(jRow, relativeCoordIndexInQ_[irc]);
+	}
+}
 
-			// Add columns to sparse row in Phi_q:
-			j.dPhi_drel[irc] = &Phi_q[jRow][idxRel];
+template <
+	std::size_t NUM_POINTS, std::size_t NUM_RELATIVE_COORDS,
+	std::size_t NUM_JACOB_ROWS>
+template <class FUNCTOR>
+void CConstraintCommon<NUM_POINTS, NUM_RELATIVE_COORDS, NUM_JACOB_ROWS>::
+	autodiff_update(
+		CAssembledRigidModel& arm, const FUNCTOR& phi, size_t row) const
+{
+	constexpr std::size_t K = NUM_LOCAL_COORDS;
+	std::array<double, K> q, dq, ddq;
+	for (size_t ip = 0; ip < NUM_POINTS; ip++)
+	{
+		const PointRef p = actual_coords(arm, ip);
+		q[2 * ip + 0] = p.x;
+		q[2 * ip + 1] = p.y;
+		dq[2 * ip + 0] = p.dotx;
+		dq[2 * ip + 1] = p.doty;
+		ddq[2 * ip + 0] = p.ddotx;
+		ddq[2 * ip + 1] = p.ddoty;
+	}
+	for (size_t irc = 0; irc < NUM_RELATIVE_COORDS; irc++)
+	{
+		const RelCoordRef r = actual_rel_coords(arm, irc);
+		q[2 * NUM_POINTS + irc] = r.x;
+		dq[2 * NUM_POINTS + irc] = r.dotx;
+		ddq[2 * NUM_POINTS + irc] = r.ddotx;
+	}
 
-			// Add columns to sparse row in \dot{Phi_q}:
-			j.dot_dPhi_drel[irc] = &dotPhi_q[jRow][idxRel];
+	TConstraintDerivatives<K> d;
+	autodiffConstraint(phi, q, dq, ddq, d);
 
-			// Add columns to sparse row in Phiqq_times_ddq:
-			j.Phiqq_times_ddq_drel[irc] = &Phiqq_times_ddq[jRow][idxRel];
+	arm.Phi_[idx_constr_[row]] = d.Phi;
+	arm.dotPhi_[idx_constr_[row]] = d.dotPhi;
 
-			// Add columns to sparse row in dotPhiqq_times_dq:
-			j.dotPhiqq_times_dq_drel[irc] = &dotPhiqq_times_dq[jRow][idxRel];
-		}
+	// Entries of fixed points have no slot, and are not written:
+	const auto& j = jacob[row];
+	auto lambdaSetAll = [&](size_t slot, size_t k) {
+		set(arm.Phi_q_, slot, d.Phi_q[k]);
+		set(arm.dotPhi_q_, slot, d.dotPhi_q[k]);
+		set(arm.Phiqq_times_ddq_, slot, d.Phiqq_times_ddq[k]);
+		set(arm.dotPhiqq_times_dq_, slot, d.dotPhiqq_times_dq[k]);
+	};
+	for (size_t ip = 0; ip < NUM_POINTS; ip++)
+	{
+		lambdaSetAll(j.dx[ip], 2 * ip + 0);
+		lambdaSetAll(j.dy[ip], 2 * ip + 1);
 	}
+	for (size_t irc = 0; irc < NUM_RELATIVE_COORDS; irc++)
+		lambdaSetAll(j.drel[irc], 2 * NUM_POINTS + irc);
 }
 
 }  // namespace mbse
@@ -33,6 +33,8 @@ class CConstraintConstantDistance : public CConstraintBase,
 
 	void buildSparseStructures(CAssembledRigidModel& arm) const override;
 	void update(CAssembledRigidModel& arm) const override;
+	void updateBatch(CAssembledRigidModelBatch& b) const override;
+	bool compile(CCompiledConstraints& cc) const override;
 
 	Ptr clone() const override { return std::make_shared<me_t>(*this); }
 };
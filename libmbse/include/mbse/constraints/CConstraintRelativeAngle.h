@@ -45,6 +45,7 @@ class CConstraintRelativeAngle
 
 	void buildSparseStructures(CAssembledRigidModel& arm) const override;
 	void update(CAssembledRigidModel& arm) const override;
+	void updateBatch(CAssembledRigidModelBatch& b) const override;
 
 	Ptr clone() const override { return std::make_shared<me_t>(*this); }
 
@@ -43,6 +43,7 @@ class CConstraintRelativeAngleAbsolute
 
 	void buildSparseStructures(CAssembledRigidModel& arm) const override;
 	void update(CAssembledRigidModel& arm) const override;
+	void updateBatch(CAssembledRigidModelBatch& b) const override;
 
 	Ptr clone() const override { return std::make_shared<me_t>(*this); }
 
@@ -0,0 +1,115 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#pragma once
+
+#include <mbse/CAssembledRigidModel.h>
+#include <mbse/dynamics/dynamic-simulators.h>
+#include <Eigen/LU>
+
+namespace mbse
+{
+/** Like CDynamicSimulator_Lagrange_LU_dense, for mechanisms whose number of
+ * coordinates `NQ` and constraints `NC` are known at compile time (e.g. the
+ * four-bar linkage: NQ=4, NC=3). The augmented matrix and its LU
+ * decomposition are fixed-size, so solve_ddotq() does not allocate memory
+ * and small products are fully unrolled by the compiler.
+ *
+ * prepare() checks that the model has the given sizes.
+ */
+template <int NQ, int NC>
+class CDynamicSimulator_Lagrange_LU_fixed : public CDynamicSimulatorBase
+{
+   public:
+	static constexpr int NTOT = NQ + NC;
+
+	CDynamicSimulator_Lagrange_LU_fixed(
+		const std::shared_ptr<CAssembledRigidModel> arm_ptr)
+		: CDynamicSimulatorBase(arm_ptr)
+	{
+	}
+
+	CDynamicSimulatorBase::Ptr clone(
+		const std::shared_ptr<CAssembledRigidModel>& arm) const override
+	{
+		auto o = std::make_shared<CDynamicSimulator_Lagrange_LU_fixed>(arm);
+		o->params = params;
+		return o;
+	}
+
+   private:
+	using matrix_t = Eigen::Matrix<double, NTOT, NTOT>;
+	using vector_t = Eigen::Matrix<double, NTOT, 1>;
+
+	void internal_prepare() override
+	{
+		timelog().enter("solver_prepare");
+
+		ASSERT_EQUAL_(static_cast<int>(arm_->q_.size()), NQ);
+		ASSERT_EQUAL_(static_cast<int>(arm_->Phi_.size()), NC);
+
+		// The mass matrix is constant with this formulation:
+		A_.setZero();
+		A_.template topLeftCorner<NQ, NQ>() =
+			arm_->massMatrixCache().dense(*arm_);
+
+		timelog().leave("solver_prepare");
+	}
+
+	void internal_solve_ddotq(
+		[[maybe_unused]] double t, Eigen::VectorXd& ddot_q,
+		Eigen::VectorXd* lagrangre = nullptr) override
+	{
+		timelog().enter("solver_ddotq");
+
+		// [   M    Phi_q^t  ] [ ddot_q ] = [ Q ]
+		// [ Phi_q     0     ] [ lambda ]   [ c ]
+		timelog().enter("solver_ddotq.update_jacob");
+		arm_->update_numeric_Phi_and_Jacobians();
+
+		// Only entries of Phi_q are overwritten: the rest keep their values.
+		const auto* Phi_q_rows = arm_->Phi_q_.outerIndexPtr();
+		const auto* Phi_q_cols = arm_->Phi_q_.innerIndexPtr();
+		const double* Phi_q_vals = arm_->Phi_q_.valuePtr();
+		for (int i = 0; i < NC; i++)
+		{
+			for (auto k = Phi_q_rows[i]; k < Phi_q_rows[i + 1]; k++)
+			{
+				const auto col = Phi_q_cols[k];
+				A_(col, NQ + i) = Phi_q_vals[k];
+				A_(NQ + i, col) = Phi_q_vals[k];
+			}
+		}
+		timelog().leave("solver_ddotq.update_jacob");
+
+		timelog().enter("solver_ddotq.build_rhs");
+		this->build_RHS(&RHS_[0], &RHS_[NQ]);
+		timelog().leave("solver_ddotq.build_rhs");
+
+		timelog().enter("solver_ddotq.solve");
+		lu_.compute(A_);
+		solution_ = lu_.solve(RHS_);
+		timelog().leave("solver_ddotq.solve");
+
+		ddot_q = solution_.template head<NQ>();
+		if (lagrangre) *lagrangre = solution_.template tail<NC>();
+
+		timelog().leave("solver_ddotq");
+	}
+
+	matrix_t A_;
+	vector_t RHS_, solution_;
+	Eigen::PartialPivLU<matrix_t> lu_;
+
+   public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+}  // namespace mbse
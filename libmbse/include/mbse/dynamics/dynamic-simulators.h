@@ -11,10 +11,22 @@
 #pragma once
 
 #include <mbse/mbse-common.h>
+#include <mbse/mbse-parallel.h>
+#include <array>
 #include <list>
 
+/** Whether the RHS of the dynamic equations includes Baumgarten
+ * stabilization terms (shared by all scalar and batch solvers) */
+#define USE_BAUMGARTEN_STABILIZATION 1
+
 namespace mbse
 {
+#if USE_BAUMGARTEN_STABILIZATION
+// Baumgarten Stabilization parameters:
+constexpr double baumgarten_epsilon = 1;
+constexpr double baumgarten_omega = 10;
+#endif
+
 struct TPointState
 {
 	TPointState(
@@ -39,6 +51,43 @@ enum TOrderingMethods
 	orderTryKeepBest  //!< Try different methods and keep the best one
 };
 
+/** Numeric factorization options of KLU-based solvers */
+struct TKLUParams
+{
+	/** Reuse the numeric factorization (and its pivot sequence) between steps
+	 * via klu_refactor(), instead of a full klu_factor() each time. */
+	bool refactor = true;
+
+	/** A full factorization is done whenever the reciprocal pivot growth or
+	 * the reciprocal condition estimate after klu_refactor() fall below this
+	 * fraction of those of the last full factorization. */
+	double refactor_tolerance = 1e-3;
+};
+
+/** Numeric LU factorization of `A` with KLU. If `numeric` already holds a
+ * factorization of a matrix with the same pattern, it is reused with
+ * klu_refactor(), falling back to a full factorization if the pivot growth or
+ * condition checks fail (counted in timelog() as
+ * "solver_ddotq.klu_refactor_fallback"). `rgrowth_rcond` keeps the figures of
+ * the last full factorization.
+ */
+void klu_numeric_factor(
+	Eigen::SparseMatrix<double>& A, klu_symbolic* symbolic,
+	klu_numeric*& numeric, klu_common& common, const TKLUParams& params,
+	std::array<double, 2>& rgrowth_rcond);
+
+/** Builds the CCS augmented matrix [ M  Phi_q^t ; Phi_q  0 ] from the mass
+ * matrix triplets and the sparsity pattern of `Phi_q`, with zeros in place of
+ * the Jacobian values. The Phi_q^t block values are stored in the last
+ * Phi_q.nonZeros() entries of A.valuePtr(), in the same order than in
+ * Phi_q.valuePtr(). For each of them, the index of its mirror entry in the
+ * Phi_q block is returned in `Phi_q_block_idxs`.
+ */
+void build_augmented_CCS_pattern(
+	const std::vector<Eigen::Triplet<double>>& mass_tri,
+	const CompressedRowSparseMatrix& Phi_q, Eigen::SparseMatrix<double>& A,
+	std::vector<int>& Phi_q_block_idxs);
+
 /** Logging structure for CDynamicSimulatorBase's "sensors" */
 struct TSensorData
 {
@@ -51,6 +100,7 @@ struct TSensorData
 
 class CAssembledRigidModel;  //!< A MBS preprocessed and ready for
 							 //!< kinematic/dynamic simulations.
+class CAssembledRigidModelBatch;  //!< Many states of one MBS
 
 enum ODE_integrator_t
 {
@@ -93,6 +143,12 @@ class CDynamicSimulatorBase
 	CDynamicSimulatorBase(std::shared_ptr<CAssembledRigidModel> arm_ptr);
 	virtual ~CDynamicSimulatorBase();
 
+	/** Creates a new simulator of the same class and with the same
+	 * parameters, for another model with the same structure (e.g. made with
+	 * CAssembledRigidModel::cloneTopology()). Call prepare() on it before
+	 * using it. \sa CPerThreadCopies */
+	virtual Ptr clone(const std::shared_ptr<CAssembledRigidModel>& arm) const;
+
 	struct TParameters
 	{
 		TParameters() = default;
@@ -105,12 +161,20 @@ class CDynamicSimulatorBase
 
 		/** Called AFTER each new simulation step */
 		simul_callback_t user_callback;
+
+		/** Debug mode for real-time use: asserts that integrating each time
+		 * step in run() makes no Eigen heap allocation. Only effective if
+		 * the library is built with the CMake option MBSE_CHECK_NO_MALLOC
+		 * (or with the unit tests) and without NDEBUG (see
+		 * EIGEN_RUNTIME_NO_MALLOC). */
+		bool check_no_allocations = false;
 	};
 
 	TParameters params;  //!< The simulator parameters
 
 	/** One-time preparation of the linear systems and anything else required,
-	 * before starting to call solve_ddotq()
+	 * before starting to call solve_ddotq(). All the workspaces of the
+	 * solver and the integrators are allocated here.
 	 *  ** MUST BE CALLED BEFORE solve_ddotq() **
 	 */
 	void prepare();
@@ -122,6 +186,24 @@ class CDynamicSimulatorBase
 		double t, Eigen::VectorXd& ddot_q,
 		Eigen::VectorXd* lagrangre = nullptr);
 
+	/** Jacobians of the accelerations solve_ddotq() would return for the
+	 * current state, with respect to q, dq and the external generalized
+	 * forces Q_ of the model (each one n x n). Pass nullptr for those not
+	 * needed.
+	 *
+	 * They are evaluated in closed form, differentiating the augmented system
+	 * [M Phi_q^t; Phi_q 0][ddq; lambda] = [Q; c]: its matrix is factorized
+	 * once with factorize_augmented_system() and all columns are solved
+	 * together, and the derivatives of Phi_q come from Phiqq_times_ddq_ and
+	 * dotPhiqq_times_dq_. No call to solve_ddotq() is made. Penalty
+	 * formulations only approximate these accelerations, and throw.
+	 *
+	 * You MUST call prepare() before this method.
+	 */
+	void eval_ddotq_jacobians(
+		Eigen::MatrixXd* ddotq_q, Eigen::MatrixXd* ddotq_dq,
+		Eigen::MatrixXd* ddotq_Q);
+
 	/** Integrators will call this before solve_ddotq() once per time step */
 	virtual void pre_iteration(double t) {}
 
@@ -167,6 +249,48 @@ class CDynamicSimulatorBase
 	 */
 	void build_RHS(double* Q, double* c);
 
+	/** \name Helpers for solvers of the augmented system
+	 *  [ M  Phi_q^t ; Phi_q  0 ], stored as a pattern-fixed CCS matrix.
+	 * @{ */
+
+	/** Builds the CCS augmented matrix with build_augmented_CCS_pattern().
+	 * Its last nConstraints columns hold Phi_q^t, which in CCS has exactly
+	 * the layout of Phi_q_ in CSR, so the values of arm_->Phi_q_ are bound
+	 * there and constraints update them in place.
+	 */
+	void build_augmented_CCS(
+		const std::vector<Eigen::Triplet<double>>& mass_tri,
+		Eigen::SparseMatrix<double>& A, std::vector<int>& Phi_q_block_idxs);
+
+	/** Refreshes the Phi_q block of a matrix built with build_augmented_CCS(),
+	 * once the constraint Jacobians have been updated. */
+	void update_augmented_CCS(
+		Eigen::SparseMatrix<double>& A,
+		const std::vector<int>& Phi_q_block_idxs);
+
+	/** Must be called from the destructor of solvers which called
+	 * build_augmented_CCS(), to release the binding of Phi_q_ to A. */
+	void unbind_augmented_CCS(const Eigen::SparseMatrix<double>& A);
+
+	/** @} */
+
+	/** \name Augmented system of eval_ddotq_jacobians()
+	 * @{ */
+
+	/** Factorizes A = [ M  Phi_q^t ; Phi_q  0 ] at the current state, once
+	 * the constraint Jacobians have been updated. Solvers which factorize A
+	 * themselves override it (and solve_augmented_system()) to reuse their
+	 * own factorization. The default one is a sparse QR, which also copes
+	 * with redundant constraints.
+	 */
+	virtual void factorize_augmented_system();
+
+	/** Solves A*X = B in place, for a (n+m) x k matrix B, with the last
+	 * factorization of factorize_augmented_system() */
+	virtual void solve_augmented_system(Eigen::MatrixXd& B);
+
+	/** @} */
+
 	/** Prepare the linear systems and anything else required to really call
 	 * solve_ddotq() */
 	virtual void internal_prepare() = 0;
@@ -193,6 +317,15 @@ class CDynamicSimulatorBase
 	Eigen::VectorXd v1, v2, v3, v4;  // \dot{q}
    private:
 	Eigen::VectorXd ddotq1, ddotq2, ddotq3, ddotq4;  // \ddot{q}
+	// Trapezoidal integrator:
+	Eigen::VectorXd dq0, ddq0, q_new, dq_new, q_old, ddq_mid;
+
+	// Default factorization of factorize_augmented_system(), made on first
+	// use:
+	Eigen::SparseMatrix<double> jacob_A_;
+	std::vector<int> jacob_A_Phi_q_idxs_;
+	Eigen::SparseQR<Eigen::SparseMatrix<double>, Eigen::COLAMDOrdering<int>>
+		jacob_qr_;
 
    protected:
 	bool init_;  //!< Used to indicate if user has called prepare()
@@ -221,11 +354,41 @@ class CDynamicSimulatorIndepBase : public CDynamicSimulatorBase
 	 */
 	double run(const double t_ini, const double t_end) override;
 
+	/** Called by integrate_step() with the increment of the independent
+	 * velocities dz of a time step, before applying it. It may modify it,
+	 * e.g. to add noise. */
+	using dz_increment_hook_t = std::function<void(Eigen::VectorXd&)>;
+
+	/** Advances the current state of the model one time step `dt` from time
+	 * `t`, with the integrator `integr` (ODE_Euler or ODE_RK4). Independent
+	 * coordinates are chosen on the first stage of the step if
+	 * can_choose_indep_coords_ is set. This is the step of run(), without
+	 * sensors nor callbacks.
+	 *  You MUST call prepare() before this method.
+	 */
+	void integrate_step(
+		double t, double dt, ODE_integrator_t integr,
+		const dz_increment_hook_t& dz_increment_hook = {});
+
 	/** Solve for the current independent accelerations
 	 *  You MUST call prepare() before this method.
 	 */
 	void solve_ddotz(double t, Eigen::VectorXd& ddot_z);
 
+	/** Jacobians of the accelerations solve_ddotz() would return for the
+	 * current state, with respect to the independent coordinates z and
+	 * their velocities dz (each one d x d), with the dependent coordinates
+	 * and velocities following z and dz so that constraints are fulfilled.
+	 * Pass nullptr for those not needed.
+	 *
+	 * They are obtained from eval_ddotq_jacobians() by the chain rule,
+	 * with the derivatives of q and dq given by the velocity transformation
+	 * matrix R (dq = R dz), so no position problem is solved.
+	 * The current state must fulfill the position and velocity constraints.
+	 */
+	void eval_ddotz_jacobians(
+		Eigen::MatrixXd* ddotz_z, Eigen::MatrixXd* ddotz_dz);
+
 	/** Performs the addition of velocities: out_dq = dq +
 	 * independent2dependent(dz) */
 	virtual void dq_plus_dz(
@@ -257,21 +420,47 @@ class CDynamicSimulatorIndepBase : public CDynamicSimulatorBase
 	// Auxiliary variables of the ODE integrators (declared here to avoid
 	// reallocating mem)
 	Eigen::VectorXd ddotz1, ddotz2, ddotz3, ddotz4;  // \ddot{z}
+	Eigen::VectorXd dotz_incr;  // \dot{z}(t+dt) - \dot{z}(t)
 };
 
+/** Per-thread copies of a simulator, made with CDynamicSimulatorBase::clone()
+ * on a CAssembledRigidModel::cloneTopology() of its model, and prepared.
+ * The simulator is not owned: it must outlive the returned object.
+ * \sa CPerThreadCopies */
+std::shared_ptr<CPerThreadCopies<CDynamicSimulatorBase>> makePerThreadCopies(
+	CDynamicSimulatorBase* simul);
+
+/** \overload */
+std::shared_ptr<CPerThreadCopies<CDynamicSimulatorIndepBase>>
+	makePerThreadCopies(CDynamicSimulatorIndepBase* simul);
+
 class CDynamicSimulator_Lagrange_LU_dense : public CDynamicSimulatorBase
 {
    public:
 	CDynamicSimulator_Lagrange_LU_dense(
 		const std::shared_ptr<CAssembledRigidModel> arm_ptr);
 
+	CDynamicSimulatorBase::Ptr clone(
+		const std::shared_ptr<CAssembledRigidModel>& arm) const override;
+
    private:
 	void internal_prepare() override;
 	void internal_solve_ddotq(
 		double t, Eigen::VectorXd& ddot_q,
 		Eigen::VectorXd* lagrangre = nullptr) override;
+	void factorize_augmented_system() override;
+	void solve_augmented_system(Eigen::MatrixXd& B) override;
+
+	/** Copies the current Phi_q_ into both blocks of A_ */
+	void update_A_Phi_q();
 
-	Eigen::MatrixXd mass_;  //!< The MBS constant mass matrix
+	/** The MBS constant mass matrix, see CMassMatrixCache */
+	const Eigen::MatrixXd* mass_ = nullptr;
+
+	// Workspaces, sized in internal_prepare():
+	Eigen::MatrixXd A_;  //!< Augmented matrix
+	Eigen::VectorXd RHS_, solution_;
+	Eigen::PartialPivLU<Eigen::MatrixXd> lu_;
 };
 
 class CDynamicSimulator_R_matrix_dense : public CDynamicSimulatorBase
@@ -280,13 +469,23 @@ class CDynamicSimulator_R_matrix_dense : public CDynamicSimulatorBase
 	CDynamicSimulator_R_matrix_dense(
 		const std::shared_ptr<CAssembledRigidModel> arm_ptr);
 
+	CDynamicSimulatorBase::Ptr clone(
+		const std::shared_ptr<CAssembledRigidModel>& arm) const override;
+
    private:
 	void internal_prepare() override;
 	void internal_solve_ddotq(
 		double t, Eigen::VectorXd& ddot_q,
 		Eigen::VectorXd* lagrangre = nullptr) override;
 
-	Eigen::MatrixXd mass_;  //!< The MBS constant mass matrix
+	/** The MBS constant mass matrix, see CMassMatrixCache */
+	const Eigen::MatrixXd* mass_ = nullptr;
+
+	// Workspaces, sized in internal_prepare():
+	Eigen::MatrixXd Phiq_, K_, R_, A_;
+	Eigen::VectorXd Q_, RHS_;
+	Eigen::FullPivLU<Eigen::MatrixXd> lu_Phiq_;
+	Eigen::PartialPivLU<Eigen::MatrixXd> lu_A_;
 };
 
 /** R matrix projection method (as in section 5.2.3 of "J. García De Jalon &
@@ -297,6 +496,9 @@ class CDynamicSimulator_Indep_dense : public CDynamicSimulatorIndepBase
 	CDynamicSimulator_Indep_dense(
 		const std::shared_ptr<CAssembledRigidModel> arm_ptr);
 
+	CDynamicSimulatorBase::Ptr clone(
+		const std::shared_ptr<CAssembledRigidModel>& arm) const override;
+
 	void dq_plus_dz(
 		const Eigen::VectorXd& dq, const Eigen::VectorXd& dz,
 		Eigen::VectorXd& out_dq) const override;
@@ -321,17 +523,105 @@ class CDynamicSimulator_Indep_dense : public CDynamicSimulatorIndepBase
 	void internal_prepare() override;
 	void internal_solve_ddotz(double t, Eigen::VectorXd& ddot_z) override;
 
-	Eigen::MatrixXd mass_;  //!< The MBS constant mass matrix
+	/** The MBS constant mass matrix, see CMassMatrixCache */
+	const Eigen::MatrixXd* mass_ = nullptr;
 	/** The indices in "q" of those coordinates to be used as "independent" (z)
 	 */
 	std::vector<size_t> indep_idxs_;
 };
 
+/** Sparse version of CDynamicSimulator_Indep_dense: the same R matrix
+ * projection, but never forming the inverse of [Phi_q; B].
+ *
+ * The dependent part of each column of R, -Phi_d^{-1} Phi_z e_k, and that of
+ * S c, Phi_d^{-1} c, are solved with the factorization of the Jacobian
+ * columns of the dependent coordinates kept by the model (see
+ * CAssembledRigidModel::coordinatePartition()), which is reused between
+ * calls while Phi_q does not change much. R is stored as a sparse matrix, and
+ * R^t M R, with the sparse mass matrix, is factorized with a sparse Cholesky
+ * decomposition. Independent coordinates are chosen (if enabled) from the
+ * column pivoting of a sparse QR decomposition of Phi_q.
+ */
+class CDynamicSimulator_Indep_sparse : public CDynamicSimulatorIndepBase
+{
+   public:
+	CDynamicSimulator_Indep_sparse(
+		const std::shared_ptr<CAssembledRigidModel> arm_ptr);
+
+	CDynamicSimulatorBase::Ptr clone(
+		const std::shared_ptr<CAssembledRigidModel>& arm) const override;
+
+	void dq_plus_dz(
+		const Eigen::VectorXd& dq, const Eigen::VectorXd& dz,
+		Eigen::VectorXd& out_dq) const override;
+	/** Compute dependent velocities and positions from the independent ones */
+	void correct_dependent_q_dq() override;
+
+	// See base class docs
+	const std::vector<size_t>& independent_coordinate_indices() const override
+	{
+		return indep_idxs_;
+	}
+	/** Manual selection of independent coordinates. Calling this method also
+	 * sets can_choose_indep_coords_=false */
+	void independent_coordinate_indices(
+		const std::vector<size_t>& idxs) override
+	{
+		indep_idxs_ = idxs;
+		can_choose_indep_coords_ = false;
+	}
+
+   private:
+	using sparse_t = Eigen::SparseMatrix<double>;
+
+	void internal_prepare() override;
+	void internal_solve_ddotz(double t, Eigen::VectorXd& ddot_z) override;
+
+	/** Sets indep_idxs_ from the rank-revealing sparse QR of Phi_q */
+	void choose_indep_coords();
+
+	/** The MBS constant mass matrix, see CMassMatrixCache */
+	const sparse_t* mass_ = nullptr;
+	/** The indices in "q" of those coordinates to be used as "independent" (z)
+	 */
+	std::vector<size_t> indep_idxs_;
+
+	/** For choose_indep_coords(): Phi_q in CCS form, and its QR, whose
+	 * symbolic analysis is done only once */
+	sparse_t Phiq_;
+	Eigen::SparseQR<sparse_t, Eigen::COLAMDOrdering<int>> qr_Phiq_;
+	bool qr_Phiq_analyzed_ = false;
+
+	/** Builds the pattern of R_ for the current indep_idxs_ (and their
+	 * complement `dep`), and the symbolic analysis of R^t M R */
+	void prepare_R_pattern(const std::vector<size_t>& dep);
+
+	/** R = [I; -Phi_d^{-1} Phi_z] (rows in the order of q), with all the
+	 * dependent rows in its pattern, so it only changes with indep_idxs_,
+	 * saved in R_indep_ */
+	sparse_t R_;
+	std::vector<size_t> R_indep_;
+	bool R_prepared_ = false;
+	/** Per column of Phi_z: (row, slot in the model Phi_q_) of its entries */
+	std::vector<std::vector<std::pair<size_t, size_t>>> Phi_z_entries_;
+	/** Slot in R_ of dep[i] in column k, at [k * dep.size() + i] */
+	std::vector<int> R_dep_slots_;
+
+	sparse_t MR_, RtMR_;  //!< M R and R^t M R
+	Eigen::SimplicialLLT<sparse_t> llt_RtMR_;
+
+	/** Workspaces of internal_solve_ddotz() */
+	Eigen::VectorXd rhs_, x_, Q_, c_, Sc_;
+};
+
 class CDynamicSimulator_Lagrange_CHOLMOD : public CDynamicSimulatorBase
 {
    public:
 	CDynamicSimulator_Lagrange_CHOLMOD(
 		const std::shared_ptr<CAssembledRigidModel> arm_ptr);
+
+	CDynamicSimulatorBase::Ptr clone(
+		const std::shared_ptr<CAssembledRigidModel>& arm) const override;
 	virtual ~CDynamicSimulator_Lagrange_CHOLMOD();
 
 	TOrderingMethods ordering_M;  //!< The ordering algorithm for factorizing M
@@ -345,14 +635,12 @@ class CDynamicSimulator_Lagrange_CHOLMOD : public CDynamicSimulatorBase
 		Eigen::VectorXd* lagrangre = nullptr) override;
 
 	cholmod_common cholmod_common_;
-	cholmod_triplet* mass_tri_;
-	cholmod_sparse* mass_;
-	cholmod_factor* Lm_;  //!< Mass = Lm * Lm'
+	/** Mass = Lm * Lm'. Owned by the model CMassMatrixCache */
+	cholmod_factor* Lm_;
 	cholmod_factor* Lt_;  //!< E*E' = Lt*Lt'
-	cholmod_triplet* Phi_q_t_tri_;
-	std::vector<double*>
-		ptrs_Phi_q_t_tri_;  //!< Pointers to elements in Phi_q_t_tri_ in the
-							//!< same order than in the sparse Jacobian.
+	/** Phi_q^t in CCS, i.e. the layout of Phi_q_ in CSR. The values of the
+	 * model Phi_q_ are bound to it, so it is always up to date. */
+	cholmod_sparse* Phi_q_t_;
 	cholmod_dense *Q_, *c_, *z_;  //!< RHS & auxiliary vectors
 };
 
@@ -361,6 +649,9 @@ class CDynamicSimulator_Lagrange_UMFPACK : public CDynamicSimulatorBase
    public:
 	CDynamicSimulator_Lagrange_UMFPACK(
 		const std::shared_ptr<CAssembledRigidModel> arm_ptr);
+
+	CDynamicSimulatorBase::Ptr clone(
+		const std::shared_ptr<CAssembledRigidModel>& arm) const override;
 	virtual ~CDynamicSimulator_Lagrange_UMFPACK();
 
 	TOrderingMethods ordering;
@@ -370,13 +661,14 @@ class CDynamicSimulator_Lagrange_UMFPACK : public CDynamicSimulatorBase
 	void internal_solve_ddotq(
 		double t, Eigen::VectorXd& ddot_q,
 		Eigen::VectorXd* lagrangre = nullptr) override;
+	void factorize_augmented_system() override;
+	void solve_augmented_system(Eigen::MatrixXd& B) override;
 
-	std::vector<Eigen::Triplet<double>> mass_tri_;
-	std::vector<Eigen::Triplet<double>>
-		A_tri_;  //!< Augmented matrix (triplet form)
-	std::vector<double*> A_tri_ptrs_Phi_q_;  //!< Placeholders for the non-zero
-											 //!< entries of the Jacobian.
 	Eigen::SparseMatrix<double> A_;  //!< Augmented matrix (CCS)
+	/** Indices in A_ of the Phi_q block entries \sa build_augmented_CCS */
+	std::vector<int> A_Phi_q_idxs_;
+
+	Eigen::VectorXd RHS_, solution_;  //!< Workspaces, sized in prepare()
 
 	void* numeric_;
 	void* symbolic_;
@@ -390,26 +682,33 @@ class CDynamicSimulator_Lagrange_KLU : public CDynamicSimulatorBase
    public:
 	CDynamicSimulator_Lagrange_KLU(
 		const std::shared_ptr<CAssembledRigidModel> arm_ptr);
+
+	CDynamicSimulatorBase::Ptr clone(
+		const std::shared_ptr<CAssembledRigidModel>& arm) const override;
 	virtual ~CDynamicSimulator_Lagrange_KLU();
 
 	TOrderingMethods ordering;
+	TKLUParams params_klu;
 
    private:
 	void internal_prepare() override;
 	void internal_solve_ddotq(
 		double t, Eigen::VectorXd& ddot_q,
 		Eigen::VectorXd* lagrangre = nullptr) override;
+	void factorize_augmented_system() override;
+	void solve_augmented_system(Eigen::MatrixXd& B) override;
 
-	std::vector<Eigen::Triplet<double>> mass_tri_;
-	std::vector<Eigen::Triplet<double>>
-		A_tri_;  //!< Augmented matrix (triplet form)
-	std::vector<double*> A_tri_ptrs_Phi_q_;  //!< Placeholders for the non-zero
-											 //!< entries of the Jacobian.
 	Eigen::SparseMatrix<double> A_;  //!< Augmented matrix (CCS)
+	/** Indices in A_ of the Phi_q block entries \sa build_augmented_CCS */
+	std::vector<int> A_Phi_q_idxs_;
+
+	/** RHS on input to KLU, solution on output. Sized in prepare() */
+	Eigen::VectorXd RHS_;
 
 	klu_common common_;
 	klu_numeric* numeric_;
 	klu_symbolic* symbolic_;
+	std::array<double, 2> numeric_rgrowth_rcond_{{0, 0}};
 };
 
 class CDynamicSimulatorBasePenalty : public CDynamicSimulatorBase
@@ -433,6 +732,11 @@ class CDynamicSimulatorBasePenalty : public CDynamicSimulatorBase
 	{
 	}
 	virtual ~CDynamicSimulatorBasePenalty() {}
+
+   protected:
+	/** Penalty formulations only approximate the accelerations of the
+	 * augmented system, so eval_ddotq_jacobians() would not match them */
+	void factorize_augmented_system() override;
 };
 
 class CDynamicSimulator_AugmentedLagrangian_KLU
@@ -441,9 +745,13 @@ class CDynamicSimulator_AugmentedLagrangian_KLU
    public:
 	CDynamicSimulator_AugmentedLagrangian_KLU(
 		const std::shared_ptr<CAssembledRigidModel> arm_ptr);
+
+	CDynamicSimulatorBase::Ptr clone(
+		const std::shared_ptr<CAssembledRigidModel>& arm) const override;
 	virtual ~CDynamicSimulator_AugmentedLagrangian_KLU();
 
 	TOrderingMethods ordering;
+	TKLUParams params_klu;
 
 	const Eigen::SparseMatrix<double>& getA() const { return A_; }
 
@@ -453,24 +761,39 @@ class CDynamicSimulator_AugmentedLagrangian_KLU
 		double t, Eigen::VectorXd& ddot_q,
 		Eigen::VectorXd* lagrangre = nullptr) override;
 
-	struct TSparseDotProduct
+	/** Precomputed plan to evaluate Phi_q^t * Phi_q into A_, with one entry
+	 * `e` per structural non-zero (i,j), j>=i, of the product. Its value is
+	 * the sum of Phi_q[r,i]*Phi_q[r,j] for the pairs of Phi_q slots in
+	 * `terms[term_ptr[e]:term_ptr[e+1]]`, and goes to the slots `A_ij[e]`
+	 * and, off the diagonal, `A_ji[e]` of A_.valuePtr().
+	 */
+	struct TPhiqtPhiPlan
 	{
-		std::vector<std::pair<const double*, const double*>> lst_terms;
-		double *out_ptr1,
-			*out_ptr2;  //!< Store the result of the dot product in these
-						//!< pointers, if they are not nullptr.
+		std::vector<int> term_ptr;
+		std::vector<std::pair<int, int>> terms;
+		std::vector<int> A_ij, A_ji;  //!< A_ji is -1 for diagonal entries
 	};
 
-	std::vector<Eigen::Triplet<double>> A_tri_,
-		M_tri_;  //!< Augmented matrix (triplet form)
-	std::vector<TSparseDotProduct>
-		PhiqtPhi_;  //!< Quick list of operations needed to update the product
-					//!< Phi_q^t * Phi_q and store it into A_tri_.
-	Eigen::SparseMatrix<double> A_, M_;  //!< Augmented matrix (CCS)
+	TPhiqtPhiPlan PhiqtPhi_;
+	Eigen::SparseMatrix<double> A_;  //!< Augmented matrix (CCS)
+	/** Values of A_ with only the (constant) mass matrix entries */
+	std::vector<double> A_mass_values_;
+
+	/** The MBS constant mass matrix and its factorization, see
+	 * CMassMatrixCache */
+	const Eigen::SparseMatrix<double>* M_ = nullptr;
+	const Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>>* M_ldlt_ =
+		nullptr;
+
+	Eigen::VectorXd M_ldlt_invD_;  //!< Inverse of M_ldlt_->vectorD()
+
+	// Workspaces, sized in prepare():
+	Eigen::VectorXd Q_, b_, RHS2_, ddotq_prev_, ddotq_next_, ldlt_tmp_;
 
 	klu_common common_;
-	klu_numeric *numeric_ = nullptr, *numeric_M_ = nullptr;
-	klu_symbolic *symbolic_ = nullptr, *symbolic_M_ = nullptr;
+	klu_numeric* numeric_ = nullptr;
+	klu_symbolic* symbolic_ = nullptr;
+	std::array<double, 2> numeric_rgrowth_rcond_{{0, 0}};
 };
 
 class CDynamicSimulator_AugmentedLagrangian_Dense
@@ -479,6 +802,9 @@ class CDynamicSimulator_AugmentedLagrangian_Dense
    public:
 	CDynamicSimulator_AugmentedLagrangian_Dense(
 		const std::shared_ptr<CAssembledRigidModel> arm_ptr);
+
+	CDynamicSimulatorBase::Ptr clone(
+		const std::shared_ptr<CAssembledRigidModel>& arm) const override;
 	virtual ~CDynamicSimulator_AugmentedLagrangian_Dense();
 
 	/** Integrators will call this after each time step */
@@ -490,12 +816,17 @@ class CDynamicSimulator_AugmentedLagrangian_Dense
 		double t, Eigen::VectorXd& ddot_q,
 		Eigen::VectorXd* lagrangre = nullptr) override;
 
-	Eigen::MatrixXd M_;  //!< The MBS constant mass matrix
-	Eigen::LDLT<Eigen::MatrixXd> M_ldlt_;
+	/** The MBS constant mass matrix, see CMassMatrixCache */
+	const Eigen::MatrixXd* M_ = nullptr;
+	const Eigen::LDLT<Eigen::MatrixXd>* M_ldlt_ = nullptr;
 
 	// Data updated during solve(), then reused during post_iteration():
 	Eigen::MatrixXd A_, Phi_q_, dotPhi_q_;
-	Eigen::FullPivLU<Eigen::MatrixXd> A_lu_;
+	/** Cholesky factorization of A, which is SPD (M + alpha*Phi_q^t*Phi_q) */
+	Eigen::LLT<Eigen::MatrixXd> A_llt_;
+
+	// Workspaces, sized in prepare():
+	Eigen::VectorXd Q_, b_, RHS_, RHS2_, ddotq_prev_, ddotq_next_;
 };
 
 /** Dense solver with the index-3 Augmented Lagrange formulation (ALF) with
@@ -505,6 +836,9 @@ class CDynamicSimulator_ALi3_Dense : public CDynamicSimulatorBasePenalty
    public:
 	CDynamicSimulator_ALi3_Dense(
 		const std::shared_ptr<CAssembledRigidModel> arm_ptr);
+
+	CDynamicSimulatorBase::Ptr clone(
+		const std::shared_ptr<CAssembledRigidModel>& arm) const override;
 	virtual ~CDynamicSimulator_ALi3_Dense();
 
 	/** Integrators will call this after each time step */
@@ -523,14 +857,61 @@ class CDynamicSimulator_ALi3_Dense : public CDynamicSimulatorBasePenalty
 	bool internal_integrate(
 		double t, double dt, const ODE_integrator_t integr) override;
 
-	Eigen::MatrixXd M_;  //!< The MBS constant mass matrix
-	Eigen::LDLT<Eigen::MatrixXd> M_ldlt_;
+	/** The MBS constant mass matrix, see CMassMatrixCache */
+	const Eigen::MatrixXd* M_ = nullptr;
+	const Eigen::LDLT<Eigen::MatrixXd>* M_ldlt_ = nullptr;
 
 	// Data updated during solve(), then reused during post_iteration():
 	Eigen::MatrixXd A_, Phi_q_, dotPhi_q_;
-	Eigen::FullPivLU<Eigen::MatrixXd> A_lu_;
+	/** Cholesky factorization of A, which is SPD (M + alpha*Phi_q^t*Phi_q) */
+	Eigen::LLT<Eigen::MatrixXd> A_llt_;
 
 	Eigen::VectorXd Lambda_;
+
+	// Workspaces, sized in prepare():
+	Eigen::VectorXd Q_, b_, RHS_, qp_g_, qpp_g_, Aq_, tmp_;
+};
+
+/** Lagrange formulation for all the states of a CAssembledRigidModelBatch,
+ * solved with KLU. The augmented matrix has the same pattern for all states,
+ * so its symbolic analysis is done once in prepare() and shared, and each
+ * state only costs a numeric refactorization (see TKLUParams).
+ */
+class CDynamicSimulatorBatch_Lagrange_KLU
+{
+   public:
+	CDynamicSimulatorBatch_Lagrange_KLU(
+		const std::shared_ptr<CAssembledRigidModelBatch> batch_ptr);
+	~CDynamicSimulatorBatch_Lagrange_KLU();
+
+	TOrderingMethods ordering;
+	TKLUParams params_klu;
+
+	/** Must be called once before solve_ddotq() */
+	void prepare();
+
+	/** Updates the constraints and Jacobians of all states and solves their
+	 * accelerations (and Lagrange multipliers, if `lagrangre` is not null),
+	 * one column per state. */
+	void solve_ddotq(
+		Eigen::MatrixXd& ddot_q, Eigen::MatrixXd* lagrangre = nullptr);
+
+   private:
+	std::shared_ptr<CAssembledRigidModelBatch> batch_;
+
+	Eigen::VectorXd Q_;  //!< Generalized forces, equal for all states
+	Eigen::SparseMatrix<double> A_;  //!< Augmented matrix (CCS)
+	/** Indices in A_ of the Phi_q block entries
+	 * \sa build_augmented_CCS_pattern */
+	std::vector<int> A_Phi_q_idxs_;
+	Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+		c_;  //!< "c" term of the RHS of all states
+	Eigen::VectorXd RHS_;
+
+	klu_common common_;
+	klu_numeric* numeric_ = nullptr;
+	klu_symbolic* symbolic_ = nullptr;
+	std::array<double, 2> numeric_rgrowth_rcond_{{0, 0}};
 };
 
 }  // namespace mbse
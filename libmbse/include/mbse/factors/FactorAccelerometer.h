@@ -0,0 +1,91 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#pragma once
+
+#include <mbse/factors/factor-common.h>
+#include <gtsam/nonlinear/NonlinearFactor.h>
+#include <mbse/virtual-sensors.h>
+
+namespace mbse
+{
+/** Factor for an accelerometer reading, see CVirtualSensor_Accelerometer.
+ *
+ * It depends on the coordinates (the orientation of the sensor axes) and the
+ * accelerations. The sensor is evaluated from them through its gather plan,
+ * so the factor needs no copy of the model.
+ */
+class FactorAccelerometer : public gtsam::NoiseModelFactor2<state_t, state_t>
+{
+   private:
+	using This = FactorAccelerometer;
+	using Base = gtsam::NoiseModelFactor2<state_t, state_t>;
+
+	std::shared_ptr<const CVirtualSensor_Accelerometer> sensor_;
+	double reading_ = 0;
+
+   public:
+	// shorthand for a smart pointer to a factor
+	using shared_ptr = boost::shared_ptr<This>;
+
+	/** default constructor - only use for serialization */
+	FactorAccelerometer() = default;
+	virtual ~FactorAccelerometer() override = default;
+
+	/** Constructor. acc_reading in m/s^2. */
+	FactorAccelerometer(
+		const std::shared_ptr<const CVirtualSensor_Accelerometer>& sensor,
+		const double acc_reading, const gtsam::SharedNoiseModel& noiseModel,
+		gtsam::Key key_q_k, gtsam::Key key_ddq_k)
+		: Base(noiseModel, key_q_k, key_ddq_k),
+		  sensor_(sensor),
+		  reading_(acc_reading)
+	{
+	}
+
+	/// @return a deep copy of this factor
+	virtual gtsam::NonlinearFactor::shared_ptr clone() const override;
+
+	/** implement functions needed for Testable */
+
+	/** print */
+	virtual void print(
+		const std::string& s, const gtsam::KeyFormatter& keyFormatter =
+								  gtsam::DefaultKeyFormatter) const override;
+
+	/** equals */
+	virtual bool equals(
+		const gtsam::NonlinearFactor& expected,
+		double tol = 1e-9) const override;
+
+	/** implement functions needed to derive from Factor */
+
+	/** vector of errors */
+	gtsam::Vector evaluateError(
+		const state_t& q_k, const state_t& ddq_k,
+		boost::optional<gtsam::Matrix&> H1 = boost::none,
+		boost::optional<gtsam::Matrix&> H2 = boost::none) const override;
+
+	/** number of variables attached to this factor */
+	std::size_t size() const { return 2; }
+
+   private:
+	/** Serialization function */
+	friend class boost::serialization::access;
+	template <class ARCHIVE>
+	void serialize(ARCHIVE& ar, const unsigned int /*version*/)
+	{
+		ar& boost::serialization::make_nvp(
+			"FactorAccelerometer",
+			boost::serialization::base_object<Base>(*this));
+	}
+};
+
+}  // namespace mbse
@@ -0,0 +1,116 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#pragma once
+
+#include <mbse/factors/state-blocks.h>
+#include <gtsam/nonlinear/NonlinearFactor.h>
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <mbse/CAssembledRigidModel.h>
+
+namespace mbse
+{
+/** Factor for the rows Phi_i(q)=0 of one single constraint, for states
+ * split into blocks with StateBlockLayout. Its variables are only the blocks
+ * of the points involved in the constraint, and evaluating it only updates
+ * that constraint.
+ *
+ * Together, the factors of all constraints are equivalent to one
+ * FactorConstraints with a diagonal noise model.
+ * \sa addFactorConstraintBlocks
+ */
+class FactorConstraintBlocks : public gtsam::NoiseModelFactor
+{
+   private:
+	using This = FactorConstraintBlocks;
+	using Base = gtsam::NoiseModelFactor;
+
+	CAssembledRigidModel::Ptr arm_;
+	/** Copies of arm_ used from other threads than the creator one */
+	std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>> arms_;
+	StateBlockLayout::Ptr layout_;
+	size_t constraint_index_ = 0;
+
+	/** The blocks of each key, in the same order than keys() */
+	std::vector<size_t> blocks_;
+
+	/** Each non-zero entry of the rows of this constraint in Phi_q */
+	struct JacobEntry
+	{
+		size_t row;  //!< Row in the error vector
+		size_t var;  //!< Index of the key in keys()
+		size_t pos;  //!< Position in that block
+		size_t slot;  //!< Index in Phi_q_.valuePtr()
+	};
+	std::vector<JacobEntry> entries_;
+
+   public:
+	// shorthand for a smart pointer to a factor
+	using shared_ptr = boost::shared_ptr<This>;
+
+	/** default constructor - only use for serialization */
+	FactorConstraintBlocks() = default;
+
+	/** Constructor for constraint `arm->constraints_[constraint_index]`, at
+	 * the blocks of the state `c` at time step `t` (see
+	 * StateBlockLayout::key()). Factors of the same model may share their
+	 * per-thread copies `arms` of it (one is created if empty). */
+	FactorConstraintBlocks(
+		const CAssembledRigidModel::Ptr& arm,
+		const StateBlockLayout::Ptr& layout, size_t constraint_index,
+		const gtsam::SharedNoiseModel& noiseModel, unsigned char c, size_t t,
+		const std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>>& arms =
+			nullptr);
+
+	virtual ~FactorConstraintBlocks() override;
+
+	// @return a deep copy of this factor
+	virtual gtsam::NonlinearFactor::shared_ptr clone() const override;
+	/** implement functions needed for Testable */
+	/** print */
+	virtual void print(
+		const std::string& s, const gtsam::KeyFormatter& keyFormatter =
+								  gtsam::DefaultKeyFormatter) const override;
+
+	/** equals */
+	virtual bool equals(
+		const gtsam::NonlinearFactor& expected,
+		double tol = 1e-9) const override;
+
+	/** implement functions needed to derive from Factor */
+	/** vector of errors */
+	gtsam::Vector unwhitenedError(
+		const gtsam::Values& x,
+		boost::optional<std::vector<gtsam::Matrix>&> H =
+			boost::none) const override;
+
+	size_t constraintIndex() const { return constraint_index_; }
+
+   private:
+	/** Serialization function */
+	friend class boost::serialization::access;
+	template <class ARCHIVE>
+	void serialize(ARCHIVE& ar, const unsigned int /*version*/)
+	{
+		ar& boost::serialization::make_nvp(
+			"FactorConstraintBlocks",
+			boost::serialization::base_object<Base>(*this));
+	}
+};
+
+/** Adds one FactorConstraintBlocks for each constraint in `arm`, for the
+ * state `c` at time step `t`, with isotropic noise `sigma`. All of them share
+ * the same per-thread copies of `arm`. */
+void addFactorConstraintBlocks(
+	gtsam::NonlinearFactorGraph& graph, const CAssembledRigidModel::Ptr& arm,
+	const StateBlockLayout::Ptr& layout, double sigma, unsigned char c,
+	size_t t);
+
+}  // namespace mbse
@@ -26,6 +26,8 @@ class FactorConstraints : public gtsam::NoiseModelFactor1<state_t>
 
 	// Class parameters (pointer to type "CConstraintBase")
 	CAssembledRigidModel::Ptr arm_;
+	/** Copies of arm_ used from other threads than the creator one */
+	std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>> arms_;
 
    public:
 	// shorthand for a smart pointer to a factor
@@ -34,12 +36,19 @@ class FactorConstraints : public gtsam::NoiseModelFactor1<state_t>
 	/** default constructor - only use for serialization */
 	FactorConstraints() = default;
 
-	/** Construcotr */
+	/** Constructor. Factors of the same model should share their per-thread
+	 * copies `arms` of it (see makePerThreadCopies()). One is created if
+	 * empty. */
 	FactorConstraints(
 		const CAssembledRigidModel::Ptr& arm,
-		const gtsam::SharedNoiseModel& noiseModel, gtsam::Key key_q_k)
-		: Base(noiseModel, key_q_k), arm_(arm)
+		const gtsam::SharedNoiseModel& noiseModel, gtsam::Key key_q_k,
+		const std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>>& arms =
+			nullptr)
+		: Base(noiseModel, key_q_k),
+		  arm_(arm),
+		  arms_(arms ? arms : makePerThreadCopies(arm))
 	{
+		ASSERT_(arms_->prototype() == arm_);
 	}
 
 	virtual ~FactorConstraints() override;
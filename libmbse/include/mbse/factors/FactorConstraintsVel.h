@@ -28,6 +28,8 @@ class FactorConstraintsVel : public gtsam::NoiseModelFactor2<state_t, state_t>
 
 	// Class parameters (pointer to type "CConstraintBase")
 	CAssembledRigidModel::Ptr arm_;
+	/** Copies of arm_ used from other threads than the creator one */
+	std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>> arms_;
 
    public:
 	// shorthand for a smart pointer to a factor
@@ -36,13 +38,20 @@ class FactorConstraintsVel : public gtsam::NoiseModelFactor2<state_t, state_t>
 	/** default constructor - only use for serialization */
 	FactorConstraintsVel() = default;
 
-	/** Construcotr */
+	/** Constructor. Factors of the same model should share their per-thread
+	 * copies `arms` of it (see makePerThreadCopies()). One is created if
+	 * empty. */
 	FactorConstraintsVel(
 		const CAssembledRigidModel::Ptr& arm,
 		const gtsam::SharedNoiseModel& noiseModel, gtsam::Key key_q_k,
-		gtsam::Key key_dotq_k)
-		: Base(noiseModel, key_q_k, key_dotq_k), arm_(arm)
+		gtsam::Key key_dotq_k,
+		const std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>>& arms =
+			nullptr)
+		: Base(noiseModel, key_q_k, key_dotq_k),
+		  arm_(arm),
+		  arms_(arms ? arms : makePerThreadCopies(arm))
 	{
+		ASSERT_(arms_->prototype() == arm_);
 	}
 
 	virtual ~FactorConstraintsVel() override;
@@ -31,8 +31,9 @@ class FactorConstraintsVelIndep
 
 	// Class parameters (pointer to type "CConstraintBase")
 	CAssembledRigidModel::Ptr arm_;
+	/** Copies of arm_ used from other threads than the creator one */
+	std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>> arms_;
 	std::vector<size_t> indCoordsIndices_;
-	gtsam::Matrix matrix_Iidx_;
 
    public:
 	// shorthand for a smart pointer to a factor
@@ -41,12 +42,16 @@ class FactorConstraintsVelIndep
 	/** default constructor - only use for serialization */
 	FactorConstraintsVelIndep() = default;
 
-	/** Construcotr */
+	/** Constructor. Factors of the same model should share their per-thread
+	 * copies `arms` of it (see makePerThreadCopies()). One is created if
+	 * empty. */
 	FactorConstraintsVelIndep(
 		const CAssembledRigidModel::Ptr& arm,
 		const std::vector<size_t>& indCoordsIndices,
 		const gtsam::SharedNoiseModel& noiseModel, gtsam::Key key_q_k,
-		gtsam::Key key_dotq_k, gtsam::Key key_dotz_k);
+		gtsam::Key key_dotq_k, gtsam::Key key_dotz_k,
+		const std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>>& arms =
+			nullptr);
 
 	virtual ~FactorConstraintsVelIndep() override;
 
@@ -25,6 +25,9 @@ namespace mbse
  * Unknowns: \f$ q_k, \dot{q}_k, \ddot{q}_k \f$
  *
  * Fixed data: multibody model (inertias, masses, etc.), external forces.
+ *
+ * Jacobians come from CDynamicSimulatorBase::eval_ddotq_jacobians(), so the
+ * solver cannot be a penalty formulation.
  */
 class FactorDynamics
 	: public gtsam::NoiseModelFactor3<
@@ -35,6 +38,9 @@ class FactorDynamics
 	using Base = gtsam::NoiseModelFactor3<state_t, state_t, state_t>;
 
 	CDynamicSimulatorBase* dynamic_solver_ = nullptr;
+	/** Copies of dynamic_solver_ used from other threads than the creator
+	 * one */
+	std::shared_ptr<CPerThreadCopies<CDynamicSimulatorBase>> solvers_;
 
    public:
 	// shorthand for a smart pointer to a factor
@@ -43,14 +49,20 @@ class FactorDynamics
 	/** default constructor - only use for serialization */
 	FactorDynamics() = default;
 
-	/** Constructor */
+	/** Constructor. Factors of the same simulator should share their
+	 * per-thread copies `solvers` of it (see makePerThreadCopies()), so each
+	 * thread clones it once for the whole graph. One is created if empty. */
 	FactorDynamics(
 		CDynamicSimulatorBase* dynamic_solver,
 		const gtsam::SharedNoiseModel& noiseModel, gtsam::Key key_q_k,
-		gtsam::Key key_dq_k, gtsam::Key key_ddq_k)
+		gtsam::Key key_dq_k, gtsam::Key key_ddq_k,
+		const std::shared_ptr<CPerThreadCopies<CDynamicSimulatorBase>>&
+			solvers = nullptr)
 		: Base(noiseModel, key_q_k, key_dq_k, key_ddq_k),
-		  dynamic_solver_(dynamic_solver)
+		  dynamic_solver_(dynamic_solver),
+		  solvers_(solvers ? solvers : makePerThreadCopies(dynamic_solver))
 	{
+		ASSERT_(solvers_->prototype().get() == dynamic_solver);
 	}
 
 	virtual ~FactorDynamics() override;
@@ -39,6 +39,9 @@ class FactorDynamicsIndep
 	using Base = gtsam::NoiseModelFactor3<state_t, state_t, state_t>;
 
 	CDynamicSimulatorIndepBase* dynamic_solver_ = nullptr;
+	/** Copies of dynamic_solver_ used from other threads than the creator
+	 * one */
+	std::shared_ptr<CPerThreadCopies<CDynamicSimulatorIndepBase>> solvers_;
 	gtsam::Key key_q_k_;
 	const gtsam::Values* valuesForQk_ = nullptr;
 
@@ -49,18 +52,24 @@ class FactorDynamicsIndep
 	/** default constructor - only use for serialization */
 	FactorDynamicsIndep() = default;
 
-	/** Constructor */
+	/** Constructor. Factors of the same simulator should share their
+	 * per-thread copies `solvers` of it (see makePerThreadCopies()). One is
+	 * created if empty. */
 	FactorDynamicsIndep(
 		CDynamicSimulatorIndepBase* dynamic_solver,
 		const gtsam::SharedNoiseModel& noiseModel, gtsam::Key key_z_k,
 		gtsam::Key key_dz_k, gtsam::Key key_ddz_k, gtsam::Key key_q_k,
-		const gtsam::Values& valuesForQk)
+		const gtsam::Values& valuesForQk,
+		const std::shared_ptr<CPerThreadCopies<CDynamicSimulatorIndepBase>>&
+			solvers = nullptr)
 		: Base(noiseModel, key_z_k, key_dz_k, key_ddz_k),
 		  dynamic_solver_(dynamic_solver),
+		  solvers_(solvers ? solvers : makePerThreadCopies(dynamic_solver)),
 		  key_q_k_(key_q_k),
 		  valuesForQk_(&valuesForQk)
 	{
 		MRPT_START
+		ASSERT_(solvers_->prototype().get() == dynamic_solver);
 		ASSERTMSG_(
 			!dynamic_solver->can_choose_indep_coords_,
 			"Passed `dynamic_solver` must be configured NOT to dynamically "
@@ -0,0 +1,86 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#pragma once
+
+#include <mbse/factors/factor-common.h>
+#include <gtsam/nonlinear/NonlinearFactor.h>
+#include <mbse/virtual-sensors.h>
+
+namespace mbse
+{
+/** Factor for an angle encoder reading, see CVirtualSensor_Encoder.
+ *
+ * The error is wrapped to [-pi, pi]. The sensor is evaluated from q through
+ * its gather plan, so the factor needs no copy of the model.
+ */
+class FactorEncoder : public gtsam::NoiseModelFactor1<state_t>
+{
+   private:
+	using This = FactorEncoder;
+	using Base = gtsam::NoiseModelFactor1<state_t>;
+
+	std::shared_ptr<const CVirtualSensor_Encoder> sensor_;
+	double reading_ = 0;
+
+   public:
+	// shorthand for a smart pointer to a factor
+	using shared_ptr = boost::shared_ptr<This>;
+
+	/** default constructor - only use for serialization */
+	FactorEncoder() = default;
+	virtual ~FactorEncoder() override = default;
+
+	/** Constructor. angle_reading in rad, positive CCW. */
+	FactorEncoder(
+		const std::shared_ptr<const CVirtualSensor_Encoder>& sensor,
+		const double angle_reading, const gtsam::SharedNoiseModel& noiseModel,
+		gtsam::Key key_q_k)
+		: Base(noiseModel, key_q_k), sensor_(sensor), reading_(angle_reading)
+	{
+	}
+
+	/// @return a deep copy of this factor
+	virtual gtsam::NonlinearFactor::shared_ptr clone() const override;
+
+	/** implement functions needed for Testable */
+
+	/** print */
+	virtual void print(
+		const std::string& s, const gtsam::KeyFormatter& keyFormatter =
+								  gtsam::DefaultKeyFormatter) const override;
+
+	/** equals */
+	virtual bool equals(
+		const gtsam::NonlinearFactor& expected,
+		double tol = 1e-9) const override;
+
+	/** implement functions needed to derive from Factor */
+
+	/** vector of errors */
+	gtsam::Vector evaluateError(
+		const state_t& q_k,
+		boost::optional<gtsam::Matrix&> H1 = boost::none) const override;
+
+	/** number of variables attached to this factor */
+	std::size_t size() const { return 1; }
+
+   private:
+	/** Serialization function */
+	friend class boost::serialization::access;
+	template <class ARCHIVE>
+	void serialize(ARCHIVE& ar, const unsigned int /*version*/)
+	{
+		ar& boost::serialization::make_nvp(
+			"FactorEncoder", boost::serialization::base_object<Base>(*this));
+	}
+};
+
+}  // namespace mbse
@@ -28,6 +28,8 @@ class FactorGyroscope : public gtsam::NoiseModelFactor2<state_t, state_t>
 	using Base = gtsam::NoiseModelFactor2<state_t, state_t>;
 
 	CAssembledRigidModel* arm_ = nullptr;
+	/** Copies of arm_ used from other threads than the creator one */
+	std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>> arms_;
 	size_t body_idx_ = 0;
 	double reading_ = 0;
 
@@ -39,13 +41,17 @@ class FactorGyroscope : public gtsam::NoiseModelFactor2<state_t, state_t>
 	FactorGyroscope() = default;
 	virtual ~FactorGyroscope() override = default;
 
-	/** Constructor. angvel_reading in rad/sec, positive CCW. */
+	/** Constructor. angvel_reading in rad/sec, positive CCW. `arms` are the
+	 * per-thread copies of the model (see makePerThreadCopies()), which
+	 * should be shared by all factors of the same model. */
 	FactorGyroscope(
-		CAssembledRigidModel& arm, const size_t body_idx,
-		const double angvel_reading, const gtsam::SharedNoiseModel& noiseModel,
-		gtsam::Key key_q_k, gtsam::Key key_dq_k)
+		const std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>>& arms,
+		const size_t body_idx, const double angvel_reading,
+		const gtsam::SharedNoiseModel& noiseModel, gtsam::Key key_q_k,
+		gtsam::Key key_dq_k)
 		: Base(noiseModel, key_q_k, key_dq_k),
-		  arm_(&arm),
+		  arm_(arms->prototype().get()),
+		  arms_(arms),
 		  body_idx_(body_idx),
 		  reading_(angvel_reading)
 	{
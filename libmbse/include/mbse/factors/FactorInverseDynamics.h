@@ -40,6 +40,9 @@ class FactorInverseDynamics : public gtsam::NoiseModelFactor4<
 	using Base = gtsam::NoiseModelFactor4<state_t, state_t, state_t, state_t>;
 
 	CDynamicSimulatorBase* dynamic_solver_ = nullptr;
+	/** Copies of dynamic_solver_ used from other threads than the creator
+	 * one */
+	std::shared_ptr<CPerThreadCopies<CDynamicSimulatorBase>> solvers_;
 
    public:
 	// shorthand for a smart pointer to a factor
@@ -48,14 +51,20 @@ class FactorInverseDynamics : public gtsam::NoiseModelFactor4<
 	/** default constructor - only use for serialization */
 	FactorInverseDynamics() = default;
 
-	/** Constructor */
+	/** Constructor. Factors of the same simulator should share their
+	 * per-thread copies `solvers` of it (see makePerThreadCopies()). One is
+	 * created if empty. */
 	FactorInverseDynamics(
 		CDynamicSimulatorBase* dynamic_solver,
 		const gtsam::SharedNoiseModel& noiseModel, gtsam::Key key_q_k,
-		gtsam::Key key_dq_k, gtsam::Key key_ddq_k, gtsam::Key key_Q_k)
+		gtsam::Key key_dq_k, gtsam::Key key_ddq_k, gtsam::Key key_Q_k,
+		const std::shared_ptr<CPerThreadCopies<CDynamicSimulatorBase>>&
+			solvers = nullptr)
 		: Base(noiseModel, key_q_k, key_dq_k, key_ddq_k, key_Q_k),
-		  dynamic_solver_(dynamic_solver)
+		  dynamic_solver_(dynamic_solver),
+		  solvers_(solvers ? solvers : makePerThreadCopies(dynamic_solver))
 	{
+		ASSERT_(solvers_->prototype().get() == dynamic_solver);
 	}
 
 	virtual ~FactorInverseDynamics() override;
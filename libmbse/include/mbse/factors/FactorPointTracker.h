@@ -0,0 +1,87 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#pragma once
+
+#include <mbse/factors/factor-common.h>
+#include <gtsam/nonlinear/NonlinearFactor.h>
+#include <mbse/virtual-sensors.h>
+
+namespace mbse
+{
+/** Factor for a point tracker reading, see CVirtualSensor_PointTracker.
+ *
+ * The sensor is evaluated from q through its gather plan, so the factor
+ * needs no copy of the model.
+ */
+class FactorPointTracker : public gtsam::NoiseModelFactor1<state_t>
+{
+   private:
+	using This = FactorPointTracker;
+	using Base = gtsam::NoiseModelFactor1<state_t>;
+
+	std::shared_ptr<const CVirtualSensor_PointTracker> sensor_;
+	double reading_ = 0;
+
+   public:
+	// shorthand for a smart pointer to a factor
+	using shared_ptr = boost::shared_ptr<This>;
+
+	/** default constructor - only use for serialization */
+	FactorPointTracker() = default;
+	virtual ~FactorPointTracker() override = default;
+
+	/** Constructor. coord_reading in meters. */
+	FactorPointTracker(
+		const std::shared_ptr<const CVirtualSensor_PointTracker>& sensor,
+		const double coord_reading, const gtsam::SharedNoiseModel& noiseModel,
+		gtsam::Key key_q_k)
+		: Base(noiseModel, key_q_k), sensor_(sensor), reading_(coord_reading)
+	{
+	}
+
+	/// @return a deep copy of this factor
+	virtual gtsam::NonlinearFactor::shared_ptr clone() const override;
+
+	/** implement functions needed for Testable */
+
+	/** print */
+	virtual void print(
+		const std::string& s, const gtsam::KeyFormatter& keyFormatter =
+								  gtsam::DefaultKeyFormatter) const override;
+
+	/** equals */
+	virtual bool equals(
+		const gtsam::NonlinearFactor& expected,
+		double tol = 1e-9) const override;
+
+	/** implement functions needed to derive from Factor */
+
+	/** vector of errors */
+	gtsam::Vector evaluateError(
+		const state_t& q_k,
+		boost::optional<gtsam::Matrix&> H1 = boost::none) const override;
+
+	/** number of variables attached to this factor */
+	std::size_t size() const { return 1; }
+
+   private:
+	/** Serialization function */
+	friend class boost::serialization::access;
+	template <class ARCHIVE>
+	void serialize(ARCHIVE& ar, const unsigned int /*version*/)
+	{
+		ar& boost::serialization::make_nvp(
+			"FactorPointTracker",
+			boost::serialization::base_object<Base>(*this));
+	}
+};
+
+}  // namespace mbse
@@ -0,0 +1,121 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#pragma once
+
+#include <mbse/factors/factor-common.h>
+#include <gtsam/nonlinear/NonlinearFactor.h>
+
+namespace mbse
+{
+/** Like FactorTrapInt, for fixed-size states of `N` coordinates
+ * (state_fixed_t<N>).
+ *
+ * This implements: \f$x_{k+1} = x_{k} + frac{dt}{2} * v_{k} + frac{dt}{2} *
+ * v_{k+1}\f$
+ */
+template <int N>
+class FactorTrapIntFixed
+	: public gtsam::NoiseModelFactor4<
+		  state_fixed_t<N>, state_fixed_t<N>, state_fixed_t<N>,
+		  state_fixed_t<N>>
+{
+   private:
+	using This = FactorTrapIntFixed<N>;
+	using value_t = state_fixed_t<N>;
+	using Base = gtsam::NoiseModelFactor4<value_t, value_t, value_t, value_t>;
+
+	/** Numerical integration timestep */
+	double timestep_ = 0;
+
+   public:
+	// shorthand for a smart pointer to a factor
+	using shared_ptr = boost::shared_ptr<This>;
+
+	/** default constructor - only use for serialization */
+	FactorTrapIntFixed() = default;
+
+	/** Constructor */
+	FactorTrapIntFixed(
+		const double timestep, const gtsam::SharedNoiseModel& noiseModel,
+		gtsam::Key key_x_k, gtsam::Key key_x_kp1, gtsam::Key key_v_k,
+		gtsam::Key key_v_kp1)
+		: Base(noiseModel, key_x_k, key_x_kp1, key_v_k, key_v_kp1),
+		  timestep_(timestep)
+	{
+	}
+
+	/// @return a deep copy of this factor
+	gtsam::NonlinearFactor::shared_ptr clone() const override
+	{
+		return boost::static_pointer_cast<gtsam::NonlinearFactor>(
+			gtsam::NonlinearFactor::shared_ptr(new This(*this)));
+	}
+
+	/** print */
+	void print(
+		const std::string& s, const gtsam::KeyFormatter& keyFormatter =
+								  gtsam::DefaultKeyFormatter) const override
+	{
+		std::cout << s << "mbde::FactorTrapIntFixed<" << N << ">("
+				  << keyFormatter(this->key1()) << ","
+				  << keyFormatter(this->key2()) << ","
+				  << keyFormatter(this->key3()) << ","
+				  << keyFormatter(this->key4()) << ")\n";
+		gtsam::traits<double>::Print(timestep_, "  timestep: ");
+		this->noiseModel_->print("  noise model: ");
+	}
+
+	/** equals */
+	bool equals(
+		const gtsam::NonlinearFactor& expected,
+		double tol = 1e-9) const override
+	{
+		const This* e = dynamic_cast<const This*>(&expected);
+		return e != nullptr && Base::equals(*e, tol) &&
+			   gtsam::traits<double>::Equals(timestep_, e->timestep_, tol);
+	}
+
+	/** vector of errors */
+	gtsam::Vector evaluateError(
+		const value_t& x_k, const value_t& x_kp1, const value_t& v_k,
+		const value_t& v_kp1, boost::optional<gtsam::Matrix&> H1 = boost::none,
+		boost::optional<gtsam::Matrix&> H2 = boost::none,
+		boost::optional<gtsam::Matrix&> H3 = boost::none,
+		boost::optional<gtsam::Matrix&> H4 = boost::none) const override
+	{
+		using I = Eigen::Matrix<double, N, N>;
+		if (H1) *H1 = -I::Identity();
+		if (H2) *H2 = I::Identity();
+		if (H3) *H3 = -0.5 * timestep_ * I::Identity();
+		if (H4) *H4 = -0.5 * timestep_ * I::Identity();
+
+		const value_t err =
+			x_kp1 - x_k - 0.5 * timestep_ * (v_k + v_kp1);
+		return err;
+	}
+
+	/** number of variables attached to this factor */
+	std::size_t size() const { return 4; }
+
+   private:
+	/** Serialization function */
+	friend class boost::serialization::access;
+	template <class ARCHIVE>
+	void serialize(ARCHIVE& ar, const unsigned int /*version*/)
+	{
+		ar& boost::serialization::make_nvp(
+			"FactorTrapIntFixed",
+			boost::serialization::base_object<Base>(*this));
+		ar& BOOST_SERIALIZATION_NVP(timestep_);
+	}
+};
+
+}  // namespace mbse
@@ -18,4 +18,10 @@ namespace mbse
 /** Type for system internal states q_{k}, dq_{k}, ddq_{k} */
 using state_t = gtsam::Vector;
 
+/** Fixed-size alternative to state_t, for mechanisms with `N` coordinates
+ * known at compile time. Its values are stored inline, without heap
+ * allocations. */
+template <int N>
+using state_fixed_t = Eigen::Matrix<double, N, 1>;
+
 }  // namespace mbse
@@ -0,0 +1,87 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#pragma once
+
+#include <mbse/factors/factor-common.h>
+#include <mbse/CAssembledRigidModel.h>
+#include <gtsam/inference/Key.h>
+#include <gtsam/nonlinear/Values.h>
+#include <memory>
+#include <vector>
+
+namespace mbse
+{
+/** Alternative layout of the GTSAM variables of a state vector (q, dq or
+ * ddq): instead of one n-vector per time step, q is split into small blocks,
+ * each one a different key:
+ *  - one block (x,y) for each non-fixed point, and
+ *  - one block for each relative coordinate.
+ *
+ * Each constraint only involves the blocks of its own points (see
+ * FactorConstraintBlocks), so the factor graph follows the topology of the
+ * mechanism and elimination can exploit it.
+ *
+ * Keys are `gtsam::Symbol(c, t * numBlocks() + b)` for the block `b` of
+ * the state at time step `t`, with `c` the symbol character of the kind of
+ * state (e.g. 'q', 'v' or 'a').
+ */
+class StateBlockLayout
+{
+   public:
+	using Ptr = std::shared_ptr<const StateBlockLayout>;
+
+	StateBlockLayout(const CAssembledRigidModel& arm);
+
+	/** Number of blocks per state */
+	size_t numBlocks() const { return blocks_.size(); }
+
+	/** Dimension of the full state vector */
+	size_t stateDimension() const { return dofBlock_.size(); }
+
+	/** Indices in q of the coordinates of block `b` */
+	const std::vector<dof_index_t>& block(size_t b) const
+	{
+		return blocks_.at(b);
+	}
+
+	/** The block of coordinate `dof` in q, and its position within it */
+	std::pair<size_t, size_t> blockOf(dof_index_t dof) const
+	{
+		return dofBlock_.at(dof);
+	}
+
+	/** The blocks involved in the rows of Phi of constraint
+	 * `arm.constraints_[constraint_index]`, sorted */
+	std::vector<size_t> constraintBlocks(
+		const CAssembledRigidModel& arm, size_t constraint_index) const;
+
+	/** Key of block `b` of the state at time step `t` */
+	gtsam::Key key(unsigned char c, size_t t, size_t b) const;
+
+	/** Keys of all the blocks of the state at time step `t` */
+	gtsam::KeyVector keys(unsigned char c, size_t t) const;
+
+	/** Inserts the blocks of state `x` as values for time step `t` */
+	void insert(
+		gtsam::Values& values, unsigned char c, size_t t,
+		const state_t& x) const;
+
+	/** Assembles the full state vector of time step `t` from its blocks */
+	state_t extract(
+		const gtsam::Values& values, unsigned char c, size_t t) const;
+
+   private:
+	std::vector<std::vector<dof_index_t>> blocks_;
+	/** For each coordinate in q: (block, position in the block) */
+	std::vector<std::pair<size_t, size_t>> dofBlock_;
+};
+
+}  // namespace mbse
@@ -0,0 +1,206 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+
+namespace mbse
+{
+/** @name Forward-mode automatic differentiation of constraints
+ * @{ */
+
+/** Scalar type to write a constraint once, as a function Phi(q) of its K
+ * local coordinates, and get all the derivatives required by
+ * CAssembledRigidModel from one evaluation (see autodiffConstraint()).
+ *
+ * It holds the truncated Taylor expansion of a function along
+ * q(t, s) = q + dq t + ddq s, in powers of t (up to t^2) and s (up to s),
+ * together with the gradient of each coefficient with respect to q. For the
+ * constraint itself, these are:
+ *  - v[0], g[0]: Phi and Phi_q
+ *  - v[1], g[1]: dotPhi = Phi_q dq, and dotPhi_q
+ *  - v[2], g[2]: half of dq' Phi_qq dq, and half of dotPhiqq_times_dq
+ *  - v[3], g[3]: Phi_q ddq, and Phiqq_times_ddq
+ *
+ * Sizes are known at compile time and each operator is one flat loop over
+ * the K gradient entries, which compilers unroll and vectorize.
+ */
+template <std::size_t K>
+struct TConstraintScalar
+{
+	std::array<double, 4> v{};  //!< Coefficients of 1, t, t^2 and s
+	std::array<std::array<double, K>, 4> g{};  //!< Their gradients
+
+	TConstraintScalar() = default;
+	/** A constant */
+	TConstraintScalar(double value) { v[0] = value; }
+
+	friend TConstraintScalar operator+(
+		const TConstraintScalar& a, const TConstraintScalar& b)
+	{
+		TConstraintScalar r;
+		for (std::size_t j = 0; j < 4; j++)
+		{
+			r.v[j] = a.v[j] + b.v[j];
+			for (std::size_t i = 0; i < K; i++)
+				r.g[j][i] = a.g[j][i] + b.g[j][i];
+		}
+		return r;
+	}
+	friend TConstraintScalar operator-(
+		const TConstraintScalar& a, const TConstraintScalar& b)
+	{
+		TConstraintScalar r;
+		for (std::size_t j = 0; j < 4; j++)
+		{
+			r.v[j] = a.v[j] - b.v[j];
+			for (std::size_t i = 0; i < K; i++)
+				r.g[j][i] = a.g[j][i] - b.g[j][i];
+		}
+		return r;
+	}
+	friend TConstraintScalar operator-(const TConstraintScalar& a)
+	{
+		return -1.0 * a;
+	}
+	friend TConstraintScalar operator*(double s, const TConstraintScalar& a)
+	{
+		TConstraintScalar r;
+		for (std::size_t j = 0; j < 4; j++)
+		{
+			r.v[j] = s * a.v[j];
+			for (std::size_t i = 0; i < K; i++) r.g[j][i] = s * a.g[j][i];
+		}
+		return r;
+	}
+	friend TConstraintScalar operator*(const TConstraintScalar& a, double s)
+	{
+		return s * a;
+	}
+	friend TConstraintScalar operator*(
+		const TConstraintScalar& a, const TConstraintScalar& b)
+	{
+		TConstraintScalar r;
+		r.v[0] = a.v[0] * b.v[0];
+		r.v[1] = a.v[0] * b.v[1] + a.v[1] * b.v[0];
+		r.v[2] = a.v[0] * b.v[2] + a.v[1] * b.v[1] + a.v[2] * b.v[0];
+		r.v[3] = a.v[0] * b.v[3] + a.v[3] * b.v[0];
+		for (std::size_t i = 0; i < K; i++)
+		{
+			r.g[0][i] = a.g[0][i] * b.v[0] + a.v[0] * b.g[0][i];
+			r.g[1][i] = a.g[0][i] * b.v[1] + a.v[0] * b.g[1][i] +
+						a.g[1][i] * b.v[0] + a.v[1] * b.g[0][i];
+			r.g[2][i] = a.g[0][i] * b.v[2] + a.v[0] * b.g[2][i] +
+						a.g[1][i] * b.v[1] + a.v[1] * b.g[1][i] +
+						a.g[2][i] * b.v[0] + a.v[2] * b.g[0][i];
+			r.g[3][i] = a.g[0][i] * b.v[3] + a.v[0] * b.g[3][i] +
+						a.g[3][i] * b.v[0] + a.v[3] * b.g[0][i];
+		}
+		return r;
+	}
+	friend TConstraintScalar operator/(
+		const TConstraintScalar& a, const TConstraintScalar& b)
+	{
+		const double x = b.v[0];
+		return a * chain(b, 1 / x, -1 / (x * x), 2 / (x * x * x),
+						 -6 / (x * x * x * x));
+	}
+
+	/** f(a), given the values of f and its first three derivatives at
+	 * a.v[0] */
+	friend TConstraintScalar chain(
+		const TConstraintScalar& a, double f0, double f1, double f2, double f3)
+	{
+		TConstraintScalar r;
+		const double v1_2 = a.v[1] * a.v[1];
+		r.v[0] = f0;
+		r.v[1] = f1 * a.v[1];
+		r.v[2] = f1 * a.v[2] + 0.5 * f2 * v1_2;
+		r.v[3] = f1 * a.v[3];
+		for (std::size_t i = 0; i < K; i++)
+		{
+			const double g0 = a.g[0][i];
+			r.g[0][i] = f1 * g0;
+			r.g[1][i] = f2 * g0 * a.v[1] + f1 * a.g[1][i];
+			r.g[2][i] = f2 * g0 * a.v[2] + f1 * a.g[2][i] +
+						0.5 * f3 * g0 * v1_2 + f2 * a.v[1] * a.g[1][i];
+			r.g[3][i] = f2 * g0 * a.v[3] + f1 * a.g[3][i];
+		}
+		return r;
+	}
+	friend TConstraintScalar sin(const TConstraintScalar& a)
+	{
+		const double s = std::sin(a.v[0]), c = std::cos(a.v[0]);
+		return chain(a, s, c, -s, -c);
+	}
+	friend TConstraintScalar cos(const TConstraintScalar& a)
+	{
+		const double s = std::sin(a.v[0]), c = std::cos(a.v[0]);
+		return chain(a, c, -s, -c, s);
+	}
+	friend TConstraintScalar sqrt(const TConstraintScalar& a)
+	{
+		// Each derivative of sqrt(x) is -(2n-1)/(2x) times the former one:
+		const double x = a.v[0], f0 = std::sqrt(x), f1 = 0.5 * f0 / x,
+					 f2 = -0.5 * f1 / x, f3 = -1.5 * f2 / x;
+		return chain(a, f0, f1, f2, f3);
+	}
+};
+
+/** Value and derivatives of one constraint equation Phi(x) of K local
+ * coordinates x, with q, dq and ddq their values, velocities and
+ * accelerations. All vectors hold derivatives with respect to x, laid out
+ * like the rows of the Jacobians in CAssembledRigidModel. */
+template <std::size_t K>
+struct TConstraintDerivatives
+{
+	double Phi = 0;
+	double dotPhi = 0;
+	std::array<double, K> Phi_q{};
+	std::array<double, K> dotPhi_q{};
+	std::array<double, K> Phiqq_times_ddq{};  //!< d(Phi_q * ddq)/dq
+	std::array<double, K> dotPhiqq_times_dq{};  //!< d(dotPhi_q * dq)/dq
+};
+
+/** Evaluates a constraint and all its derivatives in one pass of
+ * forward-mode automatic differentiation. `phi(x)` must be generic in the
+ * scalar type: it is called with a `std::array` of K TConstraintScalar<K>,
+ * and must return Phi as another TConstraintScalar<K>. Arithmetic with
+ * double constants, sin(), cos() and sqrt() are supported.
+ */
+template <std::size_t K, class FUNCTOR>
+void autodiffConstraint(
+	const FUNCTOR& phi, const std::array<double, K>& q,
+	const std::array<double, K>& dq, const std::array<double, K>& ddq,
+	TConstraintDerivatives<K>& out)
+{
+	std::array<TConstraintScalar<K>, K> x;
+	for (std::size_t k = 0; k < K; k++)
+	{
+		x[k].v = {q[k], dq[k], 0, ddq[k]};
+		x[k].g[0][k] = 1;
+	}
+	const TConstraintScalar<K> r = phi(x);
+
+	out.Phi = r.v[0];
+	out.dotPhi = r.v[1];
+	out.Phi_q = r.g[0];
+	out.dotPhi_q = r.g[1];
+	out.Phiqq_times_ddq = r.g[3];
+	for (std::size_t k = 0; k < K; k++)
+		out.dotPhiqq_times_dq[k] = 2 * r.g[2][k];
+}
+
+/** @} */
+
+}  // namespace mbse
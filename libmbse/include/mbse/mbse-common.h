@@ -14,6 +14,7 @@
  * lib.
  */
 
+#include <algorithm>
 #include <variant>
 #include <memory>  // for auto_ptr
 #include <mrpt/poses/CPose3D.h>
@@ -42,6 +43,9 @@ using point_index_t = std::size_t;
 constexpr dof_index_t INVALID_DOF = static_cast<dof_index_t>(-1);
 constexpr point_index_t INVALID_POINT_INDEX = static_cast<point_index_t>(-1);
 
+/** Used for entries in sparse matrices which are structural zeros */
+constexpr std::size_t INVALID_SLOT = static_cast<std::size_t>(-1);
+
 /** Each of the 2D points in a CModelDefinition */
 struct Point2
 {
@@ -142,23 +146,159 @@ struct Point2ToDOF
 	Point2ToDOF() = default;
 };
 
+/** A sparse matrix in Compressed Row Storage (CSR) format, with a sparsity
+ * pattern defined once, row by row, while constraints allocate their entries
+ * in buildSparseStructures(), and fixed afterwards.
+ *
+ * The non-zero values of row `r` are stored contiguously in
+ * `valuePtr()[outerIndexPtr()[r]]` to `valuePtr()[outerIndexPtr()[r+1]-1]`,
+ * with their column indices (in ascending order) in `innerIndexPtr()`.
+ * Since rows can only be appended, the index of an entry in `valuePtr()` (its
+ * "slot") remains valid once its row is completed.
+ *
+ * Values may be stored in an external buffer (see bindValues()), so solvers
+ * can have constraints writing straight into their own sparse matrices.
+ */
 struct CompressedRowSparseMatrix
 {
-	using row_t = std::map<size_t, double>;
+	/** Integer type for row pointers and column indices. It is `int`, as in
+	 * Eigen, KLU, UMFPACK and CHOLMOD, so these arrays can be used directly
+	 * by them. */
+	using index_t = int;
+
+	CompressedRowSparseMatrix() = default;
 
-	/** Important: Use deque<> to avoid mem reallocations since we use
-	 * *pointers* to elements inside here */
-	std::deque<row_t> matrix;
+	/** Copies always get their own internal storage for values */
+	CompressedRowSparseMatrix(const CompressedRowSparseMatrix& o)
+		: ncols(o.ncols),
+		  outer_(o.outer_),
+		  inner_(o.inner_),
+		  values_(o.valuePtr(), o.valuePtr() + o.nonZeros())
+	{
+	}
+	CompressedRowSparseMatrix& operator=(const CompressedRowSparseMatrix& o)
+	{
+		if (this == &o) return *this;
+		ncols = o.ncols;
+		outer_ = o.outer_;
+		inner_ = o.inner_;
+		values_.assign(o.valuePtr(), o.valuePtr() + o.nonZeros());
+		external_values_ = nullptr;
+		return *this;
+	}
 
-	/** Defines the number of rows. */
-	void setRowCount(size_t n) { matrix.resize(n); }
+	/** Defines the number of rows. New rows are empty; existing rows cannot be
+	 * removed. */
+	void setRowCount(size_t n)
+	{
+		ASSERT_GE_(n, getNumRows());
+		outer_.resize(n + 1, outer_.back());
+	}
 
-	size_t ncols;  //!< The number of cols in a sparse matrix can be set freely
-				   //!< by the user (we don't check for columns out of this
-				   //!< limit anyway)
+	size_t ncols = 0;  //!< The number of cols in a sparse matrix can be set
+					   //!< freely by the user
 
-	size_t getNumRows() const { return matrix.size(); }
+	size_t getNumRows() const { return outer_.size() - 1; }
 	size_t getNumCols() const { return ncols; }
+	/** Number of structural non-zero entries */
+	size_t nonZeros() const { return inner_.size(); }
+
+	/** Adds a structural non-zero entry (initialized to zero) at (row,col).
+	 * Only the last row can be modified, so slots of former rows remain valid.
+	 * Inserting an already existing entry has no effect. */
+	void insert(size_t row, size_t col)
+	{
+		ASSERT_(external_values_ == nullptr);
+		ASSERT_EQUAL_(row + 1, getNumRows());
+		ASSERT_BELOW_(col, ncols);
+		const auto c = static_cast<index_t>(col);
+		const auto it = std::lower_bound(
+			inner_.begin() + outer_[row], inner_.end(), c);
+		if (it != inner_.end() && *it == c) return;
+		values_.insert(values_.begin() + (it - inner_.begin()), 0.0);
+		inner_.insert(it, c);
+		outer_.back()++;
+	}
+
+	/** Returns the index in valuePtr() of entry (row,col), or INVALID_SLOT if
+	 * it is not a structural non-zero. */
+	size_t slot(size_t row, size_t col) const
+	{
+		ASSERT_BELOW_(row, getNumRows());
+		const auto c = static_cast<index_t>(col);
+		const auto first = inner_.begin() + outer_[row],
+				   last = inner_.begin() + outer_[row + 1];
+		const auto it = std::lower_bound(first, last, c);
+		if (it == last || *it != c) return INVALID_SLOT;
+		return static_cast<size_t>(it - inner_.begin());
+	}
+
+	/** Row pointers (getNumRows()+1 entries) */
+	const index_t* outerIndexPtr() const { return outer_.data(); }
+	/** Column index of each non-zero entry */
+	const index_t* innerIndexPtr() const { return inner_.data(); }
+	/** Value of each non-zero entry */
+	double* valuePtr()
+	{
+		return external_values_ ? external_values_ : values_.data();
+	}
+	const double* valuePtr() const
+	{
+		return external_values_ ? external_values_ : values_.data();
+	}
+
+	/** Moves the storage of values to an external buffer with room for
+	 * nonZeros() doubles, e.g. a block of the value array of a solver sparse
+	 * matrix with the same layout. Current values are copied into `buf`, which
+	 * must outlive the binding. \sa unbindValues */
+	void bindValues(double* buf)
+	{
+		ASSERT_(buf != nullptr);
+		if (buf == valuePtr()) return;
+		std::copy(valuePtr(), valuePtr() + nonZeros(), buf);
+		external_values_ = buf;
+	}
+
+	/** Brings values back to the internal storage, if they are currently
+	 * bound to `buf`. \sa bindValues */
+	void unbindValues(const double* buf)
+	{
+		if (!external_values_ || external_values_ != buf) return;
+		std::copy(buf, buf + nonZeros(), values_.begin());
+		external_values_ = nullptr;
+	}
+
+	/** Dot product of one row times a dense vector */
+	template <class VECTOR>
+	double rowDot(size_t row, const VECTOR& x) const
+	{
+		const double* vals = valuePtr();
+		double r = 0;
+		for (index_t k = outer_[row]; k < outer_[row + 1]; k++)
+			r += vals[k] * x[inner_[k]];
+		return r;
+	}
+
+	/** Product times a dense vector, y = A*x, in O(nonZeros()). `y` (e.g. a
+	 * segment of a larger vector) must already have getNumRows() entries. */
+	template <class VECTOR, class OUT>
+	void multiply(const VECTOR& x, OUT&& y) const
+	{
+		for (size_t row = 0; row < getNumRows(); row++)
+			y[row] = rowDot(row, x);
+	}
+
+	/** M += scale * A, touching only the structural non-zero entries of A.
+	 * `M` (e.g. a block of a larger matrix) must already have the size of
+	 * this matrix. */
+	template <class MATRIX>
+	void addTo(MATRIX&& M, double scale = 1.0) const
+	{
+		const double* vals = valuePtr();
+		for (size_t row = 0; row < getNumRows(); row++)
+			for (index_t k = outer_[row]; k < outer_[row + 1]; k++)
+				M(row, inner_[k]) += scale * vals[k];
+	}
 
 	/** Create a dense version of this sparse matrix */
 	template <class MATRIX>
@@ -168,11 +308,12 @@ struct CompressedRowSparseMatrix
 		ASSERT_ABOVE_(getNumCols(), 0U);
 		M.resize(getNumRows(), getNumCols());
 		M.fill(0);
-		for (size_t row = 0; row < matrix.size(); row++)
-			for (const auto& row_val : matrix[row])
+		const double* vals = valuePtr();
+		for (size_t row = 0; row < getNumRows(); row++)
+			for (index_t k = outer_[row]; k < outer_[row + 1]; k++)
 			{
-				ASSERT_BELOW_(row_val.first, ncols);
-				M(row, row_val.first) = row_val.second;
+				ASSERT_BELOW_(static_cast<size_t>(inner_[k]), ncols);
+				M(row, inner_[k]) = vals[k];
 			}
 	}
 
@@ -184,6 +325,12 @@ struct CompressedRowSparseMatrix
 		asDense(m);
 		return m;
 	}
+
+   private:
+	std::vector<index_t> outer_{0};
+	std::vector<index_t> inner_;
+	std::vector<double> values_;
+	double* external_values_ = nullptr;  //!< See bindValues()
 };
 
 }  // namespace mbse
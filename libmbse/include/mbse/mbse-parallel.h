@@ -0,0 +1,156 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mbse
+{
+/** A fixed set of worker threads to run loops in parallel.
+ *
+ * parallel_for() splits a range into chunks of a given grain size, which are
+ * taken on demand by the workers and the calling thread. It returns once all
+ * chunks are done, and only wakes as many workers as there are chunks
+ * besides the one of the caller. If the pool is already running a loop
+ * (e.g. it is being used from another thread), or parallel_for() is called
+ * from within a loop of any pool, the loop runs serially in the caller
+ * instead of waiting, so it is safe (if not useful) to share or nest pools.
+ *
+ * \sa threadPool()
+ */
+class CThreadPool
+{
+   public:
+	using range_function_t = std::function<void(std::size_t, std::size_t)>;
+
+	/** Launches `numThreads - 1` workers, so loops run in `numThreads`
+	 * threads counting the caller. 0 means one per hardware thread. */
+	explicit CThreadPool(unsigned int numThreads = 0);
+	~CThreadPool();
+
+	CThreadPool(const CThreadPool&) = delete;
+	CThreadPool& operator=(const CThreadPool&) = delete;
+
+	/** Number of threads running loops, including the caller */
+	unsigned int numThreads() const { return workers_.size() + 1; }
+
+	/** Ids of the worker threads (not including callers of parallel_for) */
+	std::vector<std::thread::id> workerIds() const;
+
+	/** Calls `f(i0, i1)` for consecutive ranges [i0, i1) of at most
+	 * `grainSize` elements covering [0, n). Calls are concurrent, so `f` must
+	 * only write to data owned by its range. Exceptions thrown by `f` are
+	 * rethrown here, after all other chunks have finished. */
+	void parallel_for(
+		std::size_t n, std::size_t grainSize, const range_function_t& f);
+
+   private:
+	void worker();
+	void runChunks();
+
+	std::vector<std::thread> workers_;
+
+	std::mutex busy_mtx_;  //!< Held while running a loop
+	std::mutex mtx_;
+	std::condition_variable cv_start_, cv_done_;
+
+	/** Current loop. Written with mtx_ locked, before bumping generation_ */
+	const range_function_t* job_ = nullptr;
+	std::size_t n_ = 0, grain_ = 1;
+	std::atomic<std::size_t> next_{0};
+	std::size_t generation_ = 0;
+	unsigned int slots_ = 0;  //!< Workers still to join the current loop
+	unsigned int pending_ = 0;  //!< Workers not done with the current loop
+	std::exception_ptr error_;
+	bool quit_ = false;
+};
+
+/** The thread pool shared by the library, created on first use with one
+ * thread per hardware thread. */
+CThreadPool& threadPool();
+
+/** Copies of an object with mutable state (e.g. an assembled model, or a
+ * dynamic simulator), one per thread, so it can be used concurrently.
+ *
+ * The thread which creates this object uses the prototype itself; any other
+ * thread gets its own copy, made from the prototype by `cloner` on its first
+ * call to get(). The cloner must only read data which is not modified while
+ * the prototype is in use (structure, parameters), not its current state.
+ * get() is thread-safe.
+ */
+template <class T>
+class CPerThreadCopies
+{
+   public:
+	using cloner_t = std::function<std::shared_ptr<T>(const T&)>;
+
+	CPerThreadCopies(std::shared_ptr<T> prototype, cloner_t cloner)
+		: prototype_(std::move(prototype)),
+		  cloner_(std::move(cloner)),
+		  owner_(std::this_thread::get_id())
+	{
+	}
+
+	/** The object to be used from the calling thread */
+	T& get()
+	{
+		const auto id = std::this_thread::get_id();
+		if (id == owner_) return *prototype_;
+
+		std::lock_guard<std::mutex> lck(mtx_);
+		auto& c = copies_[id];
+		if (!c) c = cloner_(*prototype_);
+		return *c;
+	}
+
+	/** Makes now the copies of the given threads (e.g. the workers of a
+	 * CThreadPool), instead of on their first call to get(). Use it before
+	 * the prototype is in use, if the cloner reads its mutable state. */
+	void makeCopies(const std::vector<std::thread::id>& threads)
+	{
+		std::lock_guard<std::mutex> lck(mtx_);
+		for (const auto id : threads)
+		{
+			if (id == owner_) continue;
+			auto& c = copies_[id];
+			if (!c) c = cloner_(*prototype_);
+		}
+	}
+
+	const std::shared_ptr<T>& prototype() const { return prototype_; }
+
+	/** Number of copies made so far (not counting the prototype) */
+	std::size_t copyCount() const
+	{
+		std::lock_guard<std::mutex> lck(mtx_);
+		return copies_.size();
+	}
+
+   private:
+	const std::shared_ptr<T> prototype_;
+	const cloner_t cloner_;
+	const std::thread::id owner_;
+
+	mutable std::mutex mtx_;
+	std::map<std::thread::id, std::shared_ptr<T>> copies_;
+};
+
+}  // namespace mbse
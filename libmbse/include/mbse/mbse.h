@@ -15,4 +15,7 @@
 // Include the main classes/structs:
 #include <mbse/CModelDefinition.h>
 #include <mbse/CAssembledRigidModel.h>
+#include <mbse/CAssembledRigidModelBatch.h>
 #include <mbse/dynamics/dynamic-simulators.h>
+#include <mbse/dynamics/CDynamicSimulator_Lagrange_LU_fixed.h>
+#include <mbse/mbse-parallel.h>
@@ -13,9 +13,13 @@
 #include <mbse/mbse-common.h>
 #include "mbse-utils.h"
 #include "CAssembledRigidModel.h"
+#include <array>
+#include <mutex>
 
 namespace mbse
 {
+class CAssembledRigidModelBatch;
+
 /** Base of all types of virtual sensors */
 class CVirtualSensor
 {
@@ -33,18 +37,63 @@ class CVirtualSensor
 		const double sensor_reading, const CAssembledRigidModel& mb_state) const
 	{
 		const double sensor_prediction = this->simulate_reading(mb_state);
-		return -0.5 *
-			   mrpt::square(
-				   (sensor_reading - sensor_prediction) / sensor_noise_std);
+		return -0.5 * mrpt::square(
+						  reading_error(sensor_reading, sensor_prediction) /
+						  sensor_noise_std);
+	}
+
+	/** Difference between a reading and a prediction. Sensors of angles
+	 * override it to wrap the difference to [-pi, pi]. */
+	virtual double reading_error(double reading, double prediction) const
+	{
+		return reading - prediction;
 	}
 
+	/** Whether the sensor reads accelerations: if so, they must be set in
+	 * the models (ddotq_) and batches of states passed to it. */
+	virtual bool needs_accelerations() const { return false; }
+
+	/** Simulates the readings for all the states in `states`: one value per
+	 * state (column). The default implementation calls simulate_reading()
+	 * for each state (with its accelerations, if needs_accelerations()),
+	 * loaded into a copy of the model (one per thread, kept while the states
+	 * come from the same model); sensors should
+	 * override it with a loop over all states at once, reading the rows of
+	 * their coordinates (see CAssembledRigidModelBatch::pointRows()). */
+	virtual void simulate_readings(
+		const CAssembledRigidModelBatch& states,
+		Eigen::VectorXd& out_readings) const;
+
+	/** Log-likelihoods of the given read value for all the states in
+	 * `states`, one per state, as in evaluate_log_likelihood() */
+	void log_likelihoods(
+		const double sensor_reading, const CAssembledRigidModelBatch& states,
+		Eigen::VectorXd& out_log_lik) const;
+
 	/** One standard deviation (1sigma) of the sensor Gaussian noise model
 	 * (units are sensor-specific) */
 	double sensor_noise_std;
 
 	CVirtualSensor() : sensor_noise_std(1) {}
+	/** Copies the sensor parameters, but not the scratch models */
+	CVirtualSensor(const CVirtualSensor& o)
+		: sensor_noise_std(o.sensor_noise_std)
+	{
+	}
+	CVirtualSensor& operator=(const CVirtualSensor& o)
+	{
+		sensor_noise_std = o.sensor_noise_std;
+		return *this;
+	}
 
 	virtual ~CVirtualSensor() {}
+
+   private:
+	/** For the default simulate_readings(): copies of the model of the last
+	 * states passed to it (kept alive in scratchSource_) */
+	mutable std::mutex scratchMtx_;
+	mutable CAssembledRigidModel::Ptr scratchSource_;
+	mutable std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>> scratch_;
 };
 
 /** A Gyroscope sensor */
@@ -56,10 +105,148 @@ class CVirtualSensor_Gyro : public CVirtualSensor
 	virtual double simulate_reading(
 		const CAssembledRigidModel& mb_state) const override;
 
+	void simulate_readings(
+		const CAssembledRigidModelBatch& states,
+		Eigen::VectorXd& out_readings) const override;
+
 	CVirtualSensor_Gyro(const size_t body_idx) : body_idx_(body_idx) {}
 
    protected:
 	size_t body_idx_;
 };
 
+/** Where to read the coordinates of one point from, resolved once from the
+ * model: the indices of its x and y in q (also in dq and ddq), or their
+ * constant values for fixed points. Sensors keep one per point they observe,
+ * so evaluating them needs no lookup of bodies nor points in the model. */
+struct TPointGather
+{
+	TPointGather() = default;
+	TPointGather(const CAssembledRigidModel& arm, size_t point_idx);
+
+	size_t point_idx = 0;
+	std::array<dof_index_t, 2> dof = {{INVALID_DOF, INVALID_DOF}};
+	/** Coordinates, used for those with INVALID_DOF */
+	std::array<double, 2> fixed = {{.0, .0}};
+
+	/** Coordinate `c` (0:x, 1:y) of the point */
+	double pos(const Eigen::VectorXd& q, int c) const
+	{
+		return dof[c] != INVALID_DOF ? q[dof[c]] : fixed[c];
+	}
+
+	/** Velocity or acceleration (from dq or ddq) of coordinate `c` */
+	double deriv(const Eigen::VectorXd& v, int c) const
+	{
+		return dof[c] != INVALID_DOF ? v[dof[c]] : .0;
+	}
+
+	/** Adds the derivatives wrt the x and y of the point to the columns of
+	 * their DOFs in the row Jacobian `H` (1 x n) */
+	void addToJacobian(Eigen::MatrixXd& H, double d_dx, double d_dy) const
+	{
+		if (dof[0] != INVALID_DOF) H(0, dof[0]) += d_dx;
+		if (dof[1] != INVALID_DOF) H(0, dof[1]) += d_dy;
+	}
+};
+
+/** An angle encoder: the angle of a body (the direction from its first to
+ * its second point) wrt the X axis, or wrt another body for a relative
+ * encoder at a joint. Readings in radians, positive CCW, in [-pi, pi]. */
+class CVirtualSensor_Encoder : public CVirtualSensor
+{
+   public:
+	/** Absolute encoder of body `body_idx` of `arm` */
+	CVirtualSensor_Encoder(const CAssembledRigidModel& arm, size_t body_idx);
+
+	/** Relative encoder: angle of `body_idx` wrt `ref_body_idx` */
+	CVirtualSensor_Encoder(
+		const CAssembledRigidModel& arm, size_t ref_body_idx,
+		size_t body_idx);
+
+	double simulate_reading(const CAssembledRigidModel& arm) const override
+	{
+		return reading(arm.q_);
+	}
+
+	void simulate_readings(
+		const CAssembledRigidModelBatch& states,
+		Eigen::VectorXd& out_readings) const override;
+
+	double reading_error(double reading, double prediction) const override;
+
+	/** The reading for coordinates `q`, and its Jacobian wrt them (1 x n)
+	 * if `H_q` is not null */
+	double reading(
+		const Eigen::VectorXd& q, Eigen::MatrixXd* H_q = nullptr) const;
+
+   private:
+	bool relative_ = false;
+	/** Points 0, 1 of the body, then those of the reference body */
+	std::array<TPointGather, 4> pts_;
+};
+
+/** An accelerometer: the acceleration of a point, projected on the axes of a
+ * body it moves with. Axis 0 is the direction from the first to the second
+ * point of the body, axis 1 its normal (+90 deg). Readings in m/s^2, without
+ * gravity. */
+class CVirtualSensor_Accelerometer : public CVirtualSensor
+{
+   public:
+	CVirtualSensor_Accelerometer(
+		const CAssembledRigidModel& arm, size_t point_idx, size_t body_idx,
+		int axis);
+
+	double simulate_reading(const CAssembledRigidModel& arm) const override
+	{
+		return reading(arm.q_, arm.ddotq_);
+	}
+
+	void simulate_readings(
+		const CAssembledRigidModelBatch& states,
+		Eigen::VectorXd& out_readings) const override;
+
+	bool needs_accelerations() const override { return true; }
+
+	/** The reading for coordinates `q` and accelerations `ddq`, and its
+	 * Jacobians wrt them (1 x n), for those not null */
+	double reading(
+		const Eigen::VectorXd& q, const Eigen::VectorXd& ddq,
+		Eigen::MatrixXd* H_q = nullptr,
+		Eigen::MatrixXd* H_ddq = nullptr) const;
+
+   private:
+	int axis_ = 0;
+	TPointGather pt_;
+	/** Points 0, 1 of the body */
+	std::array<TPointGather, 2> axis_pts_;
+};
+
+/** A point tracker (e.g. a fixed camera): the x (axis 0) or y (axis 1)
+ * coordinate of a point. Readings in meters. */
+class CVirtualSensor_PointTracker : public CVirtualSensor
+{
+   public:
+	CVirtualSensor_PointTracker(
+		const CAssembledRigidModel& arm, size_t point_idx, int axis);
+
+	double simulate_reading(const CAssembledRigidModel& arm) const override
+	{
+		return reading(arm.q_);
+	}
+
+	void simulate_readings(
+		const CAssembledRigidModelBatch& states,
+		Eigen::VectorXd& out_readings) const override;
+
+	/** The reading for coordinates `q`, and its Jacobian wrt them (1 x n)
+	 * if `H_q` is not null */
+	double reading(
+		const Eigen::VectorXd& q, Eigen::MatrixXd* H_q = nullptr) const;
+
+   private:
+	int axis_ = 0;
+	TPointGather pt_;
+};
+
 }  // namespace mbse
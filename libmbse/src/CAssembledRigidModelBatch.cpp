@@ -0,0 +1,152 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#include <mbse/CAssembledRigidModelBatch.h>
+#include <mrpt/core/exceptions.h>
+
+using namespace mbse;
+using namespace Eigen;
+using namespace std;
+
+CAssembledRigidModelBatch::CAssembledRigidModelBatch(
+	const CAssembledRigidModel::Ptr& arm, size_t numStates)
+	: arm_(arm)
+{
+	ASSERT_(arm_);
+	nDOFs_ = arm_->q_.size();
+
+	// Assign rows to point coordinates: those of fixed points go after the
+	// generalized coordinates.
+	const auto& pts2dofs = arm_->getPoints2DOFs();
+	pointRows_.resize(pts2dofs.size());
+
+	std::vector<double> fixedCoords;
+	for (size_t i = 0; i < pts2dofs.size(); i++)
+	{
+		const auto& pt = arm_->parent_.getPointInfo(i);
+		const dof_index_t dofs[2] = {pts2dofs[i].dof_x, pts2dofs[i].dof_y};
+		const double coords[2] = {pt.coords.x, pt.coords.y};
+		for (int d = 0; d < 2; d++)
+		{
+			if (dofs[d] != INVALID_DOF)
+			{
+				pointRows_[i][d] = dofs[d];
+				continue;
+			}
+			pointRows_[i][d] = nDOFs_ + fixedCoords.size();
+			fixedCoords.push_back(coords[d]);
+		}
+	}
+	fixedCoords_ =
+		Eigen::Map<const VectorXd>(fixedCoords.data(), fixedCoords.size());
+
+	resize(numStates);
+}
+
+void CAssembledRigidModelBatch::resize(size_t numStates)
+{
+	const size_t nOld = numStates_;
+	const size_t nRows = nDOFs_ + fixedCoords_.size();
+	const size_t m = arm_->Phi_.size();
+	const size_t nnz = arm_->Phi_q_.nonZeros();
+
+	q_.conservativeResize(nRows, numStates);
+	dotq_.conservativeResize(nRows, numStates);
+	ddotq_.conservativeResize(nRows, numStates);
+	Phi_.conservativeResize(m, numStates);
+	dotPhi_.conservativeResize(m, numStates);
+	Phi_q_.conservativeResize(nnz, numStates);
+	dotPhi_q_.conservativeResize(nnz, numStates);
+	scratch_.resize(numStates);
+	for (auto& c : constraintCache_)
+	{
+		c.second.conservativeResize(c.second.rows(), numStates);
+		if (numStates > nOld) c.second.rightCols(numStates - nOld).setZero();
+	}
+
+	numStates_ = numStates;
+
+	for (size_t k = nOld; k < numStates; k++)
+	{
+		q_.col(k).tail(fixedCoords_.size()) = fixedCoords_;
+		dotq_.col(k).tail(fixedCoords_.size()).setZero();
+		ddotq_.col(k).tail(fixedCoords_.size()).setZero();
+		setStateFrom(k, *arm_);
+	}
+}
+
+void CAssembledRigidModelBatch::setState(
+	size_t k, const Eigen::VectorXd& q, const Eigen::VectorXd& dotq)
+{
+	ASSERT_BELOW_(k, numStates_);
+	ASSERT_EQUAL_(static_cast<size_t>(q.size()), nDOFs_);
+	ASSERT_EQUAL_(static_cast<size_t>(dotq.size()), nDOFs_);
+
+	q_.col(k).head(nDOFs_) = q;
+	dotq_.col(k).head(nDOFs_) = dotq;
+}
+
+void CAssembledRigidModelBatch::getState(
+	size_t k, Eigen::VectorXd& q, Eigen::VectorXd& dotq) const
+{
+	ASSERT_BELOW_(k, numStates_);
+
+	q = q_.col(k).head(nDOFs_);
+	dotq = dotq_.col(k).head(nDOFs_);
+}
+
+void CAssembledRigidModelBatch::setAccelerations(
+	size_t k, const Eigen::VectorXd& ddotq)
+{
+	ASSERT_BELOW_(k, numStates_);
+	ASSERT_EQUAL_(static_cast<size_t>(ddotq.size()), nDOFs_);
+
+	ddotq_.col(k).head(nDOFs_) = ddotq;
+}
+
+void CAssembledRigidModelBatch::getAccelerations(
+	size_t k, Eigen::VectorXd& ddotq) const
+{
+	ASSERT_BELOW_(k, numStates_);
+
+	ddotq = ddotq_.col(k).head(nDOFs_);
+}
+
+void CAssembledRigidModelBatch::update_numeric_Phi_and_Jacobians()
+{
+	timelog().enter("batch.update_numeric_Phi_and_Jacobians");
+
+	for (const auto& c : arm_->constraints_) c->updateBatch(*this);
+
+	timelog().leave("batch.update_numeric_Phi_and_Jacobians");
+}
+
+CAssembledRigidModelBatch::matrix_t&
+	CAssembledRigidModelBatch::constraintCache(
+		size_t constraintRow, size_t count)
+{
+	auto it = constraintCache_.find(constraintRow);
+	if (it == constraintCache_.end())
+		it = constraintCache_
+				 .emplace(constraintRow, matrix_t::Zero(count, numStates_))
+				 .first;
+	ASSERT_EQUAL_(static_cast<size_t>(it->second.rows()), count);
+	return it->second;
+}
+
+void CAssembledRigidModelBatch::getPhi_q(
+	size_t k, CompressedRowSparseMatrix& Phi_q) const
+{
+	ASSERT_BELOW_(k, numStates_);
+
+	Phi_q = arm_->Phi_q_;
+	double* vals = Phi_q.valuePtr();
+	for (Eigen::Index i = 0; i < Phi_q_.rows(); i++) vals[i] = Phi_q_(i, k);
+}
@@ -9,10 +9,12 @@
   +-------------------------------------------------------------------------+ */
 
 #include <mbse/CAssembledRigidModel.h>
+#include <mbse/mbse-parallel.h>
 #include <mbse/constraints/CConstraintRelativeAngle.h>
 #include <mbse/constraints/CConstraintRelativeAngleAbsolute.h>
 #include <mrpt/opengl.h>
 #include <iostream>
+#include <limits>
 
 using namespace mbse;
 using namespace Eigen;
@@ -24,8 +26,10 @@ const double DEFAULT_GRAVITY[3] = {0, -9.81, 0};
 
 /** Constructor */
 CAssembledRigidModel::CAssembledRigidModel(const TSymbolicAssembledModel& armi)
-	: parent_(armi.model)
+	: parent_(armi.model), massMatrixCache_(armi.massMatrixCache)
 {
+	ASSERT_(massMatrixCache_);
+
 	for (int i = 0; i < 3; i++) gravity_[i] = DEFAULT_GRAVITY[i];
 
 	const auto nEuclideanDOFs = armi.DOFs.size();
@@ -124,8 +128,17 @@ CAssembledRigidModel::CAssembledRigidModel(const TSymbolicAssembledModel& armi)
 		}
 	}
 
-	// Final step: build structures
-	for (auto& c : constraints_) c->buildSparseStructures(*this);
+	// Final step: build structures, keeping track of the rows of each one
+	constraintFirstRow_.clear();
+	for (auto& c : constraints_)
+	{
+		constraintFirstRow_.push_back(Phi_.size());
+		c->buildSparseStructures(*this);
+	}
+	constraintFirstRow_.push_back(Phi_.size());
+
+	// ...and group them by type for faster evaluation:
+	compiledConstraints_.build(*this);
 }
 
 void CAssembledRigidModel::getGravityVector(
@@ -149,8 +162,102 @@ void CAssembledRigidModel::setGravityVector(
 void CAssembledRigidModel::update_numeric_Phi_and_Jacobians()
 {
 	// Update numeric values of the constraint Jacobians:
-	for (size_t i = 0; i < constraints_.size(); i++)
-		constraints_[i]->update(*this);
+	if (compiledConstraintsEnabled_)
+	{
+		compiledConstraints_.update(*this);
+		return;
+	}
+
+	parallel_update_for(constraints_.size(), [this](size_t i0, size_t i1) {
+		for (size_t i = i0; i < i1; i++) constraints_[i]->update(*this);
+	});
+}
+
+void CAssembledRigidModel::update_numeric_Phi_and_Jacobians(
+	size_t constraint_index)
+{
+	constraints_.at(constraint_index)->update(*this);
+}
+
+void CAssembledRigidModel::eval_Phiqq_transpose_times(
+	const Eigen::VectorXd& lambda, Eigen::MatrixXd& out)
+{
+	timelog().enter("eval_Phiqq_transpose_times");
+
+	const size_t n = q_.size();
+	const size_t m = Phi_.size();
+	ASSERT_EQUAL_(static_cast<size_t>(lambda.size()), m);
+
+	const auto* rows = Phi_q_.outerIndexPtr();
+	const auto* cols = Phi_q_.innerIndexPtr();
+
+	// Greedy coloring of the columns of Phi_q, such that no two columns with
+	// the same color have entries in the same row:
+	std::vector<std::vector<size_t>> colRows(n);
+	for (size_t i = 0; i < m; i++)
+		for (auto k = rows[i]; k < rows[i + 1]; k++)
+			colRows[cols[k]].push_back(i);
+
+	const size_t NO_COLOR = std::numeric_limits<size_t>::max();
+	std::vector<size_t> color(n, NO_COLOR), usedBy;
+	size_t nColors = 0;
+	for (size_t c = 0; c < n; c++)
+	{
+		for (size_t i : colRows[c])
+			for (auto k = rows[i]; k < rows[i + 1]; k++)
+				if (const size_t o = color[cols[k]]; o != NO_COLOR)
+					usedBy[o] = c;
+
+		size_t col = 0;
+		while (col < nColors && usedBy[col] == c) col++;
+		if (col == nColors)
+		{
+			nColors++;
+			usedBy.push_back(NO_COLOR);
+		}
+		color[c] = col;
+	}
+
+	// Row i of Phiqq_times_ddq_, for ddq = e_k, holds the derivatives of
+	// Phi_q(i,k) with respect to q. Since each row has at most one column of
+	// each color, a probe with all columns of one color gives them for all
+	// rows at once:
+	const Eigen::VectorXd ddotq_bak = ddotq_;
+
+	out.setZero(n, n);
+	for (size_t col = 0; col < nColors; col++)
+	{
+		for (size_t c = 0; c < n; c++) ddotq_[c] = color[c] == col ? 1 : 0;
+		update_numeric_Phi_and_Jacobians();
+
+		const double* vals = Phiqq_times_ddq_.valuePtr();
+		for (size_t i = 0; i < m; i++)
+		{
+			auto kc = rows[i];
+			while (kc < rows[i + 1] && color[cols[kc]] != col) kc++;
+			if (kc == rows[i + 1]) continue;
+
+			for (auto k = rows[i]; k < rows[i + 1]; k++)
+				out(cols[kc], cols[k]) += lambda[i] * vals[k];
+		}
+	}
+
+	ddotq_ = ddotq_bak;
+	update_numeric_Phi_and_Jacobians();
+
+	timelog().leave("eval_Phiqq_transpose_times");
+}
+
+void CAssembledRigidModel::parallel_update_for(
+	size_t n, const std::function<void(size_t, size_t)>& f) const
+{
+	const auto& p = parallel_update_params;
+	if (!p.enabled || constraints_.size() < p.serial_threshold)
+	{
+		f(0, n);
+		return;
+	}
+	threadPool().parallel_for(n, p.grain_size, f);
 }
 
 /** Returns a 3D visualization of the model */
@@ -281,6 +388,23 @@ size_t CAssembledRigidModel::addNewRowToConstraints()
 	return idx;
 }
 
+CAssembledRigidModel::Ptr CAssembledRigidModel::cloneTopology() const
+{
+	TSymbolicAssembledModel armi(parent_);
+	armi.DOFs = DOFs_;
+	armi.rDOFs = rDOFs_;
+	armi.massMatrixCache = massMatrixCache_;
+
+	auto o = std::make_shared<CAssembledRigidModel>(armi);
+	o->gravity_ = gravity_;
+	o->Q_ = Q_;
+	o->compiledConstraintsEnabled_ = compiledConstraintsEnabled_;
+	o->parallel_update_params = parallel_update_params;
+	o->position_solver = position_solver;
+	o->partition_params = partition_params;
+	return o;
+}
+
 /** Only to be called between objects created from the same symbolic model, this
  * method replicates the state of "o" into "this". */
 void CAssembledRigidModel::copyStateFrom(const CAssembledRigidModel& o)
@@ -489,3 +613,11 @@ void CAssembledRigidModel::printCoordinates(std::ostream& o)
 
 	MRPT_END
 }
+
+std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>>
+	mbse::makePerThreadCopies(const CAssembledRigidModel::Ptr& arm)
+{
+	ASSERT_(arm);
+	return std::make_shared<CPerThreadCopies<CAssembledRigidModel>>(
+		arm, [](const CAssembledRigidModel& a) { return a.cloneTopology(); });
+}
@@ -17,51 +17,84 @@ using namespace mrpt::math;
 using namespace mrpt;
 using namespace std;
 
-/** Solves the "initial position" problem: iterates refining the position until
- * the constraints are minimized */
-double CAssembledRigidModel::refinePosition(
-	const double maxPhiNorm, const size_t nItersMax)
+CCoordinatePartition& CAssembledRigidModel::coordinatePartition(
+	const std::vector<size_t>& z_indices)
 {
-	timelog().enter("refinePosition");
+	auto& partitions = partitionCache_.partitions;
+	auto it = partitions.find(z_indices);
+	if (it != partitions.end()) return *it->second;
+
+	// Integrators only use a few different sets, but do not grow forever if
+	// the independent coordinates keep changing:
+	const size_t MAX_CACHED_PARTITIONS = 16;
+	if (partitions.size() >= MAX_CACHED_PARTITIONS) partitions.clear();
+
+	auto& p = partitions[z_indices];
+	p = std::make_unique<CCoordinatePartition>(*this, z_indices);
+	return *p;
+}
 
-	Eigen::MatrixXd Phi_q;
-	this->update_numeric_Phi_and_Jacobians();
+void CAssembledRigidModel::invalidateCoordinatePartitions()
+{
+	for (auto& p : partitionCache_.partitions) p.second->invalidate();
+}
+
+namespace
+{
+/** Newton iterations on Phi(q)=0 for the dependent coordinates of
+ * `partition`. The Jacobian is only refactorized when it drifts away from
+ * that of the former factorization (i.e. a modified Newton method), so
+ * steps close to the solution are cheap.
+ * \return The final norm of Phi */
+double newtonDependentPositions(
+	CAssembledRigidModel& arm, CCoordinatePartition& partition,
+	const double maxPhiNorm, const size_t nItersMax,
+	const std::string& timelogName)
+{
+	arm.update_numeric_Phi_and_Jacobians();
 
 	size_t iter = 0;
-	double phi_norm = Phi_.norm();
+	double phi_norm = arm.Phi_.norm();
 
-	timelog().registerUserMeasure("refinePosition.init_phi_norm", phi_norm);
+	timelog().registerUserMeasure(
+		(timelogName + ".init_phi_norm").c_str(), phi_norm);
 
-	Eigen::FullPivLU<Eigen::MatrixXd> lu_Phiq;
-	bool rebuild_lu = true;
+	const std::vector<size_t>& idxs_d = partition.dep();
+	Eigen::VectorXd qd_incr;
 
 	// Non-linear Newton iterations:
 	for (; iter < nItersMax && phi_norm > maxPhiNorm; iter++)
 	{
-		if (rebuild_lu)
-		{
-			Phi_q = Phi_q_.asDense();
-
-			lu_Phiq.compute(Phi_q);
-			rebuild_lu = false;
-		}
+		partition.update(arm);
 
 		// Solve for increment:
-		const Eigen::VectorXd q_incr = lu_Phiq.solve(Phi_);
-		q_ -= q_incr;
+		partition.solve(arm, arm.Phi_, qd_incr, false /*exact*/);
+		for (size_t i = 0; i < idxs_d.size(); i++)
+			arm.q_[idxs_d[i]] -= qd_incr[i];
 
 		// Re-evaluate error:
-		this->update_numeric_Phi_and_Jacobians();
+		arm.update_numeric_Phi_and_Jacobians();
 
-		const double new_phi_norm = Phi_.norm();
+		phi_norm = arm.Phi_.norm();
+	}
 
-		// Selective re-evaluation of the Jacobian:
-		if (new_phi_norm > 1e-6) rebuild_lu = true;
+	timelog().registerUserMeasure(
+		(timelogName + ".num_iters").c_str(), static_cast<double>(iter));
 
-		phi_norm = new_phi_norm;
-	}
+	return phi_norm;
+}
+}  // namespace
+
+/** Solves the "initial position" problem: iterates refining the position until
+ * the constraints are minimized */
+double CAssembledRigidModel::refinePosition(
+	const double maxPhiNorm, const size_t nItersMax)
+{
+	timelog().enter("refinePosition");
 
-	timelog().registerUserMeasure("refinePosition.num_iters", iter);
+	const double phi_norm = newtonDependentPositions(
+		*this, coordinatePartition({}), maxPhiNorm, nItersMax,
+		"refinePosition");
 
 	timelog().leave("refinePosition");
 
@@ -77,59 +110,11 @@ double CAssembledRigidModel::finiteDisplacement(
 {
 	timelog().enter("finiteDisplacement");
 
-	this->update_numeric_Phi_and_Jacobians();
-
-	size_t iter = 0;
-	double phi_norm = Phi_.norm();
-
-	timelog().registerUserMeasure("finiteDisplacement.init_phi_norm", phi_norm);
-
-	std::vector<bool> q_fixed;
-	q_fixed.assign(q_.size(), false);
-	for (size_t i = 0; i < z_indices.size(); i++) q_fixed[z_indices[i]] = true;
-
-	const size_t nDepCoords = q_.size() - z_indices.size();
-	std::vector<size_t> idxs_d;  // make a list with the rest of indices
-	idxs_d.reserve(nDepCoords);
-
-	for (int i = 0; i < q_.size(); i++)
-		if (!q_fixed[i]) idxs_d.push_back(i);
-	ASSERT_EQUAL_(idxs_d.size(), nDepCoords);
-
-	Eigen::FullPivLU<Eigen::MatrixXd> lu_Phiq;
-	bool rebuild_lu = true;
-
-	// Non-linear Newton iterations:
-	Eigen::MatrixXd Phi_q;
-	for (; iter < nItersMax && phi_norm > maxPhiNorm; iter++)
-	{
-		if (rebuild_lu)
-		{
-			this->Phi_q_.asDense(Phi_q);
-			mbse::removeColumns(Phi_q, z_indices);
-			lu_Phiq.compute(Phi_q);
-			rebuild_lu = false;
-		}
-		// Solve for increment:
-
-		const Eigen::VectorXd qi_incr = lu_Phiq.solve(Phi_);
-
-		for (size_t i = 0; i < nDepCoords; i++) q_[idxs_d.at(i)] -= qi_incr[i];
-
-		// Re-evaluate error:
-		MRPT_TODO(
-			"Possible optimization: eval Phi() then, if needed, Jacobians");
-		this->update_numeric_Phi_and_Jacobians();
+	CCoordinatePartition& partition = coordinatePartition(z_indices);
+	const std::vector<size_t>& idxs_d = partition.dep();
 
-		const double new_phi_norm = Phi_.norm();
-
-		// Selective re-evaluation of the Jacobian:
-		if (new_phi_norm > 1e-6) rebuild_lu = true;
-
-		phi_norm = new_phi_norm;
-	}
-
-	timelog().registerUserMeasure("finiteDisplacement.num_iters", iter);
+	const double phi_norm = newtonDependentPositions(
+		*this, partition, maxPhiNorm, nItersMax, "finiteDisplacement");
 
 	timelog().leave("finiteDisplacement");
 
@@ -139,42 +124,25 @@ double CAssembledRigidModel::finiteDisplacement(
 	{
 		timelog().enter("finiteDisplacement.dotq");
 
-		Eigen::MatrixXd Phi_q;
-		this->Phi_q_.asDense(Phi_q);
-
 		// qd = Phi_d \ (-Phi_i * dot{q}_i)
-		//      -------------v-------------
-		//              = vector "p"
-		const size_t nConstr = Phi_q.rows();
-		Eigen::VectorXd p(nConstr);
-		for (size_t i = 0; i < nConstr; i++)
-		{
-			double r = 0;
-			for (size_t j = 0; j < z_indices.size(); j++)
-				r -= Phi_q(i, z_indices[j]) * dotq_[z_indices[j]];
-
-			p[i] = r;
-		}
-
-		mbse::removeColumns(Phi_q, z_indices);
-
-		const Eigen::VectorXd dotq_d = Phi_q.lu().solve(p);
+		Eigen::VectorXd dotq_d;
+		partition.update(*this);
+		partition.solve(
+			*this, partition.minusPhi_z_times(*this, dotq_), dotq_d);
 
 		for (size_t i = 0; i < idxs_d.size(); i++)
-			dotq_[idxs_d.at(i)] = dotq_d[i];
+			dotq_[idxs_d[i]] = dotq_d[i];
 
 		timelog().leave("finiteDisplacement.dotq");
 	}
 
 	// Return this precomputed list of dependent indices, to save time in the
 	// caller function.
-	if (out_idxs_d) out_idxs_d->swap(idxs_d);
+	if (out_idxs_d) *out_idxs_d = idxs_d;
 
 	return phi_norm;
 }
 
-MRPT_TODO("Split into several methods?")
-
 void CAssembledRigidModel::computeDependentPosVelAcc(
 	const std::vector<size_t>& z_indices, bool update_q, bool update_dq,
 	const TComputeDependentParams& params,
@@ -182,66 +150,24 @@ void CAssembledRigidModel::computeDependentPosVelAcc(
 {
 	timelog().enter("computeDependentPosVelAcc");
 
-	// Build list of coordinates indices:
-	std::vector<bool> q_fixed;
-	q_fixed.assign(q_.size(), false);
-	for (size_t i = 0; i < z_indices.size(); i++) q_fixed[z_indices[i]] = true;
-
-	const size_t nDepCoords = q_.size() - z_indices.size();
-	std::vector<size_t> idxs_d;  // make a list with the rest of indices
-	idxs_d.reserve(nDepCoords);
-
-	for (int i = 0; i < q_.size(); i++)
-		if (!q_fixed[i]) idxs_d.push_back(i);
+	CCoordinatePartition& partition = coordinatePartition(z_indices);
+	const std::vector<size_t>& idxs_d = partition.dep();
 
 	// ------------------------------------------
 	// Update q
 	// ------------------------------------------
 	if (update_q)
 	{
-		Eigen::MatrixXd Phi_q;
-		this->update_numeric_Phi_and_Jacobians();
-
-		size_t iter = 0;
-		double phi_norm = Phi_.norm();
-
-		timelog().registerUserMeasure(
-			"computeDependentPosVelAcc.init_phi_norm", phi_norm);
-
-		Eigen::FullPivLU<Eigen::MatrixXd> lu_Phiq;
-		bool rebuild_lu = true;
-
-		for (; iter < params.nItersMax && phi_norm > params.maxPhiNorm; iter++)
-		{
-			if (rebuild_lu)
-			{
-				this->Phi_q_.asDense(Phi_q);
-
-				mbse::removeColumns(Phi_q, z_indices);
-
-				lu_Phiq.compute(Phi_q);
-				rebuild_lu = false;
-			}
-			// Solve for increment:
-			const Eigen::VectorXd qi_incr = lu_Phiq.solve(Phi_);
-
-			for (size_t i = 0; i < nDepCoords; i++) q_[idxs_d[i]] -= qi_incr[i];
-
-			// Re-evaluate error:
-			this->update_numeric_Phi_and_Jacobians();
-
-			const double new_phi_norm = Phi_.norm();
-
-			// Selective re-evaluation of the Jacobian:
-			if (new_phi_norm > 1e-6) rebuild_lu = true;
-
-			phi_norm = new_phi_norm;
-		}
-
-		timelog().registerUserMeasure(
-			"computeDependentPosVelAcc.num_iters", iter);
+		out_results.pos_final_phi = newtonDependentPositions(
+			*this, partition, params.maxPhiNorm, params.nItersMax,
+			"computeDependentPosVelAcc");
 	}
 
+	// Velocities and accelerations share the factorization:
+	ASSERT_(
+		(ptr_ddotz && out_results.ddotq) || (!ptr_ddotz && !out_results.ddotq));
+	if (update_dq || ptr_ddotz) partition.update(*this);
+
 	// ------------------------------------------
 	// Update \dot{q}
 	// ------------------------------------------
@@ -249,25 +175,10 @@ void CAssembledRigidModel::computeDependentPosVelAcc(
 	{
 		timelog().enter("computeDependentPosVelAcc.dotq");
 
-		Eigen::MatrixXd Phi_q;
-		this->Phi_q_.asDense(Phi_q);
-
 		// qd = Phi_d \ (-Phi_i * dot{q}_i)
-		//      -------------v-------------
-		//              = vector "p"
-		const size_t nConstr = Phi_q.rows();
-		Eigen::VectorXd p(nConstr);
-		for (size_t i = 0; i < nConstr; i++)
-		{
-			double r = 0;
-			for (size_t j = 0; j < z_indices.size(); j++)
-				r -= Phi_q(i, z_indices[j]) * dotq_[z_indices[j]];
-
-			p[i] = r;
-		}
-
-		mbse::removeColumns(Phi_q, z_indices);
-		const Eigen::VectorXd dotq_d = Phi_q.lu().solve(p);
+		Eigen::VectorXd dotq_d;
+		partition.solve(
+			*this, partition.minusPhi_z_times(*this, dotq_), dotq_d);
 
 		for (size_t i = 0; i < idxs_d.size(); i++) dotq_[idxs_d[i]] = dotq_d[i];
 
@@ -277,58 +188,32 @@ void CAssembledRigidModel::computeDependentPosVelAcc(
 	// ------------------------------------------
 	// Update \ddot{q}
 	// ------------------------------------------
-	ASSERT_(
-		(ptr_ddotz && out_results.ddotq) || (!ptr_ddotz && !out_results.ddotq));
 	if (ptr_ddotz)
 	{
 		timelog().enter("computeDependentPosVelAcc.ddotq");
 
 		const Eigen::VectorXd& ddotz = *ptr_ddotz;
 		Eigen::VectorXd& ddotq = *out_results.ddotq;
-
-		const size_t nConstraints = this->Phi_.size();
-
-		Eigen::MatrixXd Phiq;
-		this->Phi_q_.asDense(Phiq);
+		ASSERT_EQUAL_((int)ddotz.size(), (int)z_indices.size());
 
 		// ddot{qd} = Phiq_d \ (-Phiq_i * ddot{q}_i - dot{Phi_q} * dotq)
 		//                     ----------------------v-------------------
 		//                                 = vector "p"
-		Eigen::VectorXd p(nConstraints);
-		ASSERT_EQUAL_((int)ddotz.size(), (int)z_indices.size());
+		ddotq.setZero(q_.size());
+		for (size_t i = 0; i < z_indices.size(); i++)
+			ddotq[z_indices[i]] = ddotz[i];
 
-		for (size_t i = 0; i < nConstraints; i++)
-		{
-			double r = 0;
-			// Part 1: -Phiq_i * ddot{q}_i
-			for (size_t j = 0; j < z_indices.size(); j++)
-				r -= Phiq(i, z_indices[j]) * ddotz[j];
-
-			// Part 2: - dot{Phi_q} * dotq)
-			const CompressedRowSparseMatrix::row_t& row_i = dotPhi_q_.matrix[i];
-			for (CompressedRowSparseMatrix::row_t::const_iterator it =
-					 row_i.begin();
-				 it != row_i.end(); ++it)
-			{
-				const size_t col = it->first;
-				r -= it->second * dotq_[col];
-			}
-
-			p[i] = r;
-		}
-
-		mbse::removeColumns(Phiq, z_indices);
-		const Eigen::VectorXd ddotq_d = Phiq.lu().solve(p);
+		Eigen::VectorXd p = partition.minusPhi_z_times(*this, ddotq);
+		for (int i = 0; i < p.size(); i++) p[i] -= dotPhi_q_.rowDot(i, dotq_);
+
+		Eigen::VectorXd ddotq_d;
+		partition.solve(*this, p, ddotq_d);
 
 		// ------------------------------------
 		// Store accelerations:
 		//  ddotq[ z_indices ] <- ddotz
 		//  ddotq[ idxs_d ]       <- ddotq_d
 		// ------------------------------------
-		ddotq.resize(q_.size());
-		for (size_t i = 0; i < z_indices.size(); i++)
-			ddotq[z_indices[i]] = ddotz[i];
-
 		for (size_t i = 0; i < idxs_d.size(); i++)
 			ddotq[idxs_d[i]] = ddotq_d[i];
 
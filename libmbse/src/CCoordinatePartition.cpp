@@ -0,0 +1,148 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+
+#include <mbse/CAssembledRigidModel.h>
+#include <mbse/CCoordinatePartition.h>
+#include <mbse/mbse-utils.h>
+
+using namespace mbse;
+using namespace Eigen;
+
+CCoordinatePartition::CCoordinatePartition(
+	const CAssembledRigidModel& arm, const std::vector<size_t>& z_indices)
+	: z_indices_(z_indices),
+	  sparse_(
+		  arm.position_solver ==
+		  CAssembledRigidModel::PositionSolver::SparseQR),
+	  redundant_(
+		  arm.Phi_q_.getNumRows() >
+		  static_cast<size_t>(arm.q_.size()) - z_indices.size())
+{
+	const size_t n = arm.q_.size();
+	std::vector<bool> isIndep(n, false);
+	for (const size_t i : z_indices_) isIndep.at(i) = true;
+
+	d_indices_.reserve(n - z_indices_.size());
+	for (size_t i = 0; i < n; i++)
+		if (!isIndep[i]) d_indices_.push_back(i);
+	ASSERT_EQUAL_(d_indices_.size(), n - z_indices_.size());
+
+	if (sparse_) sparseSolver_.setup(arm.Phi_q_, d_indices_);
+}
+
+void CCoordinatePartition::factorize(const CAssembledRigidModel& arm)
+{
+	if (sparse_)
+		sparseSolver_.factorize(arm.Phi_q_);
+	else
+	{
+		Eigen::MatrixXd Phi_d;
+		arm.Phi_q_.asDense(Phi_d);
+		mbse::removeColumns(Phi_d, z_indices_);
+		lu_.compute(Phi_d);
+	}
+
+	const double* vals = arm.Phi_q_.valuePtr();
+	factorizedValues_.assign(vals, vals + arm.Phi_q_.nonZeros());
+	factorized_ = true;
+	numFactorizations_++;
+}
+
+void CCoordinatePartition::update(const CAssembledRigidModel& arm, bool force)
+{
+	if (!force && factorized_)
+	{
+		const double* vals = arm.Phi_q_.valuePtr();
+		double maxVal = 0, maxDiff = 0;
+		for (size_t i = 0; i < factorizedValues_.size(); i++)
+		{
+			maxVal = std::max(maxVal, std::abs(factorizedValues_[i]));
+			maxDiff =
+				std::max(maxDiff, std::abs(vals[i] - factorizedValues_[i]));
+		}
+		if (maxDiff <= arm.partition_params.max_drift * maxVal) return;
+	}
+	factorize(arm);
+}
+
+bool CCoordinatePartition::isCurrent(const CAssembledRigidModel& arm) const
+{
+	return factorized_ && std::equal(
+							  factorizedValues_.begin(),
+							  factorizedValues_.end(), arm.Phi_q_.valuePtr());
+}
+
+VectorXd CCoordinatePartition::solveFactorized(const VectorXd& b) const
+{
+	if (!sparse_) return lu_.solve(b);
+	VectorXd x;
+	sparseSolver_.solve(b, x);
+	return x;
+}
+
+VectorXd CCoordinatePartition::residual(
+	const CAssembledRigidModel& arm, const VectorXd& b, const VectorXd& x) const
+{
+	VectorXd xq = VectorXd::Zero(arm.q_.size());
+	for (size_t i = 0; i < d_indices_.size(); i++) xq[d_indices_[i]] = x[i];
+
+	VectorXd r = b;
+	for (int i = 0; i < r.size(); i++) r[i] -= arm.Phi_q_.rowDot(i, xq);
+	return r;
+}
+
+void CCoordinatePartition::solve(
+	const CAssembledRigidModel& arm, const VectorXd& b, VectorXd& x,
+	bool exact)
+{
+	ASSERTMSG_(factorized_, "update() must be called before solve()");
+
+	if (!exact || isCurrent(arm))
+	{
+		x = solveFactorized(b);
+		return;
+	}
+
+	// With redundant constraints this is a least-squares solve, whose
+	// residual does not vanish: refinement would never converge.
+	if (redundant_)
+	{
+		factorize(arm);
+		x = solveFactorized(b);
+		return;
+	}
+
+	x = solveFactorized(b);
+	const auto& p = arm.partition_params;
+	const double tol = p.refine_tolerance * b.norm();
+	for (size_t iter = 0;; iter++)
+	{
+		const VectorXd r = residual(arm, b, x);
+		if (r.norm() <= tol) return;
+		if (iter == p.max_refine_iters) break;
+		x += solveFactorized(r);
+	}
+
+	// Too far from the current Jacobian: start over with a new one.
+	factorize(arm);
+	x = solveFactorized(b);
+}
+
+VectorXd CCoordinatePartition::minusPhi_z_times(
+	const CAssembledRigidModel& arm, const VectorXd& v) const
+{
+	VectorXd vz = VectorXd::Zero(v.size());
+	for (const size_t i : z_indices_) vz[i] = v[i];
+
+	VectorXd p(arm.Phi_q_.getNumRows());
+	for (int i = 0; i < p.size(); i++) p[i] = -arm.Phi_q_.rowDot(i, vz);
+	return p;
+}
@@ -0,0 +1,154 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+
+#include <mbse/CAssembledRigidModel.h>
+#include <mbse/CMassMatrixCache.h>
+
+using namespace mbse;
+using namespace Eigen;
+
+CMassMatrixCache::~CMassMatrixCache()
+{
+	if (!cholmod_started_) return;
+
+	for (auto& f : cholmod_factors_)
+		cholmod_free_factor(&f.second, &cholmod_common_);
+	cholmod_free_sparse(&cholmod_M_, &cholmod_common_);
+	cholmod_finish(&cholmod_common_);
+}
+
+const MatrixXd& CMassMatrixCache::dense(const CAssembledRigidModel& arm)
+{
+	std::lock_guard<std::mutex> lck(mtx_);
+	if (!dense_)
+	{
+		dense_ = std::make_unique<MatrixXd>();
+		arm.buildMassMatrix_dense(*dense_);
+	}
+	ASSERT_EQUAL_(dense_->rows(), arm.q_.size());
+	return *dense_;
+}
+
+const LDLT<MatrixXd>& CMassMatrixCache::denseLDLT(
+	const CAssembledRigidModel& arm)
+{
+	const MatrixXd& M = dense(arm);
+
+	std::lock_guard<std::mutex> lck(mtx_);
+	if (!denseLDLT_)
+	{
+		denseLDLT_ = std::make_unique<LDLT<MatrixXd>>(M);
+		factorizationCount_++;
+	}
+	return *denseLDLT_;
+}
+
+const std::vector<Triplet<double>>& CMassMatrixCache::internal_triplets(
+	const CAssembledRigidModel& arm)
+{
+	if (!triplets_)
+	{
+		triplets_ = std::make_unique<std::vector<Triplet<double>>>();
+		arm.buildMassMatrix_sparse(*triplets_);
+	}
+	return *triplets_;
+}
+
+const SparseMatrix<double>& CMassMatrixCache::internal_sparse(
+	const CAssembledRigidModel& arm)
+{
+	if (!sparse_)
+	{
+		const auto& tri = internal_triplets(arm);
+		const auto n = arm.q_.size();
+		sparse_ = std::make_unique<SparseMatrix<double>>(n, n);
+		sparse_->setFromTriplets(tri.begin(), tri.end());
+		sparse_->makeCompressed();
+	}
+	ASSERT_EQUAL_(sparse_->rows(), arm.q_.size());
+	return *sparse_;
+}
+
+const std::vector<Triplet<double>>& CMassMatrixCache::triplets(
+	const CAssembledRigidModel& arm)
+{
+	std::lock_guard<std::mutex> lck(mtx_);
+	return internal_triplets(arm);
+}
+
+const SparseMatrix<double>& CMassMatrixCache::sparse(
+	const CAssembledRigidModel& arm)
+{
+	std::lock_guard<std::mutex> lck(mtx_);
+	return internal_sparse(arm);
+}
+
+const SimplicialLDLT<SparseMatrix<double>>& CMassMatrixCache::sparseLDLT(
+	const CAssembledRigidModel& arm)
+{
+	std::lock_guard<std::mutex> lck(mtx_);
+	if (!sparseLDLT_)
+	{
+		sparseLDLT_ = std::make_unique<SimplicialLDLT<SparseMatrix<double>>>(
+			internal_sparse(arm));
+		if (sparseLDLT_->info() != Eigen::Success)
+			THROW_EXCEPTION("Could not factorize the mass matrix");
+		factorizationCount_++;
+	}
+	return *sparseLDLT_;
+}
+
+cholmod_factor* CMassMatrixCache::cholmodFactor(
+	const CAssembledRigidModel& arm, int cholmodOrdering)
+{
+	std::lock_guard<std::mutex> lck(mtx_);
+
+	if (auto it = cholmod_factors_.find(cholmodOrdering);
+		it != cholmod_factors_.end())
+		return it->second;
+
+	if (!cholmod_started_)
+	{
+		cholmod_start(&cholmod_common_);
+		// M is definite, so it's OK to factor as LL' instead of LDL'
+		cholmod_common_.final_ll = 1;
+		cholmod_started_ = true;
+	}
+
+	if (!cholmod_M_)
+	{
+		cholmod_triplet* tri =
+			arm.buildMassMatrix_sparse_CHOLMOD(cholmod_common_);
+		ASSERT_(tri != nullptr);
+		cholmod_M_ = cholmod_triplet_to_sparse(tri, tri->nnz, &cholmod_common_);
+		cholmod_free_triplet(&tri, &cholmod_common_);
+		ASSERT_(cholmod_M_ != nullptr);
+	}
+
+	cholmod_common_.nmethods = 1;
+	cholmod_common_.method[0].ordering = cholmodOrdering;
+
+	cholmod_factor* L = cholmod_analyze(cholmod_M_, &cholmod_common_);
+	if (!L || cholmod_common_.status != CHOLMOD_OK)
+		THROW_EXCEPTION("CHOLMOD couldn't symbolic factorize M");
+
+	cholmod_factorize(cholmod_M_, L, &cholmod_common_);
+	factorizationCount_++;
+
+	cholmod_factors_[cholmodOrdering] = L;
+	return L;
+}
+
+size_t CMassMatrixCache::factorizationCount() const
+{
+	std::lock_guard<std::mutex> lck(mtx_);
+	return factorizationCount_;
+}
@@ -12,6 +12,8 @@
 
 #include <mrpt/math/distributions.h>
 
+#include <algorithm>
+
 using namespace mbse;
 using namespace Eigen;
 using namespace mrpt::math;
@@ -20,19 +22,32 @@ using namespace std;
 
 // Ctor:
 CMultiBodyParticleFilter::CMultiBodyParticleFilter(
-	const size_t M, const CModelDefinition& mbs)
+	const size_t M, const CModelDefinition& mbs,
+	const std::string& simulator_class)
+	: mbs_(mbs)
 {
 	// 1) Proccess model:
-	TSymbolicAssembledModel sym_model(mbs);
-	mbs.assembleRigidMBS(sym_model);
+	TSymbolicAssembledModel sym_model(mbs_);
+	mbs_.assembleRigidMBS(sym_model);
+	arm_ = std::make_shared<CAssembledRigidModel>(sym_model);
+
+	simul_ = std::dynamic_pointer_cast<CDynamicSimulatorIndepBase>(
+		CDynamicSimulatorBase::Create(simulator_class, arm_));
+	ASSERTMSG_(simul_, "Particle simulators must use independent coordinates");
+	simul_->prepare();
+	simulators_ = makePerThreadCopies(simul_.get());
+	// Simulators copy the independent coordinates of the prototype, which
+	// change while it integrates: make the copies of the workers now.
+	simulators_->makeCopies(threadPool().workerIds());
 
 	// 2) Create particles:
 	m_particles.resize(M);
 
-	for (auto& p : m_particles)
+	for (size_t i = 0; i < M; i++)
 	{
-		p.log_w = 0;
-		p.d.reset(new particle_t(sym_model));
+		m_particles[i].log_w = 0;
+		m_particles[i].d.reset(new particle_t());
+		storeParticle(i, *arm_);
 	}
 
 	// Randomize?
@@ -42,6 +57,50 @@ CMultiBodyParticleFilter::CMultiBodyParticleFilter(
 // Dtor:
 CMultiBodyParticleFilter::~CMultiBodyParticleFilter() {}
 
+namespace
+{
+/** Seed of the random stream of particle `idx` (splitmix64 finalizer) */
+uint32_t particleSeed(uint64_t stepSeed, size_t idx)
+{
+	uint64_t z = stepSeed + (idx + 1) * UINT64_C(0x9E3779B97F4A7C15);
+	z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+	return static_cast<uint32_t>(z ^ (z >> 31));
+}
+}  // namespace
+
+void CMultiBodyParticleFilter::loadParticle(
+	size_t i, CAssembledRigidModel& arm) const
+{
+	const auto& p = *m_particles.at(i).d;
+	arm.q_ = p.q;
+	arm.dotq_ = p.dotq;
+	if (p.ddotq.size() != 0) arm.ddotq_ = p.ddotq;
+
+	// So results do not depend on the particles loaded before:
+	arm.invalidateCoordinatePartitions();
+}
+
+void CMultiBodyParticleFilter::storeParticle(
+	size_t i, const CAssembledRigidModel& arm)
+{
+	auto& p = *m_particles.at(i).d;
+	p.q = arm.q_;
+	p.dotq = arm.dotq_;
+}
+
+void CMultiBodyParticleFilter::for_each_particle_range(
+	const std::function<void(size_t, size_t)>& f) const
+{
+	const size_t n = m_particles.size();
+	if (!parallel_params.enabled)
+	{
+		f(0, n);
+		return;
+	}
+	threadPool().parallel_for(n, parallel_params.grain_size, f);
+}
+
 void CMultiBodyParticleFilter::run_PF_step(
 	const double t_ini, const double t_end, const double max_t_step,
 	const std::vector<CVirtualSensor::Ptr>& sensor_descriptions,
@@ -60,102 +119,57 @@ void CMultiBodyParticleFilter::run_PF_step(
 	const size_t nTimeSteps = ceil(t_increment / max_t_step);
 
 	const double t_step = t_increment / nTimeSteps;
-	const double t_step2 = t_step * 0.5;
-	const double t_step6 = t_step / 6.0;
 
-	Eigen::VectorXd q0;	 // Backup of state.
-	Eigen::VectorXd k1, k2, k3, k4;
-	Eigen::VectorXd v1, v2, v3, v4;	 // \dot{q}
-	Eigen::VectorXd ddotz1, ddotz2, ddotz3, ddotz4;	 // \ddot{q}
-	Eigen::VectorXd q_incr, dotz_incr;
-	Eigen::VectorXd dotz_noise;
+	// One random stream per particle, seeded from this draw and the particle
+	// index:
+	const uint64_t stepSeed = random_generator.drawUniform32bit();
 
-	const size_t nParts = m_particles.size();
-	size_t i;
-	double t = t_ini;
-	for (size_t nTim = 0; nTim < nTimeSteps; nTim++, t += t_step)
-	{
-#if 0 && MBS_HAVE_OPENMP
-#pragma omp                                                                                                               \
-	parallel for private(q0) private(k1) private(k2) private(k3) private(k4) private(v1) private(v2) private(v3) private( \
-		v4) private(ddotq1) private(ddotq2) private(ddotq3) private(ddotq4) private(q_incr) private(dotq_incr) private(dotq_noise)
-#endif
-		for (i = 0; i < nParts; i++)
-		{
-			auto part = m_particles[i].d;
+	bool needAccelerations = false;
+	for (const auto& s : sensor_descriptions)
+		needAccelerations = needAccelerations || s->needs_accelerations();
 
-			// ODE_RK4:
-			// --------------------------------
-			{
-				q0 = part->num_model.q_;  // Make backup copy of state
-										  // (velocities will be in "v1")
-
-				// k1 = f(t,y);
-				// cur_time = t;
-				v1 = part->num_model.dotq_;
-				// No change needed: part->num_model.q_ = q0;
-
-				part->dyn_simul->can_choose_indep_coords_ = true;
-				part->dyn_simul->solve_ddotz(t, ddotz1);
-				part->dyn_simul->can_choose_indep_coords_ = false;
-
-				// k2 = f(t+At/2,y+At/2*k1)
-				// cur_time = t + t_step2;
-				part->dyn_simul->dq_plus_dz(
-					v1, t_step2 * ddotz1,
-					part->num_model
-						.dotq_);  // \dot{q}= \dot{q}_0 + At/2 * \ddot{q}_1
-				part->num_model.q_ = q0 + t_step2 * v1;
-				part->dyn_simul->correct_dependent_q_dq();
-
-				v2 = part->num_model.dotq_;
-				part->dyn_simul->solve_ddotz(t + t_step2, ddotz2);
-
-				// k3 = f(t+At/2,y+At/2*k2)
-				// cur_time = t + t_step2;
-				// part->num_model.dotq_ = v1 + t_step2*ddotq2;  // \dot{q}=
-				// \dot{q}_0 + At/2 * \ddot{q}_2
-				part->dyn_simul->dq_plus_dz(
-					v1, t_step2 * ddotz2, part->num_model.dotq_);
-
-				part->num_model.q_ = q0 + t_step2 * v2;
-				part->dyn_simul->correct_dependent_q_dq();
-
-				v3 = part->num_model.dotq_;
-				part->dyn_simul->solve_ddotz(t + t_step2, ddotz3);
-
-				// k4 = f(t+At  ,y+At*k3)
-				// cur_time = t + t_step;
-				// part->num_model.dotq_ = v1 + t_step*ddotq3;
-				part->dyn_simul->dq_plus_dz(
-					v1, t_step * ddotz3, part->num_model.dotq_);
-				part->num_model.q_ = q0 + t_step * v3;
-				part->dyn_simul->correct_dependent_q_dq();
-
-				v4 = part->num_model.dotq_;
-				part->dyn_simul->solve_ddotz(t + t_step, ddotz4);
-
-				// Runge-Kutta 4th order formula:
-				q_incr = t_step6 * (v1 + 2 * v2 + 2 * v3 + v4);
-				dotz_incr =
-					t_step6 * (ddotz1 + 2 * ddotz2 + 2 * ddotz3 + ddotz4);
-			}
+	for_each_particle_range([&](size_t i0, size_t i1) {
+		mrpt::random::CRandomGenerator rng;
+		Eigen::VectorXd dotz_noise;
 
-			// generate noise:
-			if (dotz_incr.size() != dotz_noise.size())
+		// Add noise to the increment of independent velocities:
+		const CDynamicSimulatorIndepBase::dz_increment_hook_t addNoise =
+			[&](Eigen::VectorXd& dotz_incr) {
 				dotz_noise.resize(dotz_incr.size());
-			random_generator.drawGaussian1DMatrix(
-				dotz_noise, 0, model_options.acc_xy_noise_std * t_step);
+				rng.drawGaussian1DMatrix(
+					dotz_noise, 0, model_options.acc_xy_noise_std * t_step);
+				dotz_incr += dotz_noise;
+			};
+
+		auto& simul = simulators_->get();
+		auto& arm = *simul.get_model_non_const();
+		Eigen::VectorXd ddotz;
+		CAssembledRigidModel::TComputeDependentResults cdr;
+		cdr.ddotq = &arm.ddotq_;
+
+		for (size_t i = i0; i < i1; i++)
+		{
+			loadParticle(i, arm);
+			rng.randomize(particleSeed(stepSeed, i));
 
-			// Add (noisy) increment:
-			part->num_model.q_ = q0 + q_incr;
-			part->dyn_simul->dq_plus_dz(
-				v1, dotz_incr + dotz_noise, part->num_model.dotq_);
-			part->dyn_simul->correct_dependent_q_dq();
+			double t = t_ini;
+			for (size_t nTim = 0; nTim < nTimeSteps; nTim++, t += t_step)
+				simul.integrate_step(
+					t, t_step, model_options.ode_solver, addNoise);
 
-		}  // end numeric integration of one time_step
+			storeParticle(i, arm);
 
-	}  // end for each time_step
+			// Accelerations at the new state, for the sensors:
+			if (needAccelerations)
+			{
+				simul.solve_ddotz(t_end, ddotz);
+				arm.computeDependentPosVelAcc(
+					simul.independent_coordinate_indices(),
+					false /*update q*/, false /*update dq*/, {}, cdr, &ddotz);
+				m_particles[i].d->ddotq = arm.ddotq_;
+			}
+		}
+	});
 
 	timelog().leave("PF.1.forward_model");
 
@@ -165,32 +179,44 @@ void CMultiBodyParticleFilter::run_PF_step(
 
 	const size_t nSensors = sensor_descriptions.size();
 
-	//	std::vector<double> sensors_logw, sensors_loglik;
-	//	sensors_logw.reserve( nParts );
-	//	sensors_loglik.reserve( nParts );
-
-	for (CParticleList::iterator it = m_particles.begin();
-		 it != m_particles.end(); ++it)
+	const size_t nParts = m_particles.size();
+	if (nSensors > 0 && nParts > 0)
 	{
-		auto part = it->d;
-
-		double cum_log_lik = 0;
-		for (size_t k = 0; k < nSensors; k++)
-		{
-			const double log_lik =
-				sensor_descriptions[k]->evaluate_log_likelihood(
-					sensor_readings[k], part->num_model);
-			cum_log_lik += log_lik;
-		}
-		it->log_w += cum_log_lik;
-
-		//		sensors_logw.push_back( it->log_w );
-		//		sensors_loglik.push_back( cum_log_lik );
+		// Chunks of states, so each sensor evaluates a chunk of particles in
+		// one vectorized loop, and chunks run in parallel. Ranges passed by
+		// for_each_particle_range() start at multiples of the grain size, but
+		// may span several chunks (e.g. if run serially).
+		const size_t grain = std::max<size_t>(1, parallel_params.grain_size);
+		lik_chunks_.resize((nParts + grain - 1) / grain);
+
+		for_each_particle_range([&](size_t i0, size_t i1) {
+			ASSERT_EQUAL_(i0 % grain, 0U);
+			for (size_t c0 = i0; c0 < i1; c0 += grain)
+			{
+				const size_t c1 = std::min(c0 + grain, i1);
+				auto& chunk = lik_chunks_[c0 / grain];
+				if (!chunk.states || chunk.states->size() != c1 - c0)
+					chunk.states = std::make_shared<CAssembledRigidModelBatch>(
+						arm_, c1 - c0);
+				for (size_t i = c0; i < c1; i++)
+				{
+					const auto& p = *m_particles[i].d;
+					chunk.states->setState(i - c0, p.q, p.dotq);
+					if (p.ddotq.size() != 0)
+						chunk.states->setAccelerations(i - c0, p.ddotq);
+				}
+
+				for (size_t k = 0; k < nSensors; k++)
+				{
+					sensor_descriptions[k]->log_likelihoods(
+						sensor_readings[k], *chunk.states, chunk.log_lik);
+					for (size_t i = c0; i < c1; i++)
+						m_particles[i].log_w += chunk.log_lik[i - c0];
+				}
+			}
+		});
 	}
 
-	//	double sensor_avrg_lik = mrpt::math::chi2
-	// CDF(nSensors,-mrpt::math::averageLogLikelihood(sensors_logw,sensors_loglik)
-	//);
 	timelog().leave("PF.2.sensor_likelihood");
 
 	//	cout << "Sensor lik: " << sensor_avrg_lik << endl;
@@ -209,17 +235,124 @@ void CMultiBodyParticleFilter::run_PF_step(
 	out_info.resampling_done = false;
 	out_info.ESS = curESS;
 
-	if (curESS < PF_options.BETA)
+	const auto& rp = resampling_params;
+	steps_since_resampling_++;
+	const bool doResample = rp.every_k_steps > 0
+								? steps_since_resampling_ >= rp.every_k_steps
+								: curESS < rp.ess_threshold;
+	if (doResample)
 	{
-		// printf("[PF] Resampling particles (ESS was %.02f)\n", curESS);
+		resample();
+		out_info.resampling_done = true;
+	}
+	timelog().leave("PF.4.resampling");
+}
 
-		size_t nNewParts = nParts;	// std::max(40.0, nParts*0.95 );
+namespace
+{
+/** Adds to `counts` N draws from the weights `w` (not necessarily
+ * normalized), with the sorted pointers (j + u_j) * sum(w) / N, j=0..N-1,
+ * and either one uniform u_j=u for all of them (systematic) or one per
+ * pointer (stratified). One pass over the cumulative sum of weights. */
+void drawSortedPointers(
+	const std::vector<double>& w, size_t N, bool oneDraw,
+	mrpt::random::CRandomGenerator& rng, std::vector<size_t>& counts)
+{
+	if (N == 0) return;
 
-		this->performResampling(PF_options, nNewParts);	 // Resample
+	double total = 0;
+	for (const double wi : w) total += wi;
+	ASSERT_ABOVE_(total, 0);
 
-		out_info.resampling_done = true;
+	const double step = total / N;
+	// Stratified draws its own u_j for each pointer below:
+	const double u = oneDraw ? rng.drawUniform(0, 1) : 0;
+
+	size_t i = 0;
+	double cum = w[0];
+	for (size_t j = 0; j < N; j++)
+	{
+		const double ptr = (j + (oneDraw ? u : rng.drawUniform(0, 1))) * step;
+		while (ptr >= cum && i + 1 < w.size()) cum += w[++i];
+		counts[i]++;
+	}
+}
+}  // namespace
+
+void CMultiBodyParticleFilter::resamplingCounts(
+	ResamplingMethod method, const std::vector<double>& w,
+	mrpt::random::CRandomGenerator& rng, std::vector<size_t>& counts)
+{
+	const size_t M = w.size();
+	counts.assign(M, 0);
+	if (M == 0) return;
+
+	switch (method)
+	{
+		case ResamplingMethod::Systematic:
+			drawSortedPointers(w, M, true, rng, counts);
+			break;
+
+		case ResamplingMethod::Stratified:
+			drawSortedPointers(w, M, false, rng, counts);
+			break;
+
+		case ResamplingMethod::Residual:
+		{
+			std::vector<double> residual(M);
+			size_t nCopies = 0;
+			for (size_t i = 0; i < M; i++)
+			{
+				const double expected = M * w[i];
+				counts[i] = static_cast<size_t>(expected);
+				residual[i] = expected - counts[i];
+				nCopies += counts[i];
+			}
+			ASSERT_(nCopies <= M);
+			drawSortedPointers(residual, M - nCopies, true, rng, counts);
+		}
+		break;
+
+		default:
+			THROW_EXCEPTION("Unknown resampling method");
 	}
-	timelog().leave("PF.4.resampling");
+}
+
+void CMultiBodyParticleFilter::resample()
+{
+	mrpt::system::CTimeLoggerEntry tle(timelog(), "PF.resample");
+
+	const size_t M = m_particles.size();
+	steps_since_resampling_ = 0;
+	if (M == 0) return;
+
+	// Normalized weights:
+	double maxLogW = m_particles[0].log_w;
+	for (const auto& p : m_particles) maxLogW = std::max(maxLogW, p.log_w);
+
+	auto& w = resampling_w_;
+	w.resize(M);
+	double sumW = 0;
+	for (size_t i = 0; i < M; i++)
+		sumW += (w[i] = std::exp(m_particles[i].log_w - maxLogW));
+	for (auto& wi : w) wi /= sumW;
+
+	auto& counts = resampling_counts_;
+	resamplingCounts(resampling_params.method, w, random_generator, counts);
+
+	// Extra copies go to the slots of particles which are not kept:
+	auto& freeSlots = resampling_free_;
+	freeSlots.clear();
+	for (size_t i = 0; i < M; i++)
+		if (counts[i] == 0) freeSlots.push_back(i);
+
+	size_t nextFree = 0;
+	for (size_t i = 0; i < M; i++)
+		for (size_t c = 1; c < counts[i]; c++)
+			*m_particles[freeSlots[nextFree++]].d = *m_particles[i].d;
+	ASSERT_EQUAL_(nextFree, freeSlots.size());
+
+	for (auto& p : m_particles) p.log_w = 0;
 }
 
 CMultiBodyParticleFilter::TTransitionModelOptions::TTransitionModelOptions()
@@ -234,14 +367,16 @@ void CMultiBodyParticleFilter::getAs3DRepresentation(
 	ASSERT_(outObj);
 
 	outObj->clear();
-	for (CParticleList::const_iterator it = m_particles.begin();
-		 it != m_particles.end(); ++it)
+	render_models_.resize(m_particles.size());
+	for (size_t i = 0; i < m_particles.size(); i++)
 	{
-		const auto part = it->d;
+		auto& rm = render_models_[i];
+		if (!rm) rm = arm_->cloneTopology();
+		loadParticle(i, *rm);
 
 		mrpt::opengl::CSetOfObjects::Ptr gl_part =
 			mrpt::opengl::CSetOfObjects::Create();
-		part->num_model.getAs3DRepresentation(gl_part, rp);
+		rm->getAs3DRepresentation(gl_part, rp);
 		outObj->insert(gl_part);
 	}
 }
@@ -252,16 +387,15 @@ void CMultiBodyParticleFilter::update3DRepresentation(
 	CBody::TRenderParams rp = rp_;
 
 	rp.render_style = CBody::reLine;
-	for (CParticleList::const_iterator it = m_particles.begin();
-		 it != m_particles.end(); ++it)
+	const size_t n = std::min(m_particles.size(), render_models_.size());
+	for (size_t i = 0; i < n; i++)
 	{
-		const auto part = it->d;
-
 		const uint8_t new_alpha =
-			uint8_t(std::max(0.2, std::exp(it->log_w)) * 255);
+			uint8_t(std::max(0.2, std::exp(m_particles[i].log_w)) * 255);
 
 		rp.line_alpha = new_alpha;
 
-		part->num_model.update3DRepresentation(rp);
+		loadParticle(i, *render_models_[i]);
+		render_models_[i]->update3DRepresentation(rp);
 	}
 }
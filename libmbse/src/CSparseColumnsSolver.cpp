@@ -0,0 +1,107 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+
+#include <mbse/CSparseColumnsSolver.h>
+#include <mrpt/core/exceptions.h>
+
+using namespace mbse;
+using namespace Eigen;
+
+void CSparseColumnsSolver::setup(
+	const CompressedRowSparseMatrix& A, const std::vector<size_t>& cols)
+{
+	const size_t nRows = A.getNumRows(), nCols = cols.size();
+
+	std::vector<int> newCol(A.getNumCols(), -1);
+	for (size_t i = 0; i < nCols; i++)
+	{
+		ASSERT_BELOW_(cols[i], A.getNumCols());
+		ASSERTMSG_(
+			i == 0 || cols[i] > cols[i - 1],
+			"Columns must be in ascending order");
+		newCol[cols[i]] = static_cast<int>(i);
+	}
+	cols_ = cols;
+	transposed_ = nRows < nCols;
+
+	// Build the pattern, with the slot in A as value of each entry, so the
+	// map from entries of M_ to slots can be read from its value array:
+	std::vector<Triplet<double>> triplets;
+	const auto *outer = A.outerIndexPtr(), *inner = A.innerIndexPtr();
+	for (size_t r = 0; r < nRows; r++)
+		for (auto k = outer[r]; k < outer[r + 1]; k++)
+		{
+			const int c = newCol[inner[k]];
+			if (c < 0) continue;
+			if (transposed_)
+				triplets.emplace_back(c, r, k);
+			else
+				triplets.emplace_back(r, c, k);
+		}
+
+	M_.resize(transposed_ ? nCols : nRows, transposed_ ? nRows : nCols);
+	M_.setFromTriplets(triplets.begin(), triplets.end());
+	M_.makeCompressed();
+
+	slots_.resize(M_.nonZeros());
+	for (size_t i = 0; i < slots_.size(); i++)
+		slots_[i] = static_cast<size_t>(M_.valuePtr()[i]);
+
+	qr_.analyzePattern(M_);
+}
+
+void CSparseColumnsSolver::setupExcluding(
+	const CompressedRowSparseMatrix& A, const std::vector<size_t>& excludedCols)
+{
+	std::vector<bool> excluded(A.getNumCols(), false);
+	for (const size_t c : excludedCols) excluded.at(c) = true;
+
+	std::vector<size_t> cols;
+	cols.reserve(A.getNumCols() - excludedCols.size());
+	for (size_t c = 0; c < A.getNumCols(); c++)
+		if (!excluded[c]) cols.push_back(c);
+
+	setup(A, cols);
+}
+
+void CSparseColumnsSolver::factorize(const CompressedRowSparseMatrix& A)
+{
+	const double* vals = A.valuePtr();
+	double* dst = M_.valuePtr();
+	for (size_t i = 0; i < slots_.size(); i++) dst[i] = vals[slots_[i]];
+
+	qr_.factorize(M_);
+	ASSERTMSG_(
+		qr_.info() == Eigen::Success,
+		"Sparse QR factorization failed: " + qr_.lastErrorMessage());
+}
+
+void CSparseColumnsSolver::solve(const VectorXd& b, VectorXd& x) const
+{
+	if (!transposed_)
+	{
+		x = qr_.solve(b);
+		return;
+	}
+
+	// Minimum norm solution of A_c x = b, given A_c^t P = Q R:
+	// R^t (Q^t x) = P^t b, where only the first `rank` rows of R are not
+	// null. Then, x = Q [y; 0], with R11^t y = (P^t b).head(rank).
+	const Index r = qr_.rank();
+	const VectorXd Ptb = qr_.colsPermutation().transpose() * b;
+	VectorXd y = VectorXd::Zero(M_.rows());
+	y.head(r) = qr_.matrixR()
+					.topLeftCorner(r, r)
+					.transpose()
+					.triangularView<Lower>()
+					.solve(Ptb.head(r));
+	x = qr_.matrixQ() * y;
+}
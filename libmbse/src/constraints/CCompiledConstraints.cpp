@@ -0,0 +1,292 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#include <mbse/CAssembledRigidModel.h>
+#include <mbse/constraints/CCompiledConstraints.h>
+
+using namespace mbse;
+using namespace Eigen;
+using mrpt::square;
+
+void CCompiledConstraints::build(const CAssembledRigidModel& arm)
+{
+	*this = CCompiledConstraints();
+
+	// Gather indices: coordinates of fixed points go after those in q:
+	const size_t nDOFs = arm.q_.size();
+	const auto& pts2dofs = arm.getPoints2DOFs();
+	pointIdxs_.resize(pts2dofs.size());
+
+	std::vector<double> fixedCoords;
+	for (size_t i = 0; i < pts2dofs.size(); i++)
+	{
+		const auto& pt = arm.parent_.getPointInfo(i);
+		const dof_index_t dofs[2] = {pts2dofs[i].dof_x, pts2dofs[i].dof_y};
+		const double coords[2] = {pt.coords.x, pt.coords.y};
+		for (int d = 0; d < 2; d++)
+		{
+			if (dofs[d] != INVALID_DOF)
+			{
+				pointIdxs_[i][d] = dofs[d];
+				continue;
+			}
+			pointIdxs_[i][d] = nDOFs + fixedCoords.size();
+			fixedCoords.push_back(coords[d]);
+		}
+	}
+
+	const size_t nExt = nDOFs + fixedCoords.size();
+	q_.resize(nExt);
+	dotq_.setZero(nExt);
+	ddotq_.setZero(nExt);
+	for (size_t i = 0; i < fixedCoords.size(); i++)
+		q_[nDOFs + i] = fixedCoords[i];
+
+	// Group constraints:
+	for (size_t i = 0; i < arm.constraints_.size(); i++)
+		if (!arm.constraints_[i]->compile(*this)) generic_.push_back(i);
+
+	constantDistance_.finalize();
+	fixedSlider_.finalize();
+	mobileSlider_.finalize();
+}
+
+template <std::size_t NUM_POINTS, std::size_t NUM_PARAMS>
+void CCompiledConstraints::add(
+	TGroup<2 * NUM_POINTS, NUM_PARAMS>& g, size_t row,
+	const std::array<size_t, NUM_POINTS>& points,
+	const std::array<size_t, 2 * NUM_POINTS>& slots,
+	const std::array<double, NUM_PARAMS>& params)
+{
+	g.rows.push_back(row);
+	for (size_t ip = 0; ip < NUM_POINTS; ip++)
+		for (size_t d = 0; d < 2; d++)
+			g.idx[2 * ip + d].push_back(pointIdxs_.at(points[ip])[d]);
+	for (size_t p = 0; p < NUM_PARAMS; p++) g.params[p].push_back(params[p]);
+	g.slots.push_back(slots);
+}
+
+void CCompiledConstraints::addConstantDistance(
+	size_t row, const std::array<size_t, 2>& points,
+	const std::array<size_t, 4>& slots, double length)
+{
+	add<2, 1>(constantDistance_, row, points, slots, {{square(length)}});
+}
+
+void CCompiledConstraints::addFixedSlider(
+	size_t row, size_t point, const std::array<size_t, 2>& slots,
+	const mrpt::math::TPoint2D& line_pt0, const mrpt::math::TPoint2D& delta)
+{
+	add<1, 4>(
+		fixedSlider_, row, {{point}}, slots,
+		{{line_pt0.x, line_pt0.y, delta.x, delta.y}});
+}
+
+void CCompiledConstraints::addMobileSlider(
+	size_t row, const std::array<size_t, 3>& points,
+	const std::array<size_t, 6>& slots)
+{
+	add<3, 0>(mobileSlider_, row, points, slots, {});
+}
+
+template <std::size_t NUM_ENTRIES, std::size_t NUM_PARAMS>
+void CCompiledConstraints::TGroup<NUM_ENTRIES, NUM_PARAMS>::finalize()
+{
+	const size_t n = size();
+	Phi.assign(n, .0);
+	dotPhi.assign(n, .0);
+	for (auto& j : jac) j.assign(NUM_ENTRIES * n, .0);
+
+	scatter_list.clear();
+	for (size_t e = 0; e < NUM_ENTRIES; e++)
+		for (size_t i = 0; i < n; i++)
+			if (slots[i][e] != INVALID_SLOT)
+				scatter_list.emplace_back(slots[i][e], e * n + i);
+
+	// Improve locality of writes:
+	std::sort(scatter_list.begin(), scatter_list.end());
+
+	slots.clear();
+	slots.shrink_to_fit();
+}
+
+template <std::size_t NUM_ENTRIES, std::size_t NUM_PARAMS>
+void CCompiledConstraints::TGroup<NUM_ENTRIES, NUM_PARAMS>::scatter(
+	CAssembledRigidModel& arm) const
+{
+	const size_t n = size();
+	for (size_t i = 0; i < n; i++)
+	{
+		arm.Phi_[rows[i]] = Phi[i];
+		arm.dotPhi_[rows[i]] = dotPhi[i];
+	}
+
+	double* out[4] = {arm.Phi_q_.valuePtr(), arm.dotPhi_q_.valuePtr(),
+					  arm.Phiqq_times_ddq_.valuePtr(),
+					  arm.dotPhiqq_times_dq_.valuePtr()};
+
+	arm.parallel_update_for(scatter_list.size(), [&](size_t i0, size_t i1) {
+		for (size_t m = 0; m < 4; m++)
+		{
+			const double* src = jac[m].data();
+			for (size_t k = i0; k < i1; k++)
+			{
+				const auto& s = scatter_list[k];
+				out[m][s.first] = src[s.second];
+			}
+		}
+	});
+}
+
+void CCompiledConstraints::update(CAssembledRigidModel& arm)
+{
+	const size_t nDOFs = arm.q_.size();
+	q_.head(nDOFs) = arm.q_;
+	dotq_.head(nDOFs) = arm.dotq_;
+	ddotq_.head(nDOFs) = arm.ddotq_;
+
+	const double* q = q_.data();
+	const double* dq = dotq_.data();
+	const double* ddq = ddotq_.data();
+
+	// Constant distance:
+	{
+		auto& g = constantDistance_;
+		const size_t n = g.size();
+		const size_t *x0 = g.idx[0].data(), *y0 = g.idx[1].data();
+		const size_t *x1 = g.idx[2].data(), *y1 = g.idx[3].data();
+		const double* length2 = g.params[0].data();
+		double *Phi = g.Phi.data(), *dotPhi = g.dotPhi.data();
+		double *J = g.jac[0].data(), *dJ = g.jac[1].data();
+		double* ddJ = g.jac[2].data();
+
+		arm.parallel_update_for(n, [&](size_t i0, size_t i1) {
+			for (size_t i = i0; i < i1; i++)
+			{
+				const double Ax = q[x1[i]] - q[x0[i]];
+				const double Ay = q[y1[i]] - q[y0[i]];
+				const double Adotx = dq[x1[i]] - dq[x0[i]];
+				const double Adoty = dq[y1[i]] - dq[y0[i]];
+				const double Addotx = ddq[x1[i]] - ddq[x0[i]];
+				const double Addoty = ddq[y1[i]] - ddq[y0[i]];
+
+				Phi[i] = square(Ax) + square(Ay) - length2[i];
+				dotPhi[i] = 2 * Ax * Adotx + 2 * Ay * Adoty;
+
+				J[i] = -2 * Ax;
+				J[n + i] = -2 * Ay;
+				J[2 * n + i] = +2 * Ax;
+				J[3 * n + i] = +2 * Ay;
+
+				dJ[i] = -2 * Adotx;
+				dJ[n + i] = -2 * Adoty;
+				dJ[2 * n + i] = +2 * Adotx;
+				dJ[3 * n + i] = +2 * Adoty;
+
+				ddJ[i] = -2 * Addotx;
+				ddJ[n + i] = -2 * Addoty;
+				ddJ[2 * n + i] = +2 * Addotx;
+				ddJ[3 * n + i] = +2 * Addoty;
+			}
+		});
+		// jac[3] (dotPhiqq_times_dq) is all zeros.
+		g.scatter(arm);
+	}
+
+	// Fixed slider:
+	{
+		auto& g = fixedSlider_;
+		const size_t n = g.size();
+		const size_t *x = g.idx[0].data(), *y = g.idx[1].data();
+		const double *lx0 = g.params[0].data(), *ly0 = g.params[1].data();
+		const double *Dx = g.params[2].data(), *Dy = g.params[3].data();
+		double *Phi = g.Phi.data(), *dotPhi = g.dotPhi.data();
+		double* J = g.jac[0].data();
+
+		arm.parallel_update_for(n, [&](size_t i0, size_t i1) {
+			for (size_t i = i0; i < i1; i++)
+			{
+				Phi[i] =
+					Dx[i] * (q[y[i]] - ly0[i]) - Dy[i] * (q[x[i]] - lx0[i]);
+				dotPhi[i] = Dx[i] * dq[y[i]] - Dy[i] * dq[x[i]];
+
+				J[i] = -Dy[i];
+				J[n + i] = Dx[i];
+			}
+		});
+		// jac[1..3] are all zeros.
+		g.scatter(arm);
+	}
+
+	// Mobile slider:
+	{
+		auto& g = mobileSlider_;
+		const size_t n = g.size();
+		const size_t *xi = g.idx[0].data(), *yi = g.idx[1].data();
+		const size_t *x0i = g.idx[2].data(), *y0i = g.idx[3].data();
+		const size_t *x1i = g.idx[4].data(), *y1i = g.idx[5].data();
+		double *Phi = g.Phi.data(), *dotPhi = g.dotPhi.data();
+		double *J = g.jac[0].data(), *dJ = g.jac[1].data();
+		double* ddJ = g.jac[2].data();
+
+		arm.parallel_update_for(n, [&](size_t i0, size_t i1) {
+			for (size_t i = i0; i < i1; i++)
+			{
+				const double x = q[xi[i]], y = q[yi[i]];
+				const double dotx = dq[xi[i]], doty = dq[yi[i]];
+				const double x0 = q[x0i[i]], y0 = q[y0i[i]];
+				const double dotx0 = dq[x0i[i]], doty0 = dq[y0i[i]];
+				const double x1 = q[x1i[i]], y1 = q[y1i[i]];
+				const double dotx1 = dq[x1i[i]], doty1 = dq[y1i[i]];
+
+				Phi[i] = (x1 - x0) * (y - y0) - (y1 - y0) * (x - x0);
+				dotPhi[i] = (dotx1 - dotx0) * (y - y0) +
+							(x1 - x0) * (doty - doty0) -
+							(doty1 - doty0) * (x - x0) -
+							(y1 - y0) * (dotx - dotx0);
+
+				J[i] = y0 - y1;
+				J[n + i] = x1 - x0;
+				J[2 * n + i] = -y + y1;
+				J[3 * n + i] = x - x1;
+				J[4 * n + i] = y - y0;
+				J[5 * n + i] = -x + x0;
+
+				dJ[i] = doty0 - doty1;
+				dJ[n + i] = dotx1 - dotx0;
+				dJ[2 * n + i] = -doty + doty1;
+				dJ[3 * n + i] = dotx - dotx1;
+				dJ[4 * n + i] = doty - doty0;
+				dJ[5 * n + i] = -dotx + dotx0;
+
+				// Phi is bilinear: its Hessian times ddq has the same form
+				// than dotPhi_q (and dotPhiqq_times_dq is zero).
+				const double ddotx = ddq[xi[i]], ddoty = ddq[yi[i]];
+				const double ddotx0 = ddq[x0i[i]], ddoty0 = ddq[y0i[i]];
+				const double ddotx1 = ddq[x1i[i]], ddoty1 = ddq[y1i[i]];
+
+				ddJ[i] = ddoty0 - ddoty1;
+				ddJ[n + i] = ddotx1 - ddotx0;
+				ddJ[2 * n + i] = -ddoty + ddoty1;
+				ddJ[3 * n + i] = ddotx - ddotx1;
+				ddJ[4 * n + i] = ddoty - ddoty0;
+				ddJ[5 * n + i] = -ddotx + ddotx0;
+			}
+		});
+		// jac[3] (dotPhiqq_times_dq) is all zeros.
+		g.scatter(arm);
+	}
+
+	// Everything else:
+	arm.parallel_update_for(generic_.size(), [&](size_t i0, size_t i1) {
+		for (size_t i = i0; i < i1; i++)
+			arm.constraints_[generic_[i]]->update(arm);
+	});
+}
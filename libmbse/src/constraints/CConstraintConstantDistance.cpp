@@ -9,6 +9,7 @@
   +-------------------------------------------------------------------------+ */
 
 #include <mbse/constraints/CConstraintConstantDistance.h>
+#include <mbse/constraints/CCompiledConstraints.h>
 
 using namespace mbse;
 using namespace Eigen;
@@ -56,29 +57,77 @@ void CConstraintConstantDistance::update(CAssembledRigidModel& arm) const
 
 	// Update Jacobian dPhi_dq(i,:)
 	// ----------------------------------
-	set(j.dPhi_dx[0], -2 * Ax);
-	set(j.dPhi_dy[0], -2 * Ay);
-	set(j.dPhi_dx[1], +2 * Ax);
-	set(j.dPhi_dy[1], +2 * Ay);
+	set(arm.Phi_q_, j.dx[0], -2 * Ax);
+	set(arm.Phi_q_, j.dy[0], -2 * Ay);
+	set(arm.Phi_q_, j.dx[1], +2 * Ax);
+	set(arm.Phi_q_, j.dy[1], +2 * Ay);
 
 	// Update Jacobian \dot{dPhi_dq}(i,:)
 	// ----------------------------------
-	set(j.dot_dPhi_dx[0], -2 * Adotx);
-	set(j.dot_dPhi_dy[0], -2 * Adoty);
-	set(j.dot_dPhi_dx[1], +2 * Adotx);
-	set(j.dot_dPhi_dy[1], +2 * Adoty);
+	set(arm.dotPhi_q_, j.dx[0], -2 * Adotx);
+	set(arm.dotPhi_q_, j.dy[0], -2 * Adoty);
+	set(arm.dotPhi_q_, j.dx[1], +2 * Adotx);
+	set(arm.dotPhi_q_, j.dy[1], +2 * Adoty);
 
 	// Update Phiqq_times_ddq
 	// ----------------------------------
-	set(j.Phiqq_times_ddq_dx[0], -2 * Addotx);
-	set(j.Phiqq_times_ddq_dy[0], -2 * Addoty);
-	set(j.Phiqq_times_ddq_dx[1], +2 * Addotx);
-	set(j.Phiqq_times_ddq_dy[1], +2 * Addoty);
+	set(arm.Phiqq_times_ddq_, j.dx[0], -2 * Addotx);
+	set(arm.Phiqq_times_ddq_, j.dy[0], -2 * Addoty);
+	set(arm.Phiqq_times_ddq_, j.dx[1], +2 * Addotx);
+	set(arm.Phiqq_times_ddq_, j.dy[1], +2 * Addoty);
 
 	// Update dotPhiqq_times_dq_dx
 	// ----------------------------------
-	set(j.dotPhiqq_times_dq_dx[0], 0);
-	set(j.dotPhiqq_times_dq_dy[0], 0);
-	set(j.dotPhiqq_times_dq_dx[1], 0);
-	set(j.dotPhiqq_times_dq_dy[1], 0);
+	set(arm.dotPhiqq_times_dq_, j.dx[0], 0);
+	set(arm.dotPhiqq_times_dq_, j.dy[0], 0);
+	set(arm.dotPhiqq_times_dq_, j.dx[1], 0);
+	set(arm.dotPhiqq_times_dq_, j.dy[1], 0);
+}
+
+bool CConstraintConstantDistance::compile(CCompiledConstraints& cc) const
+{
+	const auto& j = jacob.at(0);
+	cc.addConstantDistance(
+		idx_constr_[0], point_index, {{j.dx[0], j.dy[0], j.dx[1], j.dy[1]}},
+		length);
+	return true;
+}
+
+void CConstraintConstantDistance::updateBatch(
+	CAssembledRigidModelBatch& b) const
+{
+	const PointRows p[2] = {batch_coords(b, 0), batch_coords(b, 1)};
+	const auto& j = jacob.at(0);
+
+	double* Phi = &b.Phi_(idx_constr_[0], 0);
+	double* dotPhi = &b.dotPhi_(idx_constr_[0], 0);
+	double* Phi_q[4] = {
+		b.jacobRow(b.Phi_q_, j.dx[0]), b.jacobRow(b.Phi_q_, j.dy[0]),
+		b.jacobRow(b.Phi_q_, j.dx[1]), b.jacobRow(b.Phi_q_, j.dy[1])};
+	double* dotPhi_q[4] = {
+		b.jacobRow(b.dotPhi_q_, j.dx[0]), b.jacobRow(b.dotPhi_q_, j.dy[0]),
+		b.jacobRow(b.dotPhi_q_, j.dx[1]), b.jacobRow(b.dotPhi_q_, j.dy[1])};
+
+	const double length2 = square(length);
+
+	for (size_t k = 0; k < b.size(); k++)
+	{
+		const double Ax = p[1].x[k] - p[0].x[k];
+		const double Ay = p[1].y[k] - p[0].y[k];
+		const double Adotx = p[1].dotx[k] - p[0].dotx[k];
+		const double Adoty = p[1].doty[k] - p[0].doty[k];
+
+		Phi[k] = square(Ax) + square(Ay) - length2;
+		dotPhi[k] = 2 * Ax * Adotx + 2 * Ay * Adoty;
+
+		Phi_q[0][k] = -2 * Ax;
+		Phi_q[1][k] = -2 * Ay;
+		Phi_q[2][k] = +2 * Ax;
+		Phi_q[3][k] = +2 * Ay;
+
+		dotPhi_q[0][k] = -2 * Adotx;
+		dotPhi_q[1][k] = -2 * Adoty;
+		dotPhi_q[2][k] = +2 * Adotx;
+		dotPhi_q[3][k] = +2 * Adoty;
+	}
 }
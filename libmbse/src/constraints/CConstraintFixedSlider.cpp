@@ -9,6 +9,7 @@
   +-------------------------------------------------------------------------+ */
 
 #include <mbse/constraints/CConstraintFixedSlider.h>
+#include <mbse/constraints/CCompiledConstraints.h>
 #include <mrpt/opengl/CSimpleLine.h>
 
 using namespace mbse;
@@ -51,28 +52,60 @@ void CConstraintFixedSlider::update(CAssembledRigidModel& arm) const
 
 	// Update Jacobian dPhi_dq(i,:)
 	// ----------------------------------
-	set(j.dPhi_dx[0], -Delta_.y);
-	set(j.dPhi_dy[0], Delta_.x);
+	set(arm.Phi_q_, j.dx[0], -Delta_.y);
+	set(arm.Phi_q_, j.dy[0], Delta_.x);
 
 	// Update Jacobian \dot{dPhi_dq}(i,:)
 	// ----------------------------------
-	if (j.dot_dPhi_dx[0]) *j.dot_dPhi_dx[0] = 0;
-	if (j.dot_dPhi_dy[0]) *j.dot_dPhi_dy[0] = 0;
+	set(arm.dotPhi_q_, j.dx[0], 0);
+	set(arm.dotPhi_q_, j.dy[0], 0);
 
 	// Update Phiqq_times_ddq
 	// ----------------------------------
 	MRPT_TODO("Write actual values!");
-	set(j.Phiqq_times_ddq_dx[0], 0);
-	set(j.Phiqq_times_ddq_dy[0], 0);
-	set(j.Phiqq_times_ddq_dx[1], 0);
-	set(j.Phiqq_times_ddq_dy[1], 0);
+	set(arm.Phiqq_times_ddq_, j.dx[0], 0);
+	set(arm.Phiqq_times_ddq_, j.dy[0], 0);
 
 	// Update dotPhiqq_times_dq_dx
 	// ----------------------------------
-	set(j.dotPhiqq_times_dq_dx[0], 0);
-	set(j.dotPhiqq_times_dq_dy[0], 0);
-	set(j.dotPhiqq_times_dq_dx[1], 0);
-	set(j.dotPhiqq_times_dq_dy[1], 0);
+	set(arm.dotPhiqq_times_dq_, j.dx[0], 0);
+	set(arm.dotPhiqq_times_dq_, j.dy[0], 0);
+}
+
+bool CConstraintFixedSlider::compile(CCompiledConstraints& cc) const
+{
+	const auto& j = jacob.at(0);
+	cc.addFixedSlider(
+		idx_constr_[0], point_index[0], {{j.dx[0], j.dy[0]}}, line_pt[0],
+		Delta_);
+	return true;
+}
+
+void CConstraintFixedSlider::updateBatch(CAssembledRigidModelBatch& b) const
+{
+	const PointRows p = batch_coords(b, 0);
+	const auto& j = jacob.at(0);
+
+	double* Phi = &b.Phi_(idx_constr_[0], 0);
+	double* dotPhi = &b.dotPhi_(idx_constr_[0], 0);
+	double* Phi_q[2] = {
+		b.jacobRow(b.Phi_q_, j.dx[0]), b.jacobRow(b.Phi_q_, j.dy[0])};
+	double* dotPhi_q[2] = {
+		b.jacobRow(b.dotPhi_q_, j.dx[0]), b.jacobRow(b.dotPhi_q_, j.dy[0])};
+
+	for (size_t k = 0; k < b.size(); k++)
+	{
+		const double py_y0 = p.y[k] - line_pt[0].y;
+		const double px_x0 = p.x[k] - line_pt[0].x;
+		Phi[k] = Delta_.x * py_y0 - Delta_.y * px_x0;
+		dotPhi[k] = Delta_.x * p.doty[k] - Delta_.y * p.dotx[k];
+
+		Phi_q[0][k] = -Delta_.y;
+		Phi_q[1][k] = Delta_.x;
+
+		dotPhi_q[0][k] = 0;
+		dotPhi_q[1][k] = 0;
+	}
 }
 
 /** Creates a 3D representation of the constraint, if applicable (e.g. the line
@@ -9,6 +9,7 @@
   +-------------------------------------------------------------------------+ */
 
 #include <mbse/constraints/CConstraintMobileSlider.h>
+#include <mbse/constraints/CCompiledConstraints.h>
 
 using namespace mbse;
 using namespace Eigen;
@@ -46,38 +47,98 @@ void CConstraintMobileSlider::update(CAssembledRigidModel& arm) const
 
 	// Update Jacobian dPhi_dq(i,:)
 	// ----------------------------------
-	if (j.dPhi_dx[0]) *j.dPhi_dx[0] = pr[0].y - pr[1].y;
-	if (j.dPhi_dy[0]) *j.dPhi_dy[0] = pr[1].x - pr[0].x;
+	set(arm.Phi_q_, j.dx[0], pr[0].y - pr[1].y);
+	set(arm.Phi_q_, j.dy[0], pr[1].x - pr[0].x);
 
-	if (j.dPhi_dx[1]) *j.dPhi_dx[1] = -p.y + pr[1].y;
-	if (j.dPhi_dy[1]) *j.dPhi_dy[1] = p.x - pr[1].x;
+	set(arm.Phi_q_, j.dx[1], -p.y + pr[1].y);
+	set(arm.Phi_q_, j.dy[1], p.x - pr[1].x);
 
-	if (j.dPhi_dx[2]) *j.dPhi_dx[2] = p.y - pr[0].y;
-	if (j.dPhi_dy[2]) *j.dPhi_dy[2] = -p.x + pr[0].x;
+	set(arm.Phi_q_, j.dx[2], p.y - pr[0].y);
+	set(arm.Phi_q_, j.dy[2], -p.x + pr[0].x);
 
 	// Update Jacobian \dot{dPhi_dq}(i,:)
 	// ----------------------------------
-	set(j.dot_dPhi_dx[0], pr[0].doty - pr[1].doty);
-	set(j.dot_dPhi_dy[0], pr[1].dotx - pr[0].dotx);
+	set(arm.dotPhi_q_, j.dx[0], pr[0].doty - pr[1].doty);
+	set(arm.dotPhi_q_, j.dy[0], pr[1].dotx - pr[0].dotx);
 
-	set(j.dot_dPhi_dx[1], -p.doty + pr[1].doty);
-	set(j.dot_dPhi_dy[1], p.dotx - pr[1].dotx);
+	set(arm.dotPhi_q_, j.dx[1], -p.doty + pr[1].doty);
+	set(arm.dotPhi_q_, j.dy[1], p.dotx - pr[1].dotx);
 
-	set(j.dot_dPhi_dx[2], p.doty - pr[0].doty);
-	set(j.dot_dPhi_dy[2], -p.dotx + pr[0].dotx);
+	set(arm.dotPhi_q_, j.dx[2], p.doty - pr[0].doty);
+	set(arm.dotPhi_q_, j.dy[2], -p.dotx + pr[0].dotx);
 
-	// Update Phiqq_times_ddq
+	// Update Phiqq_times_ddq (Phi is bilinear: same form as dotPhi_q)
 	// ----------------------------------
-	MRPT_TODO("Write actual values!");
-	set(j.Phiqq_times_ddq_dx[0], 0);
-	set(j.Phiqq_times_ddq_dy[0], 0);
-	set(j.Phiqq_times_ddq_dx[1], 0);
-	set(j.Phiqq_times_ddq_dy[1], 0);
+	set(arm.Phiqq_times_ddq_, j.dx[0], pr[0].ddoty - pr[1].ddoty);
+	set(arm.Phiqq_times_ddq_, j.dy[0], pr[1].ddotx - pr[0].ddotx);
 
-	// Update dotPhiqq_times_dq_dx
+	set(arm.Phiqq_times_ddq_, j.dx[1], -p.ddoty + pr[1].ddoty);
+	set(arm.Phiqq_times_ddq_, j.dy[1], p.ddotx - pr[1].ddotx);
+
+	set(arm.Phiqq_times_ddq_, j.dx[2], p.ddoty - pr[0].ddoty);
+	set(arm.Phiqq_times_ddq_, j.dy[2], -p.ddotx + pr[0].ddotx);
+
+	// Update dotPhiqq_times_dq_dx (dotPhi_q does not depend on q)
 	// ----------------------------------
-	set(j.dotPhiqq_times_dq_dx[0], 0);
-	set(j.dotPhiqq_times_dq_dy[0], 0);
-	set(j.dotPhiqq_times_dq_dx[1], 0);
-	set(j.dotPhiqq_times_dq_dy[1], 0);
+	for (size_t i = 0; i < 3; i++)
+	{
+		set(arm.dotPhiqq_times_dq_, j.dx[i], 0);
+		set(arm.dotPhiqq_times_dq_, j.dy[i], 0);
+	}
+}
+
+bool CConstraintMobileSlider::compile(CCompiledConstraints& cc) const
+{
+	const auto& j = jacob.at(0);
+	cc.addMobileSlider(
+		idx_constr_[0], point_index,
+		{{j.dx[0], j.dy[0], j.dx[1], j.dy[1], j.dx[2], j.dy[2]}});
+	return true;
+}
+
+void CConstraintMobileSlider::updateBatch(CAssembledRigidModelBatch& b) const
+{
+	const PointRows p = batch_coords(b, 0);
+	const PointRows pr[2] = {batch_coords(b, 1), batch_coords(b, 2)};
+	const auto& j = jacob.at(0);
+
+	double* Phi = &b.Phi_(idx_constr_[0], 0);
+	double* dotPhi = &b.dotPhi_(idx_constr_[0], 0);
+	double* Phi_q[6];
+	double* dotPhi_q[6];
+	for (size_t i = 0; i < 3; i++)
+	{
+		Phi_q[2 * i + 0] = b.jacobRow(b.Phi_q_, j.dx[i]);
+		Phi_q[2 * i + 1] = b.jacobRow(b.Phi_q_, j.dy[i]);
+		dotPhi_q[2 * i + 0] = b.jacobRow(b.dotPhi_q_, j.dx[i]);
+		dotPhi_q[2 * i + 1] = b.jacobRow(b.dotPhi_q_, j.dy[i]);
+	}
+
+	for (size_t k = 0; k < b.size(); k++)
+	{
+		const double x = p.x[k], y = p.y[k];
+		const double dotx = p.dotx[k], doty = p.doty[k];
+		const double x0 = pr[0].x[k], y0 = pr[0].y[k];
+		const double dotx0 = pr[0].dotx[k], doty0 = pr[0].doty[k];
+		const double x1 = pr[1].x[k], y1 = pr[1].y[k];
+		const double dotx1 = pr[1].dotx[k], doty1 = pr[1].doty[k];
+
+		Phi[k] = (x1 - x0) * (y - y0) - (y1 - y0) * (x - x0);
+		dotPhi[k] = (dotx1 - dotx0) * (y - y0) + (x1 - x0) * (doty - doty0) -
+					(doty1 - doty0) * (x - x0) - (y1 - y0) * (dotx - dotx0);
+
+		Phi_q[0][k] = y0 - y1;
+		Phi_q[1][k] = x1 - x0;
+		Phi_q[2][k] = -y + y1;
+		Phi_q[3][k] = x - x1;
+		Phi_q[4][k] = y - y0;
+		Phi_q[5][k] = -x + x0;
+
+		dotPhi_q[0][k] = doty0 - doty1;
+		dotPhi_q[1][k] = dotx1 - dotx0;
+		dotPhi_q[2][k] = -doty + doty1;
+		dotPhi_q[3][k] = dotx - dotx1;
+		dotPhi_q[4][k] = doty - doty0;
+		dotPhi_q[5][k] = -dotx + dotx0;
+	}
 }
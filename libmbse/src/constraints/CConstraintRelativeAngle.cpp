@@ -27,56 +27,85 @@ void CConstraintRelativeAngle::buildSparseStructures(
 
 void CConstraintRelativeAngle::update(CAssembledRigidModel& arm) const
 {
-	// Get references to the point coordinates and velocities
-	// (either fixed or variables in q):
-	PointRef p[3] = {actual_coords(arm, 0), actual_coords(arm, 1),
-					 actual_coords(arm, 2)};
+	// Local coordinates: (x,y) of the three points, then the angle. With
+	// u=pt1-pt0 and v=pt2-pt0, Phi=|u||v|sin(angle(u,v)-th), written without
+	// divisions or branches. All derivatives are obtained automatically.
+	autodiff_update(arm, [](const auto& q) {
+		const auto ux = q[2] - q[0], uy = q[3] - q[1];
+		const auto vx = q[4] - q[0], vy = q[5] - q[1];
+		const auto& th = q[6];
+		return (ux * vy - uy * vx) * cos(th) - (ux * vx + uy * vy) * sin(th);
+	});
+}
+
+/* Same Phi than update(), with its derivatives written by hand. With
+ * C=cross(u,v) and D=dot(u,v): Phi = C*cos(th) - D*sin(th). */
+void CConstraintRelativeAngle::updateBatch(CAssembledRigidModelBatch& b) const
+{
+	const PointRows p[3] = {
+		batch_coords(b, 0), batch_coords(b, 1), batch_coords(b, 2)};
+	const auto angle = batch_rel_coords(b, 0);
+	const auto& j = jacob.at(0);
 
-	const double Ax = p[1].x - p[0].x;
-	const double Ay = p[1].y - p[0].y;
+	double* Phi = &b.Phi_(idx_constr_[0], 0);
+	double* dotPhi = &b.dotPhi_(idx_constr_[0], 0);
+	double* Phi_q[7];
+	double* dotPhi_q[7];
+	for (size_t i = 0; i < 3; i++)
+	{
+		Phi_q[2 * i + 0] = b.jacobRow(b.Phi_q_, j.dx[i]);
+		Phi_q[2 * i + 1] = b.jacobRow(b.Phi_q_, j.dy[i]);
+		dotPhi_q[2 * i + 0] = b.jacobRow(b.dotPhi_q_, j.dx[i]);
+		dotPhi_q[2 * i + 1] = b.jacobRow(b.dotPhi_q_, j.dy[i]);
+	}
+	Phi_q[6] = b.jacobRow(b.Phi_q_, j.drel[0]);
+	dotPhi_q[6] = b.jacobRow(b.dotPhi_q_, j.drel[0]);
 
-	const double Adotx = p[1].dotx - p[0].dotx;
-	const double Adoty = p[1].doty - p[0].doty;
+	for (size_t k = 0; k < b.size(); k++)
+	{
+		const double ux = p[1].x[k] - p[0].x[k], uy = p[1].y[k] - p[0].y[k];
+		const double vx = p[2].x[k] - p[0].x[k], vy = p[2].y[k] - p[0].y[k];
+		const double dux = p[1].dotx[k] - p[0].dotx[k];
+		const double duy = p[1].doty[k] - p[0].doty[k];
+		const double dvx = p[2].dotx[k] - p[0].dotx[k];
+		const double dvy = p[2].doty[k] - p[0].doty[k];
 
-	// Update Phi[i]
-	// ----------------------------------
-	MRPT_TODO("Continue!");
-	THROW_EXCEPTION("TO DO");
-	const double PhiVal = 0;  // XXX
-	arm.Phi_[idx_constr_[0]] = PhiVal;
+		const double th = angle[0][k], w = angle[1][k];
+		const double c = std::cos(th), s = std::sin(th);
 
-	// Update dotPhi[i]
-	// ----------------------------------
-	arm.dotPhi_[idx_constr_[0]] = 2 * Ax * Adotx + 2 * Ay * Adoty;
+		const double C = ux * vy - uy * vx, D = ux * vx + uy * vy;
+		const double dotC = dux * vy + ux * dvy - duy * vx - uy * dvx;
+		const double dotD = dux * vx + ux * dvx + duy * vy + uy * dvy;
 
-	auto& j = jacob.at(0);  // 1st (and unique) jacob row
+		// Partial derivatives wrt u, v and th, and their time derivatives:
+		const double Phi_ux = vy * c - vx * s, Phi_uy = -vx * c - vy * s;
+		const double Phi_vx = -uy * c - ux * s, Phi_vy = ux * c - uy * s;
+		const double Phi_th = -C * s - D * c;
 
-	// Update Jacobian dPhi_dq(i,:)
-	// ----------------------------------
-	set(j.dPhi_dx[0], -2 * Ax);
-	set(j.dPhi_dy[0], -2 * Ay);
-	set(j.dPhi_dx[1], 2 * Ax);
-	set(j.dPhi_dy[1], 2 * Ay);
+		const double dotPhi_ux = dvy * c - dvx * s - (vy * s + vx * c) * w;
+		const double dotPhi_uy = -dvx * c - dvy * s + (vx * s - vy * c) * w;
+		const double dotPhi_vx = -duy * c - dux * s + (uy * s - ux * c) * w;
+		const double dotPhi_vy = dux * c - duy * s - (ux * s + uy * c) * w;
+		const double dotPhi_th = -dotC * s - dotD * c + (D * s - C * c) * w;
 
-	// Update Jacobian \dot{dPhi_dq}(i,:)
-	// ----------------------------------
-	set(j.dot_dPhi_dx[0], -2 * Adotx);
-	set(j.dot_dPhi_dy[0], -2 * Adoty);
-	set(j.dot_dPhi_dx[1], 2 * Adotx);
-	set(j.dot_dPhi_dy[1], 2 * Adoty);
+		Phi[k] = C * c - D * s;
+		dotPhi[k] = Phi_ux * dux + Phi_uy * duy + Phi_vx * dvx +
+					Phi_vy * dvy + Phi_th * w;
 
-	// Update Phiqq_times_ddq
-	// ----------------------------------
-	MRPT_TODO("Write actual values!");
-	set(j.Phiqq_times_ddq_dx[0], 0);
-	set(j.Phiqq_times_ddq_dy[0], 0);
-	set(j.Phiqq_times_ddq_dx[1], 0);
-	set(j.Phiqq_times_ddq_dy[1], 0);
+		Phi_q[0][k] = -Phi_ux - Phi_vx;
+		Phi_q[1][k] = -Phi_uy - Phi_vy;
+		Phi_q[2][k] = Phi_ux;
+		Phi_q[3][k] = Phi_uy;
+		Phi_q[4][k] = Phi_vx;
+		Phi_q[5][k] = Phi_vy;
+		Phi_q[6][k] = Phi_th;
 
-	// Update dotPhiqq_times_dq_dx
-	// ----------------------------------
-	set(j.dotPhiqq_times_dq_dx[0], 0);
-	set(j.dotPhiqq_times_dq_dy[0], 0);
-	set(j.dotPhiqq_times_dq_dx[1], 0);
-	set(j.dotPhiqq_times_dq_dy[1], 0);
+		dotPhi_q[0][k] = -dotPhi_ux - dotPhi_vx;
+		dotPhi_q[1][k] = -dotPhi_uy - dotPhi_vy;
+		dotPhi_q[2][k] = dotPhi_ux;
+		dotPhi_q[3][k] = dotPhi_uy;
+		dotPhi_q[4][k] = dotPhi_vx;
+		dotPhi_q[5][k] = dotPhi_vy;
+		dotPhi_q[6][k] = dotPhi_th;
+	}
 }
@@ -16,6 +16,33 @@ using namespace mbse;
 using namespace Eigen;
 using mrpt::square;
 
+namespace
+{
+/* Updates the values cached across calls for one state, and returns whether
+ * to use the cos() version of the equations (instead of the sin() one).
+ *
+ * Always recalculating L leads to failed numerical Jacobian tests, since it
+ * introduces fake dependencies between (x,y) coordinates. In the same way,
+ * the version of the equations is chosen from a cached version of sin(th),
+ * so it does not switch back and forth between two nearby evaluations. */
+bool updateCachedValues(
+	const double Lsqr_now, const double sinTh, double& Lsqr, double& L,
+	double& sinThCache)
+{
+	if (Lsqr == 0 || std::abs(Lsqr / Lsqr_now - 1.0) > 0.02)
+	{
+		Lsqr = Lsqr_now;
+		L = std::sqrt(Lsqr);
+	}
+	if (std::abs(sinTh - sinThCache) > 0.01) sinThCache = sinTh;
+
+	// This constraints has 2 possible set of equations, with sin() or cos():
+	// sin(): pi/4
+	// cos(): pi*3/4
+	return std::abs(sinThCache) > 0.707;
+}
+}  // namespace
+
 void CConstraintRelativeAngleAbsolute::buildSparseStructures(
 	CAssembledRigidModel& arm) const
 {
@@ -36,37 +63,18 @@ void CConstraintRelativeAngleAbsolute::update(CAssembledRigidModel& arm) const
 	const double Ax = p[1].x - p[0].x;
 	const double Ay = p[1].y - p[0].y;
 
-	// Always recalculating L leads to failed numerical Jacobian tests,
-	// since it introduces fake dependencies between (x,y) coordinates.
-	const double Lsqr_now = Ax * Ax + Ay * Ay;
-	if (Lsqr_ == 0 || std::abs(Lsqr_ / Lsqr_now - 1.0) > 0.02)
-	{
-		// Update cached values
-		Lsqr_ = Lsqr_now;
-		L_ = std::sqrt(Lsqr_);
-	}
-	const double L = L_;
-
 	const double Adotx = p[1].dotx - p[0].dotx;
 	const double Adoty = p[1].doty - p[0].doty;
 
-	// This constraints has 2 possible set of equations, with sin() or cos():
-	// sin(): pi/4
-	// cos(): pi*3/4
-
 	const double theta = angle.x;
 	const double w = angle.dotx;
 	const double angAcc = angle.ddotx;
 
 	const double sinTh = std::sin(theta), cosTh = std::cos(theta);
 
-	// Use a cached version of "sinTh" to decide which version of the Jacobian
-	// to use, since always recalculating it leads to errors in numerical
-	// Jacobians:
-	if (std::abs(sinTh - sinThCache_) > 0.01)
-		// Update cached values
-		sinThCache_ = sinTh;
-	const bool useCos = std::abs(sinThCache_) > 0.707;
+	const bool useCos = updateCachedValues(
+		Ax * Ax + Ay * Ay, sinTh, Lsqr_, L_, sinThCache_);
+	const double L = L_;
 
 	// Update Phi[i]
 	// ----------------------------------
@@ -84,53 +92,111 @@ void CConstraintRelativeAngleAbsolute::update(CAssembledRigidModel& arm) const
 	// ----------------------------------
 	if (useCos)
 	{
-		set(j.dPhi_dx[0], -1);
-		set(j.dPhi_dx[1], 1);
-		set(j.dPhi_drel[0], L * sinTh);
+		set(arm.Phi_q_, j.dx[0], -1);
+		set(arm.Phi_q_, j.dx[1], 1);
+		set(arm.Phi_q_, j.drel[0], L * sinTh);
 
-		set(j.dPhi_dy[0], 0);
-		set(j.dPhi_dy[1], 0);
+		set(arm.Phi_q_, j.dy[0], 0);
+		set(arm.Phi_q_, j.dy[1], 0);
 	}
 	else
 	{
-		set(j.dPhi_dy[0], -1);
-		set(j.dPhi_dy[1], 1);
-		set(j.dPhi_drel[0], -L * cosTh);
+		set(arm.Phi_q_, j.dy[0], -1);
+		set(arm.Phi_q_, j.dy[1], 1);
+		set(arm.Phi_q_, j.drel[0], -L * cosTh);
 
-		set(j.dPhi_dx[0], 0);
-		set(j.dPhi_dx[1], 0);
+		set(arm.Phi_q_, j.dx[0], 0);
+		set(arm.Phi_q_, j.dx[1], 0);
 	}
 
 	// Update Jacobian \dot{dPhi_dq}(i,:)
 	// ----------------------------------
-	set(j.dot_dPhi_dx[0], 0);
-	set(j.dot_dPhi_dy[0], 0);
-	set(j.dot_dPhi_dx[1], 0);
-	set(j.dot_dPhi_dy[1], 0);
+	set(arm.dotPhi_q_, j.dx[0], 0);
+	set(arm.dotPhi_q_, j.dy[0], 0);
+	set(arm.dotPhi_q_, j.dx[1], 0);
+	set(arm.dotPhi_q_, j.dy[1], 0);
 	if (useCos)
-		set(j.dot_dPhi_drel[0], L * cosTh * w);
+		set(arm.dotPhi_q_, j.drel[0], L * cosTh * w);
 	else
-		set(j.dot_dPhi_drel[0], L * sinTh * w);
+		set(arm.dotPhi_q_, j.drel[0], L * sinTh * w);
 
 	// Update Phiqq_times_ddq
 	// ----------------------------------
-	set(j.Phiqq_times_ddq_dx[0], 0);
-	set(j.Phiqq_times_ddq_dy[0], 0);
-	set(j.Phiqq_times_ddq_dx[1], 0);
-	set(j.Phiqq_times_ddq_dy[1], 0);
+	set(arm.Phiqq_times_ddq_, j.dx[0], 0);
+	set(arm.Phiqq_times_ddq_, j.dy[0], 0);
+	set(arm.Phiqq_times_ddq_, j.dx[1], 0);
+	set(arm.Phiqq_times_ddq_, j.dy[1], 0);
 	if (useCos)
-		set(j.Phiqq_times_ddq_drel[0], L * cosTh * angAcc);
+		set(arm.Phiqq_times_ddq_, j.drel[0], L * cosTh * angAcc);
 	else
-		set(j.Phiqq_times_ddq_drel[0], L * sinTh * angAcc);
+		set(arm.Phiqq_times_ddq_, j.drel[0], L * sinTh * angAcc);
 
 	// Update dotPhiqq_times_dq
 	// ----------------------------------
-	set(j.dotPhiqq_times_dq_dx[0], 0);
-	set(j.dotPhiqq_times_dq_dy[0], 0);
-	set(j.dotPhiqq_times_dq_dx[1], 0);
-	set(j.dotPhiqq_times_dq_dy[1], 0);
+	set(arm.dotPhiqq_times_dq_, j.dx[0], 0);
+	set(arm.dotPhiqq_times_dq_, j.dy[0], 0);
+	set(arm.dotPhiqq_times_dq_, j.dx[1], 0);
+	set(arm.dotPhiqq_times_dq_, j.dy[1], 0);
 	if (useCos)
-		set(j.dotPhiqq_times_dq_drel[0], -L * w * w * sinTh);
+		set(arm.dotPhiqq_times_dq_, j.drel[0], -L * w * w * sinTh);
 	else
-		set(j.dotPhiqq_times_dq_drel[0], L * w * w * cosTh);
+		set(arm.dotPhiqq_times_dq_, j.drel[0], L * w * w * cosTh);
+}
+
+/* The values cached by update() are kept for each state of the batch, so
+ * both choose the same version of the equations for the same history. */
+void CConstraintRelativeAngleAbsolute::updateBatch(
+	CAssembledRigidModelBatch& b) const
+{
+	const PointRows p[2] = {batch_coords(b, 0), batch_coords(b, 1)};
+	const auto angle = batch_rel_coords(b, 0);
+	const auto& j = jacob.at(0);
+
+	// Rows: Lsqr, L, sinThCache
+	auto& cache = b.constraintCache(idx_constr_[0], 3);
+	double* Lsqr = &cache(0, 0);
+	double* Lc = &cache(1, 0);
+	double* sinThCache = &cache(2, 0);
+
+	double* Phi = &b.Phi_(idx_constr_[0], 0);
+	double* dotPhi = &b.dotPhi_(idx_constr_[0], 0);
+	double* Phi_q[5] = {
+		b.jacobRow(b.Phi_q_, j.dx[0]), b.jacobRow(b.Phi_q_, j.dy[0]),
+		b.jacobRow(b.Phi_q_, j.dx[1]), b.jacobRow(b.Phi_q_, j.dy[1]),
+		b.jacobRow(b.Phi_q_, j.drel[0])};
+	double* dotPhi_q[5] = {
+		b.jacobRow(b.dotPhi_q_, j.dx[0]), b.jacobRow(b.dotPhi_q_, j.dy[0]),
+		b.jacobRow(b.dotPhi_q_, j.dx[1]), b.jacobRow(b.dotPhi_q_, j.dy[1]),
+		b.jacobRow(b.dotPhi_q_, j.drel[0])};
+
+	for (size_t k = 0; k < b.size(); k++)
+	{
+		const double Ax = p[1].x[k] - p[0].x[k];
+		const double Ay = p[1].y[k] - p[0].y[k];
+		const double Adotx = p[1].dotx[k] - p[0].dotx[k];
+		const double Adoty = p[1].doty[k] - p[0].doty[k];
+
+		const double theta = angle[0][k];
+		const double w = angle[1][k];
+		const double sinTh = std::sin(theta), cosTh = std::cos(theta);
+
+		const bool useCos = updateCachedValues(
+			Ax * Ax + Ay * Ay, sinTh, Lsqr[k], Lc[k], sinThCache[k]);
+		const double L = Lc[k];
+
+		Phi[k] = useCos ? Ax - L * cosTh : Ay - L * sinTh;
+		dotPhi[k] = useCos ? Adotx + L * sinTh * w : Adoty - L * cosTh * w;
+
+		Phi_q[0][k] = useCos ? -1 : 0;
+		Phi_q[1][k] = useCos ? 0 : -1;
+		Phi_q[2][k] = useCos ? 1 : 0;
+		Phi_q[3][k] = useCos ? 0 : 1;
+		Phi_q[4][k] = useCos ? L * sinTh : -L * cosTh;
+
+		dotPhi_q[0][k] = 0;
+		dotPhi_q[1][k] = 0;
+		dotPhi_q[2][k] = 0;
+		dotPhi_q[3][k] = 0;
+		dotPhi_q[4][k] = useCos ? L * cosTh * w : L * sinTh * w;
+	}
 }
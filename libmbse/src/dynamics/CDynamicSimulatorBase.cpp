@@ -12,6 +12,7 @@
 #include <mbse/CAssembledRigidModel.h>
 #include <mbse/dynamics/dynamic-simulators.h>
 #include <fstream>
+#include <optional>
 
 using namespace mbse;
 using namespace Eigen;
@@ -19,8 +20,6 @@ using namespace mrpt::math;
 using namespace mrpt;
 using namespace std;
 
-#define USE_BAUMGARTEN_STABILIZATION 1
-
 const double dummy_zero = 0;
 
 TSimulationState::TSimulationState(const CAssembledRigidModel* arm_)
@@ -47,6 +46,10 @@ CDynamicSimulatorBase::Ptr CDynamicSimulatorBase::Create(
 		return Ptr(new CDynamicSimulator_Lagrange_UMFPACK(arm_ptr));
 	else if (name == "CDynamicSimulator_Lagrange_KLU")
 		return Ptr(new CDynamicSimulator_Lagrange_KLU(arm_ptr));
+	else if (name == "CDynamicSimulator_Indep_dense")
+		return Ptr(new CDynamicSimulator_Indep_dense(arm_ptr));
+	else if (name == "CDynamicSimulator_Indep_sparse")
+		return Ptr(new CDynamicSimulator_Indep_sparse(arm_ptr));
 	else
 		THROW_EXCEPTION("Unknown dynamic simulator class name: " + name);
 }
@@ -61,6 +64,39 @@ CDynamicSimulatorBase::CDynamicSimulatorBase(
 	ASSERT_(arm_ptr);
 }
 
+CDynamicSimulatorBase::Ptr CDynamicSimulatorBase::clone(
+	[[maybe_unused]] const std::shared_ptr<CAssembledRigidModel>& arm) const
+{
+	THROW_EXCEPTION("clone() not implemented for this simulator class");
+}
+
+template <class SIMUL>
+static std::shared_ptr<CPerThreadCopies<SIMUL>> internalMakePerThreadCopies(
+	SIMUL* simul)
+{
+	ASSERT_(simul);
+	return std::make_shared<CPerThreadCopies<SIMUL>>(
+		std::shared_ptr<SIMUL>(simul, [](SIMUL*) {}), [](const SIMUL& s) {
+			auto c = std::dynamic_pointer_cast<SIMUL>(
+				s.clone(s.get_model()->cloneTopology()));
+			ASSERT_(c);
+			c->prepare();
+			return c;
+		});
+}
+
+std::shared_ptr<CPerThreadCopies<CDynamicSimulatorBase>>
+	mbse::makePerThreadCopies(CDynamicSimulatorBase* simul)
+{
+	return internalMakePerThreadCopies(simul);
+}
+
+std::shared_ptr<CPerThreadCopies<CDynamicSimulatorIndepBase>>
+	mbse::makePerThreadCopies(CDynamicSimulatorIndepBase* simul)
+{
+	return internalMakePerThreadCopies(simul);
+}
+
 /** Solve for the current accelerations */
 void CDynamicSimulatorBase::solve_ddotq(
 	double t, VectorXd& ddot_q, VectorXd* lagrangre)
@@ -69,14 +105,160 @@ void CDynamicSimulatorBase::solve_ddotq(
 	this->internal_solve_ddotq(t, ddot_q, lagrangre);
 }
 
+void CDynamicSimulatorBase::eval_ddotq_jacobians(
+	Eigen::MatrixXd* ddotq_q, Eigen::MatrixXd* ddotq_dq,
+	Eigen::MatrixXd* ddotq_Q)
+{
+	ASSERT_(init_);
+	timelog().enter("eval_ddotq_jacobians");
+
+	const size_t n = arm_->q_.size();
+	const size_t m = arm_->Phi_.size();
+
+	// [   M    Phi_q^t  ] [ ddot_q ] = [ Q ]
+	// [ Phi_q     0     ] [ lambda ]   [ c ]
+	//
+	// Factorized once, for all the columns below:
+	arm_->update_numeric_Phi_and_Jacobians();
+	factorize_augmented_system();
+
+	// Derivatives of the RHS "c" (see build_RHS()), with ddot_q and lambda
+	// as the unknowns, side by side in B:
+	// d(c)/d(dq) = -2 * \dot{Phi_q} [- 2*eps*omega*Phi_q]
+	// d(c)/d(q)  = -\dot{Phi_qq}*dq [- 2*eps*omega*\dot{Phi_q} - omega^2*Phi_q]
+	const size_t nJacobs = (ddotq_q ? 1 : 0) + (ddotq_dq ? 1 : 0) +
+						   (ddotq_Q ? 1 : 0);
+	Eigen::MatrixXd B = Eigen::MatrixXd::Zero(n + m, nJacobs * n);
+	size_t col = 0;
+
+	if (ddotq_dq)
+	{
+		auto B_c = B.block(n, col, m, n);
+		arm_->dotPhi_q_.addTo(B_c, -2);
+#if USE_BAUMGARTEN_STABILIZATION
+		arm_->Phi_q_.addTo(B_c, -2 * baumgarten_epsilon * baumgarten_omega);
+#endif
+		col += n;
+	}
+
+	if (ddotq_q)
+	{
+		// Current accelerations and multipliers:
+		Eigen::MatrixXd x(n + m, 1);
+		build_RHS(x.data(), x.data() + n);
+		solve_augmented_system(x);
+		const Eigen::VectorXd lambda = x.col(0).tail(m);
+
+		// The derivatives of Phi_q ddot_q and Phi_q^t lambda are moved to
+		// the RHS:
+		const Eigen::VectorXd ddotq_bak = arm_->ddotq_;
+		arm_->ddotq_ = x.col(0).head(n);
+		arm_->update_numeric_Phi_and_Jacobians();
+
+		auto B_c = B.block(n, col, m, n);
+		arm_->Phiqq_times_ddq_.addTo(B_c, -1);
+		arm_->dotPhiqq_times_dq_.addTo(B_c, -1);
+#if USE_BAUMGARTEN_STABILIZATION
+		arm_->dotPhi_q_.addTo(
+			B_c, -2 * baumgarten_epsilon * baumgarten_omega);
+		arm_->Phi_q_.addTo(B_c, -baumgarten_omega * baumgarten_omega);
+#endif
+		Eigen::MatrixXd Phiqq_t_lambda;
+		arm_->eval_Phiqq_transpose_times(lambda, Phiqq_t_lambda);
+		B.block(0, col, n, n) = -Phiqq_t_lambda;
+
+		arm_->ddotq_ = ddotq_bak;
+		arm_->update_numeric_Phi_and_Jacobians();
+		col += n;
+	}
+
+	if (ddotq_Q) B.block(0, col, n, n).setIdentity();
+
+	solve_augmented_system(B);
+
+	col = 0;
+	if (ddotq_dq)
+	{
+		*ddotq_dq = B.block(0, col, n, n);
+		col += n;
+	}
+	if (ddotq_q)
+	{
+		*ddotq_q = B.block(0, col, n, n);
+		col += n;
+	}
+	if (ddotq_Q) *ddotq_Q = B.block(0, col, n, n);
+
+	timelog().leave("eval_ddotq_jacobians");
+}
+
+void CDynamicSimulatorBase::factorize_augmented_system()
+{
+	if (jacob_A_.nonZeros() == 0)
+	{
+		build_augmented_CCS_pattern(
+			arm_->massMatrixCache().triplets(*arm_), arm_->Phi_q_, jacob_A_,
+			jacob_A_Phi_q_idxs_);
+		jacob_qr_.analyzePattern(jacob_A_);
+	}
+	update_augmented_CCS(jacob_A_, jacob_A_Phi_q_idxs_);
+
+	jacob_qr_.factorize(jacob_A_);
+	ASSERT_(jacob_qr_.info() == Eigen::Success);
+}
+
+void CDynamicSimulatorBase::solve_augmented_system(Eigen::MatrixXd& B)
+{
+	ASSERT_EQUAL_(B.rows(), jacob_A_.rows());
+	const Eigen::MatrixXd X = jacob_qr_.solve(B);
+	B = X;
+}
+
+void CDynamicSimulatorBasePenalty::factorize_augmented_system()
+{
+	THROW_EXCEPTION(
+		"eval_ddotq_jacobians() is not available for penalty formulations");
+}
+
 /** Prepare the linear systems and anything else required to really call
  * solve_ddotq() */
 void CDynamicSimulatorBase::prepare()
 {
 	this->internal_prepare();
+
+	// Integrator workspaces, so time steps do not allocate memory:
+	const auto n = arm_->q_.size();
+	for (Eigen::VectorXd* v :
+		 {&q0, &v1, &v2, &v3, &v4, &ddotq1, &ddotq2, &ddotq3, &ddotq4, &dq0,
+		  &ddq0, &q_new, &dq_new, &q_old, &ddq_mid})
+		v->setZero(n);
+
 	init_ = true;
 }
 
+namespace
+{
+/** Forbids Eigen heap allocations while in scope, if `enabled` and the
+ * library was built with EIGEN_RUNTIME_NO_MALLOC */
+struct NoMallocScope
+{
+	NoMallocScope([[maybe_unused]] bool enabled)
+	{
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+		if (enabled) Eigen::internal::set_is_malloc_allowed(false);
+#endif
+	}
+	~NoMallocScope() { release(); }
+
+	void release()
+	{
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+		Eigen::internal::set_is_malloc_allowed(true);
+#endif
+	}
+};
+}  // namespace
+
 /** Runs a dynamic simulation for a given time span */
 double CDynamicSimulatorBase::run(const double t_ini, const double t_end)
 {
@@ -110,6 +292,8 @@ double CDynamicSimulatorBase::run(const double t_ini, const double t_end)
 
 		// Integrate:
 		// ------------------------------
+		NoMallocScope noMalloc(params.check_no_allocations);
+
 		this->pre_iteration(t);
 
 		const bool custom_integrator =
@@ -185,23 +369,20 @@ double CDynamicSimulatorBase::run(const double t_ini, const double t_end)
 					double qdiff = 10 * QDIFF_MAX;
 
 					// Keep the initial state:
-					const Eigen::VectorXd q0 = arm_->q_;
-					const Eigen::VectorXd dq0 = arm_->dotq_;
+					q0 = arm_->q_;
+					dq0 = arm_->dotq_;
 
 					// First attempt:
-					Eigen::VectorXd ddq0;
 					this->internal_solve_ddotq(t, ddq0);
 
-					Eigen::VectorXd q_new =
-						q0 + t_step * dq0 + 0.5 * t_step_sq * ddq0;
-					Eigen::VectorXd dq_new = dq0 + t_step * ddq0;
+					q_new = q0 + t_step * dq0 + 0.5 * t_step_sq * ddq0;
+					dq_new = dq0 + t_step * ddq0;
 
-					Eigen::VectorXd q_old = q_new;
+					q_old = q_new;
 					// Solve at the new predicted state "t=k+1":
 					arm_->q_ = q_new;
 					arm_->dotq_ = dq_new;
 
-					Eigen::VectorXd ddq_mid;
 					size_t iter;
 					for (iter = 0; iter < MAX_ITERS && qdiff > QDIFF_MAX;
 						 iter++)
@@ -241,6 +422,7 @@ double CDynamicSimulatorBase::run(const double t_ini, const double t_end)
 		}
 
 		this->post_iteration(t);
+		noMalloc.release();
 
 		timelog().leave("mbs.run_complete_timestep");
 
@@ -267,14 +449,7 @@ void CDynamicSimulatorBase::build_RHS(double* Q, double* c)
 		for (size_t i = 0; i < nConstraints; i++)
 		{
 			// c[i] = sum_k( -dot{Phi_q}[i,k] * dot_q[k] )
-			double ci = 0;
-			const CompressedRowSparseMatrix::row_t row_i =
-				arm_->dotPhi_q_.matrix[i];
-			for (const auto& colVal : row_i)
-			{
-				const size_t col = colVal.first;
-				ci -= colVal.second * arm_->dotq_[col];
-			}
+			double ci = -arm_->dotPhi_q_.rowDot(i, arm_->dotq_);
 
 			// "-\dot{Phi_t}"
 			MRPT_TODO("Fix me!");
@@ -286,8 +461,8 @@ void CDynamicSimulatorBase::build_RHS(double* Q, double* c)
 #if USE_BAUMGARTEN_STABILIZATION
 		// Use Baumgarten Stabilization
 		//  c= -\dot{Phi_q} * \dot{q}  - 2*eps*omega*dotPhi - omega^2 * Phi
-		const double epsilon = 1;
-		const double omega = 10;
+		const double epsilon = baumgarten_epsilon;
+		const double omega = baumgarten_omega;
 		for (size_t i = 0; i < nConstraints; i++)
 			c[i] -= 2 * epsilon * omega * arm_->dotPhi_[i] +
 					omega * omega * arm_->Phi_[i];
@@ -295,6 +470,144 @@ void CDynamicSimulatorBase::build_RHS(double* Q, double* c)
 	}
 }
 
+void mbse::build_augmented_CCS_pattern(
+	const std::vector<Eigen::Triplet<double>>& mass_tri,
+	const CompressedRowSparseMatrix& Phi_q, Eigen::SparseMatrix<double>& A,
+	std::vector<int>& Phi_q_block_idxs)
+{
+	const size_t nDOFs = Phi_q.getNumCols();
+	const size_t nConstraints = Phi_q.getNumRows();
+	const size_t nTot = nDOFs + nConstraints;
+
+	const size_t nnz = Phi_q.nonZeros();
+	const auto* Phi_q_rows = Phi_q.outerIndexPtr();
+	const auto* Phi_q_cols = Phi_q.innerIndexPtr();
+
+	std::vector<Eigen::Triplet<double>> A_tri = mass_tri;
+	A_tri.reserve(mass_tri.size() + 2 * nnz);
+	for (size_t i = 0; i < nConstraints; i++)
+	{
+		// Constraint "i" goes to column "nDOFs+i" in the augmented matrix:
+		for (auto k = Phi_q_rows[i]; k < Phi_q_rows[i + 1]; k++)
+		{
+			A_tri.emplace_back(Phi_q_cols[k], nDOFs + i, .0);
+			A_tri.emplace_back(nDOFs + i, Phi_q_cols[k], .0);
+		}
+	}
+	A.resize(nTot, nTot);
+	A.setFromTriplets(A_tri.begin(), A_tri.end());
+	A.makeCompressed();
+
+	const int* A_cols = A.outerIndexPtr();
+	const int* A_rows = A.innerIndexPtr();
+
+	// Phi_q^t block: the last nConstraints columns, only with entries at
+	// rows < nDOFs, sorted like the columns in each row of Phi_q:
+	ASSERT_EQUAL_(static_cast<size_t>(A.nonZeros() - A_cols[nDOFs]), nnz);
+	ASSERT_(std::equal(Phi_q_cols, Phi_q_cols + nnz, A_rows + A_cols[nDOFs]));
+
+	// Phi_q block: entry (nDOFs+i, col) lies within column "col" of A:
+	Phi_q_block_idxs.resize(nnz);
+	for (size_t i = 0; i < nConstraints; i++)
+	{
+		const int row = static_cast<int>(nDOFs + i);
+		for (auto k = Phi_q_rows[i]; k < Phi_q_rows[i + 1]; k++)
+		{
+			const int* first = A_rows + A_cols[Phi_q_cols[k]];
+			const int* last = A_rows + A_cols[Phi_q_cols[k] + 1];
+			const int* it = std::lower_bound(first, last, row);
+			ASSERT_(it != last && *it == row);
+			Phi_q_block_idxs[k] = static_cast<int>(it - A_rows);
+		}
+	}
+}
+
+void CDynamicSimulatorBase::build_augmented_CCS(
+	const std::vector<Eigen::Triplet<double>>& mass_tri,
+	Eigen::SparseMatrix<double>& A, std::vector<int>& Phi_q_block_idxs)
+{
+	const size_t nDOFs = arm_->q_.size();
+
+	// In case of a second call to prepare():
+	unbind_augmented_CCS(A);
+
+	build_augmented_CCS_pattern(mass_tri, arm_->Phi_q_, A, Phi_q_block_idxs);
+
+	// From now on, constraints write their Jacobians straight into A:
+	arm_->Phi_q_.bindValues(A.valuePtr() + A.outerIndexPtr()[nDOFs]);
+	update_augmented_CCS(A, Phi_q_block_idxs);
+}
+
+void CDynamicSimulatorBase::update_augmented_CCS(
+	Eigen::SparseMatrix<double>& A, const std::vector<int>& Phi_q_block_idxs)
+{
+	const size_t nDOFs = arm_->q_.size();
+	const auto& Phi_q = arm_->Phi_q_;
+	const size_t nnz = Phi_q.nonZeros();
+
+	double* A_vals = A.valuePtr();
+	double* Phi_q_t_vals = A_vals + A.outerIndexPtr()[nDOFs];
+
+	// Only if another solver has bound Phi_q_ to its own matrix afterwards:
+	if (Phi_q.valuePtr() != Phi_q_t_vals)
+		std::copy(Phi_q.valuePtr(), Phi_q.valuePtr() + nnz, Phi_q_t_vals);
+
+	for (size_t k = 0; k < nnz; k++)
+		A_vals[Phi_q_block_idxs[k]] = Phi_q_t_vals[k];
+}
+
+void CDynamicSimulatorBase::unbind_augmented_CCS(
+	const Eigen::SparseMatrix<double>& A)
+{
+	const size_t nDOFs = arm_->q_.size();
+	if (A.nonZeros() == 0 || static_cast<size_t>(A.cols()) <= nDOFs) return;
+	arm_->Phi_q_.unbindValues(A.valuePtr() + A.outerIndexPtr()[nDOFs]);
+}
+
+void mbse::klu_numeric_factor(
+	Eigen::SparseMatrix<double>& A, klu_symbolic* symbolic,
+	klu_numeric*& numeric, klu_common& common, const TKLUParams& params,
+	std::array<double, 2>& rgrowth_rcond)
+{
+	int* Ap = A.outerIndexPtr();
+	int* Ai = A.innerIndexPtr();
+	double* Ax = A.valuePtr();
+
+	// Scope of the time logger entry counting fallbacks, if any. It is left
+	// even if the full factorization below throws.
+	std::optional<mrpt::system::CTimeLoggerEntry> fallbackEntry;
+
+	const bool refactorAttempted = numeric && params.refactor;
+	if (refactorAttempted)
+	{
+		// Reuse the pivot sequence. Accept it unless it's become much less
+		// stable than when it was chosen:
+		const double tol = params.refactor_tolerance;
+		if (klu_refactor(Ap, Ai, Ax, symbolic, numeric, &common) &&
+			klu_rgrowth(Ap, Ai, Ax, symbolic, numeric, &common) &&
+			klu_rcond(symbolic, numeric, &common) &&
+			common.rgrowth >= tol * rgrowth_rcond[0] &&
+			common.rcond >= tol * rgrowth_rcond[1])
+			return;
+
+		fallbackEntry.emplace(timelog(), "solver_ddotq.klu_refactor_fallback");
+	}
+
+	if (numeric) klu_free_numeric(&numeric, &common);
+
+	numeric = klu_factor(Ap, Ai, Ax, symbolic, &common);
+	if (!numeric)
+		THROW_EXCEPTION(
+			"Error: KLU couldn't numeric-factorize the augmented matrix.");
+
+	if (params.refactor)
+	{
+		klu_rgrowth(Ap, Ai, Ax, symbolic, numeric, &common);
+		klu_rcond(symbolic, numeric, &common);
+		rgrowth_rcond = {{common.rgrowth, common.rcond}};
+	}
+}
+
 /** Add a "sensor" that grabs the position of a given point.
  * \sa saveSensorLogsToFile
  */
@@ -0,0 +1,147 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#include <mbse/CAssembledRigidModelBatch.h>
+#include <mbse/dynamics/dynamic-simulators.h>
+
+using namespace mbse;
+using namespace Eigen;
+using namespace std;
+
+// ---------------------------------------------------------------------------------------------
+//  Solver: (Sparse) KLU, for a batch of states
+// ---------------------------------------------------------------------------------------------
+CDynamicSimulatorBatch_Lagrange_KLU::CDynamicSimulatorBatch_Lagrange_KLU(
+	const std::shared_ptr<CAssembledRigidModelBatch> batch_ptr)
+	: ordering(orderCOLAMD),  // COLAMD is more efficient than AMD
+	  batch_(batch_ptr)
+{
+	ASSERT_(batch_);
+	klu_defaults(&common_);
+}
+
+CDynamicSimulatorBatch_Lagrange_KLU::~CDynamicSimulatorBatch_Lagrange_KLU()
+{
+	if (symbolic_) klu_free_symbolic(&symbolic_, &common_);
+	if (numeric_) klu_free_numeric(&numeric_, &common_);
+}
+
+void CDynamicSimulatorBatch_Lagrange_KLU::prepare()
+{
+	timelog().enter("batch_solver_prepare");
+
+	const CAssembledRigidModel& arm = batch_->model();
+
+	// Both the mass matrix and the generalized forces are constant and equal
+	// for all states:
+	arm.builGeneralizedForces(Q_);
+
+	build_augmented_CCS_pattern(
+		arm.massMatrixCache().triplets(arm), arm.Phi_q_, A_, A_Phi_q_idxs_);
+	RHS_.resize(A_.cols());
+
+	switch (this->ordering)
+	{
+		case orderAMD:
+			common_.ordering = 0;
+			break;
+		case orderCOLAMD:
+			common_.ordering = 1;
+			break;
+		default:
+			THROW_EXCEPTION("Unknown or unsupported 'ordering' value.");
+	};
+
+	if (symbolic_) klu_free_symbolic(&symbolic_, &common_);
+	if (numeric_) klu_free_numeric(&numeric_, &common_);
+
+	symbolic_ = klu_analyze(
+		A_.rows(), A_.outerIndexPtr(), A_.innerIndexPtr(), &common_);
+	if (!symbolic_)
+		THROW_EXCEPTION("Error: KLU couldn't factorize the augmented matrix.");
+
+	timelog().leave("batch_solver_prepare");
+}
+
+void CDynamicSimulatorBatch_Lagrange_KLU::solve_ddotq(
+	Eigen::MatrixXd& ddot_q, Eigen::MatrixXd* lagrangre)
+{
+	ASSERTMSG_(symbolic_, "prepare() must be called before solve_ddotq()");
+
+	timelog().enter("batch_solver_ddotq");
+
+	auto& b = *batch_;
+	const size_t nDOFs = b.getDOFCount();
+	const size_t nConstraints = b.getConstraintCount();
+	const size_t N = b.size();
+
+	const auto& Phi_q = b.model().Phi_q_;
+	const size_t nnz = Phi_q.nonZeros();
+	const auto* Phi_q_rows = Phi_q.outerIndexPtr();
+	const auto* Phi_q_cols = Phi_q.innerIndexPtr();
+
+	// Update numeric values of the constraint Jacobians:
+	timelog().enter("batch_solver_ddotq.update_jacob");
+	b.update_numeric_Phi_and_Jacobians();
+	timelog().leave("batch_solver_ddotq.update_jacob");
+
+	// "c" part of the RHS, for all states at once:
+	//  c= -\dot{Phi_q} * \dot{q}  (- 2*eps*omega*dotPhi - omega^2 * Phi)
+	// --------------------------
+	timelog().enter("batch_solver_ddotq.build_rhs");
+#if USE_BAUMGARTEN_STABILIZATION
+	const double epsilon = baumgarten_epsilon;
+	const double omega = baumgarten_omega;
+	c_ = -2 * epsilon * omega * b.dotPhi_ - omega * omega * b.Phi_;
+#else
+	c_.setZero(nConstraints, N);
+#endif
+	for (size_t i = 0; i < nConstraints; i++)
+		for (auto k = Phi_q_rows[i]; k < Phi_q_rows[i + 1]; k++)
+			c_.row(i) -=
+				b.dotPhi_q_.row(k).cwiseProduct(b.dotq_.row(Phi_q_cols[k]));
+	timelog().leave("batch_solver_ddotq.build_rhs");
+
+	ddot_q.resize(nDOFs, N);
+	if (lagrangre) lagrangre->resize(nConstraints, N);
+
+	double* A_vals = A_.valuePtr();
+	double* Phi_q_t_vals = A_vals + A_.outerIndexPtr()[nDOFs];
+
+	for (size_t s = 0; s < N; s++)
+	{
+		// Move the Jacobian of this state into both blocks of A:
+		for (size_t k = 0; k < nnz; k++)
+		{
+			const double v = b.Phi_q_(k, s);
+			Phi_q_t_vals[k] = v;
+			A_vals[A_Phi_q_idxs_[k]] = v;
+		}
+
+		timelog().enter("batch_solver_ddotq.numeric_factor");
+		klu_numeric_factor(
+			A_, symbolic_, numeric_, common_, params_klu,
+			numeric_rgrowth_rcond_);
+		timelog().leave("batch_solver_ddotq.numeric_factor");
+
+		// KLU leaves solution in the same place than the input RHS vector:
+		RHS_.head(nDOFs) = Q_;
+		RHS_.tail(nConstraints) = c_.col(s);
+
+		klu_solve(symbolic_, numeric_, A_.cols(), 1, &RHS_[0], &common_);
+		if (common_.status != KLU_OK)
+			THROW_EXCEPTION("Error: KLU couldn't solve the linear system.");
+
+		ddot_q.col(s) = RHS_.head(nDOFs);
+		if (lagrangre) lagrangre->col(s) = RHS_.tail(nConstraints);
+	}
+
+	timelog().leave("batch_solver_ddotq");
+}
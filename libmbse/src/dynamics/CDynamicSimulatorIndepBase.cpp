@@ -34,6 +34,207 @@ void CDynamicSimulatorIndepBase::solve_ddotz(double t, VectorXd& ddot_z)
 	this->internal_solve_ddotz(t, ddot_z);
 }
 
+void CDynamicSimulatorIndepBase::eval_ddotz_jacobians(
+	Eigen::MatrixXd* ddotz_z, Eigen::MatrixXd* ddotz_dz)
+{
+	const std::vector<size_t>& zIdxs = independent_coordinate_indices();
+	const size_t n = arm_->q_.size();
+	const size_t d = zIdxs.size();
+	ASSERT_BELOW_(d, n + 1);
+
+	// Jacobians with respect to all coordinates:
+	Eigen::MatrixXd J_q, J_dq;
+	eval_ddotq_jacobians(ddotz_z ? &J_q : nullptr, &J_dq, nullptr);
+
+	std::vector<bool> isIndep(n, false);
+	for (size_t i : zIdxs) isIndep[i] = true;
+	std::vector<size_t> dIdxs;
+	for (size_t i = 0; i < n; i++)
+		if (!isIndep[i]) dIdxs.push_back(i);
+
+	const Eigen::MatrixXd Phi_q = arm_->Phi_q_.asDense();
+	Eigen::MatrixXd Phi_d(Phi_q.rows(), dIdxs.size());
+	for (size_t j = 0; j < dIdxs.size(); j++)
+		Phi_d.col(j) = Phi_q.col(dIdxs[j]);
+	// Rectangular if there are redundant constraints:
+	const Eigen::FullPivLU<Eigen::MatrixXd> lu(Phi_d);
+
+	// dq = R dz, with R_z = I and R_d = -Phi_d^{-1} Phi_z:
+	Eigen::MatrixXd R = Eigen::MatrixXd::Zero(n, d);
+	for (size_t j = 0; j < d; j++) R(zIdxs[j], j) = 1;
+	const Eigen::MatrixXd R_d = -lu.solve(Phi_q * R);
+	for (size_t i = 0; i < dIdxs.size(); i++) R.row(dIdxs[i]) = R_d.row(i);
+
+	auto indepRows = [&](const Eigen::MatrixXd& J, Eigen::MatrixXd& out) {
+		out.resize(d, J.cols());
+		for (size_t i = 0; i < d; i++) out.row(i) = J.row(zIdxs[i]);
+	};
+
+	if (ddotz_dz) indepRows(J_dq * R, *ddotz_dz);
+
+	if (ddotz_z)
+	{
+		// Derivative of dq wrt z, for a fixed dz: from Phi_q dq = 0,
+		// D_z = 0 and D_d = -Phi_d^{-1} \dot{Phi_q} R
+		const Eigen::MatrixXd dotPhi_q = arm_->dotPhi_q_.asDense();
+		const Eigen::MatrixXd D_d = -lu.solve(dotPhi_q * R);
+		Eigen::MatrixXd D = Eigen::MatrixXd::Zero(n, d);
+		for (size_t i = 0; i < dIdxs.size(); i++) D.row(dIdxs[i]) = D_d.row(i);
+
+		indepRows(J_q * R + J_dq * D, *ddotz_z);
+	}
+}
+
+void CDynamicSimulatorIndepBase::integrate_step(
+	double t, double dt, ODE_integrator_t integr,
+	const dz_increment_hook_t& dz_increment_hook)
+{
+	ASSERT_(init_);
+
+	// Choose the independent coordinates (if enabled) on the first stage
+	// only, so all stages use the same ones:
+	const bool can_choose = can_choose_indep_coords_;
+
+	switch (integr)
+	{
+		case ODE_Euler:
+		{
+			this->internal_solve_ddotz(t, ddotz1);
+			arm_->q_ += dt * arm_->dotq_;
+			// arm_->dotq_ += dt * ddotz1;
+			dotz_incr = dt * ddotz1;
+			if (dz_increment_hook) dz_increment_hook(dotz_incr);
+			this->dq_plus_dz(arm_->dotq_, dotz_incr, arm_->dotq_);
+
+			this->correct_dependent_q_dq();
+		}
+		break;
+
+		case ODE_RK4:
+		{
+			const double dt2 = dt * 0.5;
+			const double dt6 = dt / 6.0;
+
+			q0 = arm_->q_;  // Make backup copy of state (velocities will
+							// be in "v1")
+
+			// k1 = f(t,y);
+			// cur_time = t;
+			v1 = arm_->dotq_;
+			// No change needed: arm_->q_ = q0;
+			this->internal_solve_ddotz(t, ddotz1);
+			can_choose_indep_coords_ = false;  // don't change indep. coords
+
+			// k2 = f(t+At/2,y+At/2*k1)
+			// cur_time = t + dt2;
+			this->dq_plus_dz(
+				v1, dt2 * ddotz1,
+				arm_->dotq_);  // \dot{q}= \dot{q}_0 + At/2 * \ddot{q}_1
+			arm_->q_ = q0 + dt2 * v1;
+			this->correct_dependent_q_dq();
+
+			v2 = arm_->dotq_;
+			this->internal_solve_ddotz(t + dt2, ddotz2);
+
+			// k3 = f(t+At/2,y+At/2*k2)
+			// cur_time = t + dt2;
+			// arm_->dotq_ = v1 + dt2*ddotq2;  // \dot{q}= \dot{q}_0 +
+			// At/2 * \ddot{q}_2
+			this->dq_plus_dz(v1, dt2 * ddotz2, arm_->dotq_);
+
+			arm_->q_ = q0 + dt2 * v2;
+			this->correct_dependent_q_dq();
+
+			v3 = arm_->dotq_;
+			this->internal_solve_ddotz(t + dt2, ddotz3);
+
+			// k4 = f(t+At  ,y+At*k3)
+			// cur_time = t + dt;
+			// arm_->dotq_ = v1 + dt*ddotq3;
+			this->dq_plus_dz(v1, dt * ddotz3, arm_->dotq_);
+			arm_->q_ = q0 + dt * v3;
+			this->correct_dependent_q_dq();
+
+			v4 = arm_->dotq_;
+			this->internal_solve_ddotz(t + dt, ddotz4);
+			can_choose_indep_coords_ = can_choose;
+
+			// Runge-Kutta 4th order formula:
+			arm_->q_ = q0 + dt6 * (v1 + 2 * v2 + 2 * v3 + v4);
+			dotz_incr = dt6 * (ddotz1 + 2 * ddotz2 + 2 * ddotz3 + ddotz4);
+			if (dz_increment_hook) dz_increment_hook(dotz_incr);
+			this->dq_plus_dz(v1, dotz_incr, arm_->dotq_);
+			this->correct_dependent_q_dq();
+		}
+		break;
+
+		// Implicit trapezoidal integration rule:
+		// -------------------------------------------
+#if 0
+	case ODE_Trapezoidal:
+		{
+			const double t_step_sq = t_step * t_step;
+
+			const size_t MAX_ITERS = 10;
+			const double QDIFF_MAX = 1e-10;
+			double qdiff=10*QDIFF_MAX;
+
+			// Keep the initial state:
+			const Eigen::VectorXd q0  = arm_->q_;
+			const Eigen::VectorXd dq0 = arm_->dotq_;
+
+			// First attempt:
+			Eigen::VectorXd ddz0;
+			this->can_choose_indep_coords_=true;
+			this->internal_solve_ddotz(ddz0, true);
+			this->can_choose_indep_coords_=false;
+
+			Eigen::VectorXd  q_new =  q0 + t_step*dq0 + 0.5*t_step_sq*ddq0;
+			Eigen::VectorXd dq_new;
+			this->dq_plus_dz(dq0, t_step*ddq0, dq_new );
+
+			// Solve at the new predicted state "t=k+1":
+			arm_->q_    =  q_new;
+			arm_->dotq_ = dq_new;
+			this->correct_dependent_q_dq();
+			Eigen::VectorXd q_old = q_new;
+
+			Eigen::VectorXd ddq_mid;
+			size_t iter;
+			for (iter=0; iter<MAX_ITERS && qdiff>QDIFF_MAX ; iter++ )
+			{
+				// Store previous state for comparing the progress of the iterative method:
+				q_old = q_new;
+
+				// Solve at the new predicted state "t=k+1":
+				this->internal_solve_ddotz(ddotz1);
+				//this->solve_ddotq(ddotq1);
+
+				// integrator (trapezoidal rule)
+				// -------------------------------
+				ddq_mid = (ddotz1+ddz0)*0.5;
+				q_new =  q0 + t_step*dq0 + 0.5*t_step_sq*ddq_mid;
+				dq_new = dq0 + t_step*ddq_mid;
+
+				// check progress:
+				qdiff = (q_old-q_new).norm();
+
+				// Solve at the new predicted state "t=k+1":
+				arm_->q_    =  q_new;
+				arm_->dotq_ = dq_new;
+			}
+			ASSERTMSG_(iter<MAX_ITERS,"Trapezoidal convergence failed!")
+
+			timelog().registerUserMeasure("trapezoidal.iters",iter);
+		}
+		break;
+#endif
+
+		default:
+			THROW_EXCEPTION("Unknown value for ode_solver");
+	};
+}
+
 // Run simulation:
 double CDynamicSimulatorIndepBase::run(const double t_ini, const double t_end)
 {
@@ -46,8 +247,6 @@ double CDynamicSimulatorIndepBase::run(const double t_ini, const double t_end)
 	TSimulationState sim_state(arm_);
 
 	const double t_step = std::min(t_end - t_ini, params.time_step);
-	const double t_step2 = t_step * 0.5;
-	const double t_step6 = t_step / 6.0;
 
 	double t;  // Declared here so we know the final "time":
 	for (t = t_ini; t < t_end; t += t_step)
@@ -68,139 +267,7 @@ double CDynamicSimulatorIndepBase::run(const double t_ini, const double t_end)
 
 		// Integrate:
 		// ------------------------------
-		switch (params.ode_solver)
-		{
-			case ODE_Euler:
-			{
-				this->internal_solve_ddotz(t, ddotz1);
-				arm_->q_ += t_step * arm_->dotq_;
-				// arm_->dotq_ += t_step * ddotz1;
-				this->dq_plus_dz(arm_->dotq_, t_step * ddotz1, arm_->dotq_);
-
-				this->correct_dependent_q_dq();
-			}
-			break;
-
-			case ODE_RK4:
-			{
-				q0 = arm_->q_;  // Make backup copy of state (velocities will
-								// be in "v1")
-
-				// k1 = f(t,y);
-				// cur_time = t;
-				v1 = arm_->dotq_;
-				// No change needed: arm_->q_ = q0;
-				can_choose_indep_coords_ = true;
-				this->internal_solve_ddotz(t, ddotz1);
-				can_choose_indep_coords_ = false;  // don't change indep. coords
-
-				// k2 = f(t+At/2,y+At/2*k1)
-				// cur_time = t + t_step2;
-				this->dq_plus_dz(
-					v1, t_step2 * ddotz1,
-					arm_->dotq_);  // \dot{q}= \dot{q}_0 + At/2 * \ddot{q}_1
-				arm_->q_ = q0 + t_step2 * v1;
-				this->correct_dependent_q_dq();
-
-				v2 = arm_->dotq_;
-				this->internal_solve_ddotz(t + t_step2, ddotz2);
-
-				// k3 = f(t+At/2,y+At/2*k2)
-				// cur_time = t + t_step2;
-				// arm_->dotq_ = v1 + t_step2*ddotq2;  // \dot{q}= \dot{q}_0 +
-				// At/2 * \ddot{q}_2
-				this->dq_plus_dz(v1, t_step2 * ddotz2, arm_->dotq_);
-
-				arm_->q_ = q0 + t_step2 * v2;
-				this->correct_dependent_q_dq();
-
-				v3 = arm_->dotq_;
-				this->internal_solve_ddotz(t + t_step2, ddotz3);
-
-				// k4 = f(t+At  ,y+At*k3)
-				// cur_time = t + t_step;
-				// arm_->dotq_ = v1 + t_step*ddotq3;
-				this->dq_plus_dz(v1, t_step * ddotz3, arm_->dotq_);
-				arm_->q_ = q0 + t_step * v3;
-				this->correct_dependent_q_dq();
-
-				v4 = arm_->dotq_;
-				this->internal_solve_ddotz(t + t_step, ddotz4);
-
-				// Runge-Kutta 4th order formula:
-				arm_->q_ = q0 + t_step6 * (v1 + 2 * v2 + 2 * v3 + v4);
-				this->dq_plus_dz(
-					v1, t_step6 * (ddotz1 + 2 * ddotz2 + 2 * ddotz3 + ddotz4),
-					arm_->dotq_);
-				this->correct_dependent_q_dq();
-			}
-			break;
-
-			// Implicit trapezoidal integration rule:
-			// -------------------------------------------
-#if 0
-		case ODE_Trapezoidal:
-			{
-				const double t_step_sq = t_step * t_step;
-
-				const size_t MAX_ITERS = 10;
-				const double QDIFF_MAX = 1e-10;
-				double qdiff=10*QDIFF_MAX;
-
-				// Keep the initial state:
-				const Eigen::VectorXd q0  = arm_->q_;
-				const Eigen::VectorXd dq0 = arm_->dotq_;
-
-				// First attempt:
-				Eigen::VectorXd ddz0;
-				this->can_choose_indep_coords_=true;
-				this->internal_solve_ddotz(ddz0, true);
-				this->can_choose_indep_coords_=false;
-
-				Eigen::VectorXd  q_new =  q0 + t_step*dq0 + 0.5*t_step_sq*ddq0;
-				Eigen::VectorXd dq_new;
-				this->dq_plus_dz(dq0, t_step*ddq0, dq_new );
-
-				// Solve at the new predicted state "t=k+1":
-				arm_->q_    =  q_new;
-				arm_->dotq_ = dq_new;
-				this->correct_dependent_q_dq();
-				Eigen::VectorXd q_old = q_new;
-
-				Eigen::VectorXd ddq_mid;
-				size_t iter;
-				for (iter=0; iter<MAX_ITERS && qdiff>QDIFF_MAX ; iter++ )
-				{
-					// Store previous state for comparing the progress of the iterative method:
-					q_old = q_new;
-
-					// Solve at the new predicted state "t=k+1":
-					this->internal_solve_ddotz(ddotz1);
-					//this->solve_ddotq(ddotq1);
-
-					// integrator (trapezoidal rule)
-					// -------------------------------
-					ddq_mid = (ddotz1+ddz0)*0.5;
-					q_new =  q0 + t_step*dq0 + 0.5*t_step_sq*ddq_mid;
-					dq_new = dq0 + t_step*ddq_mid;
-
-					// check progress:
-					qdiff = (q_old-q_new).norm();
-
-					// Solve at the new predicted state "t=k+1":
-					arm_->q_    =  q_new;
-					arm_->dotq_ = dq_new;
-				}
-				ASSERTMSG_(iter<MAX_ITERS,"Trapezoidal convergence failed!")
-
-				timelog().registerUserMeasure("trapezoidal.iters",iter);
-			}
-			break;
-#endif
-
-			default:
-				THROW_EXCEPTION("Unknown value for params.ode_solver");
-		};
+		integrate_step(t, t_step, params.ode_solver);
 
 		// Save last ddotq:
 		CAssembledRigidModel::TComputeDependentResults cdr;
@@ -25,18 +25,41 @@ CDynamicSimulator_ALi3_Dense::CDynamicSimulator_ALi3_Dense(
 {
 }
 
+CDynamicSimulatorBase::Ptr CDynamicSimulator_ALi3_Dense::clone(
+	const std::shared_ptr<CAssembledRigidModel>& arm) const
+{
+	auto o = std::make_shared<CDynamicSimulator_ALi3_Dense>(arm);
+	o->params = params;
+	o->params_penalty = params_penalty;
+	return o;
+}
+
 /** Prepare the linear systems and anything else required to really call
  * solve_ddotq() */
 void CDynamicSimulator_ALi3_Dense::internal_prepare()
 {
 	timelog().enter("solver_prepare");
 
-	arm_->buildMassMatrix_dense(M_);
-	M_ldlt_.compute(M_);
+	M_ = &arm_->massMatrixCache().dense(*arm_);
+	M_ldlt_ = &arm_->massMatrixCache().denseLDLT(*arm_);
 
+	const size_t nDepCoords = arm_->q_.size();
 	const size_t nConstraints = arm_->Phi_.size();
 	Lambda_.setZero(nConstraints);
 
+	A_.setZero(nDepCoords, nDepCoords);
+	Phi_q_.setZero(nConstraints, nDepCoords);
+	dotPhi_q_.setZero(nConstraints, nDepCoords);
+	A_llt_ = Eigen::LLT<Eigen::MatrixXd>(nDepCoords);
+
+	Q_.setZero(nDepCoords);
+	b_.setZero(nConstraints);
+	RHS_.setZero(nDepCoords);
+	qp_g_.setZero(nDepCoords);
+	qpp_g_.setZero(nDepCoords);
+	Aq_.setZero(nDepCoords);
+	tmp_.setZero(nDepCoords);
+
 	timelog().leave("solver_prepare");
 }
 
@@ -51,22 +74,17 @@ bool CDynamicSimulator_ALi3_Dense::internal_integrate(
 {
 	if (integr != ODE_Trapezoidal) return false;
 
-	const size_t nDepCoords = arm_->q_.size();
-
 	timelog().enter("internal_integrate");
 
-	Eigen::VectorXd Q(nDepCoords);
-
 	const double dt2 = dt * dt;
 
-	const Eigen::VectorXd qp_g = -(2. / dt * arm_->q_ + arm_->dotq_);
-	const Eigen::VectorXd qpp_g =
-		-(4. / dt2 * arm_->q_ + 4. / dt * arm_->dotq_ + arm_->ddotq_);
+	qp_g_ = -(2. / dt * arm_->q_ + arm_->dotq_);
+	qpp_g_ = -(4. / dt2 * arm_->q_ + 4. / dt * arm_->dotq_ + arm_->ddotq_);
 
 	arm_->q_ += dt * arm_->dotq_ + 0.5 * dt * dt * arm_->ddotq_;
 
-	arm_->dotq_ = (2. / dt) * arm_->q_ + qp_g;
-	arm_->ddotq_ = (4. / dt2) * arm_->q_ + qpp_g;
+	arm_->dotq_ = (2. / dt) * arm_->q_ + qp_g_;
+	arm_->ddotq_ = (4. / dt2) * arm_->q_ + qpp_g_;
 
 	double err = 1;
 	int iter = 0;
@@ -83,33 +101,37 @@ bool CDynamicSimulator_ALi3_Dense::internal_integrate(
 
 		// phi_0 = phi(q,l,x);
 		// Get "Q" (may be dynamic)
-		this->build_RHS(&Q[0] /* Q */, nullptr /* we don't need "c" */);
+		this->build_RHS(&Q_[0] /* Q */, nullptr /* we don't need "c" */);
 		// Q = Qg +[0;0;0;0;-k_m*(q(5)-L_0)-c_m*qp(5)];
 
-		Eigen::VectorXd RHS =
-			0.25 * dt2 *
-			(M_ * arm_->ddotq_ +
-			 Phi_q_.transpose() * params_penalty.alpha * arm_->Phi_ +
-			 Phi_q_.transpose() * Lambda_ - Q);
+		// RHS = 0.25*dt^2*(M*qpp + Phi_q^t*(alpha*Phi + Lambda) - Q)
+		b_ = params_penalty.alpha * arm_->Phi_ + Lambda_;
+		RHS_ = -Q_;
+		RHS_.noalias() += *M_ * arm_->ddotq_;
+		RHS_.noalias() += Phi_q_.transpose() * b_;
+		RHS_ *= 0.25 * dt2;
 		//[K,C]=evalKC(k_m, c_m);
 
 		// f_q = M + 0.5*dt*C+0.25*dt^2*(jac'*alpha*jac+K);
-		A_ = M_ +
-			  0.25 * dt2 * params_penalty.alpha * Phi_q_.transpose() * Phi_q_;
-		A_lu_.compute(A_);
+		A_ = *M_;
+		A_.noalias() +=
+			(0.25 * dt2 * params_penalty.alpha) * Phi_q_.transpose() * Phi_q_;
+		A_llt_.compute(A_);
+		ASSERT_(A_llt_.info() == Eigen::Success);
 
-		const Eigen::VectorXd Aq = -A_lu_.solve(RHS);
+		// Aq = -f_q \ RHS
+		Aq_ = A_llt_.solve(RHS_);
 
-		arm_->q_ += Aq;
-		arm_->dotq_ = (2. / dt) * arm_->q_ + qp_g;
-		arm_->ddotq_ = (4. / dt2) * arm_->q_ + qpp_g;
+		arm_->q_ -= Aq_;
+		arm_->dotq_ = (2. / dt) * arm_->q_ + qp_g_;
+		arm_->ddotq_ = (4. / dt2) * arm_->q_ + qpp_g_;
 
 		// phi_0 = phi(q,l,x);
 		arm_->update_numeric_Phi_and_Jacobians();
 		arm_->Phi_q_.asDense(Phi_q_);
 
 		Lambda_ += params_penalty.alpha * arm_->Phi_;
-		err = Aq.norm();
+		err = Aq_.norm();
 	}
 
 	// cout << "iter: " << iter << endl;
@@ -118,17 +140,19 @@ bool CDynamicSimulator_ALi3_Dense::internal_integrate(
 	// del timepo, porque en este problema no hay restricciones que dependan
 	// explícitamente del tiempo).
 	// qp_out = f_q\((M + 0.5*dt*C + 0.25*dt^2*K)*qp);
-	arm_->dotq_ = A_lu_.solve(M_ * arm_->dotq_);
+	tmp_.noalias() = *M_ * arm_->dotq_;
+	arm_->dotq_ = A_llt_.solve(tmp_);
 
 	// phiqpqp_0 = phiqpqp(q, qp, l);
 	arm_->dotPhi_q_.asDense(dotPhi_q_);
 
 	// qpp_out = f_q\((M + 0.5*dt*C + 0.25*dt^2*K)*qpp -
 	// 0.25*dt^2*jac'*alpha*phiqpqp_0);
-	arm_->ddotq_ = A_lu_.solve(
-		M_ * arm_->ddotq_ - 0.25 * dt2 * params_penalty.alpha *
-								   Phi_q_.transpose() * dotPhi_q_ *
-								   arm_->dotq_);
+	b_.noalias() = dotPhi_q_ * arm_->dotq_;
+	tmp_.noalias() = *M_ * arm_->ddotq_;
+	tmp_.noalias() -=
+		(0.25 * dt2 * params_penalty.alpha) * Phi_q_.transpose() * b_;
+	arm_->ddotq_ = A_llt_.solve(tmp_);
 
 	timelog().leave("internal_integrate");
 
@@ -138,8 +162,6 @@ bool CDynamicSimulator_ALi3_Dense::internal_integrate(
 void CDynamicSimulator_ALi3_Dense::internal_solve_ddotq(
 	double t, VectorXd& ddot_q, VectorXd* lagrangre)
 {
-	const size_t nDepCoords = arm_->q_.size();
-
 	if (lagrangre)
 		throw std::runtime_error(
 			"This class can't solve for lagrange multipliers!");
@@ -152,9 +174,7 @@ void CDynamicSimulator_ALi3_Dense::internal_solve_ddotq(
 	// 1) M \ddot{q}_0 = Q
 	// ---------------------------
 	// Get "Q":
-	// KLU leaves solution in the same place than the input RHS vector:
-	Eigen::VectorXd Q(nDepCoords);
-	this->build_RHS(&Q[0] /* Q */, nullptr /* we don't need "c" */);
+	this->build_RHS(&Q_[0] /* Q */, nullptr /* we don't need "c" */);
 
 	// 2) Iterate:
 	// ---------------------------
@@ -172,9 +192,11 @@ void CDynamicSimulator_ALi3_Dense::internal_solve_ddotq(
 	arm_->update_numeric_Phi_and_Jacobians();
 
 	arm_->Phi_q_.asDense(Phi_q_);
-	A_ = M_ + params_penalty.alpha * Phi_q_.transpose() * Phi_q_;
+	A_ = *M_;
+	A_.noalias() += params_penalty.alpha * Phi_q_.transpose() * Phi_q_;
 
-	A_lu_.compute(A_);
+	A_llt_.compute(A_);
+	ASSERT_(A_llt_.info() == Eigen::Success);
 
 	// Build the RHS vector:
 	// RHS = Q(q,dq) - alpha * Phi_q^t* [ \dot{Phi}_q * \dot{q} + 2 * xi * omega
@@ -187,17 +209,16 @@ void CDynamicSimulator_ALi3_Dense::internal_solve_ddotq(
 	// -----------------------------------
 	timelog().enter("solver_ddotq.solve");
 
-	Eigen::VectorXd ddotq_next, ddotq_prev;
+	// b = alpha * [...] + \lambda, so that RHS = Q - Phi_q^t * b
+	b_ = 2 * params_penalty.xi * params_penalty.w * arm_->dotPhi_ +
+		 params_penalty.w * params_penalty.w * arm_->Phi_;
+	b_.noalias() += dotPhi_q_ * arm_->dotq_;
+	b_ = params_penalty.alpha * b_ + Lambda_;
 
-	Eigen::MatrixXd RHS =
-		Q -
-		params_penalty.alpha * Phi_q_.transpose() *
-			(dotPhi_q_ * arm_->dotq_ +
-			 2 * params_penalty.xi * params_penalty.w * arm_->dotPhi_ +
-			 params_penalty.w * params_penalty.w * arm_->Phi_) -
-		Phi_q_.transpose() * Lambda_;
+	RHS_ = Q_;
+	RHS_.noalias() -= Phi_q_.transpose() * b_;
 
-	ddot_q = A_lu_.solve(RHS);
+	ddot_q = A_llt_.solve(RHS_);
 
 	Lambda_ += params_penalty.alpha * arm_->Phi_;
 
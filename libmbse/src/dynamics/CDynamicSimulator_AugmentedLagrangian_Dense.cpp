@@ -25,14 +25,38 @@ CDynamicSimulator_AugmentedLagrangian_Dense::
 {
 }
 
+CDynamicSimulatorBase::Ptr CDynamicSimulator_AugmentedLagrangian_Dense::clone(
+	const std::shared_ptr<CAssembledRigidModel>& arm) const
+{
+	auto o = std::make_shared<CDynamicSimulator_AugmentedLagrangian_Dense>(arm);
+	o->params = params;
+	o->params_penalty = params_penalty;
+	return o;
+}
+
 /** Prepare the linear systems and anything else required to really call
  * solve_ddotq() */
 void CDynamicSimulator_AugmentedLagrangian_Dense::internal_prepare()
 {
 	timelog().enter("solver_prepare");
 
-	arm_->buildMassMatrix_dense(M_);
-	M_ldlt_.compute(M_);
+	M_ = &arm_->massMatrixCache().dense(*arm_);
+	M_ldlt_ = &arm_->massMatrixCache().denseLDLT(*arm_);
+
+	const size_t nDepCoords = arm_->q_.size();
+	const size_t nConstraints = arm_->Phi_.size();
+
+	A_.setZero(nDepCoords, nDepCoords);
+	Phi_q_.setZero(nConstraints, nDepCoords);
+	dotPhi_q_.setZero(nConstraints, nDepCoords);
+	A_llt_ = Eigen::LLT<Eigen::MatrixXd>(nDepCoords);
+
+	Q_.setZero(nDepCoords);
+	b_.setZero(nConstraints);
+	RHS_.setZero(nDepCoords);
+	RHS2_.setZero(nDepCoords);
+	ddotq_prev_.setZero(nDepCoords);
+	ddotq_next_.setZero(nDepCoords);
 
 	timelog().leave("solver_prepare");
 }
@@ -59,11 +83,9 @@ void CDynamicSimulator_AugmentedLagrangian_Dense::internal_solve_ddotq(
 	// 1) M \ddot{q}_0 = Q
 	// ---------------------------
 	// Get "Q":
-	// KLU leaves solution in the same place than the input RHS vector:
-	Eigen::VectorXd ddotq_prev(nDepCoords), ddotq_next(nDepCoords);
-	this->build_RHS(&ddotq_prev[0] /* Q */, nullptr /* we don't need "c" */);
+	this->build_RHS(&Q_[0] /* Q */, nullptr /* we don't need "c" */);
 
-	ddotq_prev = M_ldlt_.solve(ddotq_prev);
+	ddotq_prev_ = M_ldlt_->solve(Q_);
 
 	// 2) Iterate:
 	// ---------------------------
@@ -81,9 +103,11 @@ void CDynamicSimulator_AugmentedLagrangian_Dense::internal_solve_ddotq(
 	arm_->update_numeric_Phi_and_Jacobians();
 
 	arm_->Phi_q_.asDense(Phi_q_);
-	A_ = M_ + params_penalty.alpha * Phi_q_.transpose() * Phi_q_;
+	A_ = *M_;
+	A_.noalias() += params_penalty.alpha * Phi_q_.transpose() * Phi_q_;
 
-	A_lu_.compute(A_);
+	A_llt_.compute(A_);
+	ASSERT_(A_llt_.info() == Eigen::Success);
 
 	// Build the RHS vector:
 	// RHS = M*\ddot{q}_i -  Phi_q^t* alpha * [ \dot{Phi}_q * \dot{q} + 2 * xi *
@@ -95,11 +119,11 @@ void CDynamicSimulator_AugmentedLagrangian_Dense::internal_solve_ddotq(
 
 	arm_->dotPhi_q_.asDense(dotPhi_q_);
 
-	const Eigen::MatrixXd RHS2 =
-		params_penalty.alpha * Phi_q_.transpose() *
-		(dotPhi_q_ * arm_->dotq_ +
-		 2 * params_penalty.xi * params_penalty.w * arm_->dotPhi_ +
-		 params_penalty.w * params_penalty.w * arm_->Phi_);
+	b_ = 2 * params_penalty.xi * params_penalty.w * arm_->dotPhi_ +
+		 params_penalty.w * params_penalty.w * arm_->Phi_;
+	b_.noalias() += dotPhi_q_ * arm_->dotq_;
+
+	RHS2_.noalias() = params_penalty.alpha * Phi_q_.transpose() * b_;
 
 	timelog().leave("solver_ddotq.build_rhs");
 
@@ -107,8 +131,6 @@ void CDynamicSimulator_AugmentedLagrangian_Dense::internal_solve_ddotq(
 	// -----------------------------------
 	timelog().enter("solver_ddotq.solve");
 
-	Eigen::VectorXd RHS(nDepCoords);
-
 	const double MAX_DDOT_INCR_NORM = 1e-4 * nDepCoords;
 	const size_t MAX_ITERS = 10;
 
@@ -117,23 +139,26 @@ void CDynamicSimulator_AugmentedLagrangian_Dense::internal_solve_ddotq(
 	do
 	{
 		// RHS = M*\ddot{q}_i - RHS2
-		RHS = (M_ * ddotq_prev) - RHS2;
-		ddotq_next = A_lu_.solve(RHS);
-
-		ddot_incr_norm = (ddotq_next - ddotq_prev).norm();
-		// cout << "iter: " << iter<< endl << "prev: " << ddotq_prev.transpose()
-		// << "\nnext: " << ddotq_next.transpose() << "\n  norm: " <<
+		RHS_ = -RHS2_;
+		RHS_.noalias() += *M_ * ddotq_prev_;
+		ddotq_next_ = A_llt_.solve(RHS_);
+
+		ddot_incr_norm = (ddotq_next_ - ddotq_prev_).norm();
+		// cout << "iter: " << iter<< endl << "prev: " <<
+		// ddotq_prev_.transpose()
+		// << "\nnext: " << ddotq_next_.transpose() << "\n  norm: " <<
 		// ddot_incr_norm << endl << endl;
 
-		ddotq_prev = ddotq_next;
+		ddotq_prev_ = ddotq_next_;
 	} while (ddot_incr_norm > MAX_DDOT_INCR_NORM && ++iter < MAX_ITERS);
 
-	ddot_q.swap(ddotq_next);
+	ddot_q = ddotq_next_;
 
 	timelog().leave("solver_ddotq.solve");
 
 	ASSERTDEBMSG_(
-		((RHS.array() == RHS.array()).all()), "NaN found in result ddotq");
+		((ddot_q.array() == ddot_q.array()).all()),
+		"NaN found in result ddotq");
 
 	timelog().leave("solver_ddotq");
 }
@@ -166,9 +191,9 @@ void CDynamicSimulator_AugmentedLagrangian_Dense::post_iteration(double t)
 		//
 		// -> Lambda = Lambda + alpha * Phi
 		// -> [M+alpha * Phi_q^t * Phi_q] Aq = -[ M (qi-q0) + Phi_q^t * Lambda ]
-		rhs = M_ *( q0 - arm_->q_ ) - Phi_q_.transpose() * Lambda;
+		rhs = *M_ *( q0 - arm_->q_ ) - Phi_q_.transpose() * Lambda;
 
-		Aq = A_lu_.solve(rhs);
+		Aq = A_llt_.solve(rhs);
 		arm_->q_ += Aq;
 
 		cout << "iter: " << i << " |Aq|=" << Aq.norm() << endl;
@@ -11,10 +11,36 @@
 #include <mbse/CAssembledRigidModel.h>
 #include <mbse/dynamics/dynamic-simulators.h>
 
+#include <algorithm>
+
 using namespace mbse;
 using namespace Eigen;
 using namespace std;
 
+namespace
+{
+/** x = LDLT \ b, like SimplicialLDLT::solve(), but without the temporaries
+ * that Eigen allocates to apply the inverse permutation in place and to
+ * return vectorD() by value. `invD` is the inverse of vectorD(). */
+void ldlt_solve(
+	const Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>>& ldlt,
+	const Eigen::VectorXd& invD, const Eigen::VectorXd& b, Eigen::VectorXd& x,
+	Eigen::VectorXd& tmp)
+{
+	if (ldlt.permutationP().size() > 0)
+		tmp = ldlt.permutationP() * b;
+	else
+		tmp = b;
+	ldlt.matrixL().solveInPlace(tmp);
+	tmp.array() *= invD.array();
+	ldlt.matrixU().solveInPlace(tmp);
+	if (ldlt.permutationPinv().size() > 0)
+		x = ldlt.permutationPinv() * tmp;
+	else
+		x = tmp;
+}
+}  // namespace
+
 // ---------------------------------------------------------------------------------------------
 //  Solver: (Sparse) KLU with the penalty formulation
 // ---------------------------------------------------------------------------------------------
@@ -26,6 +52,17 @@ CDynamicSimulator_AugmentedLagrangian_KLU::
 	klu_defaults(&common_);
 }
 
+CDynamicSimulatorBase::Ptr CDynamicSimulator_AugmentedLagrangian_KLU::clone(
+	const std::shared_ptr<CAssembledRigidModel>& arm) const
+{
+	auto o = std::make_shared<CDynamicSimulator_AugmentedLagrangian_KLU>(arm);
+	o->params = params;
+	o->params_penalty = params_penalty;
+	o->ordering = ordering;
+	o->params_klu = params_klu;
+	return o;
+}
+
 /** Prepare the linear systems and anything else required to really call
  * solve_ddotq() */
 void CDynamicSimulator_AugmentedLagrangian_KLU::internal_prepare()
@@ -44,87 +81,129 @@ void CDynamicSimulator_AugmentedLagrangian_KLU::internal_prepare()
 	// RHS = Q - alpha * Phi_q^t* [ \dot{Phi}_q * \dot{q} + 2 * xi * omega *
 	// \dot{q} + omega^2 * Phi  ]
 	//
-	// Build mass matrix (constant), and set its triplet form as the beginning
-	// of the total "A" matrix:
-	arm_->buildMassMatrix_sparse(M_tri_);
-	A_tri_ = M_tri_;
-
-	//  Add entries in the triplet form for the sparse Phi_q Jacobian.
-	// -----------------------------------------------------------
-	A_tri_.reserve(
-		A_tri_.size() + nDepCoords +
-		nDepCoords *
-			nDepCoords);  // *IMPORTANT* Reserve mem at once to avoid
-						  // reallocations, since we store pointers to places...
-
-	PhiqtPhi_.clear();
-	PhiqtPhi_.reserve(nDepCoords * nDepCoords);
-
-	// Note: All this could be done much more efficiently if Phi_q was stored
-	// in compressed column form. But since this is only computed ONCE per
-	// simulation it's probably worth leave it stay...
-	for (size_t i = 0; i < nDepCoords; i++)
+	// The pattern of Phi_q^t * Phi_q is found symbolically, row by row of
+	// Phi_q: each pair of its non-zeros (r,i), (r,j) contributes one term to
+	// the entry (i,j). Working column by column (i) over the rows that have
+	// a non-zero there, with a marker per column j, gives every entry (i,j),
+	// j>=i, once, in time proportional to the number of terms.
+	const auto* Phi_q_rows = arm_->Phi_q_.outerIndexPtr();
+	const auto* Phi_q_cols = arm_->Phi_q_.innerIndexPtr();
+	const size_t Phi_q_nnz = arm_->Phi_q_.nonZeros();
+
+	// Column adjacency of Phi_q: rows and slots of the non-zeros of column
+	// `i` are in [col_ptr[i], col_ptr[i+1]), sorted by row.
+	std::vector<int> col_ptr(nDepCoords + 1, 0), col_rows(Phi_q_nnz),
+		col_slots(Phi_q_nnz);
+	for (size_t k = 0; k < Phi_q_nnz; k++) col_ptr[Phi_q_cols[k] + 1]++;
+	for (size_t i = 0; i < nDepCoords; i++) col_ptr[i + 1] += col_ptr[i];
 	{
-		for (size_t j = i; j < nDepCoords; j++)
-		{
-			// We have to evaluate the "dot product" of the columns i and j of
-			// Phi_q:
-			TSparseDotProduct sdp;
-
-			for (size_t row = 0; row < nConstraints; row++)
+		std::vector<int> next(col_ptr.begin(), col_ptr.end() - 1);
+		for (size_t r = 0; r < nConstraints; r++)
+			for (auto k = Phi_q_rows[r]; k < Phi_q_rows[r + 1]; k++)
 			{
-				const CompressedRowSparseMatrix::row_t& row_r =
-					arm_->Phi_q_.matrix[row];
-
-				const double *Phi_r_i = nullptr, *Phi_r_j = nullptr;
-
-				for (CompressedRowSparseMatrix::row_t::const_iterator itCol =
-						 row_r.begin();
-					 itCol != row_r.end(); ++itCol)
-				{
-					const size_t col = itCol->first;
-					if (col > j) break;	 // We're done in this row.
-					if (col != i && col != j) continue;
+				const int p = next[Phi_q_cols[k]]++;
+				col_rows[p] = static_cast<int>(r);
+				col_slots[p] = k;
+			}
+	}
 
-					if (col == i) Phi_r_i = &(itCol->second);
-					if (col == j) Phi_r_j = &(itCol->second);
-				}
+	// 1st pass: count entries and terms, to allocate the plan at once.
+	// Column indices of each Phi_q row are sorted, so the columns j>=i of
+	// row `r` start right at the slot of (r,i).
+	std::vector<int> mark(nDepCoords, -1);
+	size_t nEntries = 0, nTerms = 0, nDiag = 0;
+	for (size_t i = 0; i < nDepCoords; i++)
+		for (int p = col_ptr[i]; p < col_ptr[i + 1]; p++)
+			for (auto k = col_slots[p]; k < Phi_q_rows[col_rows[p] + 1]; k++)
+			{
+				const auto j = Phi_q_cols[k];
+				nTerms++;
+				if (mark[j] == static_cast<int>(i)) continue;
+				mark[j] = static_cast<int>(i);
+				nEntries++;
+				if (j == static_cast<int>(i)) nDiag++;
+			}
 
-				// Were both Phi_q[r][i] and Phi_q[r][j] != 0??
-				if (Phi_r_i && Phi_r_j)
-					sdp.lst_terms.push_back(
-						std::pair<const double*, const double*>(
-							Phi_r_i, Phi_r_j));
-			}  // end for each "row"
+	// 2nd pass: fill in the terms of each entry, column by column.
+	PhiqtPhi_.term_ptr.assign(nEntries + 1, 0);
+	PhiqtPhi_.terms.resize(nTerms);
+	PhiqtPhi_.A_ij.resize(nEntries);
+	PhiqtPhi_.A_ji.resize(nEntries);
 
-			// Is the product != 0?
-			if (!sdp.lst_terms.empty())
+	std::vector<int> entry_i(nEntries), entry_j(nEntries), next(nEntries);
+	std::vector<int> pos(nDepCoords, -1);  // entry of column j, if >= first
+	int e = 0;
+	for (size_t i = 0; i < nDepCoords; i++)
+	{
+		const int first = e;
+		for (int p = col_ptr[i]; p < col_ptr[i + 1]; p++)
+			for (auto k = col_slots[p]; k < Phi_q_rows[col_rows[p] + 1]; k++)
 			{
-				// Append a new triplet entry (i,j)
-				A_tri_.push_back( Eigen::Triplet<double>(i,j, 1.0 /* a dummy value, it'll be updated later on by reference */ ) );
-				sdp.out_ptr1 = const_cast<double*>(&(A_tri_.back().value()));
-
-				// And also (j,i) if i!=j:
-				sdp.out_ptr2 = nullptr;
-				if (i != j)
+				const auto j = Phi_q_cols[k];
+				if (pos[j] < first)
 				{
-					A_tri_.push_back( Eigen::Triplet<double>(j,i, 1.0 /* a dummy value, it'll be updated later on by reference */ ) );
-					sdp.out_ptr2 =
-						const_cast<double*>(&(A_tri_.back().value()));
+					pos[j] = e;
+					entry_i[e] = static_cast<int>(i);
+					entry_j[e] = j;
+					e++;
 				}
-
-				PhiqtPhi_.push_back(sdp);
+				PhiqtPhi_.term_ptr[pos[j] + 1]++;
 			}
+		for (int x = first; x < e; x++)
+		{
+			PhiqtPhi_.term_ptr[x + 1] += PhiqtPhi_.term_ptr[x];
+			next[x] = PhiqtPhi_.term_ptr[x];
+		}
+		for (int p = col_ptr[i]; p < col_ptr[i + 1]; p++)
+			for (auto k = col_slots[p]; k < Phi_q_rows[col_rows[p] + 1]; k++)
+				PhiqtPhi_.terms[next[pos[Phi_q_cols[k]]]++] =
+					std::make_pair(col_slots[p], k);
+	}
+	ASSERT_EQUAL_(static_cast<size_t>(e), nEntries);
+
+	// The augmented matrix "A" is the (constant) mass matrix plus the
+	// pattern of Phi_q^t * Phi_q, analyzed once:
+	const auto& M_tri = arm_->massMatrixCache().triplets(*arm_);
+	std::vector<Eigen::Triplet<double>> A_tri;
+	A_tri.reserve(M_tri.size() + 2 * nEntries - nDiag);
+	A_tri.insert(A_tri.end(), M_tri.begin(), M_tri.end());
+	for (size_t x = 0; x < nEntries; x++)
+	{
+		A_tri.emplace_back(entry_i[x], entry_j[x], 0.0);
+		if (entry_i[x] != entry_j[x])
+			A_tri.emplace_back(entry_j[x], entry_i[x], 0.0);
+	}
 
-		}  // end for "j"
-	}  // end for "i"
-
-	// Analyze the pattern once:
 	A_.resize(nDepCoords, nDepCoords);
-	A_.setFromTriplets(A_tri_.begin(), A_tri_.end());
+	A_.setFromTriplets(A_tri.begin(), A_tri.end());
+	A_mass_values_.assign(A_.valuePtr(), A_.valuePtr() + A_.nonZeros());
+
+	const auto A_slot = [this](int row, int col) {
+		const int* first = A_.innerIndexPtr() + A_.outerIndexPtr()[col];
+		const int* last = A_.innerIndexPtr() + A_.outerIndexPtr()[col + 1];
+		const int* it = std::lower_bound(first, last, row);
+		ASSERT_(it != last && *it == row);
+		return static_cast<int>(it - A_.innerIndexPtr());
+	};
+	for (size_t x = 0; x < nEntries; x++)
+	{
+		PhiqtPhi_.A_ij[x] = A_slot(entry_i[x], entry_j[x]);
+		PhiqtPhi_.A_ji[x] = entry_i[x] != entry_j[x]
+								? A_slot(entry_j[x], entry_i[x])
+								: -1;
+	}
+
+	// Mass matrix and its (constant) factorization:
+	M_ = &arm_->massMatrixCache().sparse(*arm_);
+	M_ldlt_ = &arm_->massMatrixCache().sparseLDLT(*arm_);
 
-	M_.resize(nDepCoords, nDepCoords);
-	M_.setFromTriplets(M_tri_.begin(), M_tri_.end());
+	Q_.setZero(nDepCoords);
+	b_.setZero(nConstraints);
+	RHS2_.setZero(nDepCoords);
+	ddotq_prev_.setZero(nDepCoords);
+	ddotq_next_.setZero(nDepCoords);
+	ldlt_tmp_.setZero(nDepCoords);
+	M_ldlt_invD_ = M_ldlt_->vectorD().cwiseInverse();
 
 	/* Control [UMFPACK_ORDERING] and Info [UMFPACK_ORDERING_USED] are one of:
 	 */
@@ -145,15 +224,6 @@ void CDynamicSimulator_AugmentedLagrangian_KLU::internal_prepare()
 	if (!symbolic_)
 		THROW_EXCEPTION("Error: KLU couldn't factorize the augmented matrix.");
 
-	// Mass matrix: factorize numerically since it's constant:
-	symbolic_M_ = klu_analyze(
-		M_.rows(), M_.outerIndexPtr(), M_.innerIndexPtr(), &common_);
-	if (!symbolic_M_)
-		THROW_EXCEPTION("Error: KLU couldn't factorize the mass matrix.");
-	numeric_M_ = klu_factor(
-		M_.outerIndexPtr(), M_.innerIndexPtr(), M_.valuePtr(), symbolic_M_,
-		&common_);
-
 	timelog().leave("solver_prepare");
 }
 
@@ -161,10 +231,7 @@ CDynamicSimulator_AugmentedLagrangian_KLU::
 	~CDynamicSimulator_AugmentedLagrangian_KLU()
 {
 	if (symbolic_) klu_free_symbolic(&symbolic_, &common_);
-	if (symbolic_M_) klu_free_symbolic(&symbolic_M_, &common_);
-
 	if (numeric_) klu_free_numeric(&numeric_, &common_);
-	if (numeric_M_) klu_free_numeric(&numeric_M_, &common_);
 }
 
 void CDynamicSimulator_AugmentedLagrangian_KLU::internal_solve_ddotq(
@@ -185,11 +252,9 @@ void CDynamicSimulator_AugmentedLagrangian_KLU::internal_solve_ddotq(
 	// 1) M \ddot{q}_0 = Q
 	// ---------------------------
 	// Get "Q":
-	// KLU leaves solution in the same place than the input RHS vector:
-	Eigen::VectorXd ddotq_prev(nDepCoords), ddotq_next(nDepCoords);
-	this->build_RHS(&ddotq_prev[0] /* Q */, nullptr /* we don't need "c" */);
+	this->build_RHS(&Q_[0] /* Q */, nullptr /* we don't need "c" */);
 
-	klu_solve(symbolic_M_, numeric_M_, M_.cols(), 1, &ddotq_prev[0], &common_);
+	ldlt_solve(*M_ldlt_, M_ldlt_invD_, Q_, ddotq_prev_, ldlt_tmp_);
 
 	// 2) Iterate:
 	// ---------------------------
@@ -207,38 +272,33 @@ void CDynamicSimulator_AugmentedLagrangian_KLU::internal_solve_ddotq(
 	timelog().enter("solver_ddotq.update_PhiqtPhiq");
 	arm_->update_numeric_Phi_and_Jacobians();
 
-	// Move the updated Jacobian values to their places in the triplet form:
-	for (size_t k = 0; k < PhiqtPhi_.size(); k++)
+	// A = M + alpha * Phi_q^t * Phi_q, following the precomputed plan:
 	{
-		TSparseDotProduct& sdp = PhiqtPhi_[k];
+		double* A_vals = A_.valuePtr();
+		std::copy(A_mass_values_.begin(), A_mass_values_.end(), A_vals);
 
-		double res = 0;
-		for (size_t i = 0; i < sdp.lst_terms.size(); i++)
-			res += (*sdp.lst_terms[i].first) * (*sdp.lst_terms[i].second);
+		const double* Phi_q_vals = arm_->Phi_q_.valuePtr();
+		const auto& terms = PhiqtPhi_.terms;
+		for (size_t x = 0; x < PhiqtPhi_.A_ij.size(); x++)
+		{
+			double res = 0;
+			for (int k = PhiqtPhi_.term_ptr[x]; k < PhiqtPhi_.term_ptr[x + 1];
+				 k++)
+				res += Phi_q_vals[terms[k].first] * Phi_q_vals[terms[k].second];
 
-		res *= params_penalty.alpha;
+			res *= params_penalty.alpha;
 
-		if (sdp.out_ptr1) *sdp.out_ptr1 = res;
-		if (sdp.out_ptr2) *sdp.out_ptr2 = res;
+			A_vals[PhiqtPhi_.A_ij[x]] += res;
+			if (PhiqtPhi_.A_ji[x] >= 0) A_vals[PhiqtPhi_.A_ji[x]] += res;
+		}
 	}
 	timelog().leave("solver_ddotq.update_PhiqtPhiq");
 
 	// Solve numeric sparse LU:
 	// -----------------------------------
-	timelog().enter("solver_ddotq.ccs");
-	A_.setFromTriplets(A_tri_.begin(), A_tri_.end());
-	timelog().leave("solver_ddotq.ccs");
-
 	timelog().enter("solver_ddotq.numeric_factor");
-	if (numeric_) klu_free_numeric(&numeric_, &common_);
-
-	numeric_ = klu_factor(
-		A_.outerIndexPtr(), A_.innerIndexPtr(), A_.valuePtr(), symbolic_,
-		&common_);
-
-	if (!numeric_)
-		THROW_EXCEPTION(
-			"Error: KLU couldn't numeric-factorize the augmented matrix.");
+	klu_numeric_factor(
+		A_, symbolic_, numeric_, common_, params_klu, numeric_rgrowth_rcond_);
 	timelog().leave("solver_ddotq.numeric_factor");
 
 	// Build the RHS vector:
@@ -252,45 +312,30 @@ void CDynamicSimulator_AugmentedLagrangian_KLU::internal_solve_ddotq(
 	// Evaluate "b":
 	// b = alpha * [ \dot{Phi}_q * \dot{q} + 2 * xi * omega * \dot{Phi} +
 	// omega^2 * Phi  ]
-	Eigen::VectorXd b(nConstraints);
-
 	// \dot{Phi}_q * \dot{q}
 	for (size_t r = 0; r < nConstraints; r++)
-	{
-		const CompressedRowSparseMatrix::row_t& row_r =
-			arm_->dotPhi_q_.matrix[r];
-		double res = 0;
-		for (CompressedRowSparseMatrix::row_t::const_iterator itCol =
-				 row_r.begin();
-			 itCol != row_r.end(); ++itCol)
-			res += itCol->second * arm_->dotq_[itCol->first];
-		b[r] = res;
-	}
+		b_[r] = arm_->dotPhi_q_.rowDot(r, arm_->dotq_);
 
 	// const Eigen::VectorXd dPhiq_dq = b;
 
 	// 2 * xi * omega * \dot{Phi}
 	const double xiw2 = 2 * params_penalty.xi * params_penalty.w;
-	for (size_t r = 0; r < nConstraints; r++) b[r] += xiw2 * arm_->dotPhi_[r];
+	for (size_t r = 0; r < nConstraints; r++) b_[r] += xiw2 * arm_->dotPhi_[r];
 
 	// omega^2 * Phi
 	const double w2 = params_penalty.w * params_penalty.w;
-	for (size_t r = 0; r < nConstraints; r++) b[r] += w2 * arm_->Phi_[r];
+	for (size_t r = 0; r < nConstraints; r++) b_[r] += w2 * arm_->Phi_[r];
 
 	// RHS2 =  alpha * Phi_q^t * b
-	Eigen::VectorXd RHS2(nDepCoords);
-	RHS2.setZero();
-	b *= params_penalty.alpha;
-	for (size_t r = 0; r < nConstraints; r++)
+	RHS2_.setZero();
+	b_ *= params_penalty.alpha;
 	{
-		const CompressedRowSparseMatrix::row_t& row_r = arm_->Phi_q_.matrix[r];
-		for (CompressedRowSparseMatrix::row_t::const_iterator itCol =
-				 row_r.begin();
-			 itCol != row_r.end(); ++itCol)
-		{
-			const size_t col = itCol->first;
-			RHS2[col] += itCol->second * b[r];
-		}
+		const auto* Phi_q_rows = arm_->Phi_q_.outerIndexPtr();
+		const auto* Phi_q_cols = arm_->Phi_q_.innerIndexPtr();
+		const double* Phi_q_vals = arm_->Phi_q_.valuePtr();
+		for (size_t r = 0; r < nConstraints; r++)
+			for (auto k = Phi_q_rows[r]; k < Phi_q_rows[r + 1]; k++)
+				RHS2_[Phi_q_cols[k]] += Phi_q_vals[k] * b_[r];
 	}
 
 	timelog().leave("solver_ddotq.build_rhs");
@@ -299,8 +344,6 @@ void CDynamicSimulator_AugmentedLagrangian_KLU::internal_solve_ddotq(
 	// -----------------------------------
 	timelog().enter("solver_ddotq.solve");
 
-	Eigen::VectorXd RHS(nDepCoords);
-
 	const double MAX_DDOT_INCR_NORM = 1e-4 * nDepCoords;
 	const size_t MAX_ITERS = 10;
 
@@ -310,26 +353,29 @@ void CDynamicSimulator_AugmentedLagrangian_KLU::internal_solve_ddotq(
 	{
 		// RHS = M*\ddot{q}_i - RHS2
 		// (Directly store the RHS in the in/out vector of KLU)
-		ddotq_next = (M_ * ddotq_prev) - RHS2;
-		klu_solve(symbolic_, numeric_, A_.cols(), 1, &ddotq_next[0], &common_);
+		ddotq_next_ = -RHS2_;
+		ddotq_next_.noalias() += *M_ * ddotq_prev_;
+		klu_solve(
+			symbolic_, numeric_, A_.cols(), 1, &ddotq_next_[0], &common_);
 
 		if (common_.status != KLU_OK)
 			THROW_EXCEPTION("Error: KLU couldn't solve the linear system.");
 
-		ddot_incr_norm = (ddotq_next - ddotq_prev).norm();
+		ddot_incr_norm = (ddotq_next_ - ddotq_prev_).norm();
 		// cout << "iter: " << iter<< endl << "prev: " << ddotq_prev.transpose()
 		// << "\nnext: " << ddotq_next.transpose() << "\n  norm: " <<
 		// ddot_incr_norm << endl << endl;
 
-		ddotq_prev = ddotq_next;
+		ddotq_prev_ = ddotq_next_;
 	} while (ddot_incr_norm > MAX_DDOT_INCR_NORM && ++iter < MAX_ITERS);
 
-	ddot_q.swap(ddotq_next);
+	ddot_q = ddotq_next_;
 
 	timelog().leave("solver_ddotq.solve");
 
 	ASSERTDEBMSG_(
-		((RHS.array() == RHS.array()).all()), "NaN found in result ddotq");
+		((ddot_q.array() == ddot_q.array()).all()),
+		"NaN found in result ddotq");
 
 	timelog().leave("solver_ddotq");
 }
@@ -26,6 +26,16 @@ CDynamicSimulator_Indep_dense::CDynamicSimulator_Indep_dense(
 {
 }
 
+CDynamicSimulatorBase::Ptr CDynamicSimulator_Indep_dense::clone(
+	const std::shared_ptr<CAssembledRigidModel>& arm) const
+{
+	auto o = std::make_shared<CDynamicSimulator_Indep_dense>(arm);
+	o->params = params;
+	o->can_choose_indep_coords_ = can_choose_indep_coords_;
+	o->indep_idxs_ = indep_idxs_;
+	return o;
+}
+
 /** Prepare the linear systems and anything else required to really call
  * solve_ddotq() */
 void CDynamicSimulator_Indep_dense::internal_prepare()
@@ -34,7 +44,7 @@ void CDynamicSimulator_Indep_dense::internal_prepare()
 
 	// Build mass matrix now and don't touch it anymore, since it's constant
 	// with this formulation:
-	arm_->buildMassMatrix_dense(mass_);
+	mass_ = &arm_->massMatrixCache().dense(*arm_);
 
 	timelog().leave("solver_prepare");
 }
@@ -149,12 +159,12 @@ void CDynamicSimulator_Indep_dense::internal_solve_ddotz(
 
 	this->build_RHS(&Q[0], &c[0]);
 
-	const Eigen::VectorXd RHS = R.transpose() * (Q - mass_ * S * c);
+	const Eigen::VectorXd RHS = R.transpose() * (Q - *mass_ * S * c);
 
 	timelog().leave("solver_ddotz.build_rhs");
 
 	timelog().enter("solver_ddotz.solve");
-	const Eigen::MatrixXd RtMR = R.transpose() * mass_ * R;
+	const Eigen::MatrixXd RtMR = R.transpose() * *mass_ * R;
 	ddot_z = RtMR.llt().solve(RHS);
 	timelog().enter("solver_ddotz.solve");
 
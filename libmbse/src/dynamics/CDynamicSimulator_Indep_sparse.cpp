@@ -0,0 +1,218 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+
+#include <mbse/CAssembledRigidModel.h>
+#include <mbse/dynamics/dynamic-simulators.h>
+
+using namespace mbse;
+using namespace Eigen;
+using namespace mrpt::math;
+using namespace mrpt;
+using namespace std;
+
+// ---------------------------------------------------------------------------------------------
+//  Solver: Sparse R matrix projection
+// ---------------------------------------------------------------------------------------------
+CDynamicSimulator_Indep_sparse::CDynamicSimulator_Indep_sparse(
+	const std::shared_ptr<CAssembledRigidModel> arm_ptr)
+	: CDynamicSimulatorIndepBase(arm_ptr)
+{
+}
+
+CDynamicSimulatorBase::Ptr CDynamicSimulator_Indep_sparse::clone(
+	const std::shared_ptr<CAssembledRigidModel>& arm) const
+{
+	auto o = std::make_shared<CDynamicSimulator_Indep_sparse>(arm);
+	o->params = params;
+	o->can_choose_indep_coords_ = can_choose_indep_coords_;
+	o->indep_idxs_ = indep_idxs_;
+	return o;
+}
+
+void CDynamicSimulator_Indep_sparse::internal_prepare()
+{
+	timelog().enter("solver_prepare");
+
+	mass_ = &arm_->massMatrixCache().sparse(*arm_);
+
+	timelog().leave("solver_prepare");
+}
+
+void CDynamicSimulator_Indep_sparse::correct_dependent_q_dq()
+{
+	arm_->finiteDisplacement(
+		indep_idxs_, 1e-9, 20, true /* also solve dot{q} */);
+}
+
+void CDynamicSimulator_Indep_sparse::dq_plus_dz(
+	const Eigen::VectorXd& dq, const Eigen::VectorXd& dz,
+	Eigen::VectorXd& out_dq) const
+{
+	out_dq = dq;
+	for (size_t i = 0; i < indep_idxs_.size(); i++)
+		out_dq[indep_idxs_[i]] += dz[i];
+}
+
+void CDynamicSimulator_Indep_sparse::choose_indep_coords()
+{
+	const auto& J = arm_->Phi_q_;
+	Phiq_ = Map<const SparseMatrix<double, RowMajor>>(
+		J.getNumRows(), J.getNumCols(), J.nonZeros(), J.outerIndexPtr(),
+		J.innerIndexPtr(), J.valuePtr());
+
+	// The pattern of Phi_q never changes:
+	if (!qr_Phiq_analyzed_)
+	{
+		qr_Phiq_.analyzePattern(Phiq_);
+		qr_Phiq_analyzed_ = true;
+	}
+	qr_Phiq_.factorize(Phiq_);
+	ASSERT_(qr_Phiq_.info() == Eigen::Success);
+
+	// Columns found to be linearly dependent on the previous ones are moved
+	// to the end of the permutation: those are the DOFs.
+	const size_t nDepCoords = arm_->q_.size();
+	const size_t nDOFs = nDepCoords - qr_Phiq_.rank();
+	const auto& perm = qr_Phiq_.colsPermutation().indices();
+
+	indep_idxs_.resize(nDOFs);
+	for (size_t i = 0; i < nDOFs; i++)
+		indep_idxs_[i] = perm[nDepCoords - nDOFs + i];
+}
+
+void CDynamicSimulator_Indep_sparse::prepare_R_pattern(
+	const std::vector<size_t>& dep)
+{
+	const size_t nDepCoords = arm_->q_.size();
+	const size_t nDOFs = indep_idxs_.size();
+
+	std::vector<int> indepCol(nDepCoords, -1);
+	for (size_t i = 0; i < nDOFs; i++) indepCol[indep_idxs_[i]] = i;
+
+	// Entries of Phi_z, in one pass over Phi_q (whose pattern never changes):
+	Phi_z_entries_.assign(nDOFs, {});
+	{
+		const auto& J = arm_->Phi_q_;
+		const auto* outer = J.outerIndexPtr();
+		const auto* inner = J.innerIndexPtr();
+		for (size_t r = 0; r < J.getNumRows(); r++)
+			for (auto k = outer[r]; k < outer[r + 1]; k++)
+				if (const int c = indepCol[inner[k]]; c >= 0)
+					Phi_z_entries_[c].emplace_back(r, k);
+	}
+
+	// Pattern of R: the identity rows, and all the dependent ones, even if
+	// some entry happens to be zero now:
+	std::vector<Eigen::Triplet<double>> tri;
+	tri.reserve(nDOFs * (dep.size() + 1));
+	for (size_t k = 0; k < nDOFs; k++)
+	{
+		tri.emplace_back(indep_idxs_[k], k, 1.0);
+		for (size_t i = 0; i < dep.size(); i++)
+			tri.emplace_back(dep[i], k, 0.0);
+	}
+	R_.resize(nDepCoords, nDOFs);
+	R_.setFromTriplets(tri.begin(), tri.end());
+
+	std::vector<int> depPos(nDepCoords, -1);
+	for (size_t i = 0; i < dep.size(); i++) depPos[dep[i]] = i;
+	R_dep_slots_.resize(nDOFs * dep.size());
+	for (size_t k = 0; k < nDOFs; k++)
+		for (auto p = R_.outerIndexPtr()[k]; p < R_.outerIndexPtr()[k + 1]; p++)
+			if (const int i = depPos[R_.innerIndexPtr()[p]]; i >= 0)
+				R_dep_slots_[k * dep.size() + i] = p;
+
+	// Sparse products keep all structural entries, so the pattern of R^t M R
+	// is fixed too:
+	MR_ = *mass_ * R_;
+	RtMR_ = R_.transpose() * MR_;
+	llt_RtMR_.analyzePattern(RtMR_);
+
+	R_indep_ = indep_idxs_;
+	R_prepared_ = true;
+}
+
+// method: R matrix projection (as in section 5.2.3 of "J. García De Jalon &
+// Bayo" book), without inverting [Phi_q; B]:
+//  R = [I; -Phi_d^{-1} Phi_z],  S c = [0; Phi_d^{-1} c]
+// (independent; dependent coordinates).
+void CDynamicSimulator_Indep_sparse::internal_solve_ddotz(
+	double t, VectorXd& ddot_z)
+{
+	timelog().enter("solver_ddotz");
+
+	const size_t nDepCoords = arm_->q_.size();
+	const size_t nConstraints = arm_->Phi_.size();
+
+	timelog().enter("solver_ddotz.update_jacob");
+	arm_->update_numeric_Phi_and_Jacobians();
+	timelog().leave("solver_ddotz.update_jacob");
+
+	if (can_choose_indep_coords_)
+	{
+		timelog().enter("solver_ddotz.choose_indep");
+		choose_indep_coords();
+		timelog().leave("solver_ddotz.choose_indep");
+	}
+	const size_t nDOFs = indep_idxs_.size();
+
+	auto& partition = arm_->coordinatePartition(indep_idxs_);
+	partition.update(*arm_);
+	const auto& dep = partition.dep();
+
+	// Dependent rows of R, column by column, right into its values:
+	timelog().enter("solver_ddotz.build_R");
+	if (!R_prepared_ || R_indep_ != indep_idxs_) prepare_R_pattern(dep);
+
+	const double* vals = arm_->Phi_q_.valuePtr();
+	double* R_vals = R_.valuePtr();
+	rhs_.setZero(nConstraints);
+	for (size_t k = 0; k < nDOFs; k++)
+	{
+		for (const auto& e : Phi_z_entries_[k]) rhs_[e.first] = -vals[e.second];
+		partition.solve(*arm_, rhs_, x_);
+		for (const auto& e : Phi_z_entries_[k]) rhs_[e.first] = 0;
+
+		const int* slots = &R_dep_slots_[k * dep.size()];
+		for (size_t i = 0; i < dep.size(); i++) R_vals[slots[i]] = x_[i];
+	}
+	timelog().leave("solver_ddotz.build_R");
+
+	// Build the RHS vector:
+	//   RHS = Rt*Q - Rt*M*Sc;
+	// --------------------------
+	timelog().enter("solver_ddotz.build_rhs");
+	Q_.resize(nDepCoords);
+	c_.resize(nConstraints);
+
+	this->build_RHS(&Q_[0], &c_[0]);
+
+	Sc_.setZero(nDepCoords);
+	partition.solve(*arm_, c_, x_);
+	for (size_t i = 0; i < dep.size(); i++) Sc_[dep[i]] = x_[i];
+
+	const Eigen::VectorXd RHS = R_.transpose() * (Q_ - *mass_ * Sc_);
+
+	timelog().leave("solver_ddotz.build_rhs");
+
+	// Same pattern than in prepare_R_pattern(): only the numeric part.
+	timelog().enter("solver_ddotz.solve");
+	MR_ = *mass_ * R_;
+	RtMR_ = R_.transpose() * MR_;
+	llt_RtMR_.factorize(RtMR_);
+	ASSERTMSG_(
+		llt_RtMR_.info() == Eigen::Success,
+		"R^t M R is not positive definite");
+	ddot_z = llt_RtMR_.solve(RHS);
+	timelog().leave("solver_ddotz.solve");
+
+	timelog().leave("solver_ddotz");
+}
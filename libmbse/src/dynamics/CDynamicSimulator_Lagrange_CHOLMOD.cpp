@@ -25,13 +25,25 @@ CDynamicSimulator_Lagrange_CHOLMOD::CDynamicSimulator_Lagrange_CHOLMOD(
 	: CDynamicSimulatorBase(arm_ptr),
 	  ordering_M(orderAMD),
 	  ordering_EEt(orderAMD),
-	  mass_tri_(nullptr),
-	  mass_(nullptr),
 	  Lm_(nullptr),
-	  Phi_q_t_tri_(nullptr)
+	  Lt_(nullptr),
+	  Phi_q_t_(nullptr),
+	  Q_(nullptr),
+	  c_(nullptr),
+	  z_(nullptr)
 {
 }
 
+CDynamicSimulatorBase::Ptr CDynamicSimulator_Lagrange_CHOLMOD::clone(
+	const std::shared_ptr<CAssembledRigidModel>& arm) const
+{
+	auto o = std::make_shared<CDynamicSimulator_Lagrange_CHOLMOD>(arm);
+	o->params = params;
+	o->ordering_M = ordering_M;
+	o->ordering_EEt = ordering_EEt;
+	return o;
+}
+
 /** Prepare the linear systems and anything else required to really call
  * solve_ddotq() */
 void CDynamicSimulator_Lagrange_CHOLMOD::internal_prepare()
@@ -48,77 +60,52 @@ void CDynamicSimulator_Lagrange_CHOLMOD::internal_prepare()
 	// instead of LDL'
 	cholmod_common_.final_ll = 1;
 
-	// Build mass matrix now and don't touch it anymore, since it's constant
-	// with this formulation:
-	mass_tri_ = arm_->buildMassMatrix_sparse_CHOLMOD(cholmod_common_);
-	ASSERT_(mass_tri_ != nullptr);
-
 	// 1) M = Lm * Lm^t
-	//  Analize Mass matrix and build symbolic decomposition:
+	//  The mass matrix is constant with this formulation, so its factorization
+	//  is shared by all the models with the same structure:
 	// ---------------------------------------
-	cholmod_sparse* mass_ =
-		cholmod_triplet_to_sparse(mass_tri_, mass_tri_->nnz, &cholmod_common_);
-	ASSERT_(mass_ != nullptr);
-
-	cholmod_common_.nmethods = 1;
+	int ordering_M_cholmod = CHOLMOD_AMD;
 	switch (this->ordering_M)
 	{
 		case orderNatural:
-			cholmod_common_.method[0].ordering = CHOLMOD_NATURAL;
+			ordering_M_cholmod = CHOLMOD_NATURAL;
 			break;
 		case orderAMD:
-			cholmod_common_.method[0].ordering = CHOLMOD_AMD;
+			ordering_M_cholmod = CHOLMOD_AMD;
 			break;
 		case orderMETIS:
-			cholmod_common_.method[0].ordering = CHOLMOD_METIS;
+			ordering_M_cholmod = CHOLMOD_METIS;
 			break;
 		case orderNESDIS:
-			cholmod_common_.method[0].ordering = CHOLMOD_NESDIS;
+			ordering_M_cholmod = CHOLMOD_NESDIS;
 			break;
 		case orderCOLAMD:
-			cholmod_common_.method[0].ordering = CHOLMOD_COLAMD;
+			ordering_M_cholmod = CHOLMOD_COLAMD;
 			break;
 		default:
 			THROW_EXCEPTION("Unknown or unsupported 'ordering' value.");
 	};
-	// cholmod_common_.postorder = TRUE;
-
-	// save_matrix( mass_, "M.txt",  &cholmod_common_);
 
-	Lm_ = cholmod_analyze(mass_, &cholmod_common_);
+	Lm_ = arm_->massMatrixCache().cholmodFactor(*arm_, ordering_M_cholmod);
 	ASSERT_(Lm_ != nullptr);
 
-	if (cholmod_common_.status != CHOLMOD_OK)
-		THROW_EXCEPTION("CHOLMOD couldn't symbolic factorize M");
-
-	// Numeric factorization:
-	cholmod_factorize(mass_, Lm_, &cholmod_common_);
-
 	// 2) Lm * E^t = Phi_q^t
 	//   Build sparse Phi_q^t: (m x n)^t = (n x m)
 	// For: cholmod_spsolve(CHOLMOD_L /*Lx=b*/, Lm_, Phi_q_t_ )
 	// -----------------------------------------------------------
-	Phi_q_t_tri_ = cholmod_allocate_triplet(
-		nDOFs, nConstraints, nDOFs * nConstraints, 0 /*unsymmetric*/,
-		CHOLMOD_REAL, &cholmod_common_);
-	for (size_t i = 0; i < nConstraints; i++)
-	{
-		// Constraint "i" goes to column "nDOFs+i" in the augmented matrix:
-		const CompressedRowSparseMatrix::row_t row_i = arm_->Phi_q_.matrix[i];
-		for (CompressedRowSparseMatrix::row_t::const_iterator itCol =
-				 row_i.begin();
-			 itCol != row_i.end(); ++itCol)
-		{
-			// We have precomputed the order in which we find the numeric
-			// values, just insert at their correct place:
-			const size_t idx = Phi_q_t_tri_->nnz;
-			static_cast<int*>(Phi_q_t_tri_->i)[idx] = itCol->first;
-			static_cast<int*>(Phi_q_t_tri_->j)[idx] = i;
-			ptrs_Phi_q_t_tri_.push_back(
-				static_cast<double*>(Phi_q_t_tri_->x) + idx);
-			Phi_q_t_tri_->nnz++;
-		}
-	}
+	// Phi_q in CSR is exactly Phi_q^t in CCS, so share the pattern and bind
+	// the Jacobian values to this matrix. No copies are needed afterwards.
+	const size_t nnz = arm_->Phi_q_.nonZeros();
+	Phi_q_t_ = cholmod_allocate_sparse(
+		nDOFs, nConstraints, nnz, 1 /*sorted*/, 1 /*packed*/,
+		0 /*unsymmetric*/, CHOLMOD_REAL, &cholmod_common_);
+	ASSERT_(Phi_q_t_ != nullptr);
+	std::copy_n(
+		arm_->Phi_q_.outerIndexPtr(), nConstraints + 1,
+		static_cast<int*>(Phi_q_t_->p));
+	std::copy_n(
+		arm_->Phi_q_.innerIndexPtr(), nnz, static_cast<int*>(Phi_q_t_->i));
+	arm_->Phi_q_.bindValues(static_cast<double*>(Phi_q_t_->x));
 
 	// Allocate RHS vectors:
 	Q_ =
@@ -131,17 +118,12 @@ void CDynamicSimulator_Lagrange_CHOLMOD::internal_prepare()
 	// Build the structure of E once so we can build its symbolic decomposition
 	// just once now:
 	// -------------------------------------------------------------------------------------------
-	// Compress sparse matrix Phi_q_t:
-	cholmod_sparse* Phi_q_t = cholmod_triplet_to_sparse(
-		Phi_q_t_tri_, Phi_q_t_tri_->nnz, &cholmod_common_);
-	ASSERTDEB_(Phi_q_t != nullptr);
-
 	// Solve:
 	//   L   *   X   = B
 	//   Lm  *  E^t  = Phi_q^t
 	//
 	cholmod_sparse* E_t =
-		cholmod_spsolve(CHOLMOD_L /*Lx=b*/, Lm_, Phi_q_t, &cholmod_common_);
+		cholmod_spsolve(CHOLMOD_L /*Lx=b*/, Lm_, Phi_q_t_, &cholmod_common_);
 	ASSERTDEB_(E_t != nullptr);
 	cholmod_sparse* E = cholmod_transpose(
 		E_t, 2 /* A' complex conjugate transpose */, &cholmod_common_);
@@ -187,12 +169,13 @@ void CDynamicSimulator_Lagrange_CHOLMOD::internal_prepare()
 
 CDynamicSimulator_Lagrange_CHOLMOD::~CDynamicSimulator_Lagrange_CHOLMOD()
 {
-	cholmod_free_triplet(&mass_tri_, &cholmod_common_);
-	cholmod_free_sparse(&mass_, &cholmod_common_);
-	cholmod_free_factor(&Lm_, &cholmod_common_);
 	cholmod_free_factor(&Lt_, &cholmod_common_);
 
-	cholmod_free_triplet(&Phi_q_t_tri_, &cholmod_common_);
+	if (Phi_q_t_)
+	{
+		arm_->Phi_q_.unbindValues(static_cast<const double*>(Phi_q_t_->x));
+		cholmod_free_sparse(&Phi_q_t_, &cholmod_common_);
+	}
 
 	cholmod_free_dense(&Q_, &cholmod_common_);
 	cholmod_free_dense(&c_, &cholmod_common_);
@@ -219,40 +202,21 @@ void CDynamicSimulator_Lagrange_CHOLMOD::internal_solve_ddotq(
 	timelog().enter("solver_ddotq.update_jacob");
 	arm_->update_numeric_Phi_and_Jacobians();
 
-	// Insert Phi_q^t Jacobian in right-top block of augmented matrix:
-	{
-		size_t cnt = 0;
-		for (size_t i = 0; i < nConstraints; i++)
-		{
-			// Constraint "i" goes to column "nDOFs+i" in the augmented matrix:
-			const CompressedRowSparseMatrix::row_t row_i =
-				arm_->Phi_q_.matrix[i];
-			for (CompressedRowSparseMatrix::row_t::const_iterator itCol =
-					 row_i.begin();
-				 itCol != row_i.end(); ++itCol)
-			{
-				// We have precomputed the order in which we find the numeric
-				// values, just insert at their correct place:
-				*ptrs_Phi_q_t_tri_[cnt++] = itCol->second;
-			}
-		}
-	}
+	// Phi_q^t is bound to the Jacobian values, unless another solver took
+	// them over in the meantime:
+	if (arm_->Phi_q_.valuePtr() != Phi_q_t_->x)
+		std::copy_n(
+			arm_->Phi_q_.valuePtr(), arm_->Phi_q_.nonZeros(),
+			static_cast<double*>(Phi_q_t_->x));
 	timelog().leave("solver_ddotq.update_jacob");
 
-	// Compress sparse matrix Phi_q_t:
-	timelog().enter("solver_ddotq.ccs");
-	cholmod_sparse* Phi_q_t = cholmod_triplet_to_sparse(
-		Phi_q_t_tri_, Phi_q_t_tri_->nnz, &cholmod_common_);
-	ASSERTDEB_(Phi_q_t != nullptr);
-	timelog().leave("solver_ddotq.ccs");
-
 	// Solve:
 	//   L   *   X   = B
 	//   Lm  *  E^t  = Phi_q^t
 	//
 	timelog().enter("solver_ddotq.solve_E");
 	cholmod_sparse* E_t =
-		cholmod_spsolve(CHOLMOD_L /*Lx=b*/, Lm_, Phi_q_t, &cholmod_common_);
+		cholmod_spsolve(CHOLMOD_L /*Lx=b*/, Lm_, Phi_q_t_, &cholmod_common_);
 	ASSERTDEB_(E_t != nullptr);
 
 	cholmod_sparse* E = cholmod_transpose(
@@ -312,12 +276,12 @@ void CDynamicSimulator_Lagrange_CHOLMOD::internal_solve_ddotq(
 	{
 		lagrangre->resize(nConstraints);
 		memcpy(
-			&(*lagrangre)[0], static_cast<double*>(x->x) + nDOFs,
+			&(*lagrangre)[0], static_cast<double*>(l->x),
 			sizeof(double) * nConstraints);
 	}
 
 #if 0
-	save_matrix_dense(Phi_q_t,"Phi_q_t.txt",&cholmod_common_);
+	save_matrix_dense(Phi_q_t_,"Phi_q_t.txt",&cholmod_common_);
 	save_matrix_dense(cholmod_factor_to_sparse(Lm_, &cholmod_common_),"Lm.txt",&cholmod_common_);
 	save_matrix_dense(E,"E.txt",&cholmod_common_);
 	save_matrix_dense(cholmod_factor_to_sparse(Lt_, &cholmod_common_),"Lt.txt",&cholmod_common_);
@@ -333,6 +297,7 @@ void CDynamicSimulator_Lagrange_CHOLMOD::internal_solve_ddotq(
 
 	cholmod_free_dense(&x2, &cholmod_common_);
 	cholmod_free_dense(&x, &cholmod_common_);
+	cholmod_free_dense(&l2, &cholmod_common_);
 	cholmod_free_dense(&l, &cholmod_common_);
 
 	timelog().leave("solver_ddotq");
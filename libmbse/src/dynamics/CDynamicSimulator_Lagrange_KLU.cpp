@@ -28,58 +28,28 @@ CDynamicSimulator_Lagrange_KLU::CDynamicSimulator_Lagrange_KLU(
 	klu_defaults(&common_);
 }
 
+CDynamicSimulatorBase::Ptr CDynamicSimulator_Lagrange_KLU::clone(
+	const std::shared_ptr<CAssembledRigidModel>& arm) const
+{
+	auto o = std::make_shared<CDynamicSimulator_Lagrange_KLU>(arm);
+	o->params = params;
+	o->ordering = ordering;
+	o->params_klu = params_klu;
+	return o;
+}
+
 /** Prepare the linear systems and anything else required to really call
  * solve_ddotq() */
 void CDynamicSimulator_Lagrange_KLU::internal_prepare()
 {
 	timelog().enter("solver_prepare");
 
-	const size_t nDOFs = arm_->q_.size();
-	const size_t nConstraints = arm_->Phi_.size();
-	const size_t nTot = nDOFs + nConstraints;
-
-	// Build mass matrix now and don't touch it anymore, since it's constant
-	// with this formulation:
-	arm_->buildMassMatrix_sparse(mass_tri_);
+	// Build the augmented matrix, with the (constant) mass matrix and the
+	// Phi_q^t values bound to it, and analyze its pattern once:
+	build_augmented_CCS(
+		arm_->massMatrixCache().triplets(*arm_), A_, A_Phi_q_idxs_);
 
-	// Start augmented matrix:
-	A_tri_ = mass_tri_;
-
-	//  Add entries in the triplet form for the sparse Phi_q Jacobian.
-	// -----------------------------------------------------------
-	A_tri_.reserve(
-		A_tri_.size() +
-		2 * nConstraints *
-			nDOFs);  // *IMPORTANT* Reserve mem at once to avoid reallocations,
-					 // since we store pointers to places...
-
-	for (size_t i = 0; i < nConstraints; i++)
-	{
-		// Constraint "i" goes to column "nDOFs+i" in the augmented matrix:
-		const CompressedRowSparseMatrix::row_t row_i = arm_->Phi_q_.matrix[i];
-		for (CompressedRowSparseMatrix::row_t::const_iterator itCol =
-				 row_i.begin();
-			 itCol != row_i.end(); ++itCol)
-		{
-			// We have precomputed the order in which we find the numeric
-			// values, just insert at their correct place:
-			const size_t idx0 = A_tri_.size();
-
-			A_tri_.push_back(
-				Eigen::Triplet<double>(itCol->first, nDOFs + i, 1.0));
-			A_tri_.push_back(
-				Eigen::Triplet<double>(nDOFs + i, itCol->first, 1.0));
-
-			A_tri_ptrs_Phi_q_.push_back(
-				const_cast<double*>(&A_tri_[idx0].value()));
-			A_tri_ptrs_Phi_q_.push_back(
-				const_cast<double*>(&A_tri_[idx0 + 1].value()));
-		}
-	}
-
-	// Analyze the pattern once:
-	A_.resize(nTot, nTot);
-	A_.setFromTriplets(A_tri_.begin(), A_tri_.end());
+	RHS_.setZero(A_.rows());
 
 	//   int btf ;               /* use BTF pre-ordering, or not */
 	//   int ordering ;          /* 0: AMD, 1: COLAMD, 2: user P and Q,
@@ -113,6 +83,8 @@ void CDynamicSimulator_Lagrange_KLU::internal_prepare()
 
 CDynamicSimulator_Lagrange_KLU::~CDynamicSimulator_Lagrange_KLU()
 {
+	unbind_augmented_CCS(A_);
+
 	if (symbolic_) klu_free_symbolic(&symbolic_, &common_);
 
 	if (numeric_) klu_free_numeric(&numeric_, &common_);
@@ -131,56 +103,29 @@ void CDynamicSimulator_Lagrange_KLU::internal_solve_ddotq(
 	//
 	const size_t nDOFs = arm_->q_.size();
 	const size_t nConstraints = arm_->Phi_.size();
-	const size_t nTot = nDOFs + nConstraints;
 
 	// Update numeric values of the constraint Jacobians:
 	timelog().enter("solver_ddotq.update_jacob");
 	arm_->update_numeric_Phi_and_Jacobians();
 	timelog().leave("solver_ddotq.update_jacob");
 
-	timelog().enter("solver_ddotq.update_jacob_triplets");
-	// Move the updated Jacobian values to their places in the triplet form:
-	{
-		size_t idx = 0;
-		for (size_t i = 0; i < nConstraints; i++)
-		{
-			// Constraint "i" goes to column "nDOFs+i" in the augmented matrix:
-			const CompressedRowSparseMatrix::row_t row_i =
-				arm_->Phi_q_.matrix[i];
-			for (CompressedRowSparseMatrix::row_t::const_iterator itCol =
-					 row_i.begin();
-				 itCol != row_i.end(); ++itCol)
-			{
-				*A_tri_ptrs_Phi_q_[idx++] = itCol->second;
-				*A_tri_ptrs_Phi_q_[idx++] = itCol->second;
-			}
-		}
-	}
-	timelog().leave("solver_ddotq.update_jacob_triplets");
+	// Phi_q^t is already in place in A_ (bound to Phi_q_), just mirror it
+	// into the Phi_q block:
+	timelog().enter("solver_ddotq.update_jacob_ccs");
+	update_augmented_CCS(A_, A_Phi_q_idxs_);
+	timelog().leave("solver_ddotq.update_jacob_ccs");
 
 	// Solve numeric sparse LU:
 	// -----------------------------------
-	timelog().enter("solver_ddotq.ccs");
-	A_.setFromTriplets(A_tri_.begin(), A_tri_.end());
-	timelog().leave("solver_ddotq.ccs");
-
 	timelog().enter("solver_ddotq.numeric_factor");
-	if (numeric_) klu_free_numeric(&numeric_, &common_);
-
-	numeric_ = klu_factor(
-		A_.outerIndexPtr(), A_.innerIndexPtr(), A_.valuePtr(), symbolic_,
-		&common_);
-
-	if (!numeric_)
-		THROW_EXCEPTION(
-			"Error: KLU couldn't numeric-factorize the augmented matrix.");
+	klu_numeric_factor(
+		A_, symbolic_, numeric_, common_, params_klu, numeric_rgrowth_rcond_);
 	timelog().leave("solver_ddotq.numeric_factor");
 
 	// Build the RHS vector:
 	// --------------------------
 	timelog().enter("solver_ddotq.build_rhs");
-	Eigen::VectorXd RHS(nTot);
-	this->build_RHS(&RHS[0], &RHS[nDOFs]);
+	this->build_RHS(&RHS_[0], &RHS_[nDOFs]);
 	timelog().leave("solver_ddotq.build_rhs");
 
 	// Solve linear system:
@@ -190,23 +135,40 @@ void CDynamicSimulator_Lagrange_KLU::internal_solve_ddotq(
 	// Eigen::VectorXd solution(nTot);
 	// KLU leaves solution in the same place than the input RHS vector:
 
-	klu_solve(symbolic_, numeric_, A_.cols(), 1, &RHS[0], &common_);
+	klu_solve(symbolic_, numeric_, A_.cols(), 1, &RHS_[0], &common_);
 
 	if (common_.status != KLU_OK)
 		THROW_EXCEPTION("Error: KLU couldn't solve the linear system.");
 
 	timelog().leave("solver_ddotq.solve");
 
-	ddot_q = RHS.head(nDOFs);
-	if (lagrangre) *lagrangre = RHS.tail(nConstraints);
+	ddot_q = RHS_.head(nDOFs);
+	if (lagrangre) *lagrangre = RHS_.tail(nConstraints);
 
 #if 0
 	cout << "q: " << arm_->q_.transpose() << endl;
 	cout << "qdot: " << arm_->dotq_.transpose() << endl;
-	cout << "RHS:\n" << RHS << endl;
+	cout << "RHS:\n" << RHS_ << endl;
 	cout << "solved ddotq: " << ddot_q.transpose() << endl;
 	mrpt::system::pause();
 #endif
 
 	timelog().leave("solver_ddotq");
 }
+
+void CDynamicSimulator_Lagrange_KLU::factorize_augmented_system()
+{
+	update_augmented_CCS(A_, A_Phi_q_idxs_);
+	klu_numeric_factor(
+		A_, symbolic_, numeric_, common_, params_klu, numeric_rgrowth_rcond_);
+}
+
+void CDynamicSimulator_Lagrange_KLU::solve_augmented_system(Eigen::MatrixXd& B)
+{
+	ASSERT_EQUAL_(B.rows(), A_.rows());
+
+	// All columns at once, in place:
+	klu_solve(symbolic_, numeric_, B.rows(), B.cols(), B.data(), &common_);
+	if (common_.status != KLU_OK)
+		THROW_EXCEPTION("Error: KLU couldn't solve the linear system.");
+}
@@ -26,6 +26,14 @@ CDynamicSimulator_Lagrange_LU_dense::CDynamicSimulator_Lagrange_LU_dense(
 {
 }
 
+CDynamicSimulatorBase::Ptr CDynamicSimulator_Lagrange_LU_dense::clone(
+	const std::shared_ptr<CAssembledRigidModel>& arm) const
+{
+	auto o = std::make_shared<CDynamicSimulator_Lagrange_LU_dense>(arm);
+	o->params = params;
+	return o;
+}
+
 /** Prepare the linear systems and anything else required to really call
  * solve_ddotq() */
 void CDynamicSimulator_Lagrange_LU_dense::internal_prepare()
@@ -34,7 +42,19 @@ void CDynamicSimulator_Lagrange_LU_dense::internal_prepare()
 
 	// Build mass matrix now and don't touch it anymore, since it's constant
 	// with this formulation:
-	arm_->buildMassMatrix_dense(mass_);
+	mass_ = &arm_->massMatrixCache().dense(*arm_);
+
+	const size_t nDOFs = arm_->q_.size();
+	const size_t nConstraints = arm_->Phi_.size();
+	const size_t nTot = nDOFs + nConstraints;
+
+	// The augmented matrix, but for the Phi_q blocks, is constant:
+	A_.setZero(nTot, nTot);
+	A_.block(0, 0, nDOFs, nDOFs) = *mass_;
+
+	RHS_.setZero(nTot);
+	solution_.setZero(nTot);
+	lu_ = Eigen::PartialPivLU<Eigen::MatrixXd>(nTot);
 
 	timelog().leave("solver_prepare");
 }
@@ -52,49 +72,28 @@ void CDynamicSimulator_Lagrange_LU_dense::internal_solve_ddotq(
 	//
 	const size_t nDOFs = arm_->q_.size();
 	const size_t nConstraints = arm_->Phi_.size();
-	const size_t nTot = nDOFs + nConstraints;
-
-	// Build the dense augmented matrix:
-	Eigen::MatrixXd A(nTot, nTot);
-	A.block(0, 0, nDOFs, nDOFs) = mass_;
-	A.block(0, nDOFs, nDOFs, nConstraints).setZero();
-	A.block(nDOFs, 0, nConstraints, nDOFs).setZero();
-	A.block(nDOFs, nDOFs, nConstraints, nConstraints).setZero();
 
 	// Update numeric values of the constraint Jacobians:
 	timelog().enter("solver_ddotq.update_jacob");
 	arm_->update_numeric_Phi_and_Jacobians();
-
-	for (size_t i = 0; i < nConstraints; i++)
-	{
-		// Constraint "i" goes to column "nDOFs+i" in the augmented matrix:
-		const CompressedRowSparseMatrix::row_t& row_i = arm_->Phi_q_.matrix[i];
-		for (const auto& kv : row_i)
-		{
-			const size_t col = kv.first;
-			// Insert at (col,i) because it's tranposed:
-
-			A.coeffRef(col, nDOFs + i) = kv.second;
-			A.coeffRef(nDOFs + i, col) = kv.second;
-		}
-	}
+	update_A_Phi_q();
 	timelog().leave("solver_ddotq.update_jacob");
 
 	// Build the RHS vector:
 	// --------------------------
 	timelog().enter("solver_ddotq.build_rhs");
-	Eigen::VectorXd RHS(nTot);
-	this->build_RHS(&RHS[0], &RHS[nDOFs]);
+	this->build_RHS(&RHS_[0], &RHS_[nDOFs]);
 	timelog().leave("solver_ddotq.build_rhs");
 
 	// Solve linear system (using LU dense decomposition):
 	// -------------------------------------------------------------
 	timelog().enter("solver_ddotq.solve");
-	const Eigen::VectorXd solution = A.partialPivLu().solve(RHS);
+	lu_.compute(A_);
+	solution_ = lu_.solve(RHS_);
 	timelog().leave("solver_ddotq.solve");
 
-	ddot_q = solution.head(nDOFs);
-	if (lagrangre) *lagrangre = solution.tail(nConstraints);
+	ddot_q = solution_.head(nDOFs);
+	if (lagrangre) *lagrangre = solution_.tail(nConstraints);
 
 #if 0
 	// A.saveToTextFile("A.txt");
@@ -102,11 +101,47 @@ void CDynamicSimulator_Lagrange_LU_dense::internal_solve_ddotq(
 
 	cout << "q: " << arm_->q_.transpose() << endl;
 	cout << "qdot: " << arm_->dotq_.transpose() << endl;
-	cout << "A:\n" << A << endl;
-	cout << "RHS:\n" << RHS << endl;
+	cout << "A:\n" << A_ << endl;
+	cout << "RHS:\n" << RHS_ << endl;
 	cout << "solved ddotq: " << ddot_q.transpose() << endl;
 	mrpt::system::pause();
 #endif
 
 	timelog().leave("solver_ddotq");
 }
+
+void CDynamicSimulator_Lagrange_LU_dense::update_A_Phi_q()
+{
+	const size_t nDOFs = arm_->q_.size();
+	const size_t nConstraints = arm_->Phi_.size();
+
+	const auto* Phi_q_rows = arm_->Phi_q_.outerIndexPtr();
+	const auto* Phi_q_cols = arm_->Phi_q_.innerIndexPtr();
+	const double* Phi_q_vals = arm_->Phi_q_.valuePtr();
+	for (size_t i = 0; i < nConstraints; i++)
+	{
+		// Constraint "i" goes to column "nDOFs+i" in the augmented matrix:
+		for (auto k = Phi_q_rows[i]; k < Phi_q_rows[i + 1]; k++)
+		{
+			const auto col = Phi_q_cols[k];
+			// Insert at (col,i) because it's tranposed:
+
+			A_.coeffRef(col, nDOFs + i) = Phi_q_vals[k];
+			A_.coeffRef(nDOFs + i, col) = Phi_q_vals[k];
+		}
+	}
+}
+
+void CDynamicSimulator_Lagrange_LU_dense::factorize_augmented_system()
+{
+	update_A_Phi_q();
+	lu_.compute(A_);
+}
+
+void CDynamicSimulator_Lagrange_LU_dense::solve_augmented_system(
+	Eigen::MatrixXd& B)
+{
+	ASSERT_EQUAL_(B.rows(), A_.rows());
+	const Eigen::MatrixXd X = lu_.solve(B);
+	B = X;
+}
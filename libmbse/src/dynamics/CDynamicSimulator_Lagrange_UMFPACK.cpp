@@ -28,58 +28,28 @@ CDynamicSimulator_Lagrange_UMFPACK::CDynamicSimulator_Lagrange_UMFPACK(
 {
 }
 
+CDynamicSimulatorBase::Ptr CDynamicSimulator_Lagrange_UMFPACK::clone(
+	const std::shared_ptr<CAssembledRigidModel>& arm) const
+{
+	auto o = std::make_shared<CDynamicSimulator_Lagrange_UMFPACK>(arm);
+	o->params = params;
+	o->ordering = ordering;
+	return o;
+}
+
 /** Prepare the linear systems and anything else required to really call
  * solve_ddotq() */
 void CDynamicSimulator_Lagrange_UMFPACK::internal_prepare()
 {
 	timelog().enter("solver_prepare");
 
-	const size_t nDOFs = arm_->q_.size();
-	const size_t nConstraints = arm_->Phi_.size();
-	const size_t nTot = nDOFs + nConstraints;
-
-	// Build mass matrix now and don't touch it anymore, since it's constant
-	// with this formulation:
-	arm_->buildMassMatrix_sparse(mass_tri_);
-
-	// Start augmented matrix:
-	A_tri_ = mass_tri_;
-
-	//  Add entries in the triplet form for the sparse Phi_q Jacobian.
-	// -----------------------------------------------------------
-	A_tri_.reserve(
-		A_tri_.size() +
-		2 * nConstraints *
-			nDOFs);  // *IMPORTANT* Reserve mem at once to avoid reallocations,
-					 // since we store pointers to places...
-
-	for (size_t i = 0; i < nConstraints; i++)
-	{
-		// Constraint "i" goes to column "nDOFs+i" in the augmented matrix:
-		const CompressedRowSparseMatrix::row_t row_i = arm_->Phi_q_.matrix[i];
-		for (CompressedRowSparseMatrix::row_t::const_iterator itCol =
-				 row_i.begin();
-			 itCol != row_i.end(); ++itCol)
-		{
-			// We have precomputed the order in which we find the numeric
-			// values, just insert at their correct place:
-			const size_t idx0 = A_tri_.size();
-
-			A_tri_.push_back(
-				Eigen::Triplet<double>(itCol->first, nDOFs + i, 1.0));
-			A_tri_.push_back(
-				Eigen::Triplet<double>(nDOFs + i, itCol->first, 1.0));
-
-			A_tri_ptrs_Phi_q_.push_back(
-				const_cast<double*>(&A_tri_[idx0].value()));
-			A_tri_ptrs_Phi_q_.push_back(
-				const_cast<double*>(&A_tri_[idx0 + 1].value()));
-		}
-	}
+	// Build the augmented matrix, with the (constant) mass matrix and the
+	// Phi_q^t values bound to it, and analyze its pattern once:
+	build_augmented_CCS(
+		arm_->massMatrixCache().triplets(*arm_), A_, A_Phi_q_idxs_);
 
-	// Analyze the pattern once:
-	A_.resize(nTot, nTot);
-	A_.setFromTriplets(A_tri_.begin(), A_tri_.end());
+	RHS_.setZero(A_.rows());
+	solution_.setZero(A_.rows());
 
 	// Set defaults:
 	umfpack_di_defaults(umf_control_);
@@ -120,6 +90,8 @@ void CDynamicSimulator_Lagrange_UMFPACK::internal_prepare()
 
 CDynamicSimulator_Lagrange_UMFPACK::~CDynamicSimulator_Lagrange_UMFPACK()
 {
+	unbind_augmented_CCS(A_);
+
 	if (symbolic_)
 	{
 		umfpack_di_free_symbolic(&symbolic_);
@@ -145,36 +117,18 @@ void CDynamicSimulator_Lagrange_UMFPACK::internal_solve_ddotq(
 	//
 	const size_t nDOFs = arm_->q_.size();
 	const size_t nConstraints = arm_->Phi_.size();
-	const size_t nTot = nDOFs + nConstraints;
 
 	// Update numeric values of the constraint Jacobians:
 	timelog().enter("solver_ddotq.update_jacob");
 	arm_->update_numeric_Phi_and_Jacobians();
 
-	// Move the updated Jacobian values to their places in the triplet form:
-	{
-		size_t idx = 0;
-		for (size_t i = 0; i < nConstraints; i++)
-		{
-			// Constraint "i" goes to column "nDOFs+i" in the augmented matrix:
-			const CompressedRowSparseMatrix::row_t row_i =
-				arm_->Phi_q_.matrix[i];
-			for (CompressedRowSparseMatrix::row_t::const_iterator itCol =
-					 row_i.begin();
-				 itCol != row_i.end(); ++itCol)
-			{
-				*A_tri_ptrs_Phi_q_[idx++] = itCol->second;
-				*A_tri_ptrs_Phi_q_[idx++] = itCol->second;
-			}
-		}
-	}
+	// Phi_q^t is already in place in A_ (bound to Phi_q_), just mirror it
+	// into the Phi_q block:
+	update_augmented_CCS(A_, A_Phi_q_idxs_);
 	timelog().leave("solver_ddotq.update_jacob");
 
 	// Solve numeric sparse LU:
 	// -----------------------------------
-	timelog().enter("solver_ddotq.ccs");
-	A_.setFromTriplets(A_tri_.begin(), A_tri_.end());
-	timelog().leave("solver_ddotq.ccs");
 
 	timelog().enter("solver_ddotq.numeric_factor");
 
@@ -196,40 +150,77 @@ void CDynamicSimulator_Lagrange_UMFPACK::internal_solve_ddotq(
 	// Build the RHS vector:
 	// --------------------------
 	timelog().enter("solver_ddotq.build_rhs");
-	Eigen::VectorXd RHS(nTot);
-	this->build_RHS(&RHS[0], &RHS[nDOFs]);
+	this->build_RHS(&RHS_[0], &RHS_[nDOFs]);
 	timelog().leave("solver_ddotq.build_rhs");
 
 	// Solve linear system:
 	// -----------------------------------
 	timelog().enter("solver_ddotq.solve");
 
-	Eigen::VectorXd solution(nTot);
-
 	errorCode = umfpack_di_solve(
 		UMFPACK_A, A_.outerIndexPtr(), A_.innerIndexPtr(), A_.valuePtr(),
-		&solution[0], &RHS[0], numeric_, umf_control_, umf_info_);
+		&solution_[0], &RHS_[0], numeric_, umf_control_, umf_info_);
 
 	if (errorCode != 0)
 	{
+		std::vector<Eigen::Triplet<double>> A_tri;
+		for (int col = 0; col < A_.outerSize(); col++)
+			for (Eigen::SparseMatrix<double>::InnerIterator it(A_, col); it;
+				 ++it)
+				A_tri.emplace_back(it.row(), it.col(), it.value());
 		mrpt::math::saveEigenSparseTripletsToFile(
-			"DUMP_UMFPACK_ERROR_A.txt", A_tri_);
+			"DUMP_UMFPACK_ERROR_A.txt", A_tri);
 		// RHS.saveToTextFile("DUMP_UMFPACK_ERROR_RHS.txt");
 		THROW_EXCEPTION("Error: UMFPACK couldn't solve the linear system.");
 	}
 
 	timelog().leave("solver_ddotq.solve");
 
-	ddot_q = solution.head(nDOFs);
-	if (lagrangre) *lagrangre = solution.tail(nConstraints);
+	ddot_q = solution_.head(nDOFs);
+	if (lagrangre) *lagrangre = solution_.tail(nConstraints);
 
 #if 0
 	cout << "q: " << arm_->q_.transpose() << endl;
 	cout << "qdot: " << arm_->dotq_.transpose() << endl;
-	cout << "RHS:\n" << RHS << endl;
+	cout << "RHS:\n" << RHS_ << endl;
 	cout << "solved ddotq: " << ddot_q.transpose() << endl;
 	mrpt::system::pause();
 #endif
 
 	timelog().leave("solver_ddotq");
 }
+
+void CDynamicSimulator_Lagrange_UMFPACK::factorize_augmented_system()
+{
+	update_augmented_CCS(A_, A_Phi_q_idxs_);
+
+	if (numeric_)
+	{
+		umfpack_di_free_numeric(&numeric_);
+		numeric_ = nullptr;
+	}
+	const int errorCode = umfpack_di_numeric(
+		A_.outerIndexPtr(), A_.innerIndexPtr(), A_.valuePtr(), symbolic_,
+		&numeric_, umf_control_, umf_info_);
+	if (errorCode < 0)
+		THROW_EXCEPTION(
+			"Error: UMFPACK couldn't numeric-factorize the augmented matrix.");
+}
+
+void CDynamicSimulator_Lagrange_UMFPACK::solve_augmented_system(
+	Eigen::MatrixXd& B)
+{
+	ASSERT_EQUAL_(B.rows(), A_.rows());
+
+	// UMFPACK solves one RHS at a time:
+	for (int j = 0; j < B.cols(); j++)
+	{
+		const int errorCode = umfpack_di_solve(
+			UMFPACK_A, A_.outerIndexPtr(), A_.innerIndexPtr(), A_.valuePtr(),
+			&solution_[0], B.col(j).data(), numeric_, umf_control_,
+			umf_info_);
+		if (errorCode != 0)
+			THROW_EXCEPTION("Error: UMFPACK couldn't solve the linear system.");
+		B.col(j) = solution_;
+	}
+}
@@ -26,6 +26,14 @@ CDynamicSimulator_R_matrix_dense::CDynamicSimulator_R_matrix_dense(
 {
 }
 
+CDynamicSimulatorBase::Ptr CDynamicSimulator_R_matrix_dense::clone(
+	const std::shared_ptr<CAssembledRigidModel>& arm) const
+{
+	auto o = std::make_shared<CDynamicSimulator_R_matrix_dense>(arm);
+	o->params = params;
+	return o;
+}
+
 /** Prepare the linear systems and anything else required to really call
  * solve_ddotq() */
 void CDynamicSimulator_R_matrix_dense::internal_prepare()
@@ -34,7 +42,21 @@ void CDynamicSimulator_R_matrix_dense::internal_prepare()
 
 	// Build mass matrix now and don't touch it anymore, since it's constant
 	// with this formulation:
-	arm_->buildMassMatrix_dense(mass_);
+	mass_ = &arm_->massMatrixCache().dense(*arm_);
+
+	const size_t nDepCoords = arm_->q_.size();
+	const size_t nConstraints = arm_->Phi_.size();
+	ASSERT_ABOVE_(nDepCoords, nConstraints);
+	const size_t nDOFs = nDepCoords - nConstraints;
+
+	Phiq_.setZero(nConstraints, nDepCoords);
+	K_.setZero(nDepCoords, nDOFs);
+	R_.setZero(nDepCoords, nDOFs);
+	A_.setZero(nDepCoords, nDepCoords);
+	Q_.setZero(nDepCoords);
+	RHS_.setZero(nDepCoords);
+	lu_Phiq_ = Eigen::FullPivLU<Eigen::MatrixXd>(nConstraints, nDepCoords);
+	lu_A_ = Eigen::PartialPivLU<Eigen::MatrixXd>(nDepCoords);
 
 	timelog().leave("solver_prepare");
 }
@@ -68,43 +90,48 @@ void CDynamicSimulator_R_matrix_dense::internal_solve_ddotq(
 	// Get Jacobian dPhi_dq
 	timelog().enter("solver_ddotq.get_dense_jacob");
 
-	Eigen::MatrixXd Phiq(nConstraints, nDepCoords);
-	arm_->Phi_q_.asDense(Phiq);
+	arm_->Phi_q_.asDense(Phiq_);
 
 	timelog().leave("solver_ddotq.get_dense_jacob");
 
 	// Compute R: the kernel of Phi_q
+	// With P*Phi_q*Q = L*[U1 U2], the columns of Q*[-U1^{-1}*U2; I] are a
+	// basis of the kernel. Unlike FullPivLU::kernel(), this builds it in
+	// the preallocated R_.
 	timelog().enter("solver_ddotq.Phiq_kernel");
-	Eigen::FullPivLU<Eigen::MatrixXd> lu;
-	lu.compute(Phiq);
-	const Eigen::MatrixXd R = lu.kernel();
+	lu_Phiq_.compute(Phiq_);
 
-	const size_t nDOFs = R.cols();
+	ASSERT_EQUAL_(static_cast<size_t>(lu_Phiq_.rank()), nConstraints);
+	const size_t nDOFs = nDepCoords - nConstraints;
 
-	timelog().leave("solver_ddotq.Phiq_kernel");
+	const auto& LU = lu_Phiq_.matrixLU();
+	K_.topRows(nConstraints) = -LU.rightCols(nDOFs);
+	LU.leftCols(nConstraints)
+		.triangularView<Eigen::Upper>()
+		.solveInPlace(K_.topRows(nConstraints));
+	K_.bottomRows(nDOFs).setIdentity();
+	R_.noalias() = lu_Phiq_.permutationQ() * K_;
 
-	ASSERT_EQUAL_(nDepCoords, nConstraints + nDOFs);
+	timelog().leave("solver_ddotq.Phiq_kernel");
 
 	// Build the dense augmented matrix:
-	Eigen::MatrixXd A(nDepCoords, nDepCoords);
-	A.block(0, 0, nConstraints, nDepCoords) = Phiq;
-	A.block(nConstraints, 0, nDOFs, nDepCoords) = R.transpose() * mass_;
+	A_.topRows(nConstraints) = Phiq_;
+	A_.bottomRows(nDOFs).noalias() = R_.transpose() * *mass_;
 
 	// Build the RHS vector:
 	// --------------------------
 	timelog().enter("solver_ddotq.build_rhs");
-	Eigen::VectorXd RHS(nDepCoords);
-	Eigen::VectorXd Q(nDepCoords);
 
-	this->build_RHS(&Q[0], &RHS[0] /* c => [0:nConstraints-1] */);
-	RHS.tail(nDOFs) = R.transpose() * Q;
+	this->build_RHS(&Q_[0], &RHS_[0] /* c => [0:nConstraints-1] */);
+	RHS_.tail(nDOFs).noalias() = R_.transpose() * Q_;
 
 	timelog().leave("solver_ddotq.build_rhs");
 
 	// Solve linear system (using LU dense decomposition):
 	// -------------------------------------------------------------
 	timelog().enter("solver_ddotq.solve");
-	ddot_q = A.partialPivLu().solve(RHS);
+	lu_A_.compute(A_);
+	ddot_q = lu_A_.solve(RHS_);
 	timelog().leave("solver_ddotq.solve");
 
 #if 0
@@ -113,11 +140,11 @@ void CDynamicSimulator_R_matrix_dense::internal_solve_ddotq(
 
 	cout << "q: " << arm_->q_.transpose() << endl;
 	cout << "qdot: " << arm_->dotq_.transpose() << endl;
-	cout << "A:\n" << A << endl;
-	cout << "RHS:\n" << RHS << endl;
+	cout << "A:\n" << A_ << endl;
+	cout << "RHS:\n" << RHS_ << endl;
 	cout << "solved ddotq: " << ddot_q.transpose() << endl;
-	cout << "Phiq:\n" << Phiq << endl;
-	cout << "R^t:\n" << R << endl;
+	cout << "Phiq:\n" << Phiq_ << endl;
+	cout << "R^t:\n" << R_ << endl;
 	mrpt::system::pause();
 #endif
 
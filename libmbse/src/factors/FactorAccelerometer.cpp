@@ -0,0 +1,56 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#include <mbse/factors/FactorAccelerometer.h>
+
+using namespace mbse;
+
+gtsam::NonlinearFactor::shared_ptr FactorAccelerometer::clone() const
+{
+	return boost::static_pointer_cast<gtsam::NonlinearFactor>(
+		gtsam::NonlinearFactor::shared_ptr(new This(*this)));
+}
+
+void FactorAccelerometer::print(
+	const std::string& s, const gtsam::KeyFormatter& keyFormatter) const
+{
+	std::cout << s << "mbde::FactorAccelerometer("
+			  << keyFormatter(this->key1()) << ","
+			  << keyFormatter(this->key2()) << ")\n";
+	std::cout << " reading: " << reading_ << "\n";
+	noiseModel_->print("  noise model: ");
+}
+
+bool FactorAccelerometer::equals(
+	const gtsam::NonlinearFactor& expected, double tol) const
+{
+	const This* e = dynamic_cast<const This*>(&expected);
+	return e != nullptr && Base::equals(*e, tol);
+}
+
+gtsam::Vector FactorAccelerometer::evaluateError(
+	const state_t& q_k, const state_t& ddq_k,
+	boost::optional<gtsam::Matrix&> H1,
+	boost::optional<gtsam::Matrix&> H2) const
+{
+	const auto n = q_k.size();
+	if (ddq_k.size() != n)
+		throw std::runtime_error("Inconsistent vector lengths!");
+	if (n < 1) throw std::runtime_error("Empty state vector!");
+
+	gtsam::Vector err;
+	err.resize(1);
+	err[0] = sensor_->reading(
+				 q_k, ddq_k, H1 ? &H1.value() : nullptr,
+				 H2 ? &H2.value() : nullptr) -
+			 reading_;
+
+	return err;
+}
@@ -0,0 +1,134 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#include <mbse/factors/FactorConstraintBlocks.h>
+#include <mbse/CAssembledRigidModel.h>
+#include <algorithm>
+
+using namespace mbse;
+
+FactorConstraintBlocks::FactorConstraintBlocks(
+	const CAssembledRigidModel::Ptr& arm, const StateBlockLayout::Ptr& layout,
+	size_t constraint_index, const gtsam::SharedNoiseModel& noiseModel,
+	unsigned char c, size_t t,
+	const std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>>& arms)
+	: Base(noiseModel, gtsam::KeyVector()),
+	  arm_(arm),
+	  arms_(arms ? arms : makePerThreadCopies(arm)),
+	  layout_(layout),
+	  constraint_index_(constraint_index)
+{
+	ASSERT_(arm_);
+	ASSERT_(layout_);
+	ASSERT_EQUAL_(
+		static_cast<size_t>(arm_->q_.size()), layout_->stateDimension());
+
+	blocks_ = layout_->constraintBlocks(*arm_, constraint_index_);
+	for (const auto b : blocks_) keys_.push_back(layout_->key(c, t, b));
+
+	const auto [r0, r1] = arm_->getConstraintRows(constraint_index_);
+	ASSERT_EQUAL_(noiseModel->dim(), r1 - r0);
+
+	const auto* outer = arm_->Phi_q_.outerIndexPtr();
+	const auto* inner = arm_->Phi_q_.innerIndexPtr();
+	for (size_t r = r0; r < r1; r++)
+	{
+		for (auto k = outer[r]; k < outer[r + 1]; k++)
+		{
+			const auto [b, pos] = layout_->blockOf(inner[k]);
+			const auto var =
+				std::lower_bound(blocks_.begin(), blocks_.end(), b) -
+				blocks_.begin();
+			entries_.push_back(
+				{r - r0, static_cast<size_t>(var), pos,
+				 static_cast<size_t>(k)});
+		}
+	}
+}
+
+FactorConstraintBlocks::~FactorConstraintBlocks() = default;
+
+gtsam::NonlinearFactor::shared_ptr FactorConstraintBlocks::clone() const
+{
+	return boost::static_pointer_cast<gtsam::NonlinearFactor>(
+		gtsam::NonlinearFactor::shared_ptr(new This(*this)));
+}
+
+void FactorConstraintBlocks::print(
+	const std::string& s, const gtsam::KeyFormatter& keyFormatter) const
+{
+	std::cout << s << "mbde::FactorConstraintBlocks(constraint="
+			  << constraint_index_ << ",";
+	for (const auto k : keys()) std::cout << " " << keyFormatter(k);
+	std::cout << ")\n";
+	noiseModel_->print("  noise model: ");
+}
+
+bool FactorConstraintBlocks::equals(
+	const gtsam::NonlinearFactor& expected, double tol) const
+{
+	const This* e = dynamic_cast<const This*>(&expected);
+	return e != nullptr && Base::equals(*e, tol) &&
+		   constraint_index_ == e->constraint_index_;
+}
+
+gtsam::Vector FactorConstraintBlocks::unwhitenedError(
+	const gtsam::Values& x, boost::optional<std::vector<gtsam::Matrix>&> H) const
+{
+	MRPT_START
+
+	CAssembledRigidModel& arm = arms_->get();
+
+	// Only the coordinates of this constraint's points are set. The rest of
+	// q is left as is, since the constraint does not read it:
+	for (size_t i = 0; i < blocks_.size(); i++)
+	{
+		const auto& dofs = layout_->block(blocks_[i]);
+		const auto& xb = x.at<state_t>(keys_[i]);
+		ASSERT_EQUAL_(static_cast<size_t>(xb.size()), dofs.size());
+		for (size_t j = 0; j < dofs.size(); j++) arm.q_[dofs[j]] = xb[j];
+	}
+
+	arm.update_numeric_Phi_and_Jacobians(constraint_index_);
+
+	const auto [r0, r1] = arm.getConstraintRows(constraint_index_);
+	gtsam::Vector err = arm.Phi_.segment(r0, r1 - r0);
+
+	// d err / d q_b, for each block b:
+	if (H)
+	{
+		auto& Hv = H.value();
+		Hv.resize(blocks_.size());
+		for (size_t i = 0; i < blocks_.size(); i++)
+			Hv[i].setZero(r1 - r0, layout_->block(blocks_[i]).size());
+
+		const double* vals = arm.Phi_q_.valuePtr();
+		for (const auto& e : entries_) Hv[e.var](e.row, e.pos) = vals[e.slot];
+	}
+
+	return err;
+
+	MRPT_END
+}
+
+void mbse::addFactorConstraintBlocks(
+	gtsam::NonlinearFactorGraph& graph, const CAssembledRigidModel::Ptr& arm,
+	const StateBlockLayout::Ptr& layout, double sigma, unsigned char c,
+	size_t t)
+{
+	const auto arms = makePerThreadCopies(arm);
+	for (size_t i = 0; i < arm->constraints_.size(); i++)
+	{
+		const auto [r0, r1] = arm->getConstraintRows(i);
+		graph.emplace_shared<FactorConstraintBlocks>(
+			arm, layout, i, gtsam::noiseModel::Isotropic::Sigma(r1 - r0, sigma),
+			c, t, arms);
+	}
+}
@@ -41,24 +41,27 @@ gtsam::Vector FactorConstraints::evaluateError(
 {
 	MRPT_START
 
+	CAssembledRigidModel& arm = arms_->get();
+
 	const auto n = q_k.size();
 	if (n < 1) throw std::runtime_error("Empty state vector!");
 
 	// Set q in the multibody model:
-	arm_->q_ = q_k;
+	arm.q_ = q_k;
 
 	// Update Jacobians:
-	arm_->update_numeric_Phi_and_Jacobians();
+	arm.update_numeric_Phi_and_Jacobians();
 
 	// Evaluate error:
-	gtsam::Vector err = arm_->Phi_;
+	gtsam::Vector err = arm.Phi_;
 
 	// Get the Jacobians required for optimization:
 	// d err / d q_k
 	if (H1)
 	{
 		auto& Hv = H1.value();
-		Hv = arm_->Phi_q_.asDense();
+		Hv.setZero(arm.Phi_.rows(), n);
+		arm.Phi_q_.addTo(Hv);
 	}
 
 	return err;
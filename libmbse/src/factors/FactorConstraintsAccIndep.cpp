@@ -19,12 +19,14 @@ FactorConstraintsAccIndep::FactorConstraintsAccIndep(
 	const CAssembledRigidModel::Ptr& arm,
 	const std::vector<size_t>& indCoordsIndices,
 	const gtsam::SharedNoiseModel& noiseModel, gtsam::Key key_q_k,
-	gtsam::Key key_dotq_k, gtsam::Key key_ddotq_k, gtsam::Key key_ddotz_k)
+	gtsam::Key key_dotq_k, gtsam::Key key_ddotq_k, gtsam::Key key_ddotz_k,
+	const std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>>& arms)
 	: Base(noiseModel, key_q_k, key_dotq_k, key_ddotq_k, key_ddotz_k),
 	  arm_(arm),
-	  indCoordsIndices_(indCoordsIndices),
-	  matrix_Iidx_(selector_matrix(indCoordsIndices, arm->q_.size()))
+	  arms_(arms ? arms : makePerThreadCopies(arm)),
+	  indCoordsIndices_(indCoordsIndices)
 {
+	ASSERT_(arms_->prototype() == arm_);
 }
 
 FactorConstraintsAccIndep::~FactorConstraintsAccIndep() = default;
@@ -60,6 +62,8 @@ gtsam::Vector FactorConstraintsAccIndep::evaluateError(
 {
 	MRPT_START
 
+	CAssembledRigidModel& arm = arms_->get();
+
 	const auto n = q_k.size();
 	if (n < 1) throw std::runtime_error("Empty state vector q_k!");
 	const auto d = ddotz_k.size();
@@ -70,23 +74,21 @@ gtsam::Vector FactorConstraintsAccIndep::evaluateError(
 	ASSERT_(q_k.size() > 0);
 
 	// Set q in the multibody model:
-	arm_->q_ = q_k;
-	arm_->dotq_ = dotq_k;
-	arm_->ddotq_ = ddotq_k;
+	arm.q_ = q_k;
+	arm.dotq_ = dotq_k;
+	arm.ddotq_ = ddotq_k;
 
 	// Update Jacobian and Hessian tensor:
-	arm_->update_numeric_Phi_and_Jacobians();
+	arm.update_numeric_Phi_and_Jacobians();
 
-	const auto m = arm_->Phi_.rows();
+	const auto m = arm.Phi_.rows();
 	if (m < 1) throw std::runtime_error("Empty Phi() vector!");
 
 	// Evaluate error:
-	const Eigen::MatrixXd Phi_q = arm_->Phi_q_.asDense();
-	const Eigen::MatrixXd dotPhi_q = arm_->dotPhi_q_.asDense();
-	const Eigen::MatrixXd dPhiqdq_dq = Phi_q;
-
-	gtsam::Vector err = gtsam::Vector::Zero(m + d);
-	err.head(m) = dotPhi_q * dotq_k + Phi_q * ddotq_k;
+	gtsam::Vector err(m + d);
+	for (Eigen::Index i = 0; i < m; i++)
+		err[i] = arm.dotPhi_q_.rowDot(i, dotq_k) +
+				 arm.Phi_q_.rowDot(i, ddotq_k);
 	err.tail(d) = mbse::subset(ddotq_k, indCoordsIndices_) - ddotz_k;
 
 	// Get the Jacobians required for optimization:
@@ -95,28 +97,26 @@ gtsam::Vector FactorConstraintsAccIndep::evaluateError(
 	if (de_dq)
 	{
 		auto& Hv = de_dq.value();
-		Hv.resize(m + d, n);
+		Hv.setZero(m + d, n);
 		// first block = 	\dotPhiqq(\q_t) \dq_t + \Phiqq(\q_t) \ddq_t
-		const Eigen::MatrixXd t1 = arm_->Phiqq_times_ddq_.asDense();
-		const Eigen::MatrixXd t2 = arm_->dotPhiqq_times_dq_.asDense();
-		Hv.block(0, 0, m, n) = t1 + t2;
-		Hv.block(m, 0, d, n).setZero();
+		arm.Phiqq_times_ddq_.addTo(Hv.topRows(m));
+		arm.dotPhiqq_times_dq_.addTo(Hv.topRows(m));
 	}
 
 	if (de_dqp)
 	{
 		auto& Hv = de_dqp.value();
-		Hv.resize(m + d, n);
-		Hv.block(0, 0, m, n) = 2 * arm_->dotPhi_q_.asDense();
-		Hv.block(m, 0, d, n).setZero();
+		Hv.setZero(m + d, n);
+		arm.dotPhi_q_.addTo(Hv.topRows(m), 2.0);
 	}
 
 	if (de_dqpp)
 	{
 		auto& Hv = de_dqpp.value();
-		Hv.resize(m + d, n);
-		Hv.block(0, 0, m, n) = arm_->Phi_q_.asDense();
-		Hv.block(m, 0, d, n) = matrix_Iidx_;
+		Hv.setZero(m + d, n);
+		arm.Phi_q_.addTo(Hv.topRows(m));
+		for (size_t i = 0; i < indCoordsIndices_.size(); i++)
+			Hv(m + i, indCoordsIndices_[i]) = 1;
 	}
 
 	if (de_dzpp)
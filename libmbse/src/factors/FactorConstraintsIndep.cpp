@@ -18,12 +18,14 @@ FactorConstraintsIndep::FactorConstraintsIndep(
 	const CAssembledRigidModel::Ptr& arm,
 	const std::vector<size_t>& indCoordsIndices,
 	const gtsam::SharedNoiseModel& noiseModel, gtsam::Key key_z_k,
-	gtsam::Key key_q_k)
+	gtsam::Key key_q_k,
+	const std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>>& arms)
 	: Base(noiseModel, key_z_k, key_q_k),
 	  arm_(arm),
-	  indCoordsIndices_(indCoordsIndices),
-	  matrix_Iidx_(selector_matrix(indCoordsIndices, arm->q_.size()))
+	  arms_(arms ? arms : makePerThreadCopies(arm)),
+	  indCoordsIndices_(indCoordsIndices)
 {
+	ASSERT_(arms_->prototype() == arm_);
 }
 
 FactorConstraintsIndep::~FactorConstraintsIndep() = default;
@@ -57,23 +59,25 @@ gtsam::Vector FactorConstraintsIndep::evaluateError(
 {
 	MRPT_START
 
+	CAssembledRigidModel& arm = arms_->get();
+
 	const auto n = q_k.size();
 	if (n < 1) throw std::runtime_error("Empty state vector q_k!");
 	const auto d = z_k.size();
 	if (d < 1) throw std::runtime_error("Empty state vector z_k!");
 
 	// Set q in the multibody model:
-	arm_->q_ = q_k;
+	arm.q_ = q_k;
 
 	// Update Jacobians:
-	arm_->update_numeric_Phi_and_Jacobians();
+	arm.update_numeric_Phi_and_Jacobians();
 
-	const auto m = arm_->Phi_.rows();
+	const auto m = arm.Phi_.rows();
 	if (m < 1) throw std::runtime_error("Empty Phi() vector!");
 
 	// Evaluate error:
 	gtsam::Vector err = gtsam::Vector::Zero(m + d);
-	err.head(m) = arm_->Phi_;
+	err.head(m) = arm.Phi_;
 	err.tail(d) = mbse::subset(q_k, indCoordsIndices_) - z_k;
 
 	// Get the Jacobians required for optimization:
@@ -89,10 +93,11 @@ gtsam::Vector FactorConstraintsIndep::evaluateError(
 	if (de_dq)
 	{
 		auto& Hv = de_dq.value();
-		Hv.resize(m + d, n);
-		Hv.block(0, 0, m, n) = arm_->Phi_q_.asDense();
-		// Build "I_idx", as called in the paper (sect. 6.7)
-		Hv.block(m, 0, d, n) = matrix_Iidx_;
+		Hv.setZero(m + d, n);
+		arm.Phi_q_.addTo(Hv.topRows(m));
+		// "I_idx", as called in the paper (sect. 6.7)
+		for (size_t i = 0; i < indCoordsIndices_.size(); i++)
+			Hv(m + i, indCoordsIndices_[i]) = 1;
 	}
 
 	return err;
@@ -91,24 +91,25 @@ gtsam::Vector FactorConstraintsVel::evaluateError(
 {
 	MRPT_START
 
-	// const auto n = q_k.size();
-	// const auto m = arm_->Phi_.rows();
+	CAssembledRigidModel& arm = arms_->get();
 
 	ASSERT_EQUAL_(dotq_k.size(), q_k.size());
 	ASSERT_(q_k.size() > 0);
 
 	// Set q in the multibody model:
-	arm_->q_ = q_k;
-	arm_->dotq_ = dotq_k;
+	arm.q_ = q_k;
+	arm.dotq_ = dotq_k;
 
 	// Update Jacobian and Hessian tensor:
-	arm_->update_numeric_Phi_and_Jacobians();
+	arm.update_numeric_Phi_and_Jacobians();
 
-	// Evaluate error:
-	const Eigen::MatrixXd Phi_q = arm_->Phi_q_.asDense();
-	const Eigen::MatrixXd dPhiqdq_dq = arm_->dotPhi_q_.asDense();
+	const auto n = q_k.size();
+	const auto m = arm.Phi_.rows();
 
-	gtsam::Vector err = Phi_q * dotq_k;
+	// Evaluate error, from the sparse Phi_q: errors are evaluated much more
+	// often than Jacobians, and only these need dense matrices.
+	gtsam::Vector err(m);
+	arm.Phi_q_.multiply(dotq_k, err);
 
 	// Get the Jacobians required for optimization:
 	// d err / d q_k
@@ -117,7 +118,7 @@ gtsam::Vector FactorConstraintsVel::evaluateError(
 		auto& Hv = H1.value();
 #if USE_NUMERIC_JACOBIAN
 		NumericJacobParams p;
-		p.arm = arm_.get();
+		p.arm = &arm;
 		p.q = q_k;
 		p.dq = dotq_k;
 
@@ -132,8 +133,8 @@ gtsam::Vector FactorConstraintsVel::evaluateError(
 				gtsam::Vector& err)>(&num_err_wrt_q),
 			x_incr, p, Hv);
 #else
-		Hv = dPhiqdq_dq;
-
+		Hv.setZero(m, n);
+		arm.dotPhi_q_.addTo(Hv);
 #endif
 	}
 
@@ -142,7 +143,7 @@ gtsam::Vector FactorConstraintsVel::evaluateError(
 		auto& Hv = H2.value();
 #if USE_NUMERIC_JACOBIAN
 		NumericJacobParams p;
-		p.arm = arm_.get();
+		p.arm = &arm;
 		p.q = q_k;
 		p.dq = dotq_k;
 
@@ -157,7 +158,8 @@ gtsam::Vector FactorConstraintsVel::evaluateError(
 				gtsam::Vector& err)>(&num_err_wrt_dq),
 			x_incr, p, Hv);
 #else
-		Hv = Phi_q;
+		Hv.setZero(m, n);
+		arm.Phi_q_.addTo(Hv);
 #endif
 	}
 
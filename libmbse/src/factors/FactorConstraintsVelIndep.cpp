@@ -19,12 +19,14 @@ FactorConstraintsVelIndep::FactorConstraintsVelIndep(
 	const CAssembledRigidModel::Ptr& arm,
 	const std::vector<size_t>& indCoordsIndices,
 	const gtsam::SharedNoiseModel& noiseModel, gtsam::Key key_q_k,
-	gtsam::Key key_dotq_k, gtsam::Key key_dotz_k)
+	gtsam::Key key_dotq_k, gtsam::Key key_dotz_k,
+	const std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>>& arms)
 	: Base(noiseModel, key_q_k, key_dotq_k, key_dotz_k),
 	  arm_(arm),
-	  indCoordsIndices_(indCoordsIndices),
-	  matrix_Iidx_(selector_matrix(indCoordsIndices, arm->q_.size()))
+	  arms_(arms ? arms : makePerThreadCopies(arm)),
+	  indCoordsIndices_(indCoordsIndices)
 {
+	ASSERT_(arms_->prototype() == arm_);
 }
 
 FactorConstraintsVelIndep::~FactorConstraintsVelIndep() = default;
@@ -59,6 +61,8 @@ gtsam::Vector FactorConstraintsVelIndep::evaluateError(
 {
 	MRPT_START
 
+	CAssembledRigidModel& arm = arms_->get();
+
 	const auto n = q_k.size();
 	if (n < 1) throw std::runtime_error("Empty state vector q_k!");
 	const auto d = dotz_k.size();
@@ -68,21 +72,18 @@ gtsam::Vector FactorConstraintsVelIndep::evaluateError(
 	ASSERT_(q_k.size() > 0);
 
 	// Set q in the multibody model:
-	arm_->q_ = q_k;
-	arm_->dotq_ = dotq_k;
+	arm.q_ = q_k;
+	arm.dotq_ = dotq_k;
 
 	// Update Jacobian and Hessian tensor:
-	arm_->update_numeric_Phi_and_Jacobians();
+	arm.update_numeric_Phi_and_Jacobians();
 
-	const auto m = arm_->Phi_.rows();
+	const auto m = arm.Phi_.rows();
 	if (m < 1) throw std::runtime_error("Empty Phi() vector!");
 
 	// Evaluate error:
-	const Eigen::MatrixXd Phi_q = arm_->Phi_q_.asDense();
-	const Eigen::MatrixXd dPhiqdq_dq = Phi_q;
-
-	gtsam::Vector err = gtsam::Vector::Zero(m + d);
-	err.head(m) = Phi_q * dotq_k;
+	gtsam::Vector err(m + d);
+	arm.Phi_q_.multiply(dotq_k, err.head(m));
 	err.tail(d) = mbse::subset(dotq_k, indCoordsIndices_) - dotz_k;
 
 	// Get the Jacobians required for optimization:
@@ -91,18 +92,18 @@ gtsam::Vector FactorConstraintsVelIndep::evaluateError(
 	if (de_dq)
 	{
 		auto& Hv = de_dq.value();
-		Hv.resize(m + d, n);
+		Hv.setZero(m + d, n);
 		// Phi_qq*dq = \dot{Phi_q}
-		Hv.block(0, 0, m, n) = arm_->dotPhi_q_.asDense();
-		Hv.block(m, 0, d, n).setZero();
+		arm.dotPhi_q_.addTo(Hv.topRows(m));
 	}
 
 	if (de_dqp)
 	{
 		auto& Hv = de_dqp.value();
-		Hv.resize(m + d, n);
-		Hv.block(0, 0, m, n) = arm_->Phi_q_.asDense();
-		Hv.block(m, 0, d, n) = matrix_Iidx_;
+		Hv.setZero(m + d, n);
+		arm.Phi_q_.addTo(Hv.topRows(m));
+		for (size_t i = 0; i < indCoordsIndices_.size(); i++)
+			Hv(m + i, indCoordsIndices_[i]) = 1;
 	}
 
 	if (de_dzp)
@@ -13,15 +13,7 @@
 #include <mbse/factors/FactorDynamics.h>
 #include <mbse/CAssembledRigidModel.h>
 
-#include <gtsam/config.h>
-#if defined(GTSAM_USE_TBB)
-#error "So far, MBDE is incompatible with GTSAM+TBB!"
-#endif
-MRPT_TODO(
-	"**IMPORTANT** Refactor CAssembledRigidModel to separate state and model "
-	"data to avoid multithread errors using GTSAM+TBB")
-
-#define USE_NUMERIC_JACOBIAN 1
+#define USE_NUMERIC_JACOBIAN 0
 
 #if USE_NUMERIC_JACOBIAN
 #include <mrpt/math/num_jacobian.h>
@@ -47,6 +39,7 @@ void FactorDynamics::print(
 	noiseModel_->print("  noise model: ");
 }
 
+#if USE_NUMERIC_JACOBIAN
 struct NumericJacobParams
 {
 	CAssembledRigidModel* arm = nullptr;
@@ -86,6 +79,7 @@ static void num_err_wrt_dq(
 	// Evaluate error:
 	err = qpp_predicted - p.ddq;
 }
+#endif
 
 bool FactorDynamics::equals(
 	const gtsam::NonlinearFactor& expected, double tol) const
@@ -108,7 +102,8 @@ gtsam::Vector FactorDynamics::evaluateError(
 	ASSERT_(q_k.size() > 0);
 
 	// Set q & dq in the multibody model:
-	CAssembledRigidModel& arm = *dynamic_solver_->get_model_non_const();
+	CDynamicSimulatorBase& solver = solvers_->get();
+	CAssembledRigidModel& arm = *solver.get_model_non_const();
 	arm.q_ = q_k;
 	arm.dotq_ = dq_k;
 
@@ -116,19 +111,19 @@ gtsam::Vector FactorDynamics::evaluateError(
 	Eigen::VectorXd qpp_predicted;
 	const double t = 0;	 // wallclock time (useless?)
 
-	dynamic_solver_->solve_ddotq(t, qpp_predicted);
+	solver.solve_ddotq(t, qpp_predicted);
 
 	// Evaluate error:
 	gtsam::Vector err = qpp_predicted - ddq_k;
 
+#if USE_NUMERIC_JACOBIAN
 	// d err / d q_k
 	if (H1)
 	{
 		auto& Hv = H1.value();
-#if USE_NUMERIC_JACOBIAN
 		NumericJacobParams p;
 		p.arm = &arm;
-		p.dynamic_solver = dynamic_solver_;
+		p.dynamic_solver = &solver;
 		p.q = q_k;
 		p.dq = dq_k;
 		p.ddq = ddq_k;
@@ -143,58 +138,14 @@ gtsam::Vector FactorDynamics::evaluateError(
 				const gtsam::Vector& new_q, const NumericJacobParams& p,
 				gtsam::Vector& err)>(&num_err_wrt_q),
 			x_incr, p, Hv);
-#else
-		Hv.setZero(n, n);
-/*
-dq = param.dq;
-invM = param.invM;
-Q = param.Q;
-Phiq = ConstLen_q(q);
-Phiqq = NumJacob3D(@ConstLen_q, q);
-Phiqq_T = NumJacob3D(@ConstLen_T_q, q);
-G = Gamma(q,param);
-invGamma = inv(G);
-c = -InnerTensVect(Phiqq,param.dq)*param.dq;
-% ================================== [1]
-==================================
-A1 = invM*Q;
-B1 = Phiq*A1;
-C1 = invGamma*B1;
-D1 = InnerTensVect(Phiqq_T,C1);
-ddq_I = -invM*D1;
-dGamma_q = NumJacob3D(@Gamma, q, param);
-A2 = InnerTensVect(dGamma_q,C1);
-B2 = invGamma*A2;
-C2 = Phiq'*B2;
-ddq_II = invM*C2;
-A3 = invM*Q;
-B3 = InnerTensVect(Phiqq,A3);
-C3 = invGamma*B3;
-D3 = Phiq'*C3;
-ddq_III = -invM*D3;
-% ================================== [2]
-==================================
-dotPq = InnerTensVect(Phiqq,dq);A4 = dotPq*dq;
-B4 = invGamma*A4;
-C4 = InnerTensVect(Phiqq_T,B4);
-ddq_IV = -invM*C4;
-A5 = InnerTensVect(dGamma_q,B4);
-B5 = invGamma*A5;
-C5 = Phiq'*B5;
-ddq_V = invM*C5;
-% Theoretical Jacobian
-Jacc_qt = ddq_I+ddq_II+ddq_III+ddq_IV+ddq_V;
-*/
-#endif
 	}
 	// d err / d dq_k
 	if (H2)
 	{
 		auto& Hv = H2.value();
-#if USE_NUMERIC_JACOBIAN
 		NumericJacobParams p;
 		p.arm = &arm;
-		p.dynamic_solver = dynamic_solver_;
+		p.dynamic_solver = &solver;
 		p.q = q_k;
 		p.dq = dq_k;
 		p.ddq = ddq_k;
@@ -209,25 +160,13 @@ Jacc_qt = ddq_I+ddq_II+ddq_III+ddq_IV+ddq_V;
 				const gtsam::Vector& new_q, const NumericJacobParams& p,
 				gtsam::Vector& err)>(&num_err_wrt_dq),
 			x_incr, p, Hv);
+	}
 #else
-		Hv.setZero(n, n);
-/*
-q = param.q;
-invM = param.invM;
-Q = param.Q;
-Phiq = ConstLen_q(q);
-Phiqq = NumJacob3D(@ConstLen_q, q);
-Phiqq_T = NumJacob3D(@ConstLen_T_q, q);
-G = Gamma(q,param);
-invGamma = inv(G);
-c = -InnerTensVect(Phiqq,dq)*dq;
-dotPq = InnerTensVect(Phiqq,dq);
-A = invGamma*dotPq;
-B = Phiq'*A;
-Jacc_dqt = -2*invM*B;
-*/
+	// d err / d q_k, d err / d dq_k
+	if (H1 || H2)
+		solver.eval_ddotq_jacobians(
+			H1 ? &H1.value() : nullptr, H2 ? &H2.value() : nullptr, nullptr);
 #endif
-	}
 	// d err / d ddq_k
 	if (H3)
 	{
@@ -14,7 +14,7 @@
 #include <mbse/CAssembledRigidModel.h>
 #include <mbse/mbse-utils.h>
 
-#define USE_NUMERIC_JACOBIAN 1
+#define USE_NUMERIC_JACOBIAN 0
 
 #if USE_NUMERIC_JACOBIAN
 #include <mrpt/math/num_jacobian.h>
@@ -39,6 +39,7 @@ void FactorDynamicsIndep::print(
 	noiseModel_->print("  noise model: ");
 }
 
+#if USE_NUMERIC_JACOBIAN
 struct NumericJacobParams
 {
 	CAssembledRigidModel* arm = nullptr;
@@ -106,6 +107,7 @@ static void num_err_wrt_dz(
 	// Evaluate error:
 	err = zpp_predicted - p.ddz;
 }
+#endif
 
 bool FactorDynamicsIndep::equals(
 	const gtsam::NonlinearFactor& expected, double tol) const
@@ -130,10 +132,10 @@ gtsam::Vector FactorDynamicsIndep::evaluateError(
 	ASSERT_(valuesForQk_);
 
 	// Set q & dq in the multibody model:
-	CAssembledRigidModel& arm = *dynamic_solver_->get_model_non_const();
+	CDynamicSimulatorIndepBase& solver = solvers_->get();
+	CAssembledRigidModel& arm = *solver.get_model_non_const();
 
-	const auto& indepCoordIndices =
-		dynamic_solver_->independent_coordinate_indices();
+	const auto& indepCoordIndices = solver.independent_coordinate_indices();
 	ASSERT_EQUAL_(
 		static_cast<size_t>(indepCoordIndices.size()),
 		static_cast<size_t>(z_k.size()));
@@ -154,19 +156,19 @@ gtsam::Vector FactorDynamicsIndep::evaluateError(
 	// Predict accelerations:
 	Eigen::VectorXd zpp_predicted;
 	const double t = 0;  // wallclock time (useless?)
-	dynamic_solver_->solve_ddotz(t, zpp_predicted);
+	solver.solve_ddotz(t, zpp_predicted);
 
 	// Evaluate error:
 	gtsam::Vector err = zpp_predicted - ddz_k;
 
+#if USE_NUMERIC_JACOBIAN
 	// d err / d z_k
 	if (de_dz)
 	{
 		auto& Hv = de_dz.value();
-#if USE_NUMERIC_JACOBIAN
 		NumericJacobParams p;
 		p.arm = &arm;
-		p.dynamic_solver = dynamic_solver_;
+		p.dynamic_solver = &solver;
 		p.q = q_k;
 		p.z = z_k;
 		p.dz = dz_k;
@@ -182,18 +184,14 @@ gtsam::Vector FactorDynamicsIndep::evaluateError(
 				const gtsam::Vector& new_q, const NumericJacobParams& p,
 				gtsam::Vector& err)>(&num_err_wrt_z),
 			x_incr, p, Hv);
-#else
-		Hv.setZero(n, n);
-#endif
 	}
 	// d err / d dz_k
 	if (de_dzp)
 	{
 		auto& Hv = de_dzp.value();
-#if USE_NUMERIC_JACOBIAN
 		NumericJacobParams p;
 		p.arm = &arm;
-		p.dynamic_solver = dynamic_solver_;
+		p.dynamic_solver = &solver;
 		p.q = q_k;
 		p.z = z_k;
 		p.dz = dz_k;
@@ -209,10 +207,14 @@ gtsam::Vector FactorDynamicsIndep::evaluateError(
 				const gtsam::Vector& new_q, const NumericJacobParams& p,
 				gtsam::Vector& err)>(&num_err_wrt_dz),
 			x_incr, p, Hv);
+	}
 #else
-		Hv.setZero(n, n);
+	// d err / d z_k, d err / d dz_k
+	if (de_dz || de_dzp)
+		solver.eval_ddotz_jacobians(
+			de_dz ? &de_dz.value() : nullptr,
+			de_dzp ? &de_dzp.value() : nullptr);
 #endif
-	}
 	// d err / d ddz_k
 	if (de_dzpp)
 	{
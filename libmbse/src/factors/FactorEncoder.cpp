@@ -0,0 +1,52 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#include <mbse/factors/FactorEncoder.h>
+#include <mrpt/math/wrap2pi.h>
+
+using namespace mbse;
+
+gtsam::NonlinearFactor::shared_ptr FactorEncoder::clone() const
+{
+	return boost::static_pointer_cast<gtsam::NonlinearFactor>(
+		gtsam::NonlinearFactor::shared_ptr(new This(*this)));
+}
+
+void FactorEncoder::print(
+	const std::string& s, const gtsam::KeyFormatter& keyFormatter) const
+{
+	std::cout << s << "mbde::FactorEncoder(" << keyFormatter(this->key())
+			  << ")\n";
+	std::cout << " reading: " << reading_ << "\n";
+	noiseModel_->print("  noise model: ");
+}
+
+bool FactorEncoder::equals(
+	const gtsam::NonlinearFactor& expected, double tol) const
+{
+	const This* e = dynamic_cast<const This*>(&expected);
+	return e != nullptr && Base::equals(*e, tol);
+}
+
+gtsam::Vector FactorEncoder::evaluateError(
+	const state_t& q_k, boost::optional<gtsam::Matrix&> H1) const
+{
+	if (q_k.size() < 1) throw std::runtime_error("Empty state vector!");
+
+	gtsam::Vector err;
+	err.resize(1);
+
+	const double ang = sensor_->reading(q_k, H1 ? &H1.value() : nullptr);
+	// d err / d q_k is that of the reading: wrapping only adds a multiple of
+	// 2 pi, constant almost everywhere.
+	err[0] = mrpt::math::wrapToPi(ang - reading_);
+
+	return err;
+}
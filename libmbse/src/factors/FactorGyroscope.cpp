@@ -47,16 +47,18 @@ gtsam::Vector FactorGyroscope::evaluateError(
 	const state_t& q_k, const state_t& dq_k, boost::optional<gtsam::Matrix&> H1,
 	boost::optional<gtsam::Matrix&> H2) const
 {
+	CAssembledRigidModel& arm = arms_->get();
+
 	const auto n = q_k.size();
 	if (dq_k.size() != n)
 		throw std::runtime_error("Inconsistent vector lengths!");
 	if (n < 1) throw std::runtime_error("Empty state vector!");
 
 	// Set q in the multibody model:
-	arm_->q_ = q_k;
-	arm_->dotq_ = dq_k;
+	arm.q_ = q_k;
+	arm.dotq_ = dq_k;
 
-	const std::vector<CBody>& bodies = arm_->parent_.getBodies();
+	const std::vector<CBody>& bodies = arm.parent_.getBodies();
 	ASSERT_BELOW_(body_idx_, bodies.size());
 
 	const CBody& body = bodies[body_idx_];
@@ -65,12 +67,12 @@ gtsam::Vector FactorGyroscope::evaluateError(
 	const size_t pt1_idx = body.points[1];
 
 	TPoint2D pt0, pt1;
-	arm_->getPointCurrentCoords(pt0_idx, pt0);
-	arm_->getPointCurrentCoords(pt1_idx, pt1);
+	arm.getPointCurrentCoords(pt0_idx, pt0);
+	arm.getPointCurrentCoords(pt1_idx, pt1);
 
 	TPoint2D pt0vel, pt1vel;
-	arm_->getPointCurrentVelocity(pt0_idx, pt0vel);
-	arm_->getPointCurrentVelocity(pt1_idx, pt1vel);
+	arm.getPointCurrentVelocity(pt0_idx, pt0vel);
+	arm.getPointCurrentVelocity(pt1_idx, pt1vel);
 
 	// u: unit director vector from pt0->pt1
 	TPoint2D u = pt1 - pt0;
@@ -103,8 +105,8 @@ gtsam::Vector FactorGyroscope::evaluateError(
 		Hv.setZero(1, n);
 
 		// point0 & point1:
-		const Point2ToDOF pts_dofs[2] = {arm_->points2DOFs_[pt0_idx],
-										 arm_->points2DOFs_[pt1_idx]};
+		const Point2ToDOF pts_dofs[2] = {arm.points2DOFs_[pt0_idx],
+										 arm.points2DOFs_[pt1_idx]};
 
 		if (size_t i = pts_dofs[0].dof_x; i != INVALID_DOF)
 		{
@@ -155,8 +157,8 @@ gtsam::Vector FactorGyroscope::evaluateError(
 		Hv.setZero(1, n);
 
 		// point0 & point1:
-		const Point2ToDOF pts_dofs[2] = {arm_->points2DOFs_[pt0_idx],
-										 arm_->points2DOFs_[pt1_idx]};
+		const Point2ToDOF pts_dofs[2] = {arm.points2DOFs_[pt0_idx],
+										 arm.points2DOFs_[pt1_idx]};
 
 		if (size_t i = pts_dofs[0].dof_x; i != INVALID_DOF)
 		{
@@ -12,7 +12,7 @@
 #include <mbse/factors/FactorInverseDynamics.h>
 #include <mbse/CAssembledRigidModel.h>
 
-#define USE_NUMERIC_JACOBIAN 1
+#define USE_NUMERIC_JACOBIAN 0
 
 #if USE_NUMERIC_JACOBIAN
 #include <mrpt/math/num_jacobian.h>
@@ -39,6 +39,7 @@ void FactorInverseDynamics::print(
 	noiseModel_->print("  noise model: ");
 }
 
+#if USE_NUMERIC_JACOBIAN
 struct NumericJacobParams
 {
 	CAssembledRigidModel* arm = nullptr;
@@ -97,6 +98,7 @@ static void num_err_wrt_dq(
 	// Evaluate error:
 	err = qpp_predicted - p.ddq;
 }
+#endif
 
 bool FactorInverseDynamics::equals(
 	const gtsam::NonlinearFactor& expected, double tol) const
@@ -121,7 +123,8 @@ gtsam::Vector FactorInverseDynamics::evaluateError(
 	ASSERT_(q_k.size() > 0);
 
 	// Set q & dq in the multibody model:
-	CAssembledRigidModel& arm = *dynamic_solver_->get_model_non_const();
+	CDynamicSimulatorBase& solver = solvers_->get();
+	CAssembledRigidModel& arm = *solver.get_model_non_const();
 	arm.q_ = q_k;
 	arm.dotq_ = dq_k;
 	arm.Q_ = Q_k;
@@ -130,21 +133,19 @@ gtsam::Vector FactorInverseDynamics::evaluateError(
 	Eigen::VectorXd qpp_predicted;
 	const double t = 0;  // wallclock time (useless?)
 
-	dynamic_solver_->solve_ddotq(t, qpp_predicted);
+	solver.solve_ddotq(t, qpp_predicted);
 
 	// Evaluate error:
 	gtsam::Vector err = qpp_predicted - ddq_k;
 
+#if USE_NUMERIC_JACOBIAN
 	// d err / d q_k
 	if (H1)
 	{
 		auto& Hv = H1.value();
-#if 0
-		Hv.setZero(n, n);
-#else
 		NumericJacobParams p;
 		p.arm = &arm;
-		p.dynamic_solver = dynamic_solver_;
+		p.dynamic_solver = &solver;
 		p.q = q_k;
 		p.dq = dq_k;
 		p.ddq = ddq_k;
@@ -160,19 +161,14 @@ gtsam::Vector FactorInverseDynamics::evaluateError(
 				const gtsam::Vector& new_q, const NumericJacobParams& p,
 				gtsam::Vector& err)>(&num_err_wrt_q),
 			x_incr, p, Hv);
-
-#endif
 	}
 	// d err / d dq_k
 	if (H2)
 	{
 		auto& Hv = H2.value();
-#if 0
-		Hv.setZero(n, n);
-#else
 		NumericJacobParams p;
 		p.arm = &arm;
-		p.dynamic_solver = dynamic_solver_;
+		p.dynamic_solver = &solver;
 		p.q = q_k;
 		p.dq = dq_k;
 		p.ddq = ddq_k;
@@ -188,23 +184,14 @@ gtsam::Vector FactorInverseDynamics::evaluateError(
 				const gtsam::Vector& new_q, const NumericJacobParams& p,
 				gtsam::Vector& err)>(&num_err_wrt_dq),
 			x_incr, p, Hv);
-
-#endif
 	}
-	// d err / d ddq_k
-	if (H3)
-	{
-		auto& Hv = H3.value();
-		Hv = -Eigen::MatrixXd::Identity(n, n);
-	}
-
+	// d err / d Q_k
 	if (H4)
 	{
 		auto& Hv = H4.value();
-#if USE_NUMERIC_JACOBIAN
 		NumericJacobParams p;
 		p.arm = &arm;
-		p.dynamic_solver = dynamic_solver_;
+		p.dynamic_solver = &solver;
 		p.q = q_k;
 		p.dq = dq_k;
 		p.ddq = ddq_k;
@@ -220,9 +207,19 @@ gtsam::Vector FactorInverseDynamics::evaluateError(
 				const gtsam::Vector& new_Q, const NumericJacobParams& p,
 				gtsam::Vector& err)>(&num_err_wrt_Q),
 			x_incr, p, Hv);
+	}
 #else
-		THROW_EXCEPTION("Implement me!");
+	// d err / d q_k, d err / d dq_k, d err / d Q_k
+	if (H1 || H2 || H4)
+		solver.eval_ddotq_jacobians(
+			H1 ? &H1.value() : nullptr, H2 ? &H2.value() : nullptr,
+			H4 ? &H4.value() : nullptr);
 #endif
+	// d err / d ddq_k
+	if (H3)
+	{
+		auto& Hv = H3.value();
+		Hv = -Eigen::MatrixXd::Identity(n, n);
 	}
 	return err;
 
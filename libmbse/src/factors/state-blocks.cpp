@@ -0,0 +1,102 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#include <mbse/factors/state-blocks.h>
+#include <gtsam/inference/Symbol.h>
+#include <mrpt/core/format.h>
+#include <algorithm>
+
+using namespace mbse;
+
+StateBlockLayout::StateBlockLayout(const CAssembledRigidModel& arm)
+{
+	const auto n = static_cast<size_t>(arm.q_.size());
+	const std::pair<size_t, size_t> none{INVALID_DOF, INVALID_DOF};
+	dofBlock_.assign(n, none);
+
+	auto lambdaAddBlock = [this](std::vector<dof_index_t>&& dofs) {
+		for (size_t i = 0; i < dofs.size(); i++)
+			dofBlock_.at(dofs[i]) = {blocks_.size(), i};
+		blocks_.emplace_back(std::move(dofs));
+	};
+
+	// Points (x,y). Fixed points have no coordinates in q:
+	for (const auto& p : arm.getPoints2DOFs())
+	{
+		if (p.dof_x == INVALID_DOF) continue;
+		lambdaAddBlock({p.dof_x, p.dof_y});
+	}
+	// Relative coordinates:
+	for (const auto idx : arm.relCoordinate2Index_) lambdaAddBlock({idx});
+
+	for (size_t i = 0; i < n; i++)
+		ASSERTMSG_(
+			dofBlock_[i] != none, mrpt::format(
+									  "Coordinate q[%u] is not in any block",
+									  static_cast<unsigned int>(i)));
+}
+
+std::vector<size_t> StateBlockLayout::constraintBlocks(
+	const CAssembledRigidModel& arm, size_t constraint_index) const
+{
+	const auto [r0, r1] = arm.getConstraintRows(constraint_index);
+	const auto* outer = arm.Phi_q_.outerIndexPtr();
+	const auto* inner = arm.Phi_q_.innerIndexPtr();
+
+	std::vector<size_t> ret;
+	for (size_t r = r0; r < r1; r++)
+		for (auto k = outer[r]; k < outer[r + 1]; k++)
+			ret.push_back(blockOf(inner[k]).first);
+
+	std::sort(ret.begin(), ret.end());
+	ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+	return ret;
+}
+
+gtsam::Key StateBlockLayout::key(unsigned char c, size_t t, size_t b) const
+{
+	ASSERT_BELOW_(b, numBlocks());
+	return gtsam::Symbol(c, t * numBlocks() + b);
+}
+
+gtsam::KeyVector StateBlockLayout::keys(unsigned char c, size_t t) const
+{
+	gtsam::KeyVector ret(numBlocks());
+	for (size_t b = 0; b < numBlocks(); b++) ret[b] = key(c, t, b);
+	return ret;
+}
+
+void StateBlockLayout::insert(
+	gtsam::Values& values, unsigned char c, size_t t, const state_t& x) const
+{
+	ASSERT_EQUAL_(static_cast<size_t>(x.size()), stateDimension());
+
+	for (size_t b = 0; b < numBlocks(); b++)
+	{
+		const auto& dofs = blocks_[b];
+		state_t xb(dofs.size());
+		for (size_t i = 0; i < dofs.size(); i++) xb[i] = x[dofs[i]];
+		values.insert(key(c, t, b), xb);
+	}
+}
+
+state_t StateBlockLayout::extract(
+	const gtsam::Values& values, unsigned char c, size_t t) const
+{
+	state_t x(stateDimension());
+	for (size_t b = 0; b < numBlocks(); b++)
+	{
+		const auto& dofs = blocks_[b];
+		const auto& xb = values.at<state_t>(key(c, t, b));
+		ASSERT_EQUAL_(static_cast<size_t>(xb.size()), dofs.size());
+		for (size_t i = 0; i < dofs.size(); i++) x[dofs[i]] = xb[i];
+	}
+	return x;
+}
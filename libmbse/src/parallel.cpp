@@ -0,0 +1,144 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+
+#include <mbse/mbse-parallel.h>
+#include <algorithm>
+
+using namespace mbse;
+
+namespace
+{
+/** Set in the workers of any pool, and in a thread while it runs chunks of
+ * its own parallel_for(), so nested loops run serially */
+thread_local bool in_pool_loop = false;
+}  // namespace
+
+CThreadPool::CThreadPool(unsigned int numThreads)
+{
+	if (numThreads == 0) numThreads = std::thread::hardware_concurrency();
+	for (unsigned int i = 1; i < numThreads; i++)
+		workers_.emplace_back([this]() { worker(); });
+}
+
+CThreadPool::~CThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lck(mtx_);
+		quit_ = true;
+	}
+	cv_start_.notify_all();
+	for (auto& t : workers_) t.join();
+}
+
+std::vector<std::thread::id> CThreadPool::workerIds() const
+{
+	std::vector<std::thread::id> ids;
+	for (const auto& t : workers_) ids.push_back(t.get_id());
+	return ids;
+}
+
+void CThreadPool::runChunks()
+{
+	for (;;)
+	{
+		const std::size_t i0 = next_.fetch_add(grain_);
+		if (i0 >= n_) break;
+		try
+		{
+			(*job_)(i0, std::min(n_, i0 + grain_));
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lck(mtx_);
+			if (!error_) error_ = std::current_exception();
+		}
+	}
+}
+
+void CThreadPool::worker()
+{
+	in_pool_loop = true;
+
+	std::size_t seenGeneration = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lck(mtx_);
+			cv_start_.wait(
+				lck, [&]() { return quit_ || generation_ != seenGeneration; });
+			if (quit_) return;
+			seenGeneration = generation_;
+
+			// Enough workers may have joined this loop already:
+			if (slots_ == 0) continue;
+			slots_--;
+		}
+
+		runChunks();
+
+		std::lock_guard<std::mutex> lck(mtx_);
+		if (--pending_ == 0) cv_done_.notify_one();
+	}
+}
+
+void CThreadPool::parallel_for(
+	std::size_t n, std::size_t grainSize, const range_function_t& f)
+{
+	if (grainSize == 0) grainSize = 1;
+
+	// A nested loop runs serially: this thread may be a worker, or already
+	// hold busy_mtx_.
+	std::unique_lock<std::mutex> busy(busy_mtx_, std::defer_lock);
+	if (in_pool_loop || workers_.empty() || n <= grainSize || !busy.try_lock())
+	{
+		if (n > 0) f(0, n);
+		return;
+	}
+
+	// The caller takes chunks too, so at most one worker per extra chunk:
+	const std::size_t nChunks = (n + grainSize - 1) / grainSize;
+	const auto nWorkers = static_cast<unsigned int>(
+		std::min<std::size_t>(workers_.size(), nChunks - 1));
+	{
+		std::lock_guard<std::mutex> lck(mtx_);
+		job_ = &f;
+		n_ = n;
+		grain_ = grainSize;
+		next_ = 0;
+		error_ = nullptr;
+		slots_ = nWorkers;
+		pending_ = nWorkers;
+		generation_++;
+	}
+	if (nWorkers == workers_.size())
+		cv_start_.notify_all();
+	else
+		for (unsigned int i = 0; i < nWorkers; i++) cv_start_.notify_one();
+
+	in_pool_loop = true;
+	runChunks();
+	in_pool_loop = false;
+
+	std::exception_ptr err;
+	{
+		std::unique_lock<std::mutex> lck(mtx_);
+		cv_done_.wait(lck, [this]() { return pending_ == 0; });
+		job_ = nullptr;
+		std::swap(err, error_);
+	}
+	if (err) std::rethrow_exception(err);
+}
+
+CThreadPool& mbse::threadPool()
+{
+	static CThreadPool pool;
+	return pool;
+}
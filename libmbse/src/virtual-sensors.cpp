@@ -9,7 +9,9 @@
   +-------------------------------------------------------------------------+ */
 
 #include <mbse/CAssembledRigidModel.h>
+#include <mbse/CAssembledRigidModelBatch.h>
 #include <mbse/virtual-sensors.h>
+#include <mrpt/math/wrap2pi.h>
 
 using namespace mbse;
 using namespace Eigen;
@@ -17,6 +19,48 @@ using namespace mrpt::math;
 using namespace mrpt;
 using namespace std;
 
+// ---------------------------------------
+// Virtual sensor: Base class
+// ---------------------------------------
+void CVirtualSensor::simulate_readings(
+	const CAssembledRigidModelBatch& states, Eigen::VectorXd& out) const
+{
+	// The model to load the states into. Each thread uses its own copy, all
+	// of them cloned from a private one, since the model of `states` is
+	// shared.
+	std::shared_ptr<CPerThreadCopies<CAssembledRigidModel>> scratch;
+	{
+		std::lock_guard<std::mutex> lck(scratchMtx_);
+		if (!scratch_ || scratchSource_ != states.modelPtr())
+		{
+			scratchSource_ = states.modelPtr();
+			scratch_ = makePerThreadCopies(scratchSource_->cloneTopology());
+		}
+		scratch = scratch_;
+	}
+	auto& arm = scratch->get();
+
+	out.resize(states.size());
+	for (size_t k = 0; k < states.size(); k++)
+	{
+		states.getState(k, arm.q_, arm.dotq_);
+		if (needs_accelerations()) states.getAccelerations(k, arm.ddotq_);
+		out[k] = simulate_reading(arm);
+	}
+}
+
+void CVirtualSensor::log_likelihoods(
+	const double sensor_reading, const CAssembledRigidModelBatch& states,
+	Eigen::VectorXd& out_log_lik) const
+{
+	simulate_readings(states, out_log_lik);
+
+	const double k = 1.0 / sensor_noise_std;
+	for (Eigen::Index i = 0; i < out_log_lik.size(); i++)
+		out_log_lik[i] = reading_error(sensor_reading, out_log_lik[i]) * k;
+	out_log_lik = -0.5 * out_log_lik.array().square().matrix();
+}
+
 // ---------------------------------------
 // Virtual sensor: Gyroscope
 // ---------------------------------------
@@ -60,3 +104,258 @@ double CVirtualSensor_Gyro::simulate_reading(
 
 	return w;
 }
+
+void CVirtualSensor_Gyro::simulate_readings(
+	const CAssembledRigidModelBatch& states, Eigen::VectorXd& out) const
+{
+	const std::vector<CBody>& bodies = states.model().parent_.getBodies();
+	ASSERT_BELOW_(body_idx_, bodies.size());
+	const CBody& body = bodies[body_idx_];
+
+	const size_t n = states.size();
+	out.resize(n);
+	if (n == 0) return;
+
+	// Gather plan: rows of the coordinates of both points
+	const auto& r0 = states.pointRows(body.points[0]);
+	const auto& r1 = states.pointRows(body.points[1]);
+	const double *x0 = &states.q_(r0[0], 0), *y0 = &states.q_(r0[1], 0);
+	const double *x1 = &states.q_(r1[0], 0), *y1 = &states.q_(r1[1], 0);
+	const double *dotx0 = &states.dotq_(r0[0], 0),
+				 *doty0 = &states.dotq_(r0[1], 0);
+	const double *dotx1 = &states.dotq_(r1[0], 0),
+				 *doty1 = &states.dotq_(r1[1], 0);
+	double* w = out.data();
+
+	// Same as simulate_reading(): the relative velocity of pt1 wrt pt0,
+	// projected on the normal of pt0->pt1, divided by their distance. With
+	// the non-normalized normal, that is one division by the squared length.
+	for (size_t k = 0; k < n; k++)
+	{
+		const double ux = x1[k] - x0[k], uy = y1[k] - y0[k];
+		const double rel_vx = dotx1[k] - dotx0[k];
+		const double rel_vy = doty1[k] - doty0[k];
+		w[k] = (-rel_vx * uy + rel_vy * ux) / (ux * ux + uy * uy);
+	}
+}
+
+// ---------------------------------------
+// Gather plans
+// ---------------------------------------
+TPointGather::TPointGather(const CAssembledRigidModel& arm, size_t pt_idx)
+	: point_idx(pt_idx)
+{
+	const auto& pts2dofs = arm.getPoints2DOFs();
+	ASSERT_BELOW_(pt_idx, pts2dofs.size());
+	dof = {{pts2dofs[pt_idx].dof_x, pts2dofs[pt_idx].dof_y}};
+
+	const auto& pt = arm.parent_.getPointInfo(pt_idx);
+	fixed = {{pt.coords.x, pt.coords.y}};
+}
+
+namespace
+{
+/** Rows of the x and y of a point in a batch of states (see
+ * CAssembledRigidModelBatch::pointRows()) */
+struct TBatchPoint
+{
+	const double *x, *y;
+
+	TBatchPoint(
+		const CAssembledRigidModelBatch::matrix_t& m,
+		const CAssembledRigidModelBatch& states, const TPointGather& pt)
+	{
+		const auto& rows = states.pointRows(pt.point_idx);
+		x = &m(rows[0], 0);
+		y = &m(rows[1], 0);
+	}
+};
+
+std::array<TPointGather, 2> bodyPoints(
+	const CAssembledRigidModel& arm, size_t body_idx)
+{
+	const std::vector<CBody>& bodies = arm.parent_.getBodies();
+	ASSERT_BELOW_(body_idx, bodies.size());
+	const CBody& body = bodies[body_idx];
+
+	return {{TPointGather(arm, body.points[0]),
+			 TPointGather(arm, body.points[1])}};
+}
+}  // namespace
+
+// ---------------------------------------
+// Virtual sensor: Encoder
+// ---------------------------------------
+CVirtualSensor_Encoder::CVirtualSensor_Encoder(
+	const CAssembledRigidModel& arm, size_t body_idx)
+{
+	const auto pts = bodyPoints(arm, body_idx);
+	pts_[0] = pts[0];
+	pts_[1] = pts[1];
+}
+
+CVirtualSensor_Encoder::CVirtualSensor_Encoder(
+	const CAssembledRigidModel& arm, size_t ref_body_idx, size_t body_idx)
+	: CVirtualSensor_Encoder(arm, body_idx)
+{
+	const auto pts = bodyPoints(arm, ref_body_idx);
+	pts_[2] = pts[0];
+	pts_[3] = pts[1];
+	relative_ = true;
+}
+
+double CVirtualSensor_Encoder::reading_error(
+	double reading, double prediction) const
+{
+	return mrpt::math::wrapToPi(reading - prediction);
+}
+
+double CVirtualSensor_Encoder::reading(
+	const Eigen::VectorXd& q, Eigen::MatrixXd* H_q) const
+{
+	if (H_q) H_q->setZero(1, q.size());
+
+	// Angle of the body, minus that of the reference one:
+	double ang = 0;
+	for (int b = 0; b < (relative_ ? 2 : 1); b++)
+	{
+		const TPointGather &p0 = pts_[2 * b], &p1 = pts_[2 * b + 1];
+		const double dx = p1.pos(q, 0) - p0.pos(q, 0);
+		const double dy = p1.pos(q, 1) - p0.pos(q, 1);
+		const double sign = b == 0 ? 1.0 : -1.0;
+		ang += sign * std::atan2(dy, dx);
+
+		if (!H_q) continue;
+
+		// d atan2(dy,dx) / d(dx,dy) = (-dy, dx) / |d|^2
+		const double k = sign / (dx * dx + dy * dy);
+		p1.addToJacobian(*H_q, -dy * k, dx * k);
+		p0.addToJacobian(*H_q, dy * k, -dx * k);
+	}
+	return mrpt::math::wrapToPi(ang);
+}
+
+void CVirtualSensor_Encoder::simulate_readings(
+	const CAssembledRigidModelBatch& states, Eigen::VectorXd& out) const
+{
+	const size_t n = states.size();
+	out.setZero(n);
+	if (n == 0) return;
+
+	double* ang = out.data();
+	for (int b = 0; b < (relative_ ? 2 : 1); b++)
+	{
+		const TBatchPoint p0(states.q_, states, pts_[2 * b]);
+		const TBatchPoint p1(states.q_, states, pts_[2 * b + 1]);
+		const double sign = b == 0 ? 1.0 : -1.0;
+
+		for (size_t k = 0; k < n; k++)
+			ang[k] += sign * std::atan2(p1.y[k] - p0.y[k], p1.x[k] - p0.x[k]);
+	}
+	for (size_t k = 0; k < n; k++) ang[k] = mrpt::math::wrapToPi(ang[k]);
+}
+
+// ---------------------------------------
+// Virtual sensor: Accelerometer
+// ---------------------------------------
+CVirtualSensor_Accelerometer::CVirtualSensor_Accelerometer(
+	const CAssembledRigidModel& arm, size_t point_idx, size_t body_idx,
+	int axis)
+	: axis_(axis), pt_(arm, point_idx), axis_pts_(bodyPoints(arm, body_idx))
+{
+	ASSERT_(axis == 0 || axis == 1);
+}
+
+double CVirtualSensor_Accelerometer::reading(
+	const Eigen::VectorXd& q, const Eigen::VectorXd& ddq,
+	Eigen::MatrixXd* H_q, Eigen::MatrixXd* H_ddq) const
+{
+	const TPointGather &p0 = axis_pts_[0], &p1 = axis_pts_[1];
+	const double dx = p1.pos(q, 0) - p0.pos(q, 0);
+	const double dy = p1.pos(q, 1) - p0.pos(q, 1);
+	const double len2 = dx * dx + dy * dy, len = std::sqrt(len2);
+
+	// The projection on the unit vector d/|d| (axis 0) or its normal
+	// (axis 1) is a'.d/|d|, with a'=a or a rotated -90 deg, respectively:
+	const double ax = pt_.deriv(ddq, 0), ay = pt_.deriv(ddq, 1);
+	const double apx = axis_ == 0 ? ax : ay;
+	const double apy = axis_ == 0 ? ay : -ax;
+	const double acc = (apx * dx + apy * dy) / len;
+
+	if (H_q)
+	{
+		// d acc / d d = a'/|d| - acc d/|d|^2
+		H_q->setZero(1, q.size());
+		const double gx = apx / len - acc * dx / len2;
+		const double gy = apy / len - acc * dy / len2;
+		p1.addToJacobian(*H_q, gx, gy);
+		p0.addToJacobian(*H_q, -gx, -gy);
+	}
+	if (H_ddq)
+	{
+		// d acc / d a = the unit vector of the axis
+		H_ddq->setZero(1, ddq.size());
+		if (axis_ == 0)
+			pt_.addToJacobian(*H_ddq, dx / len, dy / len);
+		else
+			pt_.addToJacobian(*H_ddq, -dy / len, dx / len);
+	}
+	return acc;
+}
+
+void CVirtualSensor_Accelerometer::simulate_readings(
+	const CAssembledRigidModelBatch& states, Eigen::VectorXd& out) const
+{
+	const size_t n = states.size();
+	out.resize(n);
+	if (n == 0) return;
+
+	const TBatchPoint p0(states.q_, states, axis_pts_[0]);
+	const TBatchPoint p1(states.q_, states, axis_pts_[1]);
+	const TBatchPoint a(states.ddotq_, states, pt_);
+	double* acc = out.data();
+
+	// Same as reading(), with a' = (ax, ay) or (ay, -ax):
+	const double *apx = axis_ == 0 ? a.x : a.y, *apy = axis_ == 0 ? a.y : a.x;
+	const double sy = axis_ == 0 ? 1.0 : -1.0;
+	for (size_t k = 0; k < n; k++)
+	{
+		const double dx = p1.x[k] - p0.x[k], dy = p1.y[k] - p0.y[k];
+		acc[k] =
+			(apx[k] * dx + sy * apy[k] * dy) / std::sqrt(dx * dx + dy * dy);
+	}
+}
+
+// ---------------------------------------
+// Virtual sensor: Point tracker
+// ---------------------------------------
+CVirtualSensor_PointTracker::CVirtualSensor_PointTracker(
+	const CAssembledRigidModel& arm, size_t point_idx, int axis)
+	: axis_(axis), pt_(arm, point_idx)
+{
+	ASSERT_(axis == 0 || axis == 1);
+}
+
+double CVirtualSensor_PointTracker::reading(
+	const Eigen::VectorXd& q, Eigen::MatrixXd* H_q) const
+{
+	if (H_q)
+	{
+		H_q->setZero(1, q.size());
+		pt_.addToJacobian(*H_q, axis_ == 0 ? 1 : 0, axis_ == 1 ? 1 : 0);
+	}
+	return pt_.pos(q, axis_);
+}
+
+void CVirtualSensor_PointTracker::simulate_readings(
+	const CAssembledRigidModelBatch& states, Eigen::VectorXd& out) const
+{
+	if (states.size() == 0)
+	{
+		out.resize(0);
+		return;
+	}
+	const TBatchPoint p(states.q_, states, pt_);
+	out = Eigen::Map<const Eigen::VectorXd>(
+		axis_ == 0 ? p.x : p.y, states.size());
+}
@@ -0,0 +1,158 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#include <gtest/gtest.h>
+
+#include <mbse/mbse.h>
+#include <mbse/model-examples.h>
+#include <cmath>
+
+using namespace mbse;
+
+// Compares the batched evaluation of many states against evaluating them one
+// by one, each one in a freshly assembled model.
+static void testerBatchModel(
+	const CModelDefinition& model, const std::vector<RelativeDOF>& rDOFs)
+{
+	timelog().enable(false);  // avois clutter in cout
+
+	const size_t N = 10;
+
+	// Generate states along a simulation:
+	auto aMBS = model.assembleRigidMBS(rDOFs);
+	aMBS->setGravityVector(0, -9.81, 0);
+
+	CDynamicSimulator_Lagrange_LU_dense dynSimul(aMBS);
+	dynSimul.params.ode_solver = ODE_RK4;
+	dynSimul.prepare();
+
+	auto batch = std::make_shared<CAssembledRigidModelBatch>(aMBS, N);
+	for (size_t k = 0; k < N; k++)
+	{
+		dynSimul.run(k * 0.05, (k + 1) * 0.05);
+		batch->setStateFrom(k, *aMBS);
+	}
+
+	CDynamicSimulatorBatch_Lagrange_KLU batchSimul(batch);
+	batchSimul.prepare();
+
+	Eigen::MatrixXd ddotq;
+	batchSimul.solve_ddotq(ddotq);
+
+	for (size_t k = 0; k < N; k++)
+	{
+		auto arm = model.assembleRigidMBS(rDOFs);
+		arm->setGravityVector(0, -9.81, 0);
+		batch->getState(k, arm->q_, arm->dotq_);
+
+		CDynamicSimulator_Lagrange_KLU simul(arm);
+		simul.prepare();
+		Eigen::VectorXd ddotq_k;
+		simul.solve_ddotq(0, ddotq_k);
+
+		const size_t nnz = arm->Phi_q_.nonZeros();
+		for (size_t i = 0; i < nnz; i++)
+		{
+			EXPECT_NEAR(batch->Phi_q_(i, k), arm->Phi_q_.valuePtr()[i], 1e-12);
+			EXPECT_NEAR(
+				batch->dotPhi_q_(i, k), arm->dotPhi_q_.valuePtr()[i], 1e-12);
+		}
+		for (int i = 0; i < arm->Phi_.size(); i++)
+		{
+			EXPECT_NEAR(batch->Phi_(i, k), arm->Phi_[i], 1e-12);
+			EXPECT_NEAR(batch->dotPhi_(i, k), arm->dotPhi_[i], 1e-12);
+		}
+
+		EXPECT_NEAR((ddotq.col(k) - ddotq_k).array().abs().maxCoeff(), 0, 1e-8)
+			<< "state #" << k << "\n"
+			<< "ddotq batch : " << ddotq.col(k).transpose() << "\n"
+			<< "ddotq single: " << ddotq_k.transpose() << "\n";
+	}
+}
+
+TEST(BatchModel, FourBars) { testerBatchModel(buildFourBarsMBS(), {}); }
+
+TEST(BatchModel, FourBarsWithRelCoord)
+{
+	std::vector<RelativeDOF> rDOFs;
+	rDOFs.emplace_back(RelativeAngleAbsoluteDOF(0, 1));
+	testerBatchModel(buildFourBarsMBS(), rDOFs);
+}
+
+TEST(BatchModel, SliderCrank) { testerBatchModel(buildSliderCrankMBS(), {}); }
+
+// Evaluates the states of a batch along a sequence of steps, against one model
+// per state which goes through the same sequence, so constraints with values
+// cached across calls see the same history in both. The last coordinate (a
+// relative angle) moves slowly around pi/4, where |sin| crosses 0.707.
+static void testerBatchHistory(
+	const CModelDefinition& model, const std::vector<RelativeDOF>& rDOFs)
+{
+	timelog().enable(false);  // avois clutter in cout
+
+	const size_t N = 6;
+
+	auto aMBS = model.assembleRigidMBS(rDOFs);
+	auto batch = std::make_shared<CAssembledRigidModelBatch>(aMBS, N);
+	std::vector<CAssembledRigidModel::Ptr> arms;
+	for (size_t k = 0; k < N; k++) arms.push_back(model.assembleRigidMBS(rDOFs));
+
+	const size_t n = aMBS->q_.size();
+	const Eigen::VectorXd q0 = aMBS->q_;
+	Eigen::VectorXd q(n), dq(n);
+	for (int t = 0; t < 100; t++)
+	{
+		for (size_t k = 0; k < N; k++)
+		{
+			for (size_t i = 0; i < n; i++)
+			{
+				q[i] = q0[i] + 0.05 * std::sin(0.2 * t + k + i);
+				dq[i] = std::sin(2.0 + 5 * t + 3 * i + k);
+			}
+			q[n - 1] = M_PI / 4 + 0.05 * std::sin(0.2 * t + k);
+			batch->setState(k, q, dq);
+			arms[k]->q_ = q;
+			arms[k]->dotq_ = dq;
+			arms[k]->update_numeric_Phi_and_Jacobians();
+		}
+		batch->update_numeric_Phi_and_Jacobians();
+
+		for (size_t k = 0; k < N; k++)
+		{
+			const auto& arm = *arms[k];
+			for (size_t i = 0; i < arm.Phi_q_.nonZeros(); i++)
+			{
+				EXPECT_NEAR(batch->Phi_q_(i, k), arm.Phi_q_.valuePtr()[i], 1e-12)
+					<< "step #" << t << " state #" << k;
+				EXPECT_NEAR(
+					batch->dotPhi_q_(i, k), arm.dotPhi_q_.valuePtr()[i], 1e-12);
+			}
+			for (int i = 0; i < arm.Phi_.size(); i++)
+			{
+				EXPECT_NEAR(batch->Phi_(i, k), arm.Phi_[i], 1e-12);
+				EXPECT_NEAR(batch->dotPhi_(i, k), arm.dotPhi_[i], 1e-12);
+			}
+		}
+	}
+}
+
+TEST(BatchModel, RelAngleAbsoluteHistory)
+{
+	std::vector<RelativeDOF> rDOFs;
+	rDOFs.emplace_back(RelativeAngleAbsoluteDOF(0, 1));
+	testerBatchHistory(buildFourBarsMBS(), rDOFs);
+}
+
+TEST(BatchModel, RelAngleHistory)
+{
+	std::vector<RelativeDOF> rDOFs;
+	rDOFs.emplace_back(RelativeAngleDOF(1, 0, 2));
+	testerBatchHistory(buildSliderCrankMBS(), rDOFs);
+}
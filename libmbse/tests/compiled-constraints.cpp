@@ -0,0 +1,110 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#include <gtest/gtest.h>
+
+#include <mbse/mbse.h>
+#include <mbse/model-examples.h>
+#include <cmath>
+
+using namespace mbse;
+
+// Compares the evaluation of constraints grouped by type (optionally, in
+// parallel) against calling update() on each constraint, at arbitrary states.
+static void testerCompiledConstraints(
+	const CModelDefinition& model, const std::vector<RelativeDOF>& rDOFs,
+	bool parallel = false)
+{
+	timelog().enable(false);  // avois clutter in cout
+
+	auto armC = model.assembleRigidMBS(rDOFs);
+	auto armV = model.assembleRigidMBS(rDOFs);
+	armV->setCompiledConstraintsEnabled(false);
+
+	if (parallel)
+	{
+		// Force small chunks, even for small models:
+		auto& pp = armC->parallel_update_params;
+		pp.enabled = true;
+		pp.serial_threshold = 0;
+		pp.grain_size = 7;
+	}
+
+	const size_t n = armC->q_.size();
+	for (int iter = 0; iter < 10; iter++)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			armC->q_[i] += 0.05 * std::sin(1.0 + 3 * iter + 7 * i);
+			armC->dotq_[i] = std::sin(2.0 + 5 * iter + 3 * i);
+			armC->ddotq_[i] = std::cos(3.0 + 2 * iter + 5 * i);
+		}
+		armV->q_ = armC->q_;
+		armV->dotq_ = armC->dotq_;
+		armV->ddotq_ = armC->ddotq_;
+
+		armC->update_numeric_Phi_and_Jacobians();
+		armV->update_numeric_Phi_and_Jacobians();
+
+		for (int i = 0; i < armC->Phi_.size(); i++)
+		{
+			EXPECT_NEAR(armC->Phi_[i], armV->Phi_[i], 1e-12);
+			EXPECT_NEAR(armC->dotPhi_[i], armV->dotPhi_[i], 1e-12);
+		}
+
+		const auto expectEqual = [](const CompressedRowSparseMatrix& a,
+									const CompressedRowSparseMatrix& b) {
+			ASSERT_EQ(a.nonZeros(), b.nonZeros());
+			for (size_t i = 0; i < a.nonZeros(); i++)
+				EXPECT_NEAR(a.valuePtr()[i], b.valuePtr()[i], 1e-12);
+		};
+		expectEqual(armC->Phi_q_, armV->Phi_q_);
+		expectEqual(armC->dotPhi_q_, armV->dotPhi_q_);
+		expectEqual(armC->Phiqq_times_ddq_, armV->Phiqq_times_ddq_);
+		expectEqual(armC->dotPhiqq_times_dq_, armV->dotPhiqq_times_dq_);
+	}
+}
+
+TEST(CompiledConstraints, FourBars)
+{
+	testerCompiledConstraints(buildFourBarsMBS(), {});
+}
+
+TEST(CompiledConstraints, FourBarsWithRelCoord)
+{
+	std::vector<RelativeDOF> rDOFs;
+	rDOFs.emplace_back(RelativeAngleAbsoluteDOF(0, 1));
+	testerCompiledConstraints(buildFourBarsMBS(), rDOFs);
+}
+
+TEST(CompiledConstraints, SliderCrank)
+{
+	testerCompiledConstraints(buildSliderCrankMBS(), {});
+}
+
+TEST(CompiledConstraints, Follower)
+{
+	testerCompiledConstraints(buildFollowerMBS(), {});
+}
+
+TEST(CompiledConstraints, TwoSliderBlocks)
+{
+	testerCompiledConstraints(buildTwoSliderBlocks(), {});
+}
+
+TEST(CompiledConstraints, ParameterizedParallel)
+{
+	testerCompiledConstraints(buildParameterizedMBS(8, 6), {}, true);
+}
+
+TEST(CompiledConstraints, LongStringParallel)
+{
+	testerCompiledConstraints(buildLongStringMBS(100), {}, true);
+}
@@ -0,0 +1,263 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+
+#include <gtest/gtest.h>
+
+#include <mbse/constraints/CConstraintMobileSlider.h>
+#include <mbse/mbse.h>
+#include <mbse/mbse-autodiff.h>
+#include <mbse/model-examples.h>
+#include <cmath>
+
+using namespace mbse;
+
+// Checks all derivatives of a function of 5 coordinates against finite
+// differences of its gradient, itself evaluated by finite differences.
+TEST(AutoDiff, MatchesNumericDerivatives)
+{
+	constexpr std::size_t K = 5;
+	const auto phi = [](const auto& x) {
+		return x[4] * cos(x[2]) + x[0] * x[1] * sin(x[3]) -
+			   sqrt(x[0] * x[0] + x[1] * x[1] + 1.0) / (x[4] + 3.0);
+	};
+	using vec_t = std::array<double, K>;
+	const vec_t q = {0.3, -0.7, 0.4, 1.1, 0.2};
+	const vec_t dq = {0.5, 0.1, -0.3, 0.8, -0.6};
+	const vec_t ddq = {0.2, -0.4, 0.9, 0.1, 0.3};
+
+	TConstraintDerivatives<K> d;
+	autodiffConstraint(phi, q, dq, ddq, d);
+
+	const auto gradient = [&](const vec_t& x) {
+		const double h = 1e-5;
+		vec_t g;
+		for (std::size_t i = 0; i < K; i++)
+		{
+			vec_t xp = x, xm = x;
+			xp[i] += h;
+			xm[i] -= h;
+			g[i] = (phi(xp) - phi(xm)) / (2 * h);
+		}
+		return g;
+	};
+	const auto along = [](const vec_t& x, const vec_t& dir, double t) {
+		vec_t r = x;
+		for (std::size_t i = 0; i < K; i++) r[i] += t * dir[i];
+		return r;
+	};
+
+	const double h = 1e-3;
+	const vec_t g = gradient(q);
+	const vec_t g_dq_p = gradient(along(q, dq, h));
+	const vec_t g_dq_m = gradient(along(q, dq, -h));
+	const vec_t g_ddq_p = gradient(along(q, ddq, h));
+	const vec_t g_ddq_m = gradient(along(q, ddq, -h));
+
+	EXPECT_NEAR(d.Phi, phi(q), 1e-12);
+	double dotPhi = 0;
+	for (std::size_t i = 0; i < K; i++) dotPhi += g[i] * dq[i];
+	EXPECT_NEAR(d.dotPhi, dotPhi, 1e-8);
+
+	for (std::size_t i = 0; i < K; i++)
+	{
+		EXPECT_NEAR(d.Phi_q[i], g[i], 1e-8);
+		EXPECT_NEAR(d.dotPhi_q[i], (g_dq_p[i] - g_dq_m[i]) / (2 * h), 1e-5);
+		EXPECT_NEAR(
+			d.Phiqq_times_ddq[i], (g_ddq_p[i] - g_ddq_m[i]) / (2 * h), 1e-5);
+		EXPECT_NEAR(
+			d.dotPhiqq_times_dq[i],
+			(g_dq_p[i] - 2 * g[i] + g_dq_m[i]) / (h * h), 1e-3);
+	}
+}
+
+// Compares against the hand-coded derivatives of a constant distance and an
+// absolute relative angle constraint.
+TEST(AutoDiff, MatchesHandCodedConstraints)
+{
+	{
+		const auto phi = [](const auto& x) {
+			return (x[2] - x[0]) * (x[2] - x[0]) +
+				   (x[3] - x[1]) * (x[3] - x[1]) - 2.0;
+		};
+		const std::array<double, 4> q = {0.1, 0.2, 1.3, -0.4};
+		const std::array<double, 4> dq = {-0.3, 0.5, 0.7, 0.2};
+		const std::array<double, 4> ddq = {0.6, -0.1, 0.4, -0.8};
+		TConstraintDerivatives<4> d;
+		autodiffConstraint(phi, q, dq, ddq, d);
+
+		const double Ax = q[2] - q[0], Ay = q[3] - q[1];
+		const double Adotx = dq[2] - dq[0], Adoty = dq[3] - dq[1];
+		const double Addotx = ddq[2] - ddq[0], Addoty = ddq[3] - ddq[1];
+		const std::array<double, 4> Phi_q = {-2 * Ax, -2 * Ay, 2 * Ax, 2 * Ay};
+		const std::array<double, 4> dotPhi_q = {
+			-2 * Adotx, -2 * Adoty, 2 * Adotx, 2 * Adoty};
+		const std::array<double, 4> Phiqq_times_ddq = {
+			-2 * Addotx, -2 * Addoty, 2 * Addotx, 2 * Addoty};
+
+		EXPECT_NEAR(d.Phi, Ax * Ax + Ay * Ay - 2.0, 1e-14);
+		EXPECT_NEAR(d.dotPhi, 2 * Ax * Adotx + 2 * Ay * Adoty, 1e-14);
+		for (std::size_t i = 0; i < 4; i++)
+		{
+			EXPECT_NEAR(d.Phi_q[i], Phi_q[i], 1e-14);
+			EXPECT_NEAR(d.dotPhi_q[i], dotPhi_q[i], 1e-14);
+			EXPECT_NEAR(d.Phiqq_times_ddq[i], Phiqq_times_ddq[i], 1e-14);
+			EXPECT_NEAR(d.dotPhiqq_times_dq[i], 0, 1e-14);
+		}
+	}
+	{
+		const double L = 1.5;
+		const auto phi = [L](const auto& x) {
+			return x[2] - x[0] - L * cos(x[4]);
+		};
+		const std::array<double, 5> q = {0.1, 0.2, 1.3, -0.4, 0.8};
+		const std::array<double, 5> dq = {-0.3, 0.5, 0.7, 0.2, 1.2};
+		const std::array<double, 5> ddq = {0.6, -0.1, 0.4, -0.8, -0.9};
+		TConstraintDerivatives<5> d;
+		autodiffConstraint(phi, q, dq, ddq, d);
+
+		const double s = std::sin(q[4]), c = std::cos(q[4]);
+		const double w = dq[4], angAcc = ddq[4];
+
+		EXPECT_NEAR(d.dotPhi, dq[2] - dq[0] + L * s * w, 1e-14);
+		EXPECT_NEAR(d.Phi_q[0], -1, 1e-14);
+		EXPECT_NEAR(d.Phi_q[2], 1, 1e-14);
+		EXPECT_NEAR(d.Phi_q[4], L * s, 1e-14);
+		EXPECT_NEAR(d.dotPhi_q[4], L * c * w, 1e-14);
+		EXPECT_NEAR(d.Phiqq_times_ddq[4], L * c * angAcc, 1e-14);
+		EXPECT_NEAR(d.dotPhiqq_times_dq[4], -L * w * w * s, 1e-14);
+		for (std::size_t i = 0; i < 4; i++)
+		{
+			EXPECT_NEAR(d.dotPhi_q[i], 0, 1e-14);
+			EXPECT_NEAR(d.Phiqq_times_ddq[i], 0, 1e-14);
+			EXPECT_NEAR(d.dotPhiqq_times_dq[i], 0, 1e-14);
+		}
+	}
+}
+
+namespace
+{
+// A mobile slider whose derivatives are obtained by autodiff, to check the
+// hand-coded ones in CConstraintMobileSlider::update().
+class AutoDiffMobileSlider : public CConstraintMobileSlider
+{
+   public:
+	using CConstraintMobileSlider::CConstraintMobileSlider;
+
+	void update(CAssembledRigidModel& arm) const override
+	{
+		autodiff_update(arm, [](const auto& q) {
+			const auto &x = q[0], &y = q[1];
+			const auto &x0 = q[2], &y0 = q[3], &x1 = q[4], &y1 = q[5];
+			return (x1 - x0) * (y - y0) - (y1 - y0) * (x - x0);
+		});
+	}
+	bool compile(CCompiledConstraints&) const override { return false; }
+	Ptr clone() const override
+	{
+		return std::make_shared<AutoDiffMobileSlider>(*this);
+	}
+};
+}  // namespace
+
+TEST(AutoDiff, MatchesMobileSliderUpdate)
+{
+	timelog().enable(false);  // avois clutter in cout
+
+	// Point 0 is fixed, so its entries are skipped by both versions:
+	CModelDefinition modelH = buildSliderCrankMBS();
+	CModelDefinition modelA = buildSliderCrankMBS();
+	modelH.addConstraint(CConstraintMobileSlider(2, 0, 1));
+	modelA.addConstraint(AutoDiffMobileSlider(2, 0, 1));
+
+	auto armH = modelH.assembleRigidMBS();
+	auto armA = modelA.assembleRigidMBS();
+	armH->setCompiledConstraintsEnabled(false);
+	armA->setCompiledConstraintsEnabled(false);
+
+	const size_t n = armH->q_.size();
+	for (int iter = 0; iter < 5; iter++)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			armH->q_[i] += 0.1 * std::sin(1.0 + 3 * iter + 7 * i);
+			armH->dotq_[i] = std::sin(2.0 + 5 * iter + 3 * i);
+			armH->ddotq_[i] = std::cos(3.0 + 2 * iter + 5 * i);
+		}
+		armA->q_ = armH->q_;
+		armA->dotq_ = armH->dotq_;
+		armA->ddotq_ = armH->ddotq_;
+
+		armH->update_numeric_Phi_and_Jacobians();
+		armA->update_numeric_Phi_and_Jacobians();
+
+		for (int i = 0; i < armH->Phi_.size(); i++)
+		{
+			EXPECT_NEAR(armH->Phi_[i], armA->Phi_[i], 1e-12);
+			EXPECT_NEAR(armH->dotPhi_[i], armA->dotPhi_[i], 1e-12);
+		}
+		const auto expectEqual = [](const CompressedRowSparseMatrix& a,
+									const CompressedRowSparseMatrix& b) {
+			ASSERT_EQ(a.nonZeros(), b.nonZeros());
+			for (size_t i = 0; i < a.nonZeros(); i++)
+				EXPECT_NEAR(a.valuePtr()[i], b.valuePtr()[i], 1e-12);
+		};
+		expectEqual(armH->Phi_q_, armA->Phi_q_);
+		expectEqual(armH->dotPhi_q_, armA->dotPhi_q_);
+		expectEqual(armH->Phiqq_times_ddq_, armA->Phiqq_times_ddq_);
+		expectEqual(armH->dotPhiqq_times_dq_, armA->dotPhiqq_times_dq_);
+	}
+}
+
+// The relative angle constraint vanishes at the actual angle between the two
+// rods, and its Jacobian matches finite differences of Phi.
+TEST(AutoDiff, RelativeAngleConstraint)
+{
+	timelog().enable(false);  // avois clutter in cout
+
+	// Angle at point 1, from the rod 1-0 to the rod 1-2:
+	const std::vector<RelativeDOF> rDOFs = {RelativeAngleDOF(1, 0, 2)};
+	auto arm = buildSliderCrankMBS().assembleRigidMBS(rDOFs);
+	arm->setCompiledConstraintsEnabled(false);
+
+	const size_t n = arm->q_.size(), m = arm->Phi_.size();
+	const size_t iAngle = n - 1, iRow = m - 1;
+	const auto pt = [&](size_t i) {
+		const auto& d = arm->getPoints2DOFs()[i];
+		return Eigen::Vector2d(arm->q_[d.dof_x], arm->q_[d.dof_y]);
+	};
+	// Point 0 is fixed at the origin:
+	const Eigen::Vector2d p0(0, 0), p1 = pt(1), p2 = pt(2);
+	const Eigen::Vector2d u = p0 - p1, v = p2 - p1;
+	arm->q_[iAngle] = std::atan2(u.x() * v.y() - u.y() * v.x(), u.dot(v));
+	for (size_t i = 0; i < n; i++) arm->dotq_[i] = std::sin(1.0 + 3 * i);
+
+	arm->update_numeric_Phi_and_Jacobians();
+	EXPECT_NEAR(arm->Phi_[iRow], 0, 1e-12);
+
+	const Eigen::MatrixXd Phi_q = arm->Phi_q_.asDense();
+	EXPECT_NEAR(
+		arm->dotPhi_[iRow], (Phi_q.row(iRow) * arm->dotq_).value(), 1e-12);
+
+	const double h = 1e-6;
+	for (size_t i = 0; i < n; i++)
+	{
+		const double q0 = arm->q_[i];
+		arm->q_[i] = q0 + h;
+		arm->update_numeric_Phi_and_Jacobians();
+		const double phiP = arm->Phi_[iRow];
+		arm->q_[i] = q0 - h;
+		arm->update_numeric_Phi_and_Jacobians();
+		const double phiM = arm->Phi_[iRow];
+		arm->q_[i] = q0;
+
+		EXPECT_NEAR(Phi_q(iRow, i), (phiP - phiM) / (2 * h), 1e-6);
+	}
+}
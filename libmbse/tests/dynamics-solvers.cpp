@@ -12,6 +12,7 @@
 
 #include <mbse/mbse.h>
 #include <mbse/model-examples.h>
+#include <thread>
 
 template <class DYNAMIC_SOLVER_T>
 void testerPendulumDynamics(bool addRelativeAngle = false)
@@ -91,6 +92,11 @@ TEST(PendulumDynamics, CDynamicSimulator_R_matrix_dense)
 	testerPendulumDynamics<mbse::CDynamicSimulator_R_matrix_dense>();
 }
 
+TEST(PendulumDynamics, CDynamicSimulator_Lagrange_LU_fixed)
+{
+	testerPendulumDynamics<mbse::CDynamicSimulator_Lagrange_LU_fixed<2, 1>>();
+}
+
 // ---------
 TEST(PendulumDynamicsWithRelCoord, CDynamicSimulator_Lagrange_LU_dense)
 {
@@ -100,3 +106,396 @@ TEST(PendulumDynamicsWithRelCoord, CDynamicSimulator_R_matrix_dense)
 {
 	testerPendulumDynamics<mbse::CDynamicSimulator_R_matrix_dense>(true);
 }
+
+TEST(PendulumDynamicsWithRelCoord, CDynamicSimulator_Lagrange_LU_fixed)
+{
+	testerPendulumDynamics<mbse::CDynamicSimulator_Lagrange_LU_fixed<3, 2>>(
+		true);
+}
+
+// The fixed-size solver must follow the same trajectory as the dense one:
+TEST(FixedSizeDynamics, FourBars)
+{
+	mbse::timelog().enable(false);  // avois clutter in cout
+
+	const mbse::CModelDefinition model = mbse::buildFourBarsMBS();
+	auto armDense = model.assembleRigidMBS();
+	auto armFixed = model.assembleRigidMBS();
+
+	mbse::CDynamicSimulator_Lagrange_LU_dense dense(armDense);
+	mbse::CDynamicSimulator_Lagrange_LU_fixed<4, 3> fixed(armFixed);
+	for (mbse::CDynamicSimulatorBase* s :
+		 {static_cast<mbse::CDynamicSimulatorBase*>(&dense),
+		  static_cast<mbse::CDynamicSimulatorBase*>(&fixed)})
+	{
+		s->params.ode_solver = mbse::ODE_RK4;
+		s->prepare();
+	}
+
+	dense.run(0, 0.5);
+	fixed.run(0, 0.5);
+
+	EXPECT_NEAR(
+		(armDense->q_ - armFixed->q_).array().abs().maxCoeff(), 0, 1e-9);
+	EXPECT_NEAR(
+		(armDense->dotq_ - armFixed->dotq_).array().abs().maxCoeff(), 0, 1e-9);
+}
+
+// Integrating with check_no_allocations must not trip Eigen's heap allocation
+// check (always built along with the tests; as an Eigen assertion, it is
+// only effective without NDEBUG):
+template <class DYNAMIC_SOLVER_T>
+void testerNoAllocations()
+{
+	mbse::timelog().enable(false);  // avois clutter in cout
+
+	for (const auto integrator :
+		 {mbse::ODE_Euler, mbse::ODE_Trapezoidal, mbse::ODE_RK4})
+	{
+		auto arm = mbse::buildFourBarsMBS().assembleRigidMBS();
+		arm->setGravityVector(0, -9.81, 0);
+
+		DYNAMIC_SOLVER_T dynSimul(arm);
+		dynSimul.params.ode_solver = integrator;
+		dynSimul.params.time_step = 1e-3;
+		dynSimul.params.check_no_allocations = true;
+		dynSimul.prepare();
+
+		EXPECT_NO_THROW(dynSimul.run(0, 0.05));
+		EXPECT_TRUE((arm->q_.array() == arm->q_.array()).all())
+			<< "integrator: " << static_cast<int>(integrator);
+	}
+}
+
+TEST(NoAllocations, CDynamicSimulator_Lagrange_LU_dense)
+{
+	testerNoAllocations<mbse::CDynamicSimulator_Lagrange_LU_dense>();
+}
+TEST(NoAllocations, CDynamicSimulator_Lagrange_LU_fixed)
+{
+	testerNoAllocations<mbse::CDynamicSimulator_Lagrange_LU_fixed<4, 3>>();
+}
+TEST(NoAllocations, CDynamicSimulator_Lagrange_KLU)
+{
+	testerNoAllocations<mbse::CDynamicSimulator_Lagrange_KLU>();
+}
+TEST(NoAllocations, CDynamicSimulator_Lagrange_UMFPACK)
+{
+	testerNoAllocations<mbse::CDynamicSimulator_Lagrange_UMFPACK>();
+}
+TEST(NoAllocations, CDynamicSimulator_AugmentedLagrangian_KLU)
+{
+	testerNoAllocations<mbse::CDynamicSimulator_AugmentedLagrangian_KLU>();
+}
+TEST(NoAllocations, CDynamicSimulator_AugmentedLagrangian_Dense)
+{
+	testerNoAllocations<mbse::CDynamicSimulator_AugmentedLagrangian_Dense>();
+}
+TEST(NoAllocations, CDynamicSimulator_ALi3_Dense)
+{
+	testerNoAllocations<mbse::CDynamicSimulator_ALi3_Dense>();
+}
+TEST(NoAllocations, CDynamicSimulator_R_matrix_dense)
+{
+	testerNoAllocations<mbse::CDynamicSimulator_R_matrix_dense>();
+}
+
+// Simulators of models assembled from the same symbolic model must share one
+// factorization of the mass matrix:
+TEST(MassMatrixCache, SharedAcrossSimulators)
+{
+	mbse::timelog().enable(false);  // avois clutter in cout
+
+	const mbse::CModelDefinition model = mbse::buildFourBarsMBS();
+	mbse::TSymbolicAssembledModel sym(model);
+	model.assembleRigidMBS(sym);
+
+	std::vector<std::shared_ptr<mbse::CDynamicSimulatorBase>> simuls;
+	for (int i = 0; i < 5; i++)
+	{
+		auto arm = std::make_shared<mbse::CAssembledRigidModel>(sym);
+		EXPECT_EQ(&arm->massMatrixCache(), sym.massMatrixCache.get());
+
+		simuls.push_back(
+			std::make_shared<mbse::CDynamicSimulator_AugmentedLagrangian_Dense>(
+				arm));
+		simuls.push_back(
+			std::make_shared<mbse::CDynamicSimulator_AugmentedLagrangian_KLU>(
+				arm));
+		simuls.push_back(
+			std::make_shared<mbse::CDynamicSimulator_Lagrange_LU_dense>(arm));
+		for (auto& s : simuls) s->prepare();
+	}
+	// One dense and one sparse LDL^t:
+	EXPECT_EQ(sym.massMatrixCache->factorizationCount(), 2U);
+
+	// Models assembled on their own get their own cache:
+	auto arm1 = model.assembleRigidMBS(), arm2 = model.assembleRigidMBS();
+	EXPECT_NE(&arm1->massMatrixCache(), &arm2->massMatrixCache());
+	EXPECT_EQ(
+		arm1->massMatrixCache().dense(*arm1),
+		arm2->massMatrixCache().dense(*arm2));
+}
+
+TEST(PerThreadCopies, SimulatorFromOtherThreads)
+{
+	mbse::timelog().enable(false);  // avois clutter in cout
+
+	auto arm = mbse::buildFourBarsMBS().assembleRigidMBS();
+	arm->setGravityVector(0, -9.81, 0);
+
+	mbse::CDynamicSimulator_Lagrange_KLU simul(arm);
+	simul.prepare();
+	auto copies = mbse::makePerThreadCopies(&simul);
+
+	// The creator thread uses the original simulator:
+	EXPECT_EQ(&copies->get(), &simul);
+
+	Eigen::VectorXd ddotq;
+	copies->get().solve_ddotq(0, ddotq);
+
+	const size_t nThreads = 4;
+	std::vector<Eigen::VectorXd> results(nThreads);
+	std::vector<const mbse::CDynamicSimulatorBase*> used(nThreads);
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < nThreads; i++)
+		threads.emplace_back([&, i]() {
+			mbse::timelog().enable(false);
+			auto& s = copies->get();
+			s.get_model_non_const()->q_ = arm->q_;
+			s.get_model_non_const()->dotq_ = arm->dotq_;
+			s.solve_ddotq(0, results[i]);
+			used[i] = &s;
+		});
+	for (auto& t : threads) t.join();
+
+	EXPECT_EQ(copies->copyCount(), nThreads);
+	for (size_t i = 0; i < nThreads; i++)
+	{
+		EXPECT_NE(used[i], &simul);
+		EXPECT_NE(used[i]->get_model().get(), arm.get());
+		EXPECT_EQ(
+			&used[i]->get_model()->massMatrixCache(), &arm->massMatrixCache());
+		EXPECT_NEAR((results[i] - ddotq).array().abs().maxCoeff(), 0, 1e-12);
+	}
+}
+
+// Copies made in advance for the workers of a pool are the ones they use:
+TEST(PerThreadCopies, MadeForPoolWorkers)
+{
+	mbse::timelog().enable(false);  // avois clutter in cout
+
+	auto arm = mbse::buildFourBarsMBS().assembleRigidMBS();
+	mbse::CDynamicSimulator_Indep_dense simul(arm);
+	simul.prepare();
+	auto copies = mbse::makePerThreadCopies(&simul);
+
+	mbse::CThreadPool pool(3);
+	copies->makeCopies(pool.workerIds());
+	EXPECT_EQ(copies->copyCount(), 2U);
+
+	std::vector<const mbse::CDynamicSimulatorIndepBase*> used(100);
+	pool.parallel_for(used.size(), 1, [&](size_t i0, size_t i1) {
+		for (size_t i = i0; i < i1; i++) used[i] = &copies->get();
+	});
+	EXPECT_EQ(copies->copyCount(), 2U);
+	for (const auto* s : used) EXPECT_TRUE(s != nullptr);
+}
+
+// Loops nested in a loop of the pool run serially in the calling thread:
+TEST(ThreadPool, NestedLoops)
+{
+	mbse::CThreadPool pool(4);
+	for (size_t n = 1; n < 10; n++)
+	{
+		std::vector<int> visits(n, 0);
+		std::vector<size_t> nestedCount(n, 0);
+		pool.parallel_for(n, 1, [&](size_t i0, size_t i1) {
+			for (size_t i = i0; i < i1; i++)
+			{
+				visits[i]++;
+				const auto id = std::this_thread::get_id();
+				pool.parallel_for(5, 1, [&](size_t j0, size_t j1) {
+					EXPECT_TRUE(std::this_thread::get_id() == id);
+					nestedCount[i] += j1 - j0;
+				});
+			}
+		});
+		for (size_t i = 0; i < n; i++)
+		{
+			EXPECT_EQ(visits[i], 1);
+			EXPECT_EQ(nestedCount[i], 5U);
+		}
+	}
+}
+
+// The sparse R matrix projection must give the same independent accelerations
+// than the dense one, and accelerations consistent with a Lagrange solver:
+static void testerIndepSparse(const mbse::CModelDefinition& model)
+{
+	mbse::timelog().enable(false);  // avois clutter in cout
+
+	auto arm = model.assembleRigidMBS();
+	arm->setGravityVector(0, -9.81, 0);
+
+	mbse::CDynamicSimulator_Lagrange_LU_dense lagrange(arm);
+	lagrange.params.ode_solver = mbse::ODE_RK4;
+	lagrange.prepare();
+
+	mbse::CDynamicSimulator_Indep_dense dense(arm);
+	dense.prepare();
+	mbse::CDynamicSimulator_Indep_sparse sparse(arm);
+	sparse.prepare();
+
+	for (int step = 0; step < 5; step++)
+	{
+		lagrange.run(step * 0.05, (step + 1) * 0.05);
+
+		// Automatic choice of independent coordinates:
+		sparse.can_choose_indep_coords_ = true;
+		Eigen::VectorXd ddotz;
+		sparse.solve_ddotz(0, ddotz);
+		const auto z = sparse.independent_coordinate_indices();
+		EXPECT_EQ(z.size(), arm->q_.size() - arm->Phi_.size());
+
+		Eigen::VectorXd ddotq_sparse, ddotq_lagrange;
+		mbse::CAssembledRigidModel::TComputeDependentParams cdp;
+		mbse::CAssembledRigidModel::TComputeDependentResults cdr;
+		cdr.ddotq = &ddotq_sparse;
+		arm->computeDependentPosVelAcc(z, false, false, cdp, cdr, &ddotz);
+		lagrange.solve_ddotq(0, ddotq_lagrange);
+
+		EXPECT_NEAR(
+			(ddotq_sparse - ddotq_lagrange).array().abs().maxCoeff(), 0, 1e-6)
+			<< "step #" << step << "\n"
+			<< "ddotq sparse  : " << ddotq_sparse.transpose() << "\n"
+			<< "ddotq lagrange: " << ddotq_lagrange.transpose() << "\n";
+
+		// Same independent coordinates in the dense simulator:
+		dense.independent_coordinate_indices(z);
+		Eigen::VectorXd ddotz_dense;
+		dense.solve_ddotz(0, ddotz_dense);
+
+		EXPECT_NEAR((ddotz - ddotz_dense).array().abs().maxCoeff(), 0, 1e-8)
+			<< "step #" << step << "\n"
+			<< "ddotz sparse: " << ddotz.transpose() << "\n"
+			<< "ddotz dense : " << ddotz_dense.transpose() << "\n";
+	}
+}
+
+TEST(IndepSparse, FourBars) { testerIndepSparse(mbse::buildFourBarsMBS()); }
+TEST(IndepSparse, SliderCrank)
+{
+	testerIndepSparse(mbse::buildSliderCrankMBS());
+}
+TEST(IndepSparse, LongString)
+{
+	testerIndepSparse(mbse::buildLongStringMBS(10));
+}
+
+// The augmented matrix built from the symbolic Phi_q^t*Phi_q plan must be
+// M + alpha * Phi_q^t * Phi_q:
+static void testerAugmentedLagrangianMatrix(const mbse::CModelDefinition& model)
+{
+	mbse::timelog().enable(false);  // avois clutter in cout
+
+	auto arm = model.assembleRigidMBS();
+	arm->setGravityVector(0, -9.81, 0);
+
+	mbse::CDynamicSimulator_AugmentedLagrangian_KLU dynSimul(arm);
+	dynSimul.prepare();
+
+	Eigen::VectorXd ddotq;
+	dynSimul.solve_ddotq(0, ddotq);
+
+	Eigen::MatrixXd Phi_q;
+	arm->Phi_q_.asDense(Phi_q);
+	const Eigen::MatrixXd A_expected =
+		arm->massMatrixCache().dense(*arm) +
+		dynSimul.params_penalty.alpha * Phi_q.transpose() * Phi_q;
+	const Eigen::MatrixXd A = Eigen::MatrixXd(dynSimul.getA());
+
+	EXPECT_NEAR(
+		(A - A_expected).array().abs().maxCoeff() /
+			A_expected.array().abs().maxCoeff(),
+		0, 1e-12);
+}
+
+TEST(AugmentedLagrangianKLU, FourBars)
+{
+	testerAugmentedLagrangianMatrix(mbse::buildFourBarsMBS());
+}
+TEST(AugmentedLagrangianKLU, LongString)
+{
+	testerAugmentedLagrangianMatrix(mbse::buildLongStringMBS(10));
+}
+
+// When the checks after klu_refactor() fail, klu_numeric_factor() must fall
+// back to a full factorization, identical to one made from scratch:
+TEST(KLUNumericFactor, RefactorFallback)
+{
+	mbse::timelog().enable(false);  // avois clutter in cout
+
+	const auto makeMatrix = [](double a) {
+		Eigen::SparseMatrix<double> A(3, 3);
+		const std::vector<Eigen::Triplet<double>> tri = {
+			{0, 0, 4 + a}, {1, 0, 1}, {0, 1, -2 * a}, {1, 1, 3},
+			{2, 1, 1 - a}, {1, 2, 0.5}, {2, 2, 5}};
+		A.setFromTriplets(tri.begin(), tri.end());
+		return A;
+	};
+	const auto solve = [](klu_symbolic* symbolic, klu_numeric* numeric,
+						  klu_common& common) {
+		Eigen::VectorXd x = Eigen::Vector3d(1, 2, 3);
+		klu_solve(symbolic, numeric, 3, 1, &x[0], &common);
+		return x;
+	};
+
+	Eigen::SparseMatrix<double> A = makeMatrix(0.1);
+	klu_common common;
+	klu_defaults(&common);
+	klu_symbolic* symbolic =
+		klu_analyze(3, A.outerIndexPtr(), A.innerIndexPtr(), &common);
+	ASSERT_TRUE(symbolic != nullptr);
+
+	// No refactorization ever passes the checks:
+	mbse::TKLUParams params;
+	params.refactor_tolerance = 1e30;
+
+	klu_numeric* numeric = nullptr;
+	std::array<double, 2> rgrowth_rcond;
+	mbse::klu_numeric_factor(
+		A, symbolic, numeric, common, params, rgrowth_rcond);
+
+	A = makeMatrix(2.0);
+	mbse::klu_numeric_factor(
+		A, symbolic, numeric, common, params, rgrowth_rcond);
+	const Eigen::VectorXd x = solve(symbolic, numeric, common);
+
+	// From scratch:
+	klu_numeric* numeric2 = nullptr;
+	std::array<double, 2> rgrowth_rcond2;
+	mbse::klu_numeric_factor(
+		A, symbolic, numeric2, common, params, rgrowth_rcond2);
+	const Eigen::VectorXd x2 = solve(symbolic, numeric2, common);
+
+	EXPECT_EQ(rgrowth_rcond[0], rgrowth_rcond2[0]);
+	EXPECT_EQ(rgrowth_rcond[1], rgrowth_rcond2[1]);
+	EXPECT_NEAR((x - x2).array().abs().maxCoeff(), 0, 1e-14);
+	EXPECT_NEAR(
+		(Eigen::MatrixXd(A) * x - Eigen::Vector3d(1, 2, 3))
+			.array()
+			.abs()
+			.maxCoeff(),
+		0, 1e-12);
+
+	// A failed full factorization throws:
+	A = makeMatrix(2.0);
+	for (int i = 0; i < A.nonZeros(); i++) A.valuePtr()[i] = 0;
+	EXPECT_ANY_THROW(mbse::klu_numeric_factor(
+		A, symbolic, numeric, common, params, rgrowth_rcond));
+
+	klu_free_numeric(&numeric2, &common);
+	if (numeric) klu_free_numeric(&numeric, &common);
+	klu_free_symbolic(&symbolic, &common);
+}
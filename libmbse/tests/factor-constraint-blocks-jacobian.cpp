@@ -0,0 +1,90 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#include <gtest/gtest.h>
+
+#include <mbse/model-examples.h>
+#include <mbse/CAssembledRigidModel.h>
+#include <gtsam/nonlinear/factorTesting.h>
+#include <mbse/factors/FactorConstraintBlocks.h>
+#include <cmath>
+
+using namespace std;
+using namespace mbse;
+
+// Checks the Jacobians of the factors of each constraint, and that together
+// they give the same errors than the constraints of the full model.
+static void testerFactorConstraintBlocks(
+	const CModelDefinition& model, const std::vector<RelativeDOF>& rDOFs)
+{
+	// for use in EXPECT_CORRECT_FACTOR_JACOBIANS
+	const auto name_ = "FactorConstraintBlocks";
+#define EXPECT ASSERT_
+
+	auto aMBS = model.assembleRigidMBS(rDOFs);
+	auto layout = std::make_shared<StateBlockLayout>(*aMBS);
+
+	const size_t n = aMBS->q_.size();
+	ASSERT_EQ(layout->stateDimension(), n);
+
+	gtsam::NonlinearFactorGraph graph;
+	addFactorConstraintBlocks(graph, aMBS, layout, 0.1, 'q', 1);
+	ASSERT_EQ(graph.size(), aMBS->constraints_.size());
+
+	// Factors write into the model (from this thread), so keep a copy:
+	const Eigen::VectorXd q0 = aMBS->q_;
+
+	for (int iter = 0; iter < 5; iter++)
+	{
+		state_t q(n);
+		for (size_t i = 0; i < n; i++)
+			q[i] = q0[i] + 0.05 * std::sin(1.0 + 3 * iter + 7 * i);
+
+		gtsam::Values values;
+		layout->insert(values, 'q', 1, q);
+		EXPECT_NEAR((layout->extract(values, 'q', 1) - q).norm(), 0, 1e-15);
+
+		// Reference: all constraints at once.
+		auto ref = aMBS->cloneTopology();
+		ref->q_ = q;
+		ref->update_numeric_Phi_and_Jacobians();
+
+		for (const auto& f : graph)
+		{
+			const auto& factor = dynamic_cast<const FactorConstraintBlocks&>(*f);
+			const auto [r0, r1] = ref->getConstraintRows(
+				factor.constraintIndex());
+
+			const gtsam::Vector err = factor.unwhitenedError(values);
+			ASSERT_EQ(static_cast<size_t>(err.size()), r1 - r0);
+			for (size_t r = r0; r < r1; r++)
+				EXPECT_NEAR(err[r - r0], ref->Phi_[r], 1e-12);
+
+			EXPECT_CORRECT_FACTOR_JACOBIANS(factor, values, 1e-7, 1e-3);
+		}
+	}
+}
+
+TEST(Jacobians, FactorConstraintBlocks_FourBars)
+{
+	testerFactorConstraintBlocks(buildFourBarsMBS(), {});
+}
+
+TEST(Jacobians, FactorConstraintBlocks_FourBarsWithRelCoord)
+{
+	std::vector<RelativeDOF> rDOFs;
+	rDOFs.emplace_back(RelativeAngleAbsoluteDOF(0, 1));
+	testerFactorConstraintBlocks(buildFourBarsMBS(), rDOFs);
+}
+
+TEST(Jacobians, FactorConstraintBlocks_SliderCrank)
+{
+	testerFactorConstraintBlocks(buildSliderCrankMBS(), {});
+}
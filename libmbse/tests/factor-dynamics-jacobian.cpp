@@ -17,6 +17,7 @@
 #include <mbse/factors/FactorDynamics.h>
 #include <mrpt/math/num_jacobian.h>
 #include <mrpt/system/CTimeLogger.h>
+#include <thread>
 
 using namespace std;
 using namespace mbse;
@@ -44,7 +45,10 @@ static void num_err_wrt_state(
 	err = p.factor->evaluateError(q, dq, ddq);
 }
 
-TEST(Jacobians, FactorDynamics)
+// The closed-form Jacobians must match finite differences of the error, with
+// the accelerations of the given solver:
+template <class DYNAMIC_SOLVER_T>
+void testFactorDynamicsJacobians()
 {
 	try
 	{
@@ -59,7 +63,7 @@ TEST(Jacobians, FactorDynamics)
 		std::shared_ptr<CAssembledRigidModel> aMBS = model.assembleRigidMBS();
 		aMBS->setGravityVector(0, -9.81, 0);
 
-		CDynamicSimulator_R_matrix_dense dynSimul(aMBS);
+		DYNAMIC_SOLVER_T dynSimul(aMBS);
 		// Must be called before solve_ddotq():
 		dynSimul.prepare();
 
@@ -151,3 +155,87 @@ TEST(Jacobians, FactorDynamics)
 		throw std::runtime_error(mrpt::exception_to_str(e));
 	}
 }
+
+TEST(Jacobians, FactorDynamics)
+{
+	testFactorDynamicsJacobians<CDynamicSimulator_R_matrix_dense>();
+}
+TEST(Jacobians, FactorDynamics_Lagrange_LU_dense)
+{
+	testFactorDynamicsJacobians<CDynamicSimulator_Lagrange_LU_dense>();
+}
+TEST(Jacobians, FactorDynamics_Lagrange_KLU)
+{
+	testFactorDynamicsJacobians<CDynamicSimulator_Lagrange_KLU>();
+}
+TEST(Jacobians, FactorDynamics_Lagrange_UMFPACK)
+{
+	testFactorDynamicsJacobians<CDynamicSimulator_Lagrange_UMFPACK>();
+}
+
+// Penalty formulations only approximate the accelerations differentiated in
+// closed form: they must refuse to linearize.
+TEST(Jacobians, FactorDynamics_PenaltyThrows)
+{
+	using gtsam::symbol_shorthand::A;
+	using gtsam::symbol_shorthand::Q;
+	using gtsam::symbol_shorthand::V;
+
+	mbse::timelog().enable(false);  // avois clutter in cout
+
+	auto aMBS = buildFourBarsMBS().assembleRigidMBS();
+	CDynamicSimulator_AugmentedLagrangian_Dense dynSimul(aMBS);
+	dynSimul.prepare();
+
+	const auto n = aMBS->q_.size();
+	FactorDynamics factorDyn(
+		&dynSimul, gtsam::noiseModel::Isotropic::Sigma(n, 0.1), Q(1), V(1),
+		A(1));
+
+	const state_t q(aMBS->q_), dotq(aMBS->dotq_), ddotq(aMBS->ddotq_);
+	gtsam::Matrix H[3];
+	EXPECT_NO_THROW(factorDyn.evaluateError(q, dotq, ddotq));
+	EXPECT_ANY_THROW(factorDyn.evaluateError(q, dotq, ddotq, H[0], H[1], H[2]));
+}
+
+// Factors of the same simulator sharing their per-thread copies must only
+// clone it once per thread, not once per factor and thread:
+TEST(PerThreadCopies, SharedByFactors)
+{
+	using gtsam::symbol_shorthand::A;
+	using gtsam::symbol_shorthand::Q;
+	using gtsam::symbol_shorthand::V;
+
+	mbse::timelog().enable(false);  // avois clutter in cout
+
+	auto aMBS = mbse::buildFourBarsMBS().assembleRigidMBS();
+	aMBS->setGravityVector(0, -9.81, 0);
+
+	CDynamicSimulator_R_matrix_dense dynSimul(aMBS);
+	dynSimul.prepare();
+
+	const auto n = aMBS->q_.size();
+	auto noise_dyn = gtsam::noiseModel::Isotropic::Sigma(n, 0.1);
+
+	const auto solvers = makePerThreadCopies(&dynSimul);
+	const size_t nFactors = 5;
+	std::vector<FactorDynamics::shared_ptr> factors;
+	for (size_t k = 0; k < nFactors; k++)
+		factors.push_back(boost::make_shared<FactorDynamics>(
+			&dynSimul, noise_dyn, Q(k), V(k), A(k), solvers));
+
+	const state_t q = state_t(aMBS->q_);
+	const state_t dotq = state_t(aMBS->dotq_);
+	const state_t ddotq = state_t(aMBS->ddotq_);
+
+	const size_t nThreads = 2;
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < nThreads; i++)
+		threads.emplace_back([&]() {
+			mbse::timelog().enable(false);
+			for (const auto& f : factors) f->evaluateError(q, dotq, ddotq);
+		});
+	for (auto& t : threads) t.join();
+
+	EXPECT_EQ(solvers->copyCount(), nThreads);
+}
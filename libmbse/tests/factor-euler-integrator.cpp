@@ -13,6 +13,7 @@
 #include <gtest/gtest.h>
 
 #include <mbse/factors/FactorEulerInt.h>
+#include <mbse/factors/FactorEulerIntFixed.h>
 #include <gtsam/inference/Symbol.h>
 #include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
 #include <gtsam/nonlinear/NonlinearFactorGraph.h>
@@ -126,3 +127,35 @@ TEST(FactorEulerInt, Jacobian)
 	EXPECT_CORRECT_FACTOR_JACOBIANS(
 		factor, values, 1e-7 /*diff*/, 1e-6 /*tolerance*/);
 }
+
+TEST(FactorEulerIntFixed, JacobianAndError)
+{
+#define EXPECT ASSERT_
+	const std::string name_ = "FactorEulerIntFixed";
+
+	using gtsam::symbol_shorthand::V;
+	using gtsam::symbol_shorthand::X;
+	using namespace mbse;
+
+	auto noise = gtsam::noiseModel::Diagonal::Sigmas(gtsam::Vector2(1, 1));
+	const double dt = 1e-3;
+
+	FactorEulerIntFixed<2> factor(dt, noise, X(1), X(2), V(1));
+
+	const state_fixed_t<2> x1(1.0, 2.0), x2(3.0, 4.0), v1(5.0, 6.0);
+
+	gtsam::Values values;
+	values.insert(X(1), x1);
+	values.insert(X(2), x2);
+	values.insert(V(1), v1);
+
+	EXPECT_CORRECT_FACTOR_JACOBIANS(
+		factor, values, 1e-7 /*diff*/, 1e-6 /*tolerance*/);
+
+	// Same error than the dynamic-size factor:
+	FactorEulerInt factorDyn(dt, noise, X(1), X(2), V(1));
+	const gtsam::Vector err = factor.evaluateError(x1, x2, v1);
+	const gtsam::Vector errDyn = factorDyn.evaluateError(
+		gtsam::Vector(x1), gtsam::Vector(x2), gtsam::Vector(v1));
+	EXPECT_NEAR((err - errDyn).norm(), 0, 1e-15);
+}
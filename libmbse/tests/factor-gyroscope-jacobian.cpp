@@ -70,12 +70,13 @@ TEST(Jacobians, gyroscope)
 	// The "actual sensor" observation: useless in this particular test:
 	double dummy_sensor_observation = .0;
 
-	// Add a gyro for each bar:
+	// Add a gyro for each bar, all of them sharing the copies of the model:
+	const auto arms = makePerThreadCopies(aMBS);
 	FactorGyroscope::shared_ptr factorsGyro[3];
 	for (unsigned int body_idx = 0; body_idx < 3; body_idx++)
 	{
 		factorsGyro[body_idx] = boost::make_shared<FactorGyroscope>(
-			*aMBS, body_idx, dummy_sensor_observation, noise_gyro, Q(1), V(1));
+			arms, body_idx, dummy_sensor_observation, noise_gyro, Q(1), V(1));
 	}
 
 	// For different instants of time and mechanism positions and velocities,
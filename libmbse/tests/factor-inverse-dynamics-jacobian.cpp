@@ -0,0 +1,162 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#include <gtest/gtest.h>
+
+#include <mbse/model-examples.h>
+#include <mbse/dynamics/dynamic-simulators.h>
+#include <mbse/CAssembledRigidModel.h>
+#include <gtsam/inference/Symbol.h>
+#include <mbse/factors/FactorInverseDynamics.h>
+#include <mrpt/math/num_jacobian.h>
+#include <mrpt/system/CTimeLogger.h>
+
+using namespace std;
+using namespace mbse;
+
+struct NumericJacobParams
+{
+	gtsam::Vector q, dq, ddq, Q;
+
+	/** Especifies which variable are we taking numerical derivatives with
+	 * respect to: 0: q, 1: \dot{q}, 2: \ddot{q}, 3: Q
+	 */
+	int diff_variable = 0;
+	FactorInverseDynamics* factor = nullptr;
+};
+
+static void num_err_wrt_state(
+	const gtsam::Vector& new_state, const NumericJacobParams& p,
+	gtsam::Vector& err)
+{
+	auto q = state_t(p.diff_variable == 0 ? new_state : p.q);
+	auto dq = state_t(p.diff_variable == 1 ? new_state : p.dq);
+	auto ddq = state_t(p.diff_variable == 2 ? new_state : p.ddq);
+	auto Q = state_t(p.diff_variable == 3 ? new_state : p.Q);
+
+	// Evaluate error:
+	err = p.factor->evaluateError(q, dq, ddq, Q);
+}
+
+TEST(Jacobians, FactorInverseDynamics)
+{
+	try
+	{
+		using gtsam::symbol_shorthand::A;
+		using gtsam::symbol_shorthand::F;
+		using gtsam::symbol_shorthand::Q;
+		using gtsam::symbol_shorthand::V;
+		using namespace mbse;
+
+		// Create the multibody object:
+		const CModelDefinition model = mbse::buildFourBarsMBS();
+
+		std::shared_ptr<CAssembledRigidModel> aMBS = model.assembleRigidMBS();
+		aMBS->setGravityVector(0, -9.81, 0);
+
+		CDynamicSimulator_Lagrange_LU_dense dynSimul(aMBS);
+		// Must be called before solve_ddotq():
+		dynSimul.prepare();
+
+		// Add factors:
+		// Create factor noises:
+		const auto n = aMBS->q_.size();
+		// const auto m = aMBS->Phi_q_.getNumRows();
+
+		auto noise_dyn = gtsam::noiseModel::Isotropic::Sigma(n, 0.1);
+
+		// Create a dummy factor:
+		auto factorDyn = boost::make_shared<FactorInverseDynamics>(
+			&dynSimul, noise_dyn, Q(1), V(1), A(1), F(1));
+
+		// For different instants of time and mechanism positions and
+		// velocities, test the factor jacobian:
+		const double t_end = 3.0;  // end simulation time
+		const double t_steps = 1.0;  // "large steps" to run the tests at
+
+		dynSimul.params.time_step = 0.001;  // integrators timesteps
+
+		mrpt::system::CTimeLogger timlog;
+		timlog.enable(false);
+
+		for (double t = 0; t < t_end;)
+		{
+			const double t_next = t + t_steps;
+			dynSimul.run(t, t_next);
+			t = t_next;
+
+			std::cout << "Evaluating test for t=" << t << "\n";
+			std::cout << "q  =" << aMBS->q_.transpose() << "\n";
+			std::cout << "dq =" << aMBS->dotq_.transpose() << "\n";
+			std::cout << "ddq =" << aMBS->ddotq_.transpose() << "\n";
+
+			// Convert plain Eigen vectors into state_t classes (used as Values
+			// in GTSAM factor graphs):
+			const state_t q = state_t(aMBS->q_);
+			const state_t dotq = state_t(aMBS->dotq_);
+			const state_t ddotq = state_t(aMBS->ddotq_);
+			// Some external forces:
+			Eigen::VectorXd Qext(n);
+			for (int i = 0; i < n; i++) Qext[i] = std::sin(t + i);
+			const state_t Qk = state_t(Qext);
+
+			// Evaluate theoretical Jacobians:
+			gtsam::Matrix H[4];
+			timlog.enter("factorsDyn.theoretical_jacob");
+
+			factorDyn->evaluateError(
+				q, dotq, ddotq, Qk, H[0], H[1], H[2], H[3]);
+
+			timlog.leave("factorsDyn.theoretical_jacob");
+
+			// Evaluate numerical Jacobians:
+			gtsam::Matrix H_num[4];
+
+			timlog.enter("factorsDyn.numeric_jacob");
+			for (int i = 0; i < 4; i++)
+			{
+				NumericJacobParams p;
+				p.q = q;
+				p.dq = dotq;
+				p.ddq = ddotq;
+				p.Q = Qk;
+				p.diff_variable = i;
+				p.factor = factorDyn.get();
+
+				const gtsam::Vector& x =
+					i == 0 ? p.q : (i == 1 ? p.dq : (i == 2 ? p.ddq : p.Q));
+				const gtsam::Vector x_incr =
+					Eigen::VectorXd::Constant(x.rows(), x.cols(), 1e-9);
+
+				mrpt::math::estimateJacobian(
+					x,
+					std::function<void(
+						const gtsam::Vector& new_q, const NumericJacobParams& p,
+						gtsam::Vector& err)>(&num_err_wrt_state),
+					x_incr, p, H_num[i]);
+
+				// Check:
+				EXPECT_NEAR(
+					(H[i] - H_num[i]).array().abs().maxCoeff(), 0.0, 1e-2)
+					<< "H[" << i << "] Theoretical:\n"
+					<< H[i]
+					<< "\n"
+					   "H_num["
+					<< i << "] Numerical:\n"
+					<< H_num[i] << "\n";
+			}
+			timlog.leave("factorsDyn.numeric_jacob");
+		}
+	}
+	catch (const std::exception& e)
+	{
+		throw std::runtime_error(mrpt::exception_to_str(e));
+	}
+}
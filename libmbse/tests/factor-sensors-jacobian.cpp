@@ -0,0 +1,160 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+#include <gtest/gtest.h>
+
+#include <mbse/model-examples.h>
+#include <mbse/dynamics/dynamic-simulators.h>
+#include <mbse/CAssembledRigidModel.h>
+#include <gtsam/inference/Symbol.h>
+#include <mbse/factors/FactorAccelerometer.h>
+#include <mbse/factors/FactorEncoder.h>
+#include <mbse/factors/FactorPointTracker.h>
+#include <mrpt/math/num_jacobian.h>
+
+using namespace std;
+using namespace mbse;
+
+using gtsam::symbol_shorthand::A;
+using gtsam::symbol_shorthand::Q;
+
+namespace
+{
+/** Numeric Jacobian of `err(x)` around `x` */
+gtsam::Matrix numJacobian(
+	const gtsam::Vector& x,
+	const std::function<gtsam::Vector(const gtsam::Vector&)>& err)
+{
+	using func_t = std::function<void(
+		const gtsam::Vector&, const int&, gtsam::Vector&)>;
+
+	const gtsam::Vector x_incr = Eigen::VectorXd::Constant(x.size(), 1e-7);
+
+	gtsam::Matrix H;
+	mrpt::math::estimateJacobian(
+		x,
+		func_t([&](const gtsam::Vector& new_x, const int&,
+				   gtsam::Vector& out) { out = err(new_x); }),
+		x_incr, 0, H);
+	return H;
+}
+
+void expectNearJacobians(const gtsam::Matrix& H, const gtsam::Matrix& H_num)
+{
+	EXPECT_NEAR((H - H_num).array().abs().maxCoeff(), 0.0, 1e-5)
+		<< "Theoretical:\n"
+		<< H << "\nNumerical:\n"
+		<< H_num << "\n";
+}
+
+/** States along a simulation of the four bars linkage */
+template <class FUNCTOR>
+void forEachState(FUNCTOR f)
+{
+	const CModelDefinition model = mbse::buildFourBarsMBS();
+	std::shared_ptr<CAssembledRigidModel> aMBS = model.assembleRigidMBS();
+	aMBS->setGravityVector(0, -9.81, 0);
+
+	CDynamicSimulator_Lagrange_LU_dense dynSimul(aMBS);
+	dynSimul.params.ode_solver = ODE_RK4;
+	dynSimul.params.time_step = 0.001;
+	dynSimul.prepare();
+
+	for (double t = 0; t < 2.0; t += 0.25)
+	{
+		dynSimul.run(t, t + 0.25);
+		f(*aMBS);
+	}
+}
+}  // namespace
+
+TEST(Jacobians, encoder)
+{
+	auto noise = gtsam::noiseModel::Isotropic::Sigma(1, 0.01);
+
+	forEachState([&](const CAssembledRigidModel& arm) {
+		// Absolute (body with a fixed point) and relative (at a joint):
+		const std::shared_ptr<const CVirtualSensor_Encoder> sensors[] = {
+			std::make_shared<CVirtualSensor_Encoder>(arm, 0),
+			std::make_shared<CVirtualSensor_Encoder>(arm, 1),
+			std::make_shared<CVirtualSensor_Encoder>(arm, 1, 2)};
+
+		const state_t q = state_t(arm.q_);
+		for (const auto& sensor : sensors)
+		{
+			FactorEncoder f(sensor, 0.1, noise, Q(1));
+
+			gtsam::Matrix H;
+			f.evaluateError(q, H);
+			expectNearJacobians(
+				H, numJacobian(q, [&](const gtsam::Vector& x) {
+					return f.evaluateError(x);
+				}));
+		}
+	});
+}
+
+TEST(Jacobians, accelerometer)
+{
+	auto noise = gtsam::noiseModel::Isotropic::Sigma(1, 0.1);
+
+	forEachState([&](const CAssembledRigidModel& arm) {
+		// Points on the body or not, along and normal to its axis:
+		const std::shared_ptr<const CVirtualSensor_Accelerometer> sensors[] = {
+			std::make_shared<CVirtualSensor_Accelerometer>(arm, 1, 0, 0),
+			std::make_shared<CVirtualSensor_Accelerometer>(arm, 1, 0, 1),
+			std::make_shared<CVirtualSensor_Accelerometer>(arm, 2, 1, 0),
+			std::make_shared<CVirtualSensor_Accelerometer>(arm, 1, 2, 1)};
+
+		const state_t q = state_t(arm.q_);
+		const state_t ddq = state_t(arm.ddotq_);
+		for (const auto& sensor : sensors)
+		{
+			FactorAccelerometer f(sensor, 1.0, noise, Q(1), A(1));
+
+			gtsam::Matrix H[2];
+			f.evaluateError(q, ddq, H[0], H[1]);
+			expectNearJacobians(
+				H[0], numJacobian(q, [&](const gtsam::Vector& x) {
+					return f.evaluateError(x, ddq);
+				}));
+			expectNearJacobians(
+				H[1], numJacobian(ddq, [&](const gtsam::Vector& x) {
+					return f.evaluateError(q, x);
+				}));
+		}
+	});
+}
+
+TEST(Jacobians, pointTracker)
+{
+	auto noise = gtsam::noiseModel::Isotropic::Sigma(1, 0.01);
+
+	forEachState([&](const CAssembledRigidModel& arm) {
+		const state_t q = state_t(arm.q_);
+		for (size_t pt = 0; pt < 4; pt++)
+		{
+			for (int axis = 0; axis < 2; axis++)
+			{
+				FactorPointTracker f(
+					std::make_shared<CVirtualSensor_PointTracker>(
+						arm, pt, axis),
+					0.5, noise, Q(1));
+
+				gtsam::Matrix H;
+				f.evaluateError(q, H);
+				expectNearJacobians(
+					H, numJacobian(q, [&](const gtsam::Vector& x) {
+						return f.evaluateError(x);
+					}));
+			}
+		}
+	});
+}
@@ -0,0 +1,271 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+
+#include <gtest/gtest.h>
+
+#include <mbse/CMultiBodyParticleFilter.h>
+#include <mbse/model-examples.h>
+
+using namespace mbse;
+
+// Runs a few PF steps with the given seed, returning the final coordinates of
+// all particles.
+static std::vector<Eigen::VectorXd> runPF(
+	bool parallel, size_t grainSize,
+	const std::string& simulator = "CDynamicSimulator_Indep_dense",
+	ODE_integrator_t integrator = ODE_RK4, double noise = 0.1)
+{
+	timelog().enable(false);  // avois clutter in cout
+
+	const size_t M = 50;
+	CMultiBodyParticleFilter pf(M, buildFourBarsMBS(), simulator);
+	pf.model_options.acc_xy_noise_std = noise;
+	pf.model_options.ode_solver = integrator;
+	pf.parallel_params.enabled = parallel;
+	pf.parallel_params.grain_size = grainSize;
+	pf.random_generator.randomize(1234);
+
+	const std::vector<CVirtualSensor::Ptr> sensors;
+	const std::vector<double> readings;
+	CMultiBodyParticleFilter::TOutputInfo info;
+	for (int k = 0; k < 3; k++)
+		pf.run_PF_step(k * 0.01, (k + 1) * 0.01, 5e-3, sensors, readings, info);
+
+	std::vector<Eigen::VectorXd> qs;
+	for (const auto& p : pf.m_particles) qs.push_back(p.d->q);
+	return qs;
+}
+
+TEST(ParticleFilter, ParallelIsReproducible)
+{
+	const auto qSerial = runPF(false, 1);
+
+	// Noise must differ between particles:
+	EXPECT_GT((qSerial[0] - qSerial[1]).norm(), 0);
+
+	for (size_t grain : {1, 7, 64})
+	{
+		const auto qPar = runPF(true, grain);
+		ASSERT_EQ(qPar.size(), qSerial.size());
+		for (size_t i = 0; i < qPar.size(); i++)
+			EXPECT_EQ(qPar[i], qSerial[i]) << "particle #" << i;
+	}
+}
+
+// The first step of a new filter must already run in parallel safely: the
+// simulator of each worker must not be cloned from the prototype while the
+// calling thread integrates with it.
+TEST(ParticleFilter, ParallelFirstStepOfNewFilter)
+{
+	const auto qSerial = runPF(false, 1);
+	for (int rep = 0; rep < 10; rep++)
+	{
+		const auto qPar = runPF(true, 1);
+		ASSERT_EQ(qPar.size(), qSerial.size());
+		for (size_t i = 0; i < qPar.size(); i++)
+			EXPECT_EQ(qPar[i], qSerial[i]) << "particle #" << i;
+	}
+}
+
+// Sensor likelihoods are evaluated in chunks of particles: weights must not
+// depend on how particles are split:
+static std::vector<double> runPFWeights(bool parallel, size_t grainSize)
+{
+	timelog().enable(false);  // avois clutter in cout
+
+	const size_t M = 50;
+	CMultiBodyParticleFilter pf(M, buildFourBarsMBS());
+	pf.model_options.acc_xy_noise_std = 0.1;
+	pf.parallel_params.enabled = parallel;
+	pf.parallel_params.grain_size = grainSize;
+	pf.resampling_params.ess_threshold = 0;  // keep the weights
+	pf.random_generator.randomize(1234);
+
+	const std::vector<CVirtualSensor::Ptr> sensors = {
+		std::make_shared<CVirtualSensor_Gyro>(1),
+		std::make_shared<CVirtualSensor_Accelerometer>(pf.model(), 1, 0, 0)};
+	const std::vector<double> readings = {0.1, 0};
+	CMultiBodyParticleFilter::TOutputInfo info;
+	pf.run_PF_step(0, 0.01, 5e-3, sensors, readings, info);
+
+	std::vector<double> log_w;
+	for (const auto& p : pf.m_particles) log_w.push_back(p.log_w);
+	return log_w;
+}
+
+TEST(ParticleFilter, ParallelLikelihoodsAreReproducible)
+{
+	const auto wSerial = runPFWeights(false, 1);
+
+	// Weights must differ between particles:
+	EXPECT_NE(wSerial[0], wSerial[1]);
+
+	for (size_t grain : {1, 7, 64})
+	{
+		const auto wPar = runPFWeights(true, grain);
+		ASSERT_EQ(wPar.size(), wSerial.size());
+		for (size_t i = 0; i < wPar.size(); i++)
+			EXPECT_DOUBLE_EQ(wPar[i], wSerial[i]) << "particle #" << i;
+	}
+}
+
+// Without noise, all particles follow the dynamics of the model, whatever
+// the simulator class:
+TEST(ParticleFilter, SimulatorAndIntegrator)
+{
+	const auto qRef =
+		runPF(false, 1, "CDynamicSimulator_Indep_dense", ODE_RK4, 0);
+	const auto q0 = buildFourBarsMBS().assembleRigidMBS()->q_;
+	EXPECT_GT((qRef[0] - q0).norm(), 1e-4);
+
+	for (const auto integrator : {ODE_RK4, ODE_Euler})
+	{
+		// Euler must be close to RK4, for such small time steps:
+		const double tol = integrator == ODE_RK4 ? 1e-8 : 5e-3;
+		for (const std::string simul : {"CDynamicSimulator_Indep_dense",
+										"CDynamicSimulator_Indep_sparse"})
+		{
+			const auto q = runPF(true, 8, simul, integrator, 0);
+			ASSERT_EQ(q.size(), qRef.size());
+			for (size_t i = 0; i < q.size(); i++)
+				EXPECT_NEAR((q[i] - qRef[0]).norm(), 0, tol)
+					<< simul << " integrator: " << integrator << "\n"
+					<< "q    : " << q[i].transpose() << "\n"
+					<< "q_ref: " << qRef[0].transpose() << "\n";
+		}
+	}
+}
+
+TEST(ParticleFilter, RejectsDependentCoordsSimulator)
+{
+	EXPECT_ANY_THROW(CMultiBodyParticleFilter(
+		2, buildFourBarsMBS(), "CDynamicSimulator_Lagrange_LU_dense"));
+}
+
+// Particles carry their accelerations at the end of each step when a sensor
+// needs them, in agreement with the dynamics of their state.
+TEST(ParticleFilter, AccelerationsForSensors)
+{
+	timelog().enable(false);  // avois clutter in cout
+
+	const size_t M = 5;
+	CMultiBodyParticleFilter pf(M, buildFourBarsMBS());
+	pf.model_options.acc_xy_noise_std = 0.1;
+
+	const std::vector<CVirtualSensor::Ptr> sensors = {
+		std::make_shared<CVirtualSensor_Accelerometer>(pf.model(), 1, 0, 0)};
+	const std::vector<double> readings = {0};
+	CMultiBodyParticleFilter::TOutputInfo info;
+	pf.run_PF_step(0, 0.01, 5e-3, sensors, readings, info);
+
+	auto arm = pf.model().cloneTopology();
+	CDynamicSimulator_Lagrange_LU_dense simul(arm);
+	simul.prepare();
+	for (size_t i = 0; i < M; i++)
+	{
+		const auto& ddq = pf.m_particles[i].d->ddotq;
+		ASSERT_EQ(ddq.size(), arm->q_.size());
+
+		pf.loadParticle(i, *arm);
+		Eigen::VectorXd ddq_ref;
+		simul.solve_ddotq(0.01, ddq_ref);
+		EXPECT_NEAR((ddq - ddq_ref).norm(), 0, 1e-6) << "particle #" << i;
+	}
+}
+
+// Particles are plain states over the shared model: resampling just copies
+// them, and does not touch the model.
+TEST(ParticleFilter, ResamplingCopiesStates)
+{
+	timelog().enable(false);  // avois clutter in cout
+
+	const size_t M = 20;
+	CMultiBodyParticleFilter pf(M, buildFourBarsMBS());
+	auto& arm = pf.model();
+	const Eigen::VectorXd q0 = arm.q_;
+
+	std::vector<Eigen::VectorXd> qs;
+	for (size_t i = 0; i < M; i++)
+	{
+		arm.q_ = q0 + Eigen::VectorXd::Constant(q0.size(), 0.01 * i);
+		pf.storeParticle(i, arm);
+		qs.push_back(arm.q_);
+		// Most weight in the first particles:
+		pf.m_particles[i].log_w = -double(i);
+	}
+	arm.q_ = q0;
+	pf.resample();
+
+	ASSERT_EQ(pf.m_particles.size(), M);
+	for (size_t i = 0; i < M; i++)
+	{
+		const auto& q = pf.m_particles[i].d->q;
+		EXPECT_TRUE(std::find(qs.begin(), qs.end(), q) != qs.end())
+			<< "particle #" << i;
+
+		pf.loadParticle(i, arm);
+		EXPECT_EQ(arm.q_, q);
+		EXPECT_EQ(pf.m_particles[i].log_w, 0);
+	}
+	// The particle with most weight is kept in its slot:
+	EXPECT_EQ(pf.m_particles[0].d->q, qs[0]);
+}
+
+TEST(ParticleFilter, ResamplingCounts)
+{
+	using method_t = CMultiBodyParticleFilter::ResamplingMethod;
+
+	mrpt::random::CRandomGenerator rng(1234);
+	const size_t M = 1000;
+	std::vector<double> w(M);
+	double sum = 0;
+	for (auto& wi : w) sum += (wi = rng.drawUniform(0, 1));
+	for (auto& wi : w) wi /= sum;
+
+	for (const auto method :
+		 {method_t::Systematic, method_t::Stratified, method_t::Residual})
+	{
+		std::vector<size_t> counts;
+		CMultiBodyParticleFilter::resamplingCounts(method, w, rng, counts);
+		ASSERT_EQ(counts.size(), M);
+
+		size_t total = 0;
+		for (const size_t c : counts) total += c;
+		EXPECT_EQ(total, M);
+
+		// Low variance methods: the number of copies of each particle is
+		// M*w rounded either up or down.
+		if (method == method_t::Stratified) continue;
+		for (size_t i = 0; i < M; i++)
+		{
+			EXPECT_GE(counts[i], static_cast<size_t>(std::floor(M * w[i])));
+			EXPECT_LE(counts[i], static_cast<size_t>(std::ceil(M * w[i])));
+		}
+	}
+}
+
+// Stratified resampling draws exactly one uniform number per particle, so
+// the stream of random numbers is the same than drawing them by hand:
+TEST(ParticleFilter, StratifiedDrawsOneNumberPerParticle)
+{
+	using method_t = CMultiBodyParticleFilter::ResamplingMethod;
+
+	const size_t M = 50;
+	const std::vector<double> w(M, 1.0 / M);
+
+	mrpt::random::CRandomGenerator rng1(4321), rng2(4321);
+	std::vector<size_t> counts;
+	CMultiBodyParticleFilter::resamplingCounts(
+		method_t::Stratified, w, rng1, counts);
+	for (size_t j = 0; j < M; j++) rng2.drawUniform(0, 1);
+
+	EXPECT_EQ(rng1.drawUniform(0, 1), rng2.drawUniform(0, 1));
+}
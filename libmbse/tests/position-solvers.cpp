@@ -0,0 +1,183 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+
+#include <gtest/gtest.h>
+
+#include <mbse/constraints/CConstraintConstantDistance.h>
+#include <mbse/mbse.h>
+#include <mbse/model-examples.h>
+#include <cmath>
+
+using namespace mbse;
+using PositionSolver = CAssembledRigidModel::PositionSolver;
+
+// Picks independent coordinates from the pivots of a full LU of Phi_q
+static std::vector<size_t> pickIndependentCoords(
+	const CAssembledRigidModel& arm)
+{
+	const size_t n = arm.q_.size();
+	const Eigen::FullPivLU<Eigen::MatrixXd> lu(arm.Phi_q_.asDense());
+	const size_t nDOFs = n - lu.rank();
+	std::vector<size_t> z_indices;
+	for (size_t i = 0; i < nDOFs; i++)
+		z_indices.push_back(lu.permutationQ().indices()[n - nDOFs + i]);
+	return z_indices;
+}
+
+// Perturbs an assembled model, then solves its position, velocity and
+// acceleration problems with the dense and sparse position solvers, which
+// must both satisfy the constraints and agree on the dependent coordinates.
+static void testerPositionSolvers(const CModelDefinition& model)
+{
+	timelog().enable(false);  // avois clutter in cout
+
+	auto armD = model.assembleRigidMBS();
+	auto armS = model.assembleRigidMBS();
+	armD->position_solver = PositionSolver::DenseLU;
+	armS->position_solver = PositionSolver::SparseQR;
+
+	const size_t n = armD->q_.size();
+	for (size_t i = 0; i < n; i++)
+	{
+		armD->q_[i] += 0.01 * std::sin(1.0 + 7 * i);
+		armD->dotq_[i] = std::sin(2.0 + 3 * i);
+	}
+	armS->q_ = armD->q_;
+
+	// Initial position problem (minimum norm correction, for sparse QR):
+	EXPECT_LT(armD->refinePosition(1e-12, 20), 1e-10);
+	EXPECT_LT(armS->refinePosition(1e-12, 20), 1e-10);
+
+	const std::vector<size_t> z_indices = pickIndependentCoords(*armD);
+	const size_t nDOFs = z_indices.size();
+
+	// Finite displacement of the independent coordinates:
+	for (const size_t i : z_indices) armD->q_[i] += 0.02;
+	armS->q_ = armD->q_;
+	armS->dotq_ = armD->dotq_;
+
+	Eigen::VectorXd ddotz(nDOFs), ddotqD, ddotqS;
+	for (size_t i = 0; i < nDOFs; i++) ddotz[i] = std::cos(1.0 + i);
+
+	CAssembledRigidModel::TComputeDependentParams cdp;
+	cdp.maxPhiNorm = 1e-12;
+	cdp.nItersMax = 20;
+	CAssembledRigidModel::TComputeDependentResults cdrD, cdrS;
+	cdrD.ddotq = &ddotqD;
+	cdrS.ddotq = &ddotqS;
+	armD->computeDependentPosVelAcc(z_indices, true, true, cdp, cdrD, &ddotz);
+	armS->computeDependentPosVelAcc(z_indices, true, true, cdp, cdrS, &ddotz);
+
+	EXPECT_LT(cdrD.pos_final_phi, 1e-10);
+	EXPECT_LT(cdrS.pos_final_phi, 1e-10);
+	EXPECT_NEAR((armD->q_ - armS->q_).norm(), 0, 1e-8);
+	EXPECT_NEAR((armD->dotq_ - armS->dotq_).norm(), 0, 1e-8);
+	EXPECT_NEAR((ddotqD - ddotqS).norm(), 0, 1e-8);
+
+	// Velocities must satisfy the velocity constraints:
+	armS->update_numeric_Phi_and_Jacobians();
+	for (size_t i = 0; i < armS->Phi_q_.getNumRows(); i++)
+		EXPECT_NEAR(armS->Phi_q_.rowDot(i, armS->dotq_), 0, 1e-8);
+
+	// finiteDisplacement() must agree too:
+	for (const size_t i : z_indices) armD->q_[i] -= 0.01;
+	armS->q_ = armD->q_;
+	armD->finiteDisplacement(z_indices, 1e-12, 20, true);
+	armS->finiteDisplacement(z_indices, 1e-12, 20, true);
+	EXPECT_NEAR((armD->q_ - armS->q_).norm(), 0, 1e-8);
+	EXPECT_NEAR((armD->dotq_ - armS->dotq_).norm(), 0, 1e-8);
+}
+
+TEST(PositionSolvers, FourBars) { testerPositionSolvers(buildFourBarsMBS()); }
+
+TEST(PositionSolvers, SliderCrank)
+{
+	testerPositionSolvers(buildSliderCrankMBS());
+}
+
+TEST(PositionSolvers, LongString)
+{
+	testerPositionSolvers(buildLongStringMBS(20));
+}
+
+// Small displacements of the independent coordinates must reuse the
+// factorization of the dependent Jacobian, with accurate velocities anyway.
+TEST(PositionSolvers, ReusesFactorization)
+{
+	timelog().enable(false);  // avois clutter in cout
+
+	auto arm = buildLongStringMBS(20).assembleRigidMBS();
+	arm->refinePosition();
+	arm->update_numeric_Phi_and_Jacobians();
+	const std::vector<size_t> z_indices = pickIndependentCoords(*arm);
+
+	for (size_t i = 0; i < arm->q_.size(); i++)
+		arm->dotq_[i] = std::sin(2.0 + 3 * i);
+
+	CAssembledRigidModel::TComputeDependentParams cdp;
+	CAssembledRigidModel::TComputeDependentResults cdr;
+	arm->computeDependentPosVelAcc(z_indices, true, true, cdp, cdr);
+
+	const CCoordinatePartition& partition =
+		arm->coordinatePartition(z_indices);
+	const size_t nFactorizations = partition.factorizationCount();
+
+	for (int step = 0; step < 5; step++)
+	{
+		for (const size_t i : z_indices) arm->q_[i] += 1e-5;
+		arm->computeDependentPosVelAcc(z_indices, true, true, cdp, cdr);
+
+		EXPECT_LT(cdr.pos_final_phi, 1e-10);
+		for (size_t i = 0; i < arm->Phi_q_.getNumRows(); i++)
+			EXPECT_NEAR(arm->Phi_q_.rowDot(i, arm->dotq_), 0, 1e-9);
+	}
+	EXPECT_EQ(partition.factorizationCount(), nFactorizations);
+}
+
+// With redundant constraints, Phi_d has more rows than columns: solves with
+// an older factorization must still give exact velocities.
+TEST(PositionSolvers, RedundantConstraints)
+{
+	timelog().enable(false);  // avois clutter in cout
+
+	// The length of the coupler, already enforced by its body:
+	CModelDefinition model = buildFourBarsMBS();
+	model.addConstraint(CConstraintConstantDistance(1, 2, 2.0));
+
+	for (const auto solver : {PositionSolver::DenseLU, PositionSolver::SparseQR})
+	{
+		auto arm = model.assembleRigidMBS();
+		arm->position_solver = solver;
+		arm->refinePosition();
+		arm->update_numeric_Phi_and_Jacobians();
+		const std::vector<size_t> z_indices = pickIndependentCoords(*arm);
+		ASSERT_GT(
+			arm->Phi_q_.getNumRows(),
+			static_cast<size_t>(arm->q_.size()) - z_indices.size());
+
+		for (size_t i = 0; i < arm->q_.size(); i++)
+			arm->dotq_[i] = std::sin(2.0 + 3 * i);
+
+		CAssembledRigidModel::TComputeDependentParams cdp;
+		CAssembledRigidModel::TComputeDependentResults cdr;
+		arm->computeDependentPosVelAcc(z_indices, true, true, cdp, cdr);
+
+		for (int step = 0; step < 5; step++)
+		{
+			for (const size_t i : z_indices) arm->q_[i] += 1e-5;
+			arm->computeDependentPosVelAcc(z_indices, true, true, cdp, cdr);
+
+			EXPECT_LT(cdr.pos_final_phi, 1e-10);
+			for (size_t i = 0; i < arm->Phi_q_.getNumRows(); i++)
+				EXPECT_NEAR(arm->Phi_q_.rowDot(i, arm->dotq_), 0, 1e-9);
+		}
+	}
+}
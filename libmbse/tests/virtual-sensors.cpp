@@ -0,0 +1,152 @@
+/*+-------------------------------------------------------------------------+
+  |            Multi Body State Estimation (mbse) C++ library               |
+  |                                                                         |
+  | Copyright (C) 2014-2020 University of Almeria                           |
+  | Copyright (C) 2020 University of Salento                                |
+  | See README for list of authors and papers                               |
+  | Distributed under 3-clause BSD license                                  |
+  |  See: <https://opensource.org/licenses/BSD-3-Clause>                    |
+  +-------------------------------------------------------------------------+ */
+
+
+#include <gtest/gtest.h>
+
+#include <mbse/mbse.h>
+#include <mbse/model-examples.h>
+#include <mbse/virtual-sensors.h>
+#include <thread>
+
+using namespace mbse;
+
+namespace
+{
+// A sensor without batch evaluation, to test the default implementation:
+class SensorPointX : public CVirtualSensor
+{
+   public:
+	double simulate_reading(const CAssembledRigidModel& arm) const override
+	{
+		mrpt::math::TPoint2D pt;
+		arm.getPointCurrentCoords(1, pt);
+		return pt.x;
+	}
+};
+}  // namespace
+
+// Batch readings and likelihoods must match those evaluated state by state
+TEST(VirtualSensors, BatchMatchesSingle)
+{
+	timelog().enable(false);  // avois clutter in cout
+
+	const size_t N = 10;
+	auto arm = buildFourBarsMBS().assembleRigidMBS();
+
+	CDynamicSimulator_Lagrange_LU_dense dynSimul(arm);
+	dynSimul.params.ode_solver = ODE_RK4;
+	dynSimul.prepare();
+
+	auto batch = std::make_shared<CAssembledRigidModelBatch>(arm, N);
+	std::vector<Eigen::VectorXd> qs, dqs, ddqs;
+	for (size_t k = 0; k < N; k++)
+	{
+		dynSimul.run(k * 0.05, (k + 1) * 0.05);
+		batch->setStateFrom(k, *arm);
+		qs.push_back(arm->q_);
+		dqs.push_back(arm->dotq_);
+		ddqs.push_back(arm->ddotq_);
+	}
+
+	// Bodies 0 and 2 have one fixed point each:
+	std::vector<CVirtualSensor::Ptr> sensors = {
+		std::make_shared<CVirtualSensor_Gyro>(0),
+		std::make_shared<CVirtualSensor_Gyro>(1),
+		std::make_shared<SensorPointX>(),
+		std::make_shared<CVirtualSensor_Encoder>(*arm, 0),
+		std::make_shared<CVirtualSensor_Encoder>(*arm, 0, 1),
+		std::make_shared<CVirtualSensor_Accelerometer>(*arm, 1, 0, 0),
+		std::make_shared<CVirtualSensor_Accelerometer>(*arm, 2, 1, 1),
+		std::make_shared<CVirtualSensor_PointTracker>(*arm, 1, 0),
+		std::make_shared<CVirtualSensor_PointTracker>(*arm, 2, 1)};
+	sensors[0]->sensor_noise_std = 0.1;
+
+	const double reading = 0.3;
+	for (const auto& s : sensors)
+	{
+		Eigen::VectorXd readings, logLiks;
+		s->simulate_readings(*batch, readings);
+		s->log_likelihoods(reading, *batch, logLiks);
+		ASSERT_EQ(readings.size(), static_cast<Eigen::Index>(N));
+		ASSERT_EQ(logLiks.size(), static_cast<Eigen::Index>(N));
+
+		for (size_t k = 0; k < N; k++)
+		{
+			arm->q_ = qs[k];
+			arm->dotq_ = dqs[k];
+			arm->ddotq_ = ddqs[k];
+			EXPECT_NEAR(readings[k], s->simulate_reading(*arm), 1e-12);
+			EXPECT_NEAR(
+				logLiks[k], s->evaluate_log_likelihood(reading, *arm), 1e-9);
+		}
+	}
+}
+
+// Encoder differences wrap around +-pi, in both the single and batch forms
+TEST(VirtualSensors, EncoderWrapsAngles)
+{
+	auto arm = buildFourBarsMBS().assembleRigidMBS();
+
+	// Turn the first bar (from the fixed point 0 to point 1) to -x, slightly
+	// below the axis, so its angle is just above -pi:
+	const auto& pt1 = arm->getPoints2DOFs()[1];
+	arm->q_[pt1.dof_x] = -1;
+	arm->q_[pt1.dof_y] = -1e-3;
+	auto batch = std::make_shared<CAssembledRigidModelBatch>(arm, 1);
+
+	CVirtualSensor_Encoder enc(*arm, 0);
+	const double ang = enc.simulate_reading(*arm);
+	EXPECT_NEAR(ang, -M_PI + 1e-3, 1e-6);
+
+	// A reading just below +pi:
+	const double reading = ang + 2 * M_PI - 0.01;
+	EXPECT_NEAR(enc.reading_error(reading, ang), -0.01, 1e-12);
+
+	Eigen::VectorXd logLik;
+	enc.log_likelihoods(reading, *batch, logLik);
+	EXPECT_NEAR(logLik[0], enc.evaluate_log_likelihood(reading, *arm), 1e-12);
+	EXPECT_NEAR(logLik[0], -0.5 * 0.01 * 0.01, 1e-12);
+}
+
+// The default batch evaluation keeps one model per thread: it must give the
+// right readings when called from several threads, and when the states come
+// from another model.
+TEST(VirtualSensors, DefaultBatchFromThreadsAndModels)
+{
+	timelog().enable(false);  // avois clutter in cout
+
+	const SensorPointX sensor;
+	const size_t N = 5;
+
+	for (const auto& model : {buildFourBarsMBS(), buildSliderCrankMBS()})
+	{
+		auto arm = model.assembleRigidMBS();
+		auto batch = std::make_shared<CAssembledRigidModelBatch>(arm, N);
+		const auto& dofs = arm->getPoints2DOFs()[1];
+		for (size_t k = 0; k < N; k++)
+			batch->q()(dofs.dof_x, k) = 0.1 * k;
+
+		std::vector<Eigen::VectorXd> readings(4);
+		std::vector<std::thread> threads;
+		for (auto& r : readings)
+			threads.emplace_back([&sensor, &batch, &r]() {
+				sensor.simulate_readings(*batch, r);
+			});
+		for (auto& t : threads) t.join();
+		sensor.simulate_readings(*batch, readings[0]);
+
+		for (const auto& r : readings)
+		{
+			ASSERT_EQ(r.size(), static_cast<Eigen::Index>(N));
+			for (size_t k = 0; k < N; k++) EXPECT_NEAR(r[k], 0.1 * k, 1e-12);
+		}
+	}
+}